@@ -73,8 +73,15 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Failed to open output file\n");
         return 1;
     }
-    const int width = 640;
-    const int height = 360;
+    // Frame size comes from the stream
+    vcodec_status_t ret = vcodec_dec_init(&vcodec_dec_ctx, VCODEC_TYPE_DCT);
+    if (ret != VCODEC_STATUS_OK) {
+        fprintf(stderr, "Failed to initialize vcodec %d from %s\n", ret, argv[1]);
+        return EXIT_FAILURE;
+    }
+    const int width = vcodec_dec_ctx.width;
+    const int height = vcodec_dec_ctx.height;
+    fprintf(stderr, "Decoding %dx%d stream, GOP %d\n", width, height, vcodec_dec_ctx.gop_size);
     fprintf(stdout, "YUV4MPEG2 W%d H%d F%d:%d I%c A%d:%d C%s\n", width, height, 30, 1, 'p', 0, 0, "mono");
 
     uint8_t *p_framebuffer = malloc(width * height);
@@ -83,15 +90,6 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-
-    vcodec_dec_ctx.width = width;
-    vcodec_dec_ctx.height = height;
-    vcodec_status_t ret = vcodec_dec_init(&vcodec_dec_ctx, VCODEC_TYPE_DCT);
-    if (ret != VCODEC_STATUS_OK) {
-        fprintf(stderr, "Failed to initialize vcodec %d for %dx%d\n", ret, vcodec_dec_ctx.width, vcodec_dec_ctx.height);
-        return EXIT_FAILURE;
-    }
-
     int num_frames = 0;
     vcodec_status_t vcodec_ret = VCODEC_STATUS_OK;
     while (1) {
@@ -99,14 +97,19 @@ int main(int argc, char **argv) {
         ret = vcodec_dec_ctx.get_frame(&vcodec_dec_ctx, p_framebuffer);
         const clock_t end_time = clock();
 
-        fprintf(stdout, "FRAME\n");
-        fwrite(p_framebuffer, width * height, 1, stdout);
-
+        if (VCODEC_STATUS_AGAIN == ret) {
+            // Y4M output has a single frame size
+            fprintf(stderr, "Frame size changed to %dx%d\n", vcodec_dec_ctx.width, vcodec_dec_ctx.height);
+            break;
+        }
         if (VCODEC_STATUS_OK != ret) {
             fprintf(stderr, "vcodec error %d", ret);
             break;
         }
 
+        fprintf(stdout, "FRAME\n");
+        fwrite(p_framebuffer, width * height, 1, stdout);
+
         //print_vcodec_stats(&vcodec_dec_ctx, end_time - start_time);
         num_frames++;
     }
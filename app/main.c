@@ -3,12 +3,21 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "vcodec/vcodec.h"
+#include "vcodec/pipeline.h"
 #include "tools/source.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/**
+ * Coded frames held before they are written out together.
+ */
+#define MAX_PENDING_PACKETS 8
+
 typedef struct {
     int width;
     int height;
@@ -18,7 +27,6 @@ typedef struct {
 
 typedef struct {
     uint32_t data_size;
-    uint64_t current_frame_size;
     FILE    *out_file;
     uint32_t out_size;
 } io_ctx_t;
@@ -83,7 +91,6 @@ static vcodec_status_t vcodec_write(const uint8_t *p_data, uint32_t size, void *
     }
 
     p_io_ctx->out_size += size;
-    p_io_ctx->current_frame_size += size;
 
     return VCODEC_STATUS_OK;
 }
@@ -112,9 +119,86 @@ static void print_vcodec_stats(const vcodec_enc_ctx_t *p_ctx, clock_t diff) {
     }
 }
 
+/**
+ * Write the data of @c num_packets packets with a single gather write where possible, then release them.
+ */
+static vcodec_status_t write_packets(io_ctx_t *p_io_ctx, vcodec_packet_t **pp_packets, int num_packets) {
+    struct iovec iov[MAX_PENDING_PACKETS];
+    for (int i = 0; i < num_packets; i++) {
+        iov[i].iov_base = (void *)pp_packets[i]->p_data;
+        iov[i].iov_len = pp_packets[i]->size;
+    }
+    vcodec_status_t ret = VCODEC_STATUS_OK;
+    struct iovec *p_iov = iov;
+    int iov_count = num_packets;
+    while (iov_count > 0) {
+        const ssize_t written = writev(fileno(p_io_ctx->out_file), p_iov, iov_count);
+        if (written < 0 && EINTR == errno) {
+            continue;
+        }
+        if (written < 0) {
+            ret = VCODEC_STATUS_IO_FAILED;
+            break;
+        }
+        // Skip what was written, partial writes stop anywhere
+        size_t left = written;
+        while (iov_count > 0 && left >= p_iov->iov_len) {
+            left -= p_iov->iov_len;
+            p_iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            p_iov->iov_base = (uint8_t *)p_iov->iov_base + left;
+            p_iov->iov_len -= left;
+        }
+    }
+    for (int i = 0; i < num_packets; i++) {
+        vcodec_packet_release(pp_packets[i]);
+    }
+    return ret;
+}
+
+static vcodec_status_t pipeline_read_frame(uint8_t *p_frame, void *ctx) {
+    vcodec_source_t *p_source_ctx = ctx;
+    return p_source_ctx->read_frame(p_source_ctx, p_frame);
+}
+
+static void print_queue_stats(const char *name, const vcodec_pipeline_queue_stats_t *p_stats) {
+    fprintf(stderr, "%s queue: %lu frames, avg occupancy %f, max %d, %lu full stalls, %lu empty stalls\n", name, p_stats->frames,
+            p_stats->frames > 0 ? (double)p_stats->occupancy_sum / p_stats->frames : 0.0, p_stats->max_occupancy, p_stats->full_stalls,
+            p_stats->empty_stalls);
+}
+
+/**
+ * Encode the whole source with the source, coding and output stages on separate threads.
+ */
+static int run_pipeline(vcodec_enc_ctx_t *p_enc_ctx, vcodec_source_t *p_source_ctx) {
+    vcodec_pipeline_t pipeline = {
+        .p_enc = p_enc_ctx,
+        .read_frame = pipeline_read_frame,
+        .read_ctx = p_source_ctx,
+    };
+    vcodec_status_t ret = vcodec_pipeline_init(&pipeline, VCODEC_TYPE_DCT);
+    if (ret != VCODEC_STATUS_OK) {
+        fprintf(stderr, "Failed to initialize vcodec pipeline %d for %dx%d\n", ret, p_enc_ctx->width, p_enc_ctx->height);
+        return EXIT_FAILURE;
+    }
+    struct timespec start_time;
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    ret = vcodec_pipeline_run(&pipeline);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    const double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    fprintf(stderr, "Finish encoding, status %d, %lu frames in %fs\n", ret, pipeline.stats.output.frames, seconds);
+    print_queue_stats("Input", &pipeline.stats.input);
+    print_queue_stats("Output", &pipeline.stats.output);
+    vcodec_pipeline_deinit(&pipeline);
+    return VCODEC_STATUS_OK == ret ? 0 : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2 && argc != 3) {
-        fprintf(stderr, "Wrong number of args %d\n", argc);
+    if (argc < 2 || argc > 10) {
+        fprintf(stderr, "Usage: %s /path/to/Y4M-luma-only-raw-video [QP] [GOP] [REFS] [LONG_TERM] [SLICES] [THREADS] [WAVEFRONT] [PIPELINE]\n", argv[0]);
         return EXIT_FAILURE;
     }
     io_ctx_t io_ctx = { 0 };
@@ -146,6 +230,35 @@ int main(int argc, char **argv) {
 
     vcodec_enc_ctx.width = source_ctx.width;
     vcodec_enc_ctx.height = source_ctx.height;
+    if (argc >= 3) {
+        vcodec_enc_ctx.qp = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        vcodec_enc_ctx.gop_size = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        vcodec_enc_ctx.num_ref_frames = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        vcodec_enc_ctx.long_term_ref = 0 != atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        vcodec_enc_ctx.num_slices = atoi(argv[6]);
+    }
+    if (argc >= 8) {
+        vcodec_enc_ctx.num_threads = atoi(argv[7]);
+    }
+    if (argc >= 9) {
+        vcodec_enc_ctx.wavefront = 0 != atoi(argv[8]);
+    }
+    if (10 == argc && 0 != atoi(argv[9])) {
+        const int ret = run_pipeline(&vcodec_enc_ctx, &source_ctx);
+        fclose(io_ctx.out_file);
+        return ret;
+    }
+    // Each frame is coded into a packet of its own, and packets are written a few at a time
+    vcodec_enc_ctx.write = NULL;
+    vcodec_enc_ctx.out_buffer_grow = true;
     vcodec_status_t ret = vcodec_enc_init(&vcodec_enc_ctx, VCODEC_TYPE_DCT);
     if (ret != VCODEC_STATUS_OK) {
         fprintf(stderr, "Failed to initialize vcodec %d for %dx%d\n", ret, vcodec_enc_ctx.width, vcodec_enc_ctx.height);
@@ -155,10 +268,13 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Initialized from %s: %dx%d %u bytes/frame\n", argv[1], source_ctx.width, source_ctx.height, source_ctx.frame_size);
 
     int num_frames = 0;
+    vcodec_packet_t *pending[MAX_PENDING_PACKETS];
+    int num_pending = 0;
     vcodec_status_t vcodec_ret = VCODEC_STATUS_OK;
     while (VCODEC_STATUS_OK == (vcodec_ret = source_ctx.read_frame(&source_ctx, p_framebuffer))) {
         const clock_t start_time = clock();
-        ret = vcodec_enc_ctx.process_frame(&vcodec_enc_ctx, p_framebuffer);
+        vcodec_packet_t *p_packet;
+        ret = vcodec_enc_encode_packet(&vcodec_enc_ctx, p_framebuffer, num_frames, &p_packet);
         const clock_t end_time = clock();
         io_ctx.data_size = source_ctx.frame_size;
 
@@ -167,10 +283,22 @@ int main(int argc, char **argv) {
             break;
         }
 
+        io_ctx.out_size += p_packet->size;
         print_vcodec_stats(&vcodec_enc_ctx, end_time - start_time);
         num_frames++;
-        fprintf(stderr, "Frame size %lu\n", io_ctx.current_frame_size);
-        io_ctx.current_frame_size = 0;
+        fprintf(stderr, "Frame size %lu%s\n", p_packet->size, VCODEC_FRAME_TYPE_KEY == p_packet->frame_type ? " (key)" : "");
+        pending[num_pending++] = p_packet;
+        if (MAX_PENDING_PACKETS == num_pending) {
+            ret = write_packets(&io_ctx, pending, num_pending);
+            num_pending = 0;
+            if (VCODEC_STATUS_OK != ret) {
+                fprintf(stderr, "Failed to write output %d\n", ret);
+                break;
+            }
+        }
+    }
+    if (VCODEC_STATUS_OK != write_packets(&io_ctx, pending, num_pending)) {
+        fprintf(stderr, "Failed to write output\n");
     }
 
     fprintf(stderr, "Finish encoding, status %d\n", vcodec_ret);
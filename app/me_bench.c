@@ -0,0 +1,172 @@
+/**
+ * Motion search benchmark: runs every search method over consecutive frame pairs of a Y4M clip
+ * and reports evaluated candidates, SAD and search time per macroblock.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vcodec/vcodec.h"
+#include "tools/source.h"
+#include "vcodec_common.h"
+#include "vcodec_dsp.h"
+#include "vcodec_pyramid.h"
+#include "vcodec_frame.h"
+
+typedef struct {
+    const char *name;
+    vcodec_motion_search_t method;
+    // Add the coarse-to-fine pyramid candidate to the predictors
+    bool pyramid;
+    uint64_t candidates;
+    uint64_t sad;
+    uint64_t macroblocks;
+    double seconds;
+    motion_vector_t *p_field;
+    motion_vector_t *p_prev_field;
+} method_stats_t;
+
+static compute_motion_block_cost_t counted_sad;
+static uint64_t num_candidates;
+
+static int counting_sad(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width) {
+    num_candidates++;
+    return counted_sad(p_source_frame, p_ref_frame, x, y, mvx, mvy, block_size, frame_width);
+}
+
+static vcodec_pyramid_t source_pyramid;
+static vcodec_pyramid_t ref_pyramid;
+
+static int search(const method_stats_t *p_stats, const uint8_t *p_ref, const uint8_t *p_source, int x, int y, int stride, int mb_x, int mb_y,
+        int width_mbs, bool has_prev, int width, int height, compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function,
+        const vcodec_dsp_t *p_dsp, motion_vector_t *p_mv) {
+    vcodec_motion_search_params_t params = {
+        .method = p_stats->method,
+        .area_left = -VCODEC_FRAME_BORDER,
+        .area_top = -VCODEC_FRAME_BORDER,
+        .area_right = width + VCODEC_FRAME_BORDER,
+        .area_bottom = height + VCODEC_FRAME_BORDER,
+    };
+    params.num_predictors = vcodec_motion_predictors(p_stats->p_field, has_prev ? p_stats->p_prev_field : NULL, mb_x, mb_y, 0, width_mbs, params.predictors);
+    if (p_stats->pyramid && vcodec_pyramid_search(&source_pyramid, &ref_pyramid, x, y, p_dsp, &params.predictors[params.num_predictors])) {
+        params.num_predictors++;
+    }
+    if (VCODEC_MOTION_SEARCH_TSS == p_stats->method) {
+        return vcodec_match_block_tss(p_ref, p_source, x, y, stride, VCODEC_MACROBLOCK_SIZE, &params, &p_mv->mvx, &p_mv->mvy, cost_function, cost_multi_function);
+    }
+    return vcodec_match_block_epzs(p_ref, p_source, x, y, stride, VCODEC_MACROBLOCK_SIZE, &params, &p_mv->mvx, &p_mv->mvy, cost_function, cost_multi_function);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s /path/to/Y4M-luma-only-raw-video [max frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const int max_frames = 3 == argc ? atoi(argv[2]) : INT32_MAX;
+
+    vcodec_source_t source_ctx = { 0 };
+    if (vcodec_source_init(&source_ctx, VCODEC_SOURCE_Y4M, argv[1]) != VCODEC_STATUS_OK) {
+        fprintf(stderr, "Failed to initialize vcodec source from %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    const int width = source_ctx.width;
+    const int height = source_ctx.height;
+    const int width_mbs = width / VCODEC_MACROBLOCK_SIZE;
+    const int height_mbs = height / VCODEC_MACROBLOCK_SIZE;
+
+    uint8_t *p_framebuffer = malloc(source_ctx.frame_size);
+    vcodec_frame_t frames[2];
+    vcodec_frame_init(&frames[0], width, height, malloc);
+    vcodec_frame_init(&frames[1], width, height, malloc);
+    const int stride = frames[0].stride;
+    method_stats_t methods[] = {
+        { .name = "tss", .method = VCODEC_MOTION_SEARCH_TSS },
+        { .name = "epzs", .method = VCODEC_MOTION_SEARCH_EPZS },
+        { .name = "epzs+pyramid", .method = VCODEC_MOTION_SEARCH_EPZS, .pyramid = true },
+    };
+    const int num_methods = sizeof(methods) / sizeof(methods[0]);
+    for (int m = 0; m < num_methods; m++) {
+        methods[m].p_field = calloc(width_mbs * height_mbs, sizeof(motion_vector_t));
+        methods[m].p_prev_field = calloc(width_mbs * height_mbs, sizeof(motion_vector_t));
+    }
+
+    vcodec_dsp_t dsp;
+    vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO);
+    counted_sad = dsp.sad;
+    // SAD of the pyramid levels is not counted
+    vcodec_pyramid_init(&source_pyramid, width, height, malloc);
+    vcodec_pyramid_init(&ref_pyramid, width, height, malloc);
+
+    int num_frames = 0;
+    while (num_frames < max_frames && VCODEC_STATUS_OK == source_ctx.read_frame(&source_ctx, p_framebuffer)) {
+        vcodec_frame_t *p_source = &frames[num_frames % 2];
+        const vcodec_frame_t *p_ref = &frames[(num_frames + 1) % 2];
+        vcodec_frame_copy_from(p_source, p_framebuffer);
+        vcodec_frame_extend_border(p_source);
+        if (0 == num_frames++) {
+            continue;
+        }
+        const clock_t pyramid_start_time = clock();
+        vcodec_pyramid_build(&source_pyramid, p_source, &dsp);
+        vcodec_pyramid_build(&ref_pyramid, p_ref, &dsp);
+        const double pyramid_seconds = (double)(clock() - pyramid_start_time) / CLOCKS_PER_SEC;
+        const uint8_t *p_source_origin = p_source->p_data;
+        const uint8_t *p_ref_origin = p_ref->p_data;
+        for (int m = 0; m < num_methods; m++) {
+            method_stats_t *p_stats = methods + m;
+            const bool has_prev = num_frames > 2;
+            // Counting pass goes through the single-vector hook, timed pass uses the batched kernel
+            for (int mb_y = 0; mb_y < height_mbs; mb_y++) {
+                for (int mb_x = 0; mb_x < width_mbs; mb_x++) {
+                    motion_vector_t mv;
+                    p_stats->sad += search(p_stats, p_ref_origin, p_source_origin, mb_x * VCODEC_MACROBLOCK_SIZE, mb_y * VCODEC_MACROBLOCK_SIZE, stride,
+                            mb_x, mb_y, width_mbs, has_prev, width, height, counting_sad, NULL, &dsp, &mv);
+                    p_stats->p_field[mb_y * width_mbs + mb_x] = mv;
+                    p_stats->macroblocks++;
+                }
+            }
+            p_stats->candidates += num_candidates;
+            num_candidates = 0;
+
+            // The field is filled in the same order, so the timed pass sees the same predictors
+            const clock_t start_time = clock();
+            for (int mb_y = 0; mb_y < height_mbs; mb_y++) {
+                for (int mb_x = 0; mb_x < width_mbs; mb_x++) {
+                    motion_vector_t mv;
+                    search(p_stats, p_ref_origin, p_source_origin, mb_x * VCODEC_MACROBLOCK_SIZE, mb_y * VCODEC_MACROBLOCK_SIZE, stride,
+                            mb_x, mb_y, width_mbs, has_prev, width, height, dsp.sad, dsp.sad_multi, &dsp, &mv);
+                    p_stats->p_field[mb_y * width_mbs + mb_x] = mv;
+                }
+            }
+            p_stats->seconds += (double)(clock() - start_time) / CLOCKS_PER_SEC;
+            if (p_stats->pyramid) {
+                p_stats->seconds += pyramid_seconds;
+            }
+
+            motion_vector_t *p_field = p_stats->p_prev_field;
+            p_stats->p_prev_field = p_stats->p_field;
+            p_stats->p_field = p_field;
+        }
+    }
+
+    printf("%dx%d, %d frames\n", width, height, num_frames);
+    printf("%-12s %16s %12s %12s\n", "method", "candidates/MB", "SAD/MB", "ns/MB");
+    for (int m = 0; m < num_methods; m++) {
+        const method_stats_t *p_stats = methods + m;
+        const double macroblocks = p_stats->macroblocks ? p_stats->macroblocks : 1;
+        printf("%-12s %16.2f %12.1f %12.1f\n", p_stats->name, p_stats->candidates / macroblocks, p_stats->sad / macroblocks,
+                p_stats->seconds * 1e9 / macroblocks);
+        free(p_stats->p_field);
+        free(p_stats->p_prev_field);
+    }
+
+    vcodec_pyramid_free(&source_pyramid, free);
+    vcodec_pyramid_free(&ref_pyramid, free);
+    vcodec_frame_free(&frames[0], free);
+    vcodec_frame_free(&frames[1], free);
+    free(p_framebuffer);
+    source_ctx.deinit(&source_ctx);
+    return EXIT_SUCCESS;
+}
@@ -2,80 +2,312 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 
 #include "vcodec.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-#define VCODEC_BITSTREAM_WRITER_BUFFER_LEN 8
-#define VCODEC_BITSTREAM_READER_BUFFER_LEN 8
+/**
+ * Size of the writer output buffer. The @c write callback is called only when this many bytes
+ * are buffered or on explicit flush (end of frame).
+ * Fixed, since it sets the size of vcodec_bitstream_writer_t shared by the library and its users.
+ */
+#define VCODEC_BITSTREAM_WRITER_BUFFER_LEN 4096
+
+/**
+ * Size of the reader input buffer, refilled through the @c read callback. Fixed as well.
+ */
+#define VCODEC_BITSTREAM_READER_BUFFER_LEN 4096
 
+/**
+ * Extra bytes past the end of a bitstream buffer touched by 64-bit word stores.
+ */
+#define VCODEC_BITSTREAM_PADDING sizeof(uint64_t)
+
+/**
+ * Minimum number of valid bits in a reader window, unless the stream ends earlier.
+ */
+#define VCODEC_BITSTREAM_READER_WINDOW_BITS 57
+
+/**
+ * Bitstream writer. Writes either into the internal buffer, which is passed to the @c write callback when full,
+ * or directly into caller-provided memory (see vcodec_bitstream_writer_init_mem()).
+ */
 typedef struct vcodec_bitstream_writer {
-    uint8_t buffer[VCODEC_BITSTREAM_WRITER_BUFFER_LEN];
-    uint32_t bit_pos;
+    uint8_t *p_data;           //< Output memory, either @c buffer or caller-provided
+    size_t data_len;           //< Usable size of @c p_data, VCODEC_BITSTREAM_PADDING bytes follow it
+    size_t bit_pos;
     void *p_io_ctx;
     vcodec_write_t write;
+    vcodec_alloc_t alloc;      //< Memory-backed writer grows @c p_data through @c alloc, if set
+    vcodec_free_t free;
     vcodec_status_t last_status;
+    uint8_t buffer[VCODEC_BITSTREAM_WRITER_BUFFER_LEN + VCODEC_BITSTREAM_PADDING];
 } vcodec_bitstream_writer_t;
 
+/**
+ * Bitstream reader. Reads either from the internal buffer, which is refilled through the @c read callback,
+ * or directly from caller-provided memory (see vcodec_bitstream_reader_init_mem()).
+ */
 typedef struct vcodec_bitstream_reader {
-    uint8_t buffer[VCODEC_BITSTREAM_READER_BUFFER_LEN];
-    uint32_t bits_available;
-    uint32_t bit_pos;
+    const uint8_t *p_data;     //< Input memory, either @c buffer or caller-provided
+    size_t bits_available;
+    size_t bit_pos;
+    size_t bits_consumed;      //< Bits of the stream before @c p_data, see vcodec_bitstream_reader_tell()
     void *p_io_ctx;
     vcodec_read_t read;
     vcodec_status_t last_status;
+    bool end_of_stream;
+    uint8_t buffer[VCODEC_BITSTREAM_READER_BUFFER_LEN + VCODEC_BITSTREAM_PADDING];
 } vcodec_bitstream_reader_t;
 
+/**
+ * Exp-Golomb codes which fit into 8 bits, indexed by the next 8 bits of the stream.
+ * Each entry is (code length << 4) | value, zero if the code is longer than 8 bits.
+ */
+static const uint8_t vcodec_exp_golomb_table[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x77, 0x77, 0x78, 0x78, 0x79, 0x79, 0x7a, 0x7a, 0x7b, 0x7b, 0x7c, 0x7c, 0x7d, 0x7d, 0x7e, 0x7e,
+    0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56, 0x56,
+    0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+    0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+    0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+    0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+};
+
 /**
  * Check I/O status (not done in all below functions for performance reasons).
  */
-static vcodec_status_t vcodec_bitstream_writer_status(vcodec_bitstream_writer_t *p_writer) {
+static inline vcodec_status_t vcodec_bitstream_writer_status(vcodec_bitstream_writer_t *p_writer) {
     return p_writer->last_status;
 }
 
+/**
+ * Store 64-bit @c word at @c p_dst in big-endian (bitstream) order.
+ */
+static inline void vcodec_bitstream_store_be64(uint8_t *p_dst, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(p_dst, &word, sizeof(word));
+}
+
+/**
+ * Initialize writer which passes its output to @c write.
+ */
+static inline void vcodec_bitstream_writer_init(vcodec_bitstream_writer_t *p_writer, vcodec_write_t write, void *p_io_ctx) {
+    memset(p_writer, 0, sizeof(*p_writer));
+    p_writer->p_data = p_writer->buffer;
+    p_writer->data_len = VCODEC_BITSTREAM_WRITER_BUFFER_LEN;
+    p_writer->write = write;
+    p_writer->p_io_ctx = p_io_ctx;
+}
+
+/**
+ * Initialize writer which stores its output directly in @c p_data, no callback is involved.
+ * The last VCODEC_BITSTREAM_PADDING bytes of @c p_data are reserved for word stores.
+ * When @c p_data is full, the writer either allocates a twice larger buffer with @c alloc and releases the old one
+ * with @c free (so @c p_data must come from @c alloc too), or, when @c alloc is NULL, stops writing and reports
+ * VCODEC_STATUS_NOMEM. Get the resulting buffer with vcodec_bitstream_writer_data().
+ * If @c size leaves no room past the padding, the writer takes ownership of @c p_data: it is released with @c free
+ * and replaced by a new buffer from @c alloc.
+ * @retval VCODEC_STATUS_INVAL if @c alloc is set without @c free, or if @c size is too small and @c alloc is NULL.
+ */
+static inline vcodec_status_t vcodec_bitstream_writer_init_mem(vcodec_bitstream_writer_t *p_writer, uint8_t *p_data, size_t size,
+        vcodec_alloc_t alloc, vcodec_free_t free) {
+    p_writer->write = NULL;
+    p_writer->p_io_ctx = NULL;
+    p_writer->alloc = alloc;
+    p_writer->free = free;
+    p_writer->bit_pos = 0;
+    p_writer->last_status = VCODEC_STATUS_OK;
+    // Growing releases the old buffer, and so does replacing a too small one
+    if (NULL != alloc && NULL == free) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (size <= VCODEC_BITSTREAM_PADDING) {
+        if (NULL == alloc) {
+            return VCODEC_STATUS_INVAL;
+        }
+        if (NULL != p_data) {
+            free(p_data);
+        }
+        size = VCODEC_BITSTREAM_WRITER_BUFFER_LEN + VCODEC_BITSTREAM_PADDING;
+        p_data = alloc(size);
+        if (NULL == p_data) {
+            return VCODEC_STATUS_NOMEM;
+        }
+    }
+    p_writer->p_data = p_data;
+    p_writer->data_len = size - VCODEC_BITSTREAM_PADDING;
+    // Only the byte at the write position has to be clean, word stores zero-fill the ones after it
+    p_writer->p_data[0] = 0;
+    return VCODEC_STATUS_OK;
+}
+
+/**
+ * Get output memory of memory-backed writer and number of bytes written (including the last partial byte).
+ */
+static inline uint8_t *vcodec_bitstream_writer_data(const vcodec_bitstream_writer_t *p_writer, size_t *p_size) {
+    *p_size = (p_writer->bit_pos + 7) / 8;
+    return p_writer->p_data;
+}
+
+/**
+ * Number of bits written to memory-backed writer, not rounded up to a byte unlike vcodec_bitstream_writer_data().
+ */
+static inline size_t vcodec_bitstream_writer_tell(const vcodec_bitstream_writer_t *p_writer) {
+    return p_writer->bit_pos;
+}
+
 /**
  * Discard buffered data and reset to initial state.
  */
 static inline void vcodec_bitstream_writer_reset(vcodec_bitstream_writer_t *p_writer) {
-    memset(p_writer->buffer, 0, sizeof(p_writer->buffer));
+    if (p_writer->p_data == p_writer->buffer) {
+        memset(p_writer->buffer, 0, sizeof(p_writer->buffer));
+    } else {
+        p_writer->p_data[0] = 0;
+    }
     p_writer->bit_pos = 0;
     p_writer->last_status = VCODEC_STATUS_OK;
 }
 
 /**
  * Flush all buffered data and pad the last byte with zero bits.
+ * Memory-backed writer keeps the data and only moves to the next byte boundary.
  */
 static inline void vcodec_bitstream_writer_flush(vcodec_bitstream_writer_t *p_writer) {
-    p_writer->last_status = p_writer->write(p_writer->buffer, (p_writer->bit_pos + 7) / 8, p_writer->p_io_ctx);
+    if (NULL == p_writer->write) {
+        p_writer->bit_pos = (p_writer->bit_pos + 7) / 8 * 8;
+        return;
+    }
+    const vcodec_status_t status = p_writer->write(p_writer->buffer, (p_writer->bit_pos + 7) / 8, p_writer->p_io_ctx);
+    if (VCODEC_STATUS_OK == p_writer->last_status) {
+        p_writer->last_status = status;
+    }
     p_writer->bit_pos = 0;
     memset(p_writer->buffer, 0, sizeof(p_writer->buffer));
 }
 
+/**
+ * Grow memory-backed writer to fit @c bit_pos bits, or report overflow.
+ */
+static inline void vcodec_bitstream_writer_grow(vcodec_bitstream_writer_t *p_writer) {
+    if (p_writer->bit_pos <= p_writer->data_len * 8) {
+        // Exactly full, next store still lands in the padding
+        return;
+    }
+    const size_t needed_len = p_writer->bit_pos / 8 + 1;
+    size_t new_len = p_writer->data_len * 2;
+    while (new_len < needed_len) {
+        new_len *= 2;
+    }
+    uint8_t *p_new_data = NULL;
+    if (NULL != p_writer->alloc) {
+        p_new_data = p_writer->alloc(new_len + VCODEC_BITSTREAM_PADDING);
+    }
+    if (NULL == p_new_data) {
+        // Keep overwriting the padding, the output is incomplete anyway
+        p_writer->last_status = VCODEC_STATUS_NOMEM;
+        p_writer->bit_pos = p_writer->data_len * 8;
+        return;
+    }
+    // Padding may hold bits which spilled past the end
+    memcpy(p_new_data, p_writer->p_data, p_writer->data_len + VCODEC_BITSTREAM_PADDING);
+    memset(p_new_data + p_writer->data_len + VCODEC_BITSTREAM_PADDING, 0, new_len - p_writer->data_len);
+    p_writer->free(p_writer->p_data);
+    p_writer->p_data = p_new_data;
+    p_writer->data_len = new_len;
+}
+
+/**
+ * Write out full buffer and move the bytes which spilled past its end to the front.
+ * Loops to support long runs of zeroes which may span several buffers.
+ */
+static inline void vcodec_bitstream_writer_spill(vcodec_bitstream_writer_t *p_writer) {
+    if (NULL == p_writer->write) {
+        vcodec_bitstream_writer_grow(p_writer);
+        return;
+    }
+    const size_t buffer_bits = VCODEC_BITSTREAM_WRITER_BUFFER_LEN * 8;
+    do {
+        uint8_t spilled[VCODEC_BITSTREAM_PADDING];
+        const vcodec_status_t status = p_writer->write(p_writer->buffer, VCODEC_BITSTREAM_WRITER_BUFFER_LEN, p_writer->p_io_ctx);
+        if (VCODEC_STATUS_OK == p_writer->last_status) {
+            p_writer->last_status = status;
+        }
+        memcpy(spilled, p_writer->buffer + VCODEC_BITSTREAM_WRITER_BUFFER_LEN, sizeof(spilled));
+        memset(p_writer->buffer, 0, sizeof(p_writer->buffer));
+        memcpy(p_writer->buffer, spilled, sizeof(spilled));
+        p_writer->bit_pos -= buffer_bits;
+    } while (p_writer->bit_pos >= buffer_bits);
+}
+
 /**
  * Write internal buffer if full.
  */
 static inline void vcodec_bitstream_writer_checkflush(vcodec_bitstream_writer_t *p_writer) {
-    if (sizeof(p_writer->buffer) * 8 == p_writer->bit_pos) {
-        vcodec_bitstream_writer_flush(p_writer);
+    if (p_writer->bit_pos >= p_writer->data_len * 8) {
+        vcodec_bitstream_writer_spill(p_writer);
     }
 }
 
 /**
  * Write @c count bits starting from LSB of @c bits into the buffered bitstream.
- * @note 0 < count < 32
+ * Bits are merged with the partially filled byte in a 64-bit register, which is then stored as a whole word.
+ * The store zero-fills the bytes after the write position, so no read-modify-write of the tail is needed.
+ * @note 0 <= count <= 32
  */
 static inline void vcodec_bitstream_writer_putbits(vcodec_bitstream_writer_t *p_writer, uint32_t bits, uint32_t count) {
-    while (count > 0) {
-        const uint32_t to_write = MIN(count, 8 - p_writer->bit_pos % 8);
-        const uint32_t byte_offset = p_writer->bit_pos / 8;
-        const uint32_t bit_offset = (7 - p_writer->bit_pos % 8) - to_write + 1;
-        const uint32_t mask = (1 << to_write) - 1;
-        const uint8_t data = (bits >> (count - to_write)) & mask;
-        p_writer->buffer[byte_offset] |= data << bit_offset;
-        count -= to_write;
-        p_writer->bit_pos += to_write;
-        vcodec_bitstream_writer_checkflush(p_writer);
+    uint8_t *p_dst = p_writer->p_data + p_writer->bit_pos / 8;
+    // Two shifts to drop bits above @c count without UB when count is 0
+    const uint64_t aligned_bits = ((uint64_t)bits << 32) << (32 - count);
+    const uint64_t word = ((uint64_t)p_dst[0] << 56) | (aligned_bits >> (p_writer->bit_pos % 8));
+    vcodec_bitstream_store_be64(p_dst, word);
+    p_writer->bit_pos += count;
+    vcodec_bitstream_writer_checkflush(p_writer);
+}
+
+/**
+ * Pad the current byte with zero bits, which the word stores have already written.
+ */
+static inline void vcodec_bitstream_writer_align(vcodec_bitstream_writer_t *p_writer) {
+    p_writer->bit_pos = (p_writer->bit_pos + 7) / 8 * 8;
+    vcodec_bitstream_writer_checkflush(p_writer);
+}
+
+/**
+ * Write @c size bytes, usually at a byte boundary (see vcodec_bitstream_writer_align()), e.g. a payload coded by another writer.
+ */
+static inline void vcodec_bitstream_writer_putbytes(vcodec_bitstream_writer_t *p_writer, const uint8_t *p_bytes, size_t size) {
+    for (; size >= sizeof(uint32_t); size -= sizeof(uint32_t), p_bytes += sizeof(uint32_t)) {
+        const uint32_t word = ((uint32_t)p_bytes[0] << 24) | ((uint32_t)p_bytes[1] << 16) | ((uint32_t)p_bytes[2] << 8) | p_bytes[3];
+        vcodec_bitstream_writer_putbits(p_writer, word, 32);
+    }
+    for (; size > 0; size--, p_bytes++) {
+        vcodec_bitstream_writer_putbits(p_writer, *p_bytes, 8);
+    }
+}
+
+/**
+ * Write the first @c count bits of @c p_bits at any bit position, e.g. a part of the stream coded by another writer
+ * (see vcodec_bitstream_writer_tell()).
+ */
+static inline void vcodec_bitstream_writer_putbits_from(vcodec_bitstream_writer_t *p_writer, const uint8_t *p_bits, size_t count) {
+    vcodec_bitstream_writer_putbytes(p_writer, p_bits, count / 8);
+    if (0 != count % 8) {
+        vcodec_bitstream_writer_putbits(p_writer, p_bits[count / 8] >> (8 - count % 8), count % 8);
     }
 }
 
@@ -84,14 +316,9 @@ static inline void vcodec_bitstream_writer_putbits(vcodec_bitstream_writer_t *p_
  */
 static inline void vcodec_bitstream_writer_putones(vcodec_bitstream_writer_t *p_writer, uint32_t count) {
     while (count > 0) {
-        const uint32_t to_write = MIN(count, 8 - p_writer->bit_pos % 8);
-        const uint32_t byte_offset = p_writer->bit_pos / 8;
-        const uint32_t bit_offset = (7 - p_writer->bit_pos % 8) - to_write + 1;
-        const uint8_t mask = (1 << to_write) - 1;
-        p_writer->buffer[byte_offset] |= mask << bit_offset;
+        const uint32_t to_write = MIN(count, 32);
+        vcodec_bitstream_writer_putbits(p_writer, UINT32_MAX, to_write);
         count -= to_write;
-        p_writer->bit_pos += to_write;
-        vcodec_bitstream_writer_checkflush(p_writer);
     }
 }
 
@@ -100,20 +327,25 @@ static inline void vcodec_bitstream_writer_putones(vcodec_bitstream_writer_t *p_
  */
 static inline void vcodec_bitstream_writer_putzeroes(vcodec_bitstream_writer_t *p_writer, uint32_t count) {
     while (count > 0) {
-        const uint32_t to_write = MIN(count, sizeof(p_writer->buffer) * 8 - p_writer->bit_pos);
-        p_writer->bit_pos += to_write;
+        const uint32_t to_write = MIN(count, 32);
+        vcodec_bitstream_writer_putbits(p_writer, 0, to_write);
         count -= to_write;
-        vcodec_bitstream_writer_checkflush(p_writer);
     }
 }
 
 /**
  * Write @c unsigned integer encoded with exp-Golomb encoding.
+ * Codes up to 32 bits long are written with a single word store.
  */
 static inline void vcodec_bitstream_writer_write_exp_golomb(vcodec_bitstream_writer_t *p_writer, uint32_t value) {
-    const int num_bits = sizeof(uint32_t) * 8 - __builtin_clz(value + 1);
-    vcodec_bitstream_writer_putzeroes(p_writer, num_bits - 1);
-    vcodec_bitstream_writer_putbits(p_writer, value + 1, num_bits);
+    const uint32_t num_bits = sizeof(uint32_t) * 8 - __builtin_clz(value + 1);
+    if (num_bits <= 16) {
+        // Leading zeroes are implied by the width of the code
+        vcodec_bitstream_writer_putbits(p_writer, value + 1, num_bits * 2 - 1);
+    } else {
+        vcodec_bitstream_writer_putzeroes(p_writer, num_bits - 1);
+        vcodec_bitstream_writer_putbits(p_writer, value + 1, num_bits);
+    }
 }
 
 static inline vcodec_status_t vcodec_bitstream_reader_status(vcodec_bitstream_reader_t *p_reader) {
@@ -121,51 +353,138 @@ static inline vcodec_status_t vcodec_bitstream_reader_status(vcodec_bitstream_re
 }
 
 /**
- * Refill buffer if needed.
+ * Load 64-bit big-endian (bitstream order) word from @c p_src.
+ */
+static inline uint64_t vcodec_bitstream_load_be64(const uint8_t *p_src) {
+    uint64_t word;
+    memcpy(&word, p_src, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * Initialize reader which gets its input from @c read.
+ */
+static inline void vcodec_bitstream_reader_init(vcodec_bitstream_reader_t *p_reader, vcodec_read_t read, void *p_io_ctx) {
+    memset(p_reader, 0, sizeof(*p_reader));
+    p_reader->p_data = p_reader->buffer;
+    p_reader->read = read;
+    p_reader->p_io_ctx = p_io_ctx;
+}
+
+/**
+ * Initialize reader which decodes @c size bytes at @c p_data in place, no callback is involved.
+ * No padding is required: the last few bytes are copied into the internal buffer before reaching the end.
+ */
+static inline void vcodec_bitstream_reader_init_mem(vcodec_bitstream_reader_t *p_reader, const uint8_t *p_data, size_t size) {
+    p_reader->p_data = p_data;
+    p_reader->bits_available = size * 8;
+    p_reader->bit_pos = 0;
+    p_reader->bits_consumed = 0;
+    p_reader->read = NULL;
+    p_reader->p_io_ctx = NULL;
+    p_reader->last_status = VCODEC_STATUS_OK;
+    p_reader->end_of_stream = false;
+}
+
+/**
+ * Move unread bytes to the front of the buffer and fill the rest through the @c read callback.
+ * Memory-backed reader copies the unread tail into the internal buffer, so that window loads stay in bounds.
+ */
+static inline void vcodec_bitstream_reader_refill(vcodec_bitstream_reader_t *p_reader) {
+    if (p_reader->end_of_stream) {
+        return;
+    }
+    const size_t byte_pos = p_reader->bit_pos / 8;
+    const size_t bytes_left = p_reader->bits_available / 8 - byte_pos;
+    memmove(p_reader->buffer, p_reader->p_data + byte_pos, bytes_left);
+    p_reader->p_data = p_reader->buffer;
+    p_reader->bits_consumed += byte_pos * 8;
+    p_reader->bit_pos %= 8;
+
+    uint32_t bytes_read = 0;
+    if (NULL != p_reader->read) {
+        const vcodec_status_t status = p_reader->read(p_reader->buffer + bytes_left, VCODEC_BITSTREAM_READER_BUFFER_LEN - bytes_left,
+                &bytes_read, p_reader->p_io_ctx);
+        if (VCODEC_STATUS_OK != status && VCODEC_STATUS_EOF != status) {
+            p_reader->last_status = status;
+        }
+    }
+    // EOF is reported only when the decoder tries to read past the last bit
+    p_reader->end_of_stream = 0 == bytes_read;
+    p_reader->bits_available = (bytes_left + bytes_read) * 8;
+    // Window loads may touch padding past the data, keep it deterministic
+    memset(p_reader->buffer + bytes_left + bytes_read, 0, VCODEC_BITSTREAM_PADDING);
+}
+
+/**
+ * Refill buffer if less than a full window is left.
  */
 static inline void vcodec_bitstream_reader_check_refill(vcodec_bitstream_reader_t *p_reader) {
-    if (p_reader->bit_pos == p_reader->bits_available) {
-        uint32_t bytes_read = 0;
-        p_reader->last_status = p_reader->read(p_reader->buffer, sizeof(p_reader->buffer), &bytes_read, p_reader->p_io_ctx);
-        p_reader->bits_available = bytes_read * 8;
-        p_reader->bit_pos = 0;
+    if (p_reader->bits_available - p_reader->bit_pos < VCODEC_BITSTREAM_READER_WINDOW_BITS) {
+        vcodec_bitstream_reader_refill(p_reader);
+    }
+}
+
+/**
+ * Get 64-bit window starting at the current position.
+ * At least VCODEC_BITSTREAM_READER_WINDOW_BITS bits are valid, zero bits follow the end of stream.
+ */
+static inline uint64_t vcodec_bitstream_reader_window(const vcodec_bitstream_reader_t *p_reader) {
+    return vcodec_bitstream_load_be64(p_reader->p_data + p_reader->bit_pos / 8) << (p_reader->bit_pos % 8);
+}
+
+/**
+ * Get next @c count bits into the LSBs of the result without consuming them.
+ * @note 0 <= count <= 32
+ */
+static inline uint32_t vcodec_bitstream_reader_peekbits(vcodec_bitstream_reader_t *p_reader, uint32_t count) {
+    vcodec_bitstream_reader_check_refill(p_reader);
+    // Two shifts to avoid UB when count is 0
+    return (uint32_t)((vcodec_bitstream_reader_window(p_reader) >> 32) >> (32 - count));
+}
+
+/**
+ * Consume @c count bits. Reading past the end of stream sets VCODEC_STATUS_EOF.
+ * @note @c count bits must have been made available by peekbits or a window refill.
+ */
+static inline void vcodec_bitstream_reader_skipbits(vcodec_bitstream_reader_t *p_reader, uint32_t count) {
+    p_reader->bit_pos += count;
+    if (p_reader->bit_pos > p_reader->bits_available) {
+        p_reader->bit_pos = p_reader->bits_available;
+        if (VCODEC_STATUS_OK == p_reader->last_status) {
+            p_reader->last_status = VCODEC_STATUS_EOF;
+        }
     }
 }
 
 /**
  * Get @c count bits into the LSBs of @c *p_out from a buffered bitstream.
- * @note 0 < count <= 32
+ * @note 0 <= count <= 32
  */
 static inline void vcodec_bitstream_reader_getbits(vcodec_bitstream_reader_t *p_reader, uint32_t *p_out, uint32_t count) {
-    *p_out = 0;
-    while (count > 0) {
-        vcodec_bitstream_reader_check_refill(p_reader);
-        const uint32_t to_read = MIN(count, 8 - p_reader->bit_pos % 8);
-        *p_out <<= to_read;
-        const uint32_t byte_offset = p_reader->bit_pos / 8;
-        const uint32_t bit_offset = (7 - p_reader->bit_pos % 8) - to_read + 1;
-        const uint8_t mask = ((1 << to_read) - 1) << bit_offset;
-        *p_out |= (p_reader->buffer[byte_offset] & mask) >> bit_offset;
-        count -= to_read;
-        p_reader->bit_pos += to_read;
-    }
+    *p_out = vcodec_bitstream_reader_peekbits(p_reader, count);
+    vcodec_bitstream_reader_skipbits(p_reader, count);
 }
 
+/**
+ * Count and consume zero bits up to the next one-bit (which is not consumed).
+ */
 static inline uint32_t vcodec_bitstream_reader_getzeroes(vcodec_bitstream_reader_t *p_reader) {
     uint32_t ret = 0;
     do {
         vcodec_bitstream_reader_check_refill(p_reader);
-        const uint32_t to_read = 8 - p_reader->bit_pos % 8;
-        const uint32_t byte_offset = p_reader->bit_pos / 8;
-        const uint32_t bit_offset = (7 - p_reader->bit_pos % 8) - to_read + 1;
-        const uint8_t mask = ((1 << to_read) - 1) << bit_offset;
-        // For 32-bit word with highest `to_read` bits of data + 1 bit always set to use _builtin_clz even when all read bits are zero
-        // d...d   1   0...0
-        //   ^           ^
-        // to_read   31 - to_read
-        const uint8_t data = p_reader->buffer[byte_offset] & mask;
-        const uint32_t reg = (data << (32 - bit_offset - to_read)) | (1 << (31 - bit_offset - to_read));
-        const uint32_t num_zeroes = __builtin_clz(reg);
+        const size_t bits_left = p_reader->bits_available - p_reader->bit_pos;
+        if (0 == bits_left) {
+            vcodec_bitstream_reader_skipbits(p_reader, 1);
+            break;
+        }
+        const uint32_t to_read = MIN(bits_left, VCODEC_BITSTREAM_READER_WINDOW_BITS - 1);
+        // Sentinel one-bit right after the bits being scanned bounds __builtin_clzll() result by @c to_read
+        const uint64_t window = vcodec_bitstream_reader_window(p_reader) | ((uint64_t)1 << (63 - to_read));
+        const uint32_t num_zeroes = __builtin_clzll(window);
         ret += num_zeroes;
         p_reader->bit_pos += num_zeroes;
         if (to_read != num_zeroes) {
@@ -176,10 +495,40 @@ static inline uint32_t vcodec_bitstream_reader_getzeroes(vcodec_bitstream_reader
 }
 
 /**
- * Get @c count bits into the LSBs of @c *p_out from a buffered bitstream.
- * @note 0 < count <= 32
+ * Position of the reader in bits since the start of the stream.
+ */
+static inline size_t vcodec_bitstream_reader_tell(const vcodec_bitstream_reader_t *p_reader) {
+    return p_reader->bits_consumed + p_reader->bit_pos;
+}
+
+/**
+ * Skip to the next byte boundary (frames are byte aligned, see vcodec_bitstream_writer_flush()).
+ */
+static inline void vcodec_bitstream_reader_align(vcodec_bitstream_reader_t *p_reader) {
+    p_reader->bit_pos = MIN((p_reader->bit_pos + 7) / 8 * 8, p_reader->bits_available);
+}
+
+/**
+ * Read unsigned integer encoded with exp-Golomb encoding.
+ * Codes up to 8 bits are decoded with a single table lookup, codes up to VCODEC_BITSTREAM_READER_WINDOW_BITS
+ * with __builtin_clzll() on the bit window, longer ones bit by bit.
  */
 static inline uint32_t vcodec_bitstream_reader_read_exp_golomb(vcodec_bitstream_reader_t *p_reader) {
+    vcodec_bitstream_reader_check_refill(p_reader);
+    const uint64_t window = vcodec_bitstream_reader_window(p_reader);
+    const uint8_t entry = vcodec_exp_golomb_table[window >> 56];
+    if (0 != entry) {
+        vcodec_bitstream_reader_skipbits(p_reader, entry >> 4);
+        return entry & 0xf;
+    }
+
+    const uint32_t num_zeroes = __builtin_clzll(window | 1);
+    if (2 * num_zeroes + 1 <= VCODEC_BITSTREAM_READER_WINDOW_BITS) {
+        const uint32_t num_bits = 2 * num_zeroes + 1;
+        vcodec_bitstream_reader_skipbits(p_reader, num_bits);
+        return (uint32_t)(window >> (64 - num_bits)) - 1;
+    }
+
     const uint32_t num_bits = vcodec_bitstream_reader_getzeroes(p_reader) + 1;
     uint32_t ret;
     vcodec_bitstream_reader_getbits(p_reader, &ret, num_bits);
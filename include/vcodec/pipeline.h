@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vcodec.h"
+
+/**
+ * Default number of frames queued between two stages of a pipeline.
+ */
+#define VCODEC_PIPELINE_DEPTH_DEFAULT 4
+
+/**
+ * Read the next source frame of @c width x @c height pixels into @c p_frame.
+ * @return VCODEC_STATUS_EOF at the end of the source, any other error stops the pipeline.
+ */
+typedef vcodec_status_t (*vcodec_read_frame_t)(uint8_t *p_frame, void *ctx);
+
+/**
+ * Counters of a queue between two stages.
+ */
+typedef struct {
+    uint64_t frames;        //< Frames which went through the queue
+    uint64_t occupancy_sum; //< Frames queued right after each one was pushed, divide by @c frames for the average occupancy
+    int max_occupancy;
+    uint64_t full_stalls;   //< Times the producing stage waited for a free slot (back-pressure from the consuming stage)
+    uint64_t empty_stalls;  //< Times the consuming stage waited for a frame
+} vcodec_pipeline_queue_stats_t;
+
+typedef struct {
+    vcodec_pipeline_queue_stats_t input;  //< Source frames waiting to be coded
+    vcodec_pipeline_queue_stats_t output; //< Coded frames waiting to be written
+} vcodec_pipeline_stats_t;
+
+/**
+ * Encoder running as three stages on their own threads, so that reading the source and writing the output overlap with coding:
+ * source (@c read_frame) -> coding (process_frame) -> output (@c write of the encoder context).
+ * Stages are connected by bounded queues of @c depth frames, allocated once at init; a stage which gets ahead of the next one
+ * waits for a free slot. The stream is the same as with process_frame.
+ */
+typedef struct {
+    // Encoder context configured as for vcodec_enc_init(), with a @c write callback which is called from the output stage.
+    // Parameters which can be changed between frames must not be changed while vcodec_pipeline_run() is running.
+    vcodec_enc_ctx_t *p_enc;
+    vcodec_read_frame_t read_frame; //< Called from the source stage
+    void *read_ctx;
+    int depth; //< 0 is replaced with VCODEC_PIPELINE_DEPTH_DEFAULT by init
+    vcodec_pipeline_stats_t stats; //< Accumulated by vcodec_pipeline_run()
+    void *pipeline_ctx;
+} vcodec_pipeline_t;
+
+/**
+ * Initialize the encoder @c p_pipeline->p_enc and the queues.
+ * The encoder writes each frame into memory owned by the pipeline, which passes it to @c write from the output stage.
+ */
+vcodec_status_t vcodec_pipeline_init(vcodec_pipeline_t *p_pipeline, vcodec_type_t type);
+
+/**
+ * Code frames from @c read_frame until it returns VCODEC_STATUS_EOF, and return once all of them are written.
+ * @return VCODEC_STATUS_OK at the end of the source, otherwise the first error of any stage.
+ */
+vcodec_status_t vcodec_pipeline_run(vcodec_pipeline_t *p_pipeline);
+
+/**
+ * Release the queues and deinit the encoder.
+ */
+void vcodec_pipeline_deinit(vcodec_pipeline_t *p_pipeline);
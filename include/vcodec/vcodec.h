@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 typedef enum {
     VCODEC_STATUS_OK        =  0,
@@ -10,6 +11,9 @@ typedef enum {
     VCODEC_STATUS_IO_FAILED = -3,
     VCODEC_STATUS_NOENT     = -4,
     VCODEC_STATUS_EOF       = -5,
+    // Asynchronous queue is full (submit) or empty (receive), try again later.
+    // Returned by get_frame of a decoder instead of a frame when the stream changes the frame size.
+    VCODEC_STATUS_AGAIN     = -6,
 } vcodec_status_t;
 
 typedef enum {
@@ -20,6 +24,73 @@ typedef enum {
     VCODEC_TYPE_DCT,
 } vcodec_type_t;
 
+/**
+ * Instruction set used by the codec kernels.
+ */
+typedef enum {
+    VCODEC_CPU_LEVEL_AUTO = 0, //< Detect at init, can be overridden with the VCODEC_CPU environment variable
+    VCODEC_CPU_LEVEL_C,
+    VCODEC_CPU_LEVEL_SSE2,
+    VCODEC_CPU_LEVEL_AVX2,
+} vcodec_cpu_level_t;
+
+/**
+ * Range of the encoder quantization parameter. The quantizer step doubles every 6 QP.
+ */
+#define VCODEC_QP_MIN 1
+#define VCODEC_QP_MAX 51
+#define VCODEC_QP_DEFAULT 24
+
+/**
+ * Default distance between key frames.
+ */
+#define VCODEC_GOP_DEFAULT 30
+
+/**
+ * Default SAD of a macroblock against the previous input frame above which it is considered changed, 2 per pixel on average to tolerate sensor noise.
+ */
+#define VCODEC_ACTIVITY_THRESHOLD_DEFAULT 512
+
+/**
+ * Max number of previous frames a P frame can be predicted from, not counting the long-term reference.
+ */
+#define VCODEC_MAX_REF_FRAMES 4
+#define VCODEC_REF_FRAMES_DEFAULT 1
+
+/**
+ * Max number of threads of an encoder, including the one calling it.
+ */
+#define VCODEC_MAX_THREADS 64
+
+/**
+ * Default number of slices of a frame, see num_slices of vcodec_enc_ctx_t.
+ */
+#define VCODEC_SLICES_DEFAULT 1
+
+/**
+ * Motion search algorithm of the encoder.
+ */
+typedef enum {
+    VCODEC_MOTION_SEARCH_EPZS = 0, //< Diamond search seeded with motion vectors of neighbouring and co-located blocks
+    VCODEC_MOTION_SEARCH_TSS,      //< Three step search around the zero vector
+} vcodec_motion_search_t;
+
+/**
+ * Interpolation filter of the half-pel samples, quarter-pel samples are the average of the two nearest half or full-pel ones.
+ */
+typedef enum {
+    VCODEC_SUBPEL_FILTER_6TAP = 0,  //< (1, -5, 20, 20, -5, 1) / 32 as in H.264, sharper
+    VCODEC_SUBPEL_FILTER_BILINEAR,  //< Average of the two neighbours, cheaper
+} vcodec_subpel_filter_t;
+
+/**
+ * Type of a coded frame.
+ */
+typedef enum {
+    VCODEC_FRAME_TYPE_KEY = 0, //< Intra coded, decoding can start from it
+    VCODEC_FRAME_TYPE_P,       //< Predicted from previous frames
+} vcodec_frame_type_t;
+
 typedef vcodec_status_t (*vcodec_write_t)(const uint8_t *p_data, uint32_t size, void *ctx);
 typedef vcodec_status_t (*vcodec_read_t)(uint8_t *p_data, uint32_t size, uint32_t *num_read, void *ctx);
 typedef void *(*vcodec_alloc_t)(size_t size);
@@ -27,6 +98,24 @@ typedef void (*vcodec_free_t)(void *ptr);
 
 typedef struct vcodec_enc_ctx vcodec_enc_ctx_t;
 
+/**
+ * Coded frame, see vcodec_enc_encode_packet() and vcodec_enc_receive().
+ */
+typedef struct {
+    const uint8_t *p_data; //< Owned by the encoder
+    size_t size;
+    vcodec_frame_type_t frame_type;
+    int64_t pts; //< Timestamp passed with the frame
+    void *user_tag; //< Passed to vcodec_enc_submit() with the frame
+    vcodec_status_t status; //< Result of process_frame, or the error which stopped the encoder before this frame
+} vcodec_packet_t;
+
+/**
+ * Completion callback of the asynchronous encoder, called from its worker thread for each coded frame in submission order.
+ * The packet is valid until the callback returns.
+ */
+typedef void (*vcodec_packet_cb_t)(const vcodec_packet_t *p_packet, void *ctx);
+
 typedef vcodec_status_t (*vcodec_enc_process_frame_t)(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame);
 typedef vcodec_status_t (*vcodec_enc_reset_t)(vcodec_enc_ctx_t *p_ctx);
 typedef vcodec_status_t (*vcodec_enc_deinit_t)(vcodec_enc_ctx_t *p_ctx);
@@ -52,23 +141,84 @@ typedef struct vcodec_enc_ctx {
     vcodec_free_t free;
     void *io_ctx;
 
+    // Memory-backed output, used instead of @c write when it is NULL.
+    // Each frame is written at the start of @c p_out_buffer, its size is returned in @c out_size.
+    uint8_t *p_out_buffer;
+    size_t out_buffer_size;
+    bool out_buffer_grow; //< Replace full @c p_out_buffer with a larger one from @c alloc (old one is freed), otherwise fail with VCODEC_STATUS_NOMEM
+    size_t out_size;
+
+    // Asynchronous encoding, see vcodec_enc_submit(): number of frames queued towards and from the worker thread, 0 disables it.
+    // Output is returned as packets, so @c write must be NULL, and the memory-backed output is managed by the encoder. Fixed after init.
+    int async_depth;
+    // Called with each packet instead of queueing it for vcodec_enc_receive(), with @c io_ctx, if set. Fixed after init.
+    vcodec_packet_cb_t on_packet;
+
+    vcodec_cpu_level_t cpu_level; //< Kernel level to use, updated by init to the level actually selected
+    // Quantization parameter in [VCODEC_QP_MIN, VCODEC_QP_MAX], lower is better quality.
+    // 0 is replaced with VCODEC_QP_DEFAULT by init. Can be changed between frames.
+    int qp;
+    vcodec_motion_search_t motion_search;
+    // Filter of the sub-pixel motion compensation, stored in each P frame header. Can be changed between frames.
+    vcodec_subpel_filter_t subpel_filter;
+    // Number of previous frames each block of a P frame can pick its reference from, up to VCODEC_MAX_REF_FRAMES.
+    // 0 is replaced with VCODEC_REF_FRAMES_DEFAULT by init. Fixed after init, as the reference pictures are allocated once.
+    int num_ref_frames;
+    // Keep each key frame as a long-term reference until the next one, in addition to the previous frames.
+    // Useful for static cameras, where it holds the background uncovered by moving objects. Fixed after init.
+    bool long_term_ref;
+    // Number of slices each frame is split into: bands of macroblock rows which are coded independently, as neither intra
+    // nor motion vector prediction crosses their top edge. More slices allow more threads to work on a frame, at some cost in compression.
+    // 0 is replaced with VCODEC_SLICES_DEFAULT by init. At most the number of macroblock rows, fixed after init.
+    int num_slices;
+    // Number of threads coding the slices of a frame, including the one calling process_frame, up to VCODEC_MAX_THREADS.
+    // Output does not depend on it. 0 is replaced with 1 by init. Fixed after init.
+    int num_threads;
+    // Code the macroblock rows of key frames in parallel too: each row starts as soon as the row above is far enough ahead for
+    // intra prediction, so that key frames scale with num_threads even with a single slice. Output is the same as without it,
+    // at the cost of a scratch buffer and a bitstream buffer per macroblock row. Fixed after init.
+    bool wavefront;
+    // Distance between key frames, frames in between are P frames predicted from the previous frame. 1 encodes key frames only.
+    // 0 is replaced with VCODEC_GOP_DEFAULT by init. Can be changed between frames, reset starts a new GOP.
+    int gop_size;
+    // SAD of a macroblock against the previous input frame above which it is considered changed.
+    // 0 is replaced with VCODEC_ACTIVITY_THRESHOLD_DEFAULT by init. Can be changed between frames.
+    int activity_threshold;
+    // Motion activity of the last processed frame, set by process_frame: one entry per macroblock in raster order,
+    // 1 if it changed since the previous input frame, 0 if it is static. Every macroblock is changed in the first frame after init or reset.
+    // Static macroblocks of P frames are coded with the zero motion vector, without motion search.
+    const uint8_t *p_activity_map;
+    vcodec_frame_type_t out_frame_type; //< Type of the last processed frame, set by process_frame
+
     vcodec_enc_process_frame_t process_frame;
     vcodec_enc_reset_t reset;
     vcodec_enc_deinit_t deinit;
     vcodec_type_t encoder_type;
     void *encoder_ctx;
+    void *async_ctx;
+    void *packet_pool;
     vcodec_bitstream_writer_t *bitstream_writer;
 } vcodec_enc_ctx_t;
 
 typedef struct vcodec_dec_ctx {
+    // Frame size of the stream, set by init from the SPS at the start of the stream. A later SPS with another size (e.g. of the
+    // next stream, appended to the input) updates them from get_frame, which then returns VCODEC_STATUS_AGAIN without a frame,
+    // so that the application can resize its frame buffer before getting the next frame.
     uint32_t width;
     uint32_t height;
+    int gop_size; //< Distance between key frames of the stream, from its last PPS, 0 before it
 
     vcodec_read_t read;
     vcodec_alloc_t alloc;
     vcodec_free_t free;
     void *io_ctx;
 
+    // Memory-backed input, decoded in place instead of using @c read when it is NULL
+    const uint8_t *p_in_buffer;
+    size_t in_buffer_size;
+
+    vcodec_cpu_level_t cpu_level; //< Kernel level to use, updated by init to the level actually selected
+
     vcodec_dec_get_frame_t get_frame;
     vcodec_dec_deinit_t deinit;
     void *decoder_ctx;
@@ -81,4 +231,38 @@ typedef struct vcodec_dec_ctx {
 
 vcodec_status_t vcodec_enc_init(vcodec_enc_ctx_t *p_ctx, vcodec_type_t type);
 
+/**
+ * Queue a frame of an asynchronous encoder (async_depth > 0) for coding on its worker thread, without waiting for it.
+ * The frame is copied into the queue, so @c p_frame can be reused as soon as this returns. @c pts and @c user_tag are returned in its packet.
+ * Frames are submitted from one thread, and process_frame, reset and the parameters which can change between frames
+ * must not be used while frames are queued or being coded.
+ * @return VCODEC_STATUS_AGAIN if the queue is full, until the worker takes the next frame.
+ */
+vcodec_status_t vcodec_enc_submit(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int64_t pts, void *user_tag);
+
+/**
+ * Take the next coded frame of an asynchronous encoder, in submission order, waiting for it if it is still being coded.
+ * Packets are received from one thread, which may be the submitting one. The data of the packet belongs to the encoder
+ * and stays valid until the next call. Not available with @c on_packet.
+ * @return VCODEC_STATUS_AGAIN if every submitted frame was already received, or the error which stopped the worker,
+ *         which is reported for each frame submitted after it too.
+ */
+vcodec_status_t vcodec_enc_receive(vcodec_enc_ctx_t *p_ctx, vcodec_packet_t *p_packet);
+
+/**
+ * Code a frame with process_frame into a packet of its own, for an encoder with memory-backed output which can grow
+ * (@c write is NULL and @c out_buffer_grow is set). Output buffers are recycled: the packet is owned by the caller until
+ * vcodec_packet_release(), which gives its buffer back to the encoder for a later frame, so packets can be queued and written
+ * (e.g. many at once with writev()) without copying the data.
+ * @c p_out_buffer is not used and left unchanged.
+ * @param[out] pp_packet Coded frame, NULL on error.
+ */
+vcodec_status_t vcodec_enc_encode_packet(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int64_t pts, vcodec_packet_t **pp_packet);
+
+/**
+ * Give a packet of vcodec_enc_encode_packet() back to its encoder. Can be called from any thread, also after the encoder
+ * is deinitialized, in which case the memory of the packet is freed.
+ */
+void vcodec_packet_release(vcodec_packet_t *p_packet);
+
 vcodec_status_t vcodec_dec_init(vcodec_dec_ctx_t *p_ctx, vcodec_type_t type);
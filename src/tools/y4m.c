@@ -12,7 +12,8 @@ static vcodec_status_t y4m_read_frame(struct vcodec_source *p_ctx, uint8_t *p_fr
     const char *frame_hdr = "FRAME\n";
     char hdr[16];
     if (fread(hdr, strlen(frame_hdr), 1, p_y4m_ctx->infile) != 1) {
-        return VCODEC_STATUS_IO_FAILED;
+        // Clean end of the file between two frames
+        return feof(p_y4m_ctx->infile) ? VCODEC_STATUS_EOF : VCODEC_STATUS_IO_FAILED;
     }
     if (memcmp(hdr, frame_hdr, strlen(frame_hdr)) != 0) {
         return VCODEC_STATUS_INVAL;
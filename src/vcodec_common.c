@@ -1,5 +1,7 @@
 #include "vcodec/vcodec.h"
 #include "vcodec_common.h"
+#include "vcodec_dsp.h"
+#include "vcodec_subpel.h"
 #include "vcodec/bitstream.h"
 #include <stdlib.h>
 #include <limits.h>
@@ -10,11 +12,29 @@
 #define debug_printf
 
 vcodec_status_t vcodec_enc_init(vcodec_enc_ctx_t *p_ctx, vcodec_type_t type) {
+    p_ctx->async_ctx = NULL;
+    p_ctx->packet_pool = NULL;
+    if (p_ctx->async_depth < 0 || (p_ctx->async_depth > 0 && NULL != p_ctx->write)) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (p_ctx->async_depth > 0) {
+        // Each frame is coded into the buffer of its packet
+        p_ctx->p_out_buffer = NULL;
+        p_ctx->out_buffer_size = 0;
+        p_ctx->out_buffer_grow = true;
+    }
     p_ctx->bitstream_writer = p_ctx->alloc(sizeof(vcodec_bitstream_writer_t));
-    memset(p_ctx->bitstream_writer, 0, sizeof(sizeof(vcodec_bitstream_writer_t)));
-    p_ctx->bitstream_writer->p_io_ctx = p_ctx->io_ctx;
-    p_ctx->bitstream_writer->write = p_ctx->write;
+    if (NULL == p_ctx->bitstream_writer) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    if (NULL != p_ctx->write) {
+        vcodec_bitstream_writer_init(p_ctx->bitstream_writer, p_ctx->write, p_ctx->io_ctx);
+    } else if (NULL == p_ctx->p_out_buffer && !p_ctx->out_buffer_grow) {
+        return VCODEC_STATUS_INVAL;
+    }
+    // Memory-backed writer is attached to p_out_buffer at the start of each frame
 
+    vcodec_status_t ret;
     switch (type) {
         /*
     case VCODEC_TYPE_MED_GR:
@@ -25,17 +45,30 @@ vcodec_status_t vcodec_enc_init(vcodec_enc_ctx_t *p_ctx, vcodec_type_t type) {
         return vcodec_vec_init(p_ctx);
         */
     case VCODEC_TYPE_DCT:
-        return vcodec_dct_init(p_ctx);
+        ret = vcodec_dct_init(p_ctx);
+        break;
     default:
         return VCODEC_STATUS_INVAL;
     }
+    if (VCODEC_STATUS_OK != ret || 0 == p_ctx->async_depth) {
+        return ret;
+    }
+    return vcodec_enc_async_init(p_ctx);
 }
 
 vcodec_status_t vcodec_dec_init(vcodec_dec_ctx_t *p_ctx, vcodec_type_t type) {
     p_ctx->bitstream_reader = p_ctx->alloc(sizeof(vcodec_bitstream_reader_t));
-    memset(p_ctx->bitstream_reader, 0, sizeof(sizeof(vcodec_bitstream_reader_t)));
-    p_ctx->bitstream_reader->p_io_ctx = p_ctx->io_ctx;
-    p_ctx->bitstream_reader->read = p_ctx->read;
+    if (NULL == p_ctx->bitstream_reader) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    if (NULL != p_ctx->read) {
+        vcodec_bitstream_reader_init(p_ctx->bitstream_reader, p_ctx->read, p_ctx->io_ctx);
+    } else if (NULL != p_ctx->p_in_buffer) {
+        memset(p_ctx->bitstream_reader, 0, sizeof(vcodec_bitstream_reader_t));
+        vcodec_bitstream_reader_init_mem(p_ctx->bitstream_reader, p_ctx->p_in_buffer, p_ctx->in_buffer_size);
+    } else {
+        return VCODEC_STATUS_INVAL;
+    }
     switch (type) {
     case VCODEC_TYPE_DCT:
         return vcodec_dec_dct_init(p_ctx);
@@ -44,7 +77,25 @@ vcodec_status_t vcodec_dec_init(vcodec_dec_ctx_t *p_ctx, vcodec_type_t type) {
     }
 }
 
-static void predict_dc(int *pred_block, const uint8_t *ref_start, const int *p_src, int block_size, int ref_width) {
+vcodec_scratch_t *vcodec_scratch_alloc(vcodec_alloc_t alloc) {
+    void *p_allocation = alloc(sizeof(vcodec_scratch_t) + VCODEC_SCRATCH_ALIGNMENT - 1);
+    if (NULL == p_allocation) {
+        return NULL;
+    }
+    const uintptr_t aligned = ((uintptr_t)p_allocation + VCODEC_SCRATCH_ALIGNMENT - 1) & ~(uintptr_t)(VCODEC_SCRATCH_ALIGNMENT - 1);
+    vcodec_scratch_t *p_scratch = (vcodec_scratch_t *)aligned;
+    memset(p_scratch, 0, sizeof(*p_scratch));
+    p_scratch->p_allocation = p_allocation;
+    return p_scratch;
+}
+
+void vcodec_scratch_free(vcodec_scratch_t *p_scratch, vcodec_free_t free) {
+    if (NULL != p_scratch) {
+        free(p_scratch->p_allocation);
+    }
+}
+
+static void predict_dc(int16_t *pred_block, const uint8_t *ref_start, const int16_t *p_src, int block_size, int ref_width) {
     int dc_val = 0;
     for (int i = 1; i < block_size; i++) {
         dc_val += ref_start[i];
@@ -62,7 +113,7 @@ static void predict_dc(int *pred_block, const uint8_t *ref_start, const int *p_s
     }
 }
 
-static void predict_horizontal(int *pred_block, const uint8_t *ref_start, const int *p_src, int block_size, int ref_width) {
+static void predict_horizontal(int16_t *pred_block, const uint8_t *ref_start, const int16_t *p_src, int block_size, int ref_width) {
     for (int i = 0; i < block_size; i++) {
         const int pred_val = ref_start[i * ref_width];
         for (int j = 0; j < block_size; j++) {
@@ -71,7 +122,7 @@ static void predict_horizontal(int *pred_block, const uint8_t *ref_start, const
     }
 }
 
-static void predict_vertical(int *pred_block, const uint8_t *ref_start, const int *p_src, int block_size, int frame_width) {
+static void predict_vertical(int16_t *pred_block, const uint8_t *ref_start, const int16_t *p_src, int block_size, int frame_width) {
     for (int i = 0; i < block_size; i++) {
         for (int j = 0; j < block_size; j++) {
             pred_block[i * block_size + j] = p_src[i * block_size + j] - ref_start[j];
@@ -79,7 +130,7 @@ static void predict_vertical(int *pred_block, const uint8_t *ref_start, const in
     }
 }
 
-static void unpredict_dc(int *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
+static void unpredict_dc(int16_t *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
     int dc_val = 0;
     for (int i = 1; i < block_size; i++) {
         dc_val += ref_start[i];
@@ -97,7 +148,7 @@ static void unpredict_dc(int *pred_block, const uint8_t *ref_start, int block_si
     }
 }
 
-static void unpredict_horizontal(int *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
+static void unpredict_horizontal(int16_t *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
     for (int i = 0; i < block_size; i++) {
         const int pred_val = ref_start[i * ref_width];
         for (int j = 0; j < block_size; j++) {
@@ -106,7 +157,7 @@ static void unpredict_horizontal(int *pred_block, const uint8_t *ref_start, int
     }
 }
 
-static void unpredict_vertical(int *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
+static void unpredict_vertical(int16_t *pred_block, const uint8_t *ref_start, int block_size, int ref_width) {
     for (int i = 0; i < block_size; i++) {
         for (int j = 0; j < block_size; j++) {
             pred_block[i * block_size + j] += ref_start[j];
@@ -114,21 +165,13 @@ static void unpredict_vertical(int *pred_block, const uint8_t *ref_start, int bl
     }
 }
 
-static int compute_block_sum(const int *source, int block_size) {
-    int sum = 0;
-    for (int i = 0; i < block_size; i++) {
-        for (int j = 0; j < block_size; j++) {
-            sum += abs(source[i * block_size + j]);
-        }
-    }
-    return sum;
-}
-
-vcodec_prediction_mode_t vcodec_predict_block(int *prediction, const uint8_t *p_ref_frame, int x, int y, const uint8_t *p_source_frame, int frame_width, int block_size) {
-    int none_pred[block_size * block_size];
-    int horizontal_pred[block_size * block_size];
-    int vertical_pred[block_size * block_size];
-    int dc_pred[block_size * block_size];
+vcodec_prediction_mode_t vcodec_predict_block(int16_t *prediction, const uint8_t *p_ref_frame, int x, int y, int slice_y, const uint8_t *p_source_frame,
+        int frame_width, int block_size, vcodec_scratch_t *p_scratch, const vcodec_dsp_t *p_dsp) {
+    int16_t *none_pred = p_scratch->none_pred;
+    int16_t *horizontal_pred = p_scratch->horizontal_pred;
+    int16_t *vertical_pred = p_scratch->vertical_pred;
+    int16_t *dc_pred = p_scratch->dc_pred;
+    const size_t pred_size = sizeof(int16_t) * block_size * block_size;
     int original_sum = INT_MAX;
     int vertical_sum = INT_MAX;
     int horizontal_sum = INT_MAX;
@@ -144,49 +187,50 @@ vcodec_prediction_mode_t vcodec_predict_block(int *prediction, const uint8_t *p_
     }
     debug_printf("\n");
 
-    if (0 == y && 0 == x) {
+    // Rows above the slice are not available, as if the block was at the top of the frame
+    if (slice_y == y && 0 == x) {
         // No prediction is available for top-left block
-        memcpy(prediction, none_pred, sizeof(none_pred));
+        memcpy(prediction, none_pred, pred_size);
         return VCODEC_PREDICTION_MODE_NONE;
-    } else if (0 == y) {
-        original_sum = compute_block_sum(none_pred, block_size);
+    } else if (slice_y == y) {
+        original_sum = p_dsp->block_cost(none_pred, block_size);
         predict_horizontal(horizontal_pred, p_ref_frame + y * frame_width + x - 1, none_pred, block_size, frame_width);
-        horizontal_sum = compute_block_sum(horizontal_pred, block_size);
+        horizontal_sum = p_dsp->block_cost(horizontal_pred, block_size);
     } else if (0 == x) {
-        original_sum = compute_block_sum(none_pred, block_size);
+        original_sum = p_dsp->block_cost(none_pred, block_size);
         predict_vertical(vertical_pred, p_ref_frame + (y - 1) * frame_width + x, none_pred, block_size, frame_width);
-        vertical_sum = compute_block_sum(vertical_pred, block_size);
+        vertical_sum = p_dsp->block_cost(vertical_pred, block_size);
     } else {
-        original_sum = compute_block_sum(none_pred, block_size);
+        original_sum = p_dsp->block_cost(none_pred, block_size);
 
         predict_horizontal(horizontal_pred, p_ref_frame + y * frame_width + x - 1, none_pred, block_size, frame_width);
-        horizontal_sum = compute_block_sum(horizontal_pred, block_size);
+        horizontal_sum = p_dsp->block_cost(horizontal_pred, block_size);
 
         predict_vertical(vertical_pred, p_ref_frame + (y - 1) * frame_width + x, none_pred, block_size, frame_width);
-        vertical_sum = compute_block_sum(vertical_pred, block_size);
+        vertical_sum = p_dsp->block_cost(vertical_pred, block_size);
 
         predict_dc(dc_pred, p_ref_frame + (y - 1) * frame_width + x - 1, none_pred, block_size, frame_width);
-        dc_sum = compute_block_sum(dc_pred, block_size);
+        dc_sum = p_dsp->block_cost(dc_pred, block_size);
     }
 
     debug_printf("Sums computed: %d %d %d %d\n", original_sum, dc_sum, horizontal_sum, vertical_sum);
     const int min_sum = MIN(original_sum, MIN(dc_sum, MIN(vertical_sum, horizontal_sum)));
     if (dc_sum == min_sum) {
-        memcpy(prediction, dc_pred, sizeof(dc_pred));
+        memcpy(prediction, dc_pred, pred_size);
         return VCODEC_PREDICTION_MODE_DC;
     } else if (horizontal_sum == min_sum) {
-        memcpy(prediction, horizontal_pred, sizeof(horizontal_pred));
+        memcpy(prediction, horizontal_pred, pred_size);
         return VCODEC_PREDICTION_MODE_HORIZONTAL;
     } else if (vertical_sum == min_sum) {
-        memcpy(prediction, vertical_pred, sizeof(vertical_pred));
+        memcpy(prediction, vertical_pred, pred_size);
         return VCODEC_PREDICTION_MODE_VERTICAL;
     } else {
-        memcpy(prediction, none_pred, sizeof(none_pred));
+        memcpy(prediction, none_pred, pred_size);
         return VCODEC_PREDICTION_MODE_NONE;
     }
 }
 
-void vcodec_unpredict_block(int *reconstructed, const uint8_t *p_ref_frame, int x, int y, int block_size, int frame_width, vcodec_prediction_mode_t pred_mode) {
+void vcodec_unpredict_block(int16_t *reconstructed, const uint8_t *p_ref_frame, int x, int y, int block_size, int frame_width, vcodec_prediction_mode_t pred_mode) {
     switch (pred_mode) {
     case VCODEC_PREDICTION_MODE_NONE:
         break;
@@ -202,31 +246,169 @@ void vcodec_unpredict_block(int *reconstructed, const uint8_t *p_ref_frame, int
     }
 }
 
-static int compute_motion_block_sad(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width) {
-    int diff = 0;
-    for (int i = y; i < y + block_size; i++) {
-        for (int j = x; j < x + block_size; j++) {
-            diff += abs(p_source_frame[i * frame_width + j] - p_ref_frame[(i + mvy) * frame_width + j + mvx]);
+/**
+ * Motion vector components of cached costs are biased by this value and must fit 13 bits.
+ */
+#define COST_CACHE_MV_BIAS 4096
+
+/**
+ * Cached cost indices of the 8x8 blocks and of the macroblock, after the 16 4x4 blocks.
+ */
+#define COST_CACHE_8X8 16
+#define COST_CACHE_16X16 20
+
+/**
+ * Index of a block of the cached macroblock within the cached costs.
+ * @retval -1 if the block is not within the cached macroblock.
+ */
+static inline int cost_cache_block(const vcodec_cost_cache_t *p_cache, int x, int y, int block_size) {
+    const int block_x = x - p_cache->x;
+    const int block_y = y - p_cache->y;
+    if (block_x < 0 || block_y < 0 || block_x + block_size > VCODEC_MACROBLOCK_SIZE || block_y + block_size > VCODEC_MACROBLOCK_SIZE
+            || 0 != (block_x | block_y) % block_size) {
+        return -1;
+    }
+    switch (block_size) {
+    case 4:
+        return block_y + block_x / 4;
+    case 8:
+        return COST_CACHE_8X8 + block_y / 4 + block_x / 8;
+    case 16:
+        return COST_CACHE_16X16;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Bits of the 4x4 blocks of an 8x8 block.
+ */
+static inline uint32_t cost_cache_quadrants(int block) {
+    const int quadrant = block - COST_CACHE_8X8;
+    return 0x33u << ((quadrant / 2) * 8 + (quadrant % 2) * 2);
+}
+
+static inline vcodec_cost_cache_entry_t *cost_cache_entry(vcodec_cost_cache_t *p_cache, int mvx, int mvy, uint32_t *p_vector) {
+    if ((uint32_t)(mvx + COST_CACHE_MV_BIAS) >= 2 * COST_CACHE_MV_BIAS || (uint32_t)(mvy + COST_CACHE_MV_BIAS) >= 2 * COST_CACHE_MV_BIAS) {
+        return NULL;
+    }
+    *p_vector = ((uint32_t)(mvy + COST_CACHE_MV_BIAS) << 13) | (uint32_t)(mvx + COST_CACHE_MV_BIAS);
+    // Fibonacci hashing, top bits of the product
+    return &p_cache->entries[(*p_vector * 2654435761u) >> (32 - __builtin_ctz(VCODEC_COST_CACHE_SIZE))];
+}
+
+static inline void cost_cache_put(vcodec_cost_cache_t *p_cache, int block, int mvx, int mvy, int cost) {
+    uint32_t vector;
+    vcodec_cost_cache_entry_t *p_entry = cost_cache_entry(p_cache, mvx, mvy, &vector);
+    if (NULL == p_entry || cost < 0 || cost > UINT16_MAX) {
+        return;
+    }
+    if (p_entry->generation != p_cache->generation || p_entry->vector != vector) {
+        p_entry->vector = vector;
+        p_entry->generation = p_cache->generation;
+        p_entry->valid = 0;
+    }
+    p_entry->valid |= 1u << block;
+    p_entry->costs[block] = cost;
+}
+
+/**
+ * Cost of a block of the cached macroblock, derived from the costs of its quadrants if the block itself has none.
+ */
+static bool cost_cache_get(vcodec_cost_cache_t *p_cache, int block, int mvx, int mvy, int *p_cost) {
+    uint32_t vector;
+    const vcodec_cost_cache_entry_t *p_entry = cost_cache_entry(p_cache, mvx, mvy, &vector);
+    if (NULL == p_entry || p_entry->generation != p_cache->generation || p_entry->vector != vector) {
+        return false;
+    }
+    const uint32_t valid = p_entry->valid;
+    const uint16_t *p_costs = p_entry->costs;
+    if (valid & (1u << block)) {
+        *p_cost = p_costs[block];
+        return true;
+    }
+    if (block < COST_CACHE_8X8) {
+        return false;
+    }
+    const int first = COST_CACHE_16X16 == block ? COST_CACHE_8X8 : block;
+    const int last = COST_CACHE_16X16 == block ? COST_CACHE_16X16 - 1 : block;
+    int cost = 0;
+    for (int quadrant = first; quadrant <= last; quadrant++) {
+        if (valid & (1u << quadrant)) {
+            cost += p_costs[quadrant];
+            continue;
+        }
+        const uint32_t quadrants = cost_cache_quadrants(quadrant);
+        if (quadrants != (valid & quadrants)) {
+            return false;
+        }
+        const int top_left = (quadrant - COST_CACHE_8X8) / 2 * 8 + (quadrant - COST_CACHE_8X8) % 2 * 2;
+        cost += p_costs[top_left] + p_costs[top_left + 1] + p_costs[top_left + 4] + p_costs[top_left + 5];
+    }
+    *p_cost = cost;
+    return true;
+}
+
+/**
+ * Costs of the candidates: cached ones are looked up, the rest are computed in one batch (if @c cost_multi_function is set) and cached.
+ * Costs of 4x4 blocks are only cached for the larger blocks to derive from: looking them up would take as long as computing them.
+ */
+static void compute_costs(const uint8_t *p_ref_frame, const uint8_t *p_source_frame, int x, int y, int frame_width, int block_size,
+        const motion_vector_t *p_candidates, int num_candidates, compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function,
+        vcodec_cost_cache_t *p_cache, int *p_costs) {
+    motion_vector_t misses[VCODEC_MAX_MOTION_PREDICTORS + 8];
+    int miss_costs[VCODEC_MAX_MOTION_PREDICTORS + 8];
+    int miss_index[VCODEC_MAX_MOTION_PREDICTORS + 8];
+    int num_misses = 0;
+    const int block = NULL != p_cache ? cost_cache_block(p_cache, x, y, block_size) : -1;
+    for (int i = 0; i < num_candidates; i++) {
+        if (block < COST_CACHE_8X8 || !cost_cache_get(p_cache, block, p_candidates[i].mvx, p_candidates[i].mvy, &p_costs[i])) {
+            misses[num_misses] = p_candidates[i];
+            miss_index[num_misses++] = i;
+        }
+    }
+    if (NULL != cost_multi_function) {
+        cost_multi_function(p_source_frame, p_ref_frame, x, y, misses, num_misses, block_size, frame_width, miss_costs);
+    } else {
+        for (int i = 0; i < num_misses; i++) {
+            miss_costs[i] = cost_function(p_source_frame, p_ref_frame, x, y, misses[i].mvx, misses[i].mvy, block_size, frame_width);
+        }
+    }
+    for (int i = 0; i < num_misses; i++) {
+        p_costs[miss_index[i]] = miss_costs[i];
+        if (block >= 0) {
+            cost_cache_put(p_cache, block, misses[i].mvx, misses[i].mvy, miss_costs[i]);
         }
     }
-    return diff;
 }
 
 /**
  * Find best matching position from 9 points.
- * @param[in] p_ref_frame    Reference frame buffer.
- * @param[in] p_source_frame Source frame buffer
- * @param[in] x              Block center position (x) in pixels.
- * @param[in] y              Block center position (y) in pixels.
- * @param[in] frame_width    Source/reference frame width.
- * @param[in] block_size     Block width in pixels.
- * @param[in] p_mvx          Resulting vector on y axis.
- * @param[in] p_mvy          Resulting vector on y axis.
+ * @param[in] p_ref_frame         Reference frame buffer.
+ * @param[in] p_source_frame      Source frame buffer
+ * @param[in] x                   Block center position (x) in pixels.
+ * @param[in] y                   Block center position (y) in pixels.
+ * @param[in] frame_width         Row stride of the source and reference frames.
+ * @param[in] block_size          Block width in pixels.
+ * @param[in] p_search            Search area, candidates reading outside of it are skipped, and the optional cost cache (@c p_cache).
+ * @param[in] p_mvx               Resulting vector on y axis.
+ * @param[in] p_mvy               Resulting vector on y axis.
+ * @param[in] cost_function       Cost of a single motion vector.
+ * @param[in] cost_multi_function Optional batched @c cost_function, evaluates the 9 points of a step in one call. NULL to call @c cost_function for each point.
  *
  * @retval SAD for the resulting motion vector.
  */
+/**
+ * Check that the block at (@c x, @c y) displaced by @c mv reads only inside the search area.
+ */
+static bool search_in_area(const vcodec_motion_search_params_t *p_search, int x, int y, int block_size, motion_vector_t mv) {
+    return x + mv.mvx >= p_search->area_left && x + mv.mvx + block_size <= p_search->area_right
+        && y + mv.mvy >= p_search->area_top && y + mv.mvy + block_size <= p_search->area_bottom;
+}
+
 int vcodec_match_block_tss(const uint8_t *p_ref_frame, const uint8_t *p_source_frame, int x, int y,
-        int frame_width, int block_size, int *p_mvx, int *p_mvy, compute_motion_block_cost_t cost_function) {
+        int frame_width, int block_size, const vcodec_motion_search_params_t *p_search, int *p_mvx, int *p_mvy,
+        compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function) {
     int sad_min = INT_MAX;
     int mvx_min = 0;
     int mvy_min = 0;
@@ -235,64 +417,283 @@ int vcodec_match_block_tss(const uint8_t *p_ref_frame, const uint8_t *p_source_f
     *p_mvy = 0;
 
     for (int step_size = block_size; step_size > 0; step_size /= 2) {
+        motion_vector_t candidates[9];
+        int costs[9];
+        int num_candidates = 0;
         for (int i = -step_size; i < step_size + 1; i += step_size) {
             for (int j = -step_size; j < step_size + 1; j += step_size) {
-                const int mvx = *p_mvx + j;
-                const int mvy = *p_mvy + i;
-                const int sad = cost_function(p_source_frame, p_ref_frame, x, y, mvx, mvy, block_size, frame_width);
-                if (sad < sad_min) {
-                    sad_min = sad;
-                    mvx_min = mvx;
-                    mvy_min = mvy;
+                const motion_vector_t mv = { *p_mvx + j, *p_mvy + i };
+                if (search_in_area(p_search, x, y, block_size, mv)) {
+                    candidates[num_candidates++] = mv;
                 }
             }
         }
+        compute_costs(p_ref_frame, p_source_frame, x, y, frame_width, block_size, candidates, num_candidates, cost_function, cost_multi_function,
+                p_search->p_cache, costs);
+        for (int k = 0; k < num_candidates; k++) {
+            if (costs[k] < sad_min) {
+                sad_min = costs[k];
+                mvx_min = candidates[k].mvx;
+                mvy_min = candidates[k].mvy;
+            }
+        }
         *p_mvx = mvx_min;
         *p_mvy = mvy_min;
     }
     return sad_min;
 }
 
-vcodec_motion_prediction_mode_t vcodec_predict_motion_block(int *prediction, const uint8_t *p_ref_frame, int x, int y,
-        const uint8_t *p_source_frame, int frame_width, int block_size, int *p_mvx, int *p_mvy, int *p_sad, vcodec_prediction_mode_t *p_intra_mode) {
-    const vcodec_prediction_mode_t intra_pred = vcodec_predict_block(prediction, p_ref_frame, x, y, p_source_frame, frame_width, block_size);
-    const int intra_pred_diff = compute_block_sum(prediction, block_size);
-    const int inter_pred_diff = vcodec_match_block_tss(p_ref_frame, p_source_frame, x, y, frame_width, block_size, p_mvx, p_mvy, compute_motion_block_sad);
+/**
+ * EPZS stops right after the predictors when SAD is below this value per pixel,
+ * and goes straight to the small diamond when it is below the refine threshold.
+ */
+#define EPZS_STOP_SAD_PER_PIXEL 1
+#define EPZS_REFINE_SAD_PER_PIXEL 4
+
+/**
+ * Bounds the diamond walk, in steps.
+ */
+#define EPZS_MAX_ITERATIONS 16
+
+static const motion_vector_t large_diamond[] = {
+    { 0, -2 }, { -1, -1 }, { 1, -1 }, { -2, 0 }, { 2, 0 }, { -1, 1 }, { 1, 1 }, { 0, 2 },
+};
+
+static const motion_vector_t small_diamond[] = {
+    { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 },
+};
+
+typedef struct {
+    const uint8_t *p_ref_frame;
+    const uint8_t *p_source_frame;
+    int x;
+    int y;
+    int frame_width;
+    int block_size;
+    const vcodec_motion_search_params_t *p_search;
+    compute_motion_block_cost_t cost_function;
+    compute_motion_block_cost_multi_t cost_multi_function;
+    // Cache of the predictor costs, NULL during the diamond walk
+    vcodec_cost_cache_t *p_cache;
+    motion_vector_t best;
+    int best_cost;
+} epzs_state_t;
+
+
+/**
+ * Evaluate the candidates which are inside the search area and differ from the current best one.
+ * @return true if the best candidate has changed.
+ */
+static bool epzs_evaluate(epzs_state_t *p_state, const motion_vector_t *p_candidates, int num_candidates) {
+    motion_vector_t candidates[VCODEC_MAX_MOTION_PREDICTORS + 8];
+    int costs[VCODEC_MAX_MOTION_PREDICTORS + 8];
+    int n = 0;
+    for (int i = 0; i < num_candidates; i++) {
+        const motion_vector_t mv = p_candidates[i];
+        bool duplicate = INT_MAX != p_state->best_cost && mv.mvx == p_state->best.mvx && mv.mvy == p_state->best.mvy;
+        for (int j = 0; j < n && !duplicate; j++) {
+            duplicate = mv.mvx == candidates[j].mvx && mv.mvy == candidates[j].mvy;
+        }
+        if (!duplicate && search_in_area(p_state->p_search, p_state->x, p_state->y, p_state->block_size, mv)) {
+            candidates[n++] = mv;
+        }
+    }
+    compute_costs(p_state->p_ref_frame, p_state->p_source_frame, p_state->x, p_state->y, p_state->frame_width, p_state->block_size, candidates, n,
+            p_state->cost_function, p_state->cost_multi_function, p_state->p_cache, costs);
+    bool improved = false;
+    for (int i = 0; i < n; i++) {
+        if (costs[i] < p_state->best_cost) {
+            p_state->best_cost = costs[i];
+            p_state->best = candidates[i];
+            improved = true;
+        }
+    }
+    return improved;
+}
+
+/**
+ * Move the best candidate with the pattern until it stays at the center.
+ */
+static void epzs_diamond(epzs_state_t *p_state, const motion_vector_t *p_pattern, int pattern_size) {
+    for (int i = 0; i < EPZS_MAX_ITERATIONS; i++) {
+        motion_vector_t candidates[8];
+        for (int j = 0; j < pattern_size; j++) {
+            candidates[j].mvx = p_state->best.mvx + p_pattern[j].mvx;
+            candidates[j].mvy = p_state->best.mvy + p_pattern[j].mvy;
+        }
+        if (!epzs_evaluate(p_state, candidates, pattern_size)) {
+            return;
+        }
+    }
+}
+
+int vcodec_match_block_epzs(const uint8_t *p_ref_frame, const uint8_t *p_source_frame, int x, int y,
+        int frame_width, int block_size, const vcodec_motion_search_params_t *p_search, int *p_mvx, int *p_mvy,
+        compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function) {
+    epzs_state_t state = {
+        .p_ref_frame = p_ref_frame,
+        .p_source_frame = p_source_frame,
+        .x = x,
+        .y = y,
+        .frame_width = frame_width,
+        .block_size = block_size,
+        .p_search = p_search,
+        .cost_function = cost_function,
+        .cost_multi_function = cost_multi_function,
+        .p_cache = p_search->p_cache,
+        .best_cost = INT_MAX,
+    };
+    motion_vector_t candidates[VCODEC_MAX_MOTION_PREDICTORS + 1] = { { 0, 0 } };
+    memcpy(candidates + 1, p_search->predictors, sizeof(motion_vector_t) * p_search->num_predictors);
+    epzs_evaluate(&state, candidates, p_search->num_predictors + 1);
+    // Diamond points are rarely shared between blocks, caching them costs more than it saves
+    state.p_cache = NULL;
+
+    const int num_pixels = block_size * block_size;
+    if (state.best_cost > EPZS_STOP_SAD_PER_PIXEL * num_pixels) {
+        if (state.best_cost > EPZS_REFINE_SAD_PER_PIXEL * num_pixels) {
+            epzs_diamond(&state, large_diamond, sizeof(large_diamond) / sizeof(large_diamond[0]));
+        }
+        epzs_diamond(&state, small_diamond, sizeof(small_diamond) / sizeof(small_diamond[0]));
+    }
+    *p_mvx = state.best.mvx;
+    *p_mvy = state.best.mvy;
+    return state.best_cost;
+}
+
+void vcodec_cost_cache_reset(vcodec_cost_cache_t *p_cache, int x, int y) {
+    p_cache->generation++;
+    if (0 == p_cache->generation) {
+        // Generation wrapped around, entries of old generations could become valid again
+        memset(p_cache->entries, 0, sizeof(p_cache->entries));
+        p_cache->generation = 1;
+    }
+    p_cache->x = x;
+    p_cache->y = y;
+}
+
+bool vcodec_cost_cache_lookup(vcodec_cost_cache_t *p_cache, int x, int y, int block_size, int mvx, int mvy, int *p_cost) {
+    const int block = cost_cache_block(p_cache, x, y, block_size);
+    return block >= 0 && cost_cache_get(p_cache, block, mvx, mvy, p_cost);
+}
+
+void vcodec_cost_cache_insert(vcodec_cost_cache_t *p_cache, int x, int y, int block_size, int mvx, int mvy, int cost) {
+    const int block = cost_cache_block(p_cache, x, y, block_size);
+    if (block >= 0) {
+        cost_cache_put(p_cache, block, mvx, mvy, cost);
+    }
+}
+
+static int median3(int a, int b, int c) {
+    return MAX(MIN(a, b), MIN(MAX(a, b), c));
+}
+
+int vcodec_motion_predictors(const motion_vector_t *p_field, const motion_vector_t *p_prev_field, int mb_x, int mb_y, int slice_mb_y, int width_mbs,
+        motion_vector_t *p_predictors) {
+    int n = 0;
+    const bool has_left = mb_x > 0;
+    const bool has_top = mb_y > slice_mb_y;
+    const bool has_top_right = has_top && mb_x + 1 < width_mbs;
+    if (has_left) {
+        p_predictors[n++] = p_field[mb_y * width_mbs + mb_x - 1];
+    }
+    if (has_top) {
+        p_predictors[n++] = p_field[(mb_y - 1) * width_mbs + mb_x];
+    }
+    if (has_top_right) {
+        p_predictors[n++] = p_field[(mb_y - 1) * width_mbs + mb_x + 1];
+    }
+    if (has_left && has_top && has_top_right) {
+        p_predictors[n].mvx = median3(p_predictors[0].mvx, p_predictors[1].mvx, p_predictors[2].mvx);
+        p_predictors[n].mvy = median3(p_predictors[0].mvy, p_predictors[1].mvy, p_predictors[2].mvy);
+        n++;
+    }
+    if (NULL != p_prev_field) {
+        p_predictors[n++] = p_prev_field[mb_y * width_mbs + mb_x];
+    }
+    return n;
+}
+
+motion_vector_t vcodec_motion_vector_prediction(const motion_vector_t *p_field, int mb_x, int mb_y, int slice_mb_y, int width_mbs) {
+    motion_vector_t predictors[VCODEC_MAX_MOTION_PREDICTORS];
+    const int n = vcodec_motion_predictors(p_field, NULL, mb_x, mb_y, slice_mb_y, width_mbs, predictors);
+    if (0 == n) {
+        return (motion_vector_t){ 0, 0 };
+    }
+    // Median follows the three neighbours if all of them are available, otherwise the left or the top one is used
+    return 4 == n ? predictors[3] : predictors[0];
+}
+
+vcodec_motion_prediction_mode_t vcodec_predict_motion_block(int16_t *prediction, const vcodec_subpel_ref_t *const *p_refs, int num_refs,
+        const uint8_t *p_recon_frame, int slice_y, int x, int y, const uint8_t *p_source_frame, int frame_width, int block_size, int *p_ref_idx, int *p_mvx, int *p_mvy,
+        int *p_sad, vcodec_prediction_mode_t *p_intra_mode, const vcodec_motion_search_params_t *p_search, vcodec_scratch_t *p_scratch, const vcodec_dsp_t *p_dsp) {
+    vcodec_prediction_mode_t intra_pred = VCODEC_PREDICTION_MODE_NONE;
+    int intra_pred_diff = INT_MAX;
+    if (NULL != p_recon_frame) {
+        intra_pred = vcodec_predict_block(prediction, p_recon_frame, x, y, slice_y, p_source_frame, frame_width, block_size, p_scratch, p_dsp);
+        intra_pred_diff = p_dsp->block_cost(prediction, block_size);
+    }
+    int inter_pred_diff = INT_MAX;
+    vcodec_motion_search_params_t search = *p_search;
+    for (int i = 0; i < num_refs; i++) {
+        const uint8_t *p_ref_frame = p_refs[i]->p_full;
+        if (NULL != p_search->p_cache) {
+            search.p_cache = p_search->p_cache + i;
+        }
+        int mvx;
+        int mvy;
+        int cost;
+        if (VCODEC_MOTION_SEARCH_TSS == search.method) {
+            cost = vcodec_match_block_tss(p_ref_frame, p_source_frame, x, y, frame_width, block_size, &search, &mvx, &mvy, p_dsp->sad, p_dsp->sad_multi);
+        } else {
+            cost = vcodec_match_block_epzs(p_ref_frame, p_source_frame, x, y, frame_width, block_size, &search, &mvx, &mvy, p_dsp->sad, p_dsp->sad_multi);
+        }
+        mvx *= VCODEC_SUBPEL_SCALE;
+        mvy *= VCODEC_SUBPEL_SCALE;
+        cost = vcodec_subpel_refine(p_refs[i], p_source_frame, x, y, block_size, &mvx, &mvy, cost, p_dsp);
+        if (cost < inter_pred_diff) {
+            inter_pred_diff = cost;
+            *p_ref_idx = i;
+            *p_mvx = mvx;
+            *p_mvy = mvy;
+        }
+    }
     if (inter_pred_diff < intra_pred_diff) {
         *p_sad = inter_pred_diff;
-        for (int i = 0; i < block_size; i++) {
-            for (int j = 0; j < block_size; j++) {
-                prediction[i * block_size + j] = p_source_frame[(i + y) * frame_width + j + x]
-                    - p_ref_frame[(i + y + *p_mvy) * frame_width + j + x + *p_mvx];
-            }
-        }
+        vcodec_subpel_residual(prediction, block_size, p_source_frame, p_refs[*p_ref_idx], x, y, *p_mvx, *p_mvy, block_size);
         return VCODEC_MOTION_PREDICTION_MODE_MV;
     } else {
-        *p_sad = inter_pred_diff;
+        *p_sad = intra_pred_diff;
         *p_intra_mode = intra_pred;
         return VCODEC_MOTION_PREDICTION_MODE_INTRA;
     }
 }
 
-void vcodec_unpredict_motion_block(int *reconstructed, const uint8_t *p_ref_frame, int x, int y,
-        int block_size, int frame_width, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode, int mvx, int mvy) {
-    switch (pred_mode) {
-        case VCODEC_MOTION_PREDICTION_MODE_SKIP:
-            for (int i = 0; i < block_size; i++) {
-                for (int j = 0; j < block_size; j++) {
-                    reconstructed[i * block_size + j] = p_ref_frame[(i + y + mvy) * frame_width + j + x + mvx];
-                }
-            }
-            break;
-        case VCODEC_MOTION_PREDICTION_MODE_INTRA:
-            vcodec_unpredict_block(reconstructed, p_ref_frame, x, y, block_size, frame_width, pred_mode);
-            break;
-        case VCODEC_MOTION_PREDICTION_MODE_MV:
-            for (int i = 0; i < block_size; i++) {
-                for (int j = 0; j < block_size; j++) {
-                    reconstructed[i * block_size + j] += p_ref_frame[(i + y + mvy) * frame_width + j + x + mvx];
-                }
-            }
-            break;
+int vcodec_unpredict_partition(int16_t *p_residual, int stride, const block_motion_vector_t *p_vectors, const vcodec_subpel_ref_t *const *p_refs,
+        const uint8_t *p_recon_frame, int x, int y, int block_size, int frame_width) {
+    if (VCODEC_BLOCK_PARTITION_MODE_QUAD == p_vectors[0].partition_mode) {
+        const int sub_block_size = block_size / 2;
+        int num_vectors = 1;
+        for (int i = 0; i < 4; i++) {
+            const int sub_x = (i % 2) * sub_block_size;
+            const int sub_y = (i / 2) * sub_block_size;
+            num_vectors += vcodec_unpredict_partition(p_residual + sub_y * stride + sub_x, stride, p_vectors + num_vectors, p_refs, p_recon_frame,
+                    x + sub_x, y + sub_y, sub_block_size, frame_width);
+        }
+        return num_vectors;
+    }
+    if (VCODEC_MOTION_PREDICTION_MODE_INTRA == p_vectors[0].motion_pred_mode) {
+        // Only whole macroblocks are intra predicted, so the residual is not strided
+        vcodec_unpredict_block(p_residual, p_recon_frame, x, y, block_size, frame_width, p_vectors[0].intra_pred_mode);
+        return 1;
+    }
+    const uint8_t *p_a;
+    const uint8_t *p_b;
+    vcodec_subpel_sources(p_refs[p_vectors[0].ref_idx], x, y, p_vectors[0].mvx, p_vectors[0].mvy, &p_a, &p_b);
+    for (int i = 0; i < block_size; i++) {
+        for (int j = 0; j < block_size; j++) {
+            p_residual[i * stride + j] += (p_a[i * frame_width + j] + p_b[i * frame_width + j] + 1) >> 1;
+        }
     }
+    return 1;
 }
@@ -27,8 +27,165 @@ typedef enum {
 } vcodec_block_partition_mode_t;
 
 
+#define VCODEC_MACROBLOCK_SIZE 16
+#define VCODEC_BLOCK_SIZE 4
+
+/**
+ * Number of quad partition levels below a macroblock (16x16 -> 8x8 -> 4x4).
+ */
+#define VCODEC_PARTITION_DEPTH 2
+
+/**
+ * Max number of entries in a partition tree of a macroblock: one per node of a full quad tree.
+ */
+#define VCODEC_MAX_PARTITION_VECTORS (1 + 4 * (1 + 4))
+
+#define VCODEC_SCRATCH_ALIGNMENT 64
+
+/**
+ * Max number of references of a P frame: the short-term ones and the long-term one.
+ */
+#define VCODEC_MAX_REFS (VCODEC_MAX_REF_FRAMES + 1)
+
+/**
+ * Type of a unit of the stream, in its first VCODEC_UNIT_TYPE_BITS bits. Each unit starts at a byte boundary.
+ */
+typedef enum {
+    VCODEC_UNIT_P_FRAME = 0,
+    VCODEC_UNIT_KEY_FRAME,
+    VCODEC_UNIT_SPS, //< Sequence parameter set, precedes every key frame
+    VCODEC_UNIT_PPS, //< Picture parameter set, precedes every key frame and the frames where its parameters change
+} vcodec_unit_type_t;
+
+#define VCODEC_UNIT_TYPE_BITS 2
+
+/**
+ * First word of the SPS after its type byte, "VCDC".
+ */
+#define VCODEC_SPS_MAGIC 0x56434443
+
+/**
+ * Max width and height in the SPS.
+ */
+#define VCODEC_MAX_DIMENSION 16384
+
+typedef struct {
+    vcodec_block_partition_mode_t partition_mode;
+    vcodec_motion_prediction_mode_t motion_pred_mode;
+    vcodec_prediction_mode_t intra_pred_mode;
+    // Quarter-pel motion vector, see VCODEC_SUBPEL_SCALE
+    int mvx;
+    int mvy;
+    // Reference of the motion vector, in the reference list of the frame
+    int ref_idx;
+} block_motion_vector_t;
+
+/**
+ * Number of motion vectors the cost cache holds, a power of two.
+ * The table is direct mapped, a vector colliding with another one replaces its costs.
+ */
+#define VCODEC_COST_CACHE_SIZE 256
+
+/**
+ * Blocks of a macroblock with cached costs: 16 4x4 blocks, 4 8x8 blocks and the macroblock itself.
+ */
+#define VCODEC_COST_CACHE_BLOCKS 21
+
+/**
+ * Costs of all blocks of the macroblock for one motion vector, so that deriving a cost takes a single lookup.
+ */
+typedef struct {
+    uint32_t vector;
+    uint32_t generation;
+    uint32_t valid; //< Bit per block which has a cost
+    // SAD of a 16x16 block fits 16 bits
+    uint16_t costs[VCODEC_COST_CACHE_BLOCKS];
+} vcodec_cost_cache_entry_t;
+
+/**
+ * Motion search costs of the blocks of one macroblock, keyed by block position, block size and motion vector.
+ * A missing cost of an 8x8 or 16x16 block is derived from the costs of its four quadrants when all of them are cached.
+ * Entries of previous macroblocks are invalidated by bumping the generation, so the table is never cleared.
+ */
+typedef struct {
+    vcodec_cost_cache_entry_t entries[VCODEC_COST_CACHE_SIZE];
+    uint32_t generation;
+    // Macroblock origin
+    int x;
+    int y;
+} vcodec_cost_cache_t;
+
+/**
+ * Per-context scratch memory for macroblock coding.
+ * Allocated once at init and reused for each macroblock, so the hot path does not need any VLAs.
+ *
+ * Sample buffers are 16-bit, which holds every value of the coding pipeline for 8-bit input:
+ * - residuals after intra or inter prediction are within [-255, 255];
+ * - forward4x4() coefficients and their rescaled values are within [-9180, 9180];
+ * - reconstructed samples before clamping are within [-255, 510], give or take the quantization error.
+ */
+typedef struct {
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t macroblock[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    // Quantized levels of the macroblock, 16 per 4x4 block
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t levels[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    // Intra prediction candidates, see vcodec_predict_block()
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t none_pred[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t horizontal_pred[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t vertical_pred[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t dc_pred[VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    // Whole block residual of the partition search, per recursion depth
+    _Alignas(VCODEC_SCRATCH_ALIGNMENT) int16_t partition_blocks[VCODEC_PARTITION_DEPTH + 1][VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE];
+    block_motion_vector_t vectors[VCODEC_MAX_PARTITION_VECTORS];
+    block_motion_vector_t sub_vectors[VCODEC_PARTITION_DEPTH][VCODEC_MAX_PARTITION_VECTORS];
+    // One per reference of the frame
+    vcodec_cost_cache_t cost_cache[VCODEC_MAX_REFS];
+    void *p_allocation; //< Pointer returned by alloc, before alignment
+} vcodec_scratch_t;
+
+typedef struct vcodec_dsp vcodec_dsp_t;
+typedef struct vcodec_subpel_ref vcodec_subpel_ref_t;
+
+/**
+ * Motion estimation cost of a block. Source and reference frames share the row stride @c frame_width,
+ * and the reference can be read up to VCODEC_FRAME_BORDER pixels outside the picture, see vcodec_frame_t.
+ */
 typedef int (*compute_motion_block_cost_t)(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width);
 
+typedef struct {
+    int mvx;
+    int mvy;
+} motion_vector_t;
+
+/**
+ * Max number of motion vector predictors of a block: left, top, top-right, their median, co-located,
+ * the coarse-to-fine pyramid candidate and the vectors of the four quadrants.
+ */
+#define VCODEC_MAX_MOTION_PREDICTORS 10
+
+/**
+ * Motion search setup of a block.
+ */
+typedef struct {
+    vcodec_motion_search_t method;
+    // Part of the reference frame the search can read, in pixels relative to the frame origin
+    // (right and bottom are exclusive).
+    int area_left;
+    int area_top;
+    int area_right;
+    int area_bottom;
+    motion_vector_t predictors[VCODEC_MAX_MOTION_PREDICTORS];
+    int num_predictors;
+    // Optional cache of the costs, NULL to compute every cost.
+    // vcodec_predict_motion_block() takes an array of caches, one per reference.
+    vcodec_cost_cache_t *p_cache;
+} vcodec_motion_search_params_t;
+
+/**
+ * Batched version of compute_motion_block_cost_t: costs of @c num_candidates motion vectors of one source block are written to @c p_costs.
+ */
+typedef void (*compute_motion_block_cost_multi_t)(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, const motion_vector_t *p_candidates,
+        int num_candidates, int block_size, int frame_width, int *p_costs);
+
 vcodec_status_t vcodec_med_gr_init(vcodec_enc_ctx_t *p_ctx);
 
 vcodec_status_t vcodec_inter_init(vcodec_enc_ctx_t *p_ctx);
@@ -37,23 +194,107 @@ vcodec_status_t vcodec_vec_init(vcodec_enc_ctx_t *p_ctx);
 
 vcodec_status_t vcodec_dct_init(vcodec_enc_ctx_t *p_ctx);
 
+/**
+ * Start the worker thread of an initialized encoder with async_depth > 0, see vcodec_enc_submit().
+ */
+vcodec_status_t vcodec_enc_async_init(vcodec_enc_ctx_t *p_ctx);
+
+/**
+ * Detach the packet pool from an encoder being deinitialized. Its memory is freed once the application released every packet.
+ */
+void vcodec_packet_pool_close(vcodec_enc_ctx_t *p_ctx);
+
 vcodec_status_t vcodec_dec_dct_init(vcodec_dec_ctx_t *p_ctx);
 
 vcodec_status_t vcodec_med_gr_dpcm_med_predictor_golomb(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_current_line, const uint8_t *p_prev_line);
 
 vcodec_status_t vcodec_med_gr_write_golomb_rice_code(vcodec_enc_ctx_t *p_ctx, unsigned int value, int m);
 
-vcodec_prediction_mode_t vcodec_predict_block(int *prediction, const uint8_t *p_ref_frame, int block_x, int block_y, const uint8_t *p_source_frame, int frame_width, int block_size);
+/**
+ * Allocate VCODEC_SCRATCH_ALIGNMENT-aligned scratch memory through @c alloc.
+ * @retval NULL if out of memory.
+ */
+vcodec_scratch_t *vcodec_scratch_alloc(vcodec_alloc_t alloc);
+
+void vcodec_scratch_free(vcodec_scratch_t *p_scratch, vcodec_free_t free);
 
-void vcodec_unpredict_block(int *reconstructed, const uint8_t *p_ref_frame, int x, int y, int block_size, int frame_width, vcodec_prediction_mode_t pred_mode);
+/**
+ * Pick the intra prediction of a block from its reconstructed neighbours in @c p_ref_frame and write its residual to @c prediction.
+ * Neighbours above row @c slice_y belong to another slice and are not used.
+ */
+vcodec_prediction_mode_t vcodec_predict_block(int16_t *prediction, const uint8_t *p_ref_frame, int block_x, int block_y, int slice_y, const uint8_t *p_source_frame,
+        int frame_width, int block_size, vcodec_scratch_t *p_scratch, const vcodec_dsp_t *p_dsp);
 
-vcodec_motion_prediction_mode_t vcodec_predict_motion_block(int *prediction, const uint8_t *p_ref_frame, int x, int y,
-        const uint8_t *p_source_frame, int frame_width, int block_size, int *p_mvx, int *p_mvy, int *p_sad, vcodec_prediction_mode_t *p_intra_mode);
+void vcodec_unpredict_block(int16_t *reconstructed, const uint8_t *p_ref_frame, int x, int y, int block_size, int frame_width, vcodec_prediction_mode_t pred_mode);
 
-void vcodec_unpredict_motion_block(int *reconstructed, const uint8_t *p_ref_frame, int x, int y,
-        int block_size, int frame_width, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode, int mvx, int mvy);
+/**
+ * Pick the better of motion compensated and intra prediction of a block and write its residual to @c prediction.
+ * Motion search runs on each reference, and the full-pel result is refined to quarter pixels, see vcodec_subpel_refine().
+ * @param[in] p_refs         Reference frames the motion search runs on. The earlier one wins ties, as its index is cheaper to code.
+ * @param[in] p_recon_frame  Reconstructed part of the current frame for intra prediction, NULL to use motion compensation only.
+ * @param[in] slice_y        First row of the slice of the block, see vcodec_predict_block().
+ * @param[out] p_ref_idx     Index of the reference of the motion vector.
+ * @param[out] p_mvx, p_mvy  Quarter-pel motion vector.
+ * @param[out] p_sad         Cost of the chosen prediction.
+ */
+vcodec_motion_prediction_mode_t vcodec_predict_motion_block(int16_t *prediction, const vcodec_subpel_ref_t *const *p_refs, int num_refs,
+        const uint8_t *p_recon_frame, int slice_y, int x, int y, const uint8_t *p_source_frame, int frame_width, int block_size, int *p_ref_idx, int *p_mvx, int *p_mvy,
+        int *p_sad, vcodec_prediction_mode_t *p_intra_mode, const vcodec_motion_search_params_t *p_search, vcodec_scratch_t *p_scratch, const vcodec_dsp_t *p_dsp);
+
+/**
+ * Add the prediction of each block of the partition tree @c p_vectors (in pre-order) to the residual in @c p_residual (row stride @c stride).
+ * Inter blocks are predicted from the entry of @c p_refs picked by their reference index, intra blocks (whole macroblocks only)
+ * from the reconstructed neighbours in @c p_recon_frame.
+ * @return Number of entries of @c p_vectors taken by the tree.
+ */
+int vcodec_unpredict_partition(int16_t *p_residual, int stride, const block_motion_vector_t *p_vectors, const vcodec_subpel_ref_t *const *p_refs,
+        const uint8_t *p_recon_frame, int x, int y, int block_size, int frame_width);
 
 int vcodec_match_block_tss(const uint8_t *p_ref_frame, const uint8_t *p_source_frame, int x, int y,
-        int frame_width, int block_size, int *p_mvx, int *p_mvy, compute_motion_block_cost_t cost_function);
+        int frame_width, int block_size, const vcodec_motion_search_params_t *p_search, int *p_mvx, int *p_mvy,
+        compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function);
+
+/**
+ * Predictive zonal search (EPZS): evaluate the zero vector and @c p_search predictors, stop if the best one is good enough,
+ * otherwise refine it with a large and then a small diamond pattern.
+ * Candidates reading outside of the @c p_search area are skipped.
+ * Same parameters as vcodec_match_block_tss().
+ *
+ * @retval SAD for the resulting motion vector.
+ */
+int vcodec_match_block_epzs(const uint8_t *p_ref_frame, const uint8_t *p_source_frame, int x, int y,
+        int frame_width, int block_size, const vcodec_motion_search_params_t *p_search, int *p_mvx, int *p_mvy,
+        compute_motion_block_cost_t cost_function, compute_motion_block_cost_multi_t cost_multi_function);
+
+/**
+ * Start caching the costs of the macroblock at (@c x, @c y).
+ */
+void vcodec_cost_cache_reset(vcodec_cost_cache_t *p_cache, int x, int y);
+
+/**
+ * Look up the cost of a block of the current macroblock, deriving it from its quadrants if needed.
+ * @retval false if the cost is unknown.
+ */
+bool vcodec_cost_cache_lookup(vcodec_cost_cache_t *p_cache, int x, int y, int block_size, int mvx, int mvy, int *p_cost);
+
+void vcodec_cost_cache_insert(vcodec_cost_cache_t *p_cache, int x, int y, int block_size, int mvx, int mvy, int cost);
+
+/**
+ * Collect motion vector predictors of a macroblock from the motion field of the current frame (already searched macroblocks only)
+ * and the co-located macroblock of the previous frame.
+ * @param[in]  p_field        Motion vectors of the current frame, one per macroblock.
+ * @param[in]  p_prev_field   Motion vectors of the previous frame, NULL if not available.
+ * @param[in]  slice_mb_y     First macroblock row of the slice, the rows above it are not available.
+ * @param[out] p_predictors   At least VCODEC_MAX_MOTION_PREDICTORS - 2 entries.
+ * @return Number of predictors written.
+ */
+int vcodec_motion_predictors(const motion_vector_t *p_field, const motion_vector_t *p_prev_field, int mb_x, int mb_y, int slice_mb_y, int width_mbs,
+        motion_vector_t *p_predictors);
+
+/**
+ * Prediction of the first coded motion vector of a macroblock: median of the coded vectors of its left, top and top-right neighbours
+ * if all of them are available, otherwise the left or the top one (zero vector if neither is). Same availability as vcodec_motion_predictors().
+ */
+motion_vector_t vcodec_motion_vector_prediction(const motion_vector_t *p_field, int mb_x, int mb_y, int slice_mb_y, int width_mbs);
 
 #endif // _VCODEC_COMMON_H_
@@ -1,6 +1,13 @@
 #include "vcodec/vcodec.h"
 #include "vcodec_common.h"
 #include "vcodec_transform.h"
+#include "vcodec_dsp.h"
+#include "vcodec_quant.h"
+#include "vcodec_pyramid.h"
+#include "vcodec_subpel.h"
+#include "vcodec_picture.h"
+#include "vcodec_frame.h"
+#include "vcodec_thread.h"
 #include "vcodec/bitstream.h"
 #include "vcodec_entropy_coding.h"
 
@@ -11,23 +18,75 @@
 #include <math.h>
 #include <limits.h>
 
-#define GOP 1
-
 //#define debug_printf printf
 #define debug_printf
 
+/**
+ * Band of macroblock rows coded independently of the others into its own buffer, see num_slices of vcodec_enc_ctx_t.
+ * Slices of a frame are coded in parallel and then written one after another, each prefixed with its size in bytes.
+ */
 typedef struct {
-    uint8_t *p_ref_frame;
-    int gop_cnt;
-} vcodec_dct_ctx_t;
+    int mb_row_start;
+    int mb_row_end; //< Exclusive, the last slice includes the rows of reduced macroblocks at the bottom
+    vcodec_bitstream_writer_t writer;
+    // Memory of the writer, kept (and grown) across frames
+    uint8_t *p_buffer;
+    size_t buffer_size;
+    vcodec_scratch_t *p_scratch;
+} vcodec_dct_slice_t;
 
+/**
+ * Macroblock row of a key frame coded in the wavefront, see wavefront of vcodec_enc_ctx_t.
+ * Rows of a slice are written one after another without any alignment, so the slice is the same as if it was coded by one thread.
+ */
 typedef struct {
-    vcodec_block_partition_mode_t partition_mode;
-    vcodec_motion_prediction_mode_t motion_pred_mode;
-    vcodec_prediction_mode_t intra_pred_mode;
-    int mvx;
-    int mvy;
-} block_motion_vector_t;
+    // Own writer and scratch memory, with the macroblock rows of the enclosing slice, whose top is the edge for intra prediction
+    vcodec_dct_slice_t slice;
+    size_t num_bits;
+    // Reconstructed columns of the row, which the row below waits for
+    atomic_int progress;
+} vcodec_dct_row_t;
+
+typedef struct {
+    // Reconstructed frames: the references and the frame being coded
+    vcodec_picture_pool_t pictures;
+    vcodec_picture_t *p_recon;
+    // References of the current P frame, the short-term ones, most recent first, then the long-term one
+    const vcodec_subpel_ref_t *p_refs[VCODEC_MAX_REFS];
+    int num_refs;
+    // Input frame is copied next to the reference, so that both share one stride
+    vcodec_frame_t source_frame;
+    // Previous input frame, swapped with the source after each frame
+    vcodec_frame_t prev_source_frame;
+    bool prev_source_valid;
+    // Changed macroblocks of the current frame, see p_activity_map of vcodec_enc_ctx_t
+    uint8_t *p_activity_map;
+    int gop_cnt;
+    // QP and GOP size of the last PPS, the next PPS is written when they change
+    int pps_qp;
+    int pps_gop_size;
+    vcodec_dct_slice_t *p_slices;
+    int num_slices;
+    // One per macroblock row if wavefront is enabled, NULL otherwise
+    vcodec_dct_row_t *p_rows;
+    int num_rows;
+    vcodec_thread_pool_t threads;
+    // Frame being coded by the slices
+    bool key_frame;
+    const vcodec_quant_t *p_quant;
+    vcodec_dsp_t dsp;
+    vcodec_quant_tables_t quant;
+    // Full-pel whole-macroblock motion vectors of the current and the previous frame, used as motion search predictors
+    motion_vector_t *p_motion_field;
+    motion_vector_t *p_prev_motion_field;
+    bool prev_motion_field_valid;
+    // Last coded (quarter-pel) motion vector of each macroblock of the current frame, predicts the vectors of the next macroblocks
+    motion_vector_t *p_coded_motion_field;
+    int width_mbs;
+    // Downsampled source and reference frames, rebuilt for each P frame
+    vcodec_pyramid_t source_pyramid;
+    vcodec_pyramid_t ref_pyramid;
+} vcodec_dct_ctx_t;
 
 static const int jpeg_zigzag_order8x8[8][8] = {
   {  0,  1,  5,  6, 14, 15, 27, 28 },
@@ -56,21 +115,78 @@ static vcodec_status_t vcodec_dct_process_frame(vcodec_enc_ctx_t *p_ctx, const u
 static vcodec_status_t vcodec_dct_reset(vcodec_enc_ctx_t *p_ctx);
 static vcodec_status_t vcodec_dct_deinit(vcodec_enc_ctx_t *p_ctx);
 
-static vcodec_status_t encode_key_frame(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame);
-static vcodec_status_t encode_p_frame(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame);
-
-static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size);
-static void encode_macroblock_p(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size);
-static void encode_dc(vcodec_enc_ctx_t *p_ctx, int *p_macroblock, const int *p_quant, int macroblock_size, int block_size);
-
+static vcodec_status_t encode_key_frame(vcodec_enc_ctx_t *p_ctx);
+static vcodec_status_t encode_p_frame(vcodec_enc_ctx_t *p_ctx);
+static vcodec_status_t encode_slices(vcodec_enc_ctx_t *p_ctx);
+static void encode_slice(void *p_arg, int index);
+static vcodec_status_t encode_slices_wavefront(vcodec_enc_ctx_t *p_ctx);
+static void encode_row(void *p_arg, int index);
+
+static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size);
+static void encode_macroblock_p(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size);
+static void encode_residual(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size,
+        bool intra);
+static void encode_dc(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size,
+        int block_size, bool intra);
+static bool quant_dc(vcodec_enc_ctx_t *p_ctx, const int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size, int block_size, bool intra,
+        int *p_dc_block);
+static bool encode_macroblock_skip(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size, motion_vector_t mv);
+static void report_psnr(vcodec_enc_ctx_t *p_ctx);
+
+static void write_sps(vcodec_enc_ctx_t *p_ctx);
+static void write_pps(vcodec_enc_ctx_t *p_ctx);
 static void write_frame_header(vcodec_enc_ctx_t *p_ctx, bool is_key_frame);
-static void write_macroblock_header(vcodec_enc_ctx_t *p_ctx, vcodec_prediction_mode_t pred_mode);
-static void write_p_macroblock_header(vcodec_enc_ctx_t *p_ctx, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode);
+static void write_macroblock_header(vcodec_bitstream_writer_t *p_writer, vcodec_prediction_mode_t pred_mode);
+static void write_p_macroblock_header(vcodec_bitstream_writer_t *p_writer, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode);
+static int write_partition(vcodec_enc_ctx_t *p_ctx, vcodec_bitstream_writer_t *p_writer, const block_motion_vector_t *p_vectors, int block_size,
+        motion_vector_t *p_mv_pred);
 
-static int find_optimal_motion_vectors(vcodec_enc_ctx_t *p_ctx, int *p_block, int block_size, const uint8_t *p_frame, int x, int y, block_motion_vector_t *p_vectors, int *p_total_vectors);
+static int find_optimal_motion_vectors(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_block, int stride, int block_size,
+        const uint8_t *p_frame, int x, int y, block_motion_vector_t *p_vectors, int *p_total_vectors, motion_vector_t *p_mv,
+        const vcodec_motion_search_params_t *p_search, int depth);
 
 vcodec_status_t vcodec_dct_init(vcodec_enc_ctx_t *p_ctx) {
-    if (0 == p_ctx->width || 0 == p_ctx->height) {
+    if (0 == p_ctx->width || 0 == p_ctx->height || p_ctx->width > VCODEC_MAX_DIMENSION || p_ctx->height > VCODEC_MAX_DIMENSION) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_ctx->qp) {
+        p_ctx->qp = VCODEC_QP_DEFAULT;
+    }
+    if (p_ctx->qp < VCODEC_QP_MIN || p_ctx->qp > VCODEC_QP_MAX) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_ctx->gop_size) {
+        p_ctx->gop_size = VCODEC_GOP_DEFAULT;
+    }
+    if (p_ctx->gop_size < 0) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_ctx->activity_threshold) {
+        p_ctx->activity_threshold = VCODEC_ACTIVITY_THRESHOLD_DEFAULT;
+    }
+    if (p_ctx->activity_threshold < 0) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_ctx->num_ref_frames) {
+        p_ctx->num_ref_frames = VCODEC_REF_FRAMES_DEFAULT;
+    }
+    if (p_ctx->num_ref_frames < 1 || p_ctx->num_ref_frames > VCODEC_MAX_REF_FRAMES) {
+        return VCODEC_STATUS_INVAL;
+    }
+    const int height_mbs = (p_ctx->height + VCODEC_MACROBLOCK_SIZE - 1) / VCODEC_MACROBLOCK_SIZE;
+    if (0 == p_ctx->num_slices) {
+        p_ctx->num_slices = VCODEC_SLICES_DEFAULT;
+    }
+    if (p_ctx->num_slices < 1 || p_ctx->num_slices > height_mbs) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_ctx->num_threads) {
+        p_ctx->num_threads = 1;
+    }
+    if (p_ctx->num_threads < 1 || p_ctx->num_threads > VCODEC_MAX_THREADS) {
         return VCODEC_STATUS_INVAL;
     }
 
@@ -80,11 +196,75 @@ vcodec_status_t vcodec_dct_init(vcodec_enc_ctx_t *p_ctx) {
     }
 
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    p_dct_ctx->p_ref_frame = p_ctx->alloc(p_ctx->width * p_ctx->height);
-    if (NULL == p_dct_ctx->p_ref_frame) {
+    if (VCODEC_STATUS_OK != vcodec_picture_pool_init(&p_dct_ctx->pictures, p_ctx->width, p_ctx->height, p_ctx->num_ref_frames, p_ctx->long_term_ref,
+                p_ctx->alloc)
+            || VCODEC_STATUS_OK != vcodec_frame_init(&p_dct_ctx->source_frame, p_ctx->width, p_ctx->height, p_ctx->alloc)
+            || VCODEC_STATUS_OK != vcodec_frame_init(&p_dct_ctx->prev_source_frame, p_ctx->width, p_ctx->height, p_ctx->alloc)) {
         return VCODEC_STATUS_NOMEM;
     }
     p_dct_ctx->gop_cnt = 0;
+    p_dct_ctx->num_slices = p_ctx->num_slices;
+    p_dct_ctx->p_slices = p_ctx->alloc(sizeof(vcodec_dct_slice_t) * p_dct_ctx->num_slices);
+    if (NULL == p_dct_ctx->p_slices) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    for (int i = 0; i < p_dct_ctx->num_slices; i++) {
+        vcodec_dct_slice_t *p_slice = &p_dct_ctx->p_slices[i];
+        // Macroblock rows are spread evenly, the decoder splits the frame the same way
+        p_slice->mb_row_start = height_mbs * i / p_dct_ctx->num_slices;
+        p_slice->mb_row_end = height_mbs * (i + 1) / p_dct_ctx->num_slices;
+        p_slice->buffer_size = VCODEC_BITSTREAM_WRITER_BUFFER_LEN + VCODEC_BITSTREAM_PADDING;
+        p_slice->p_buffer = p_ctx->alloc(p_slice->buffer_size);
+        p_slice->p_scratch = vcodec_scratch_alloc(p_ctx->alloc);
+        if (NULL == p_slice->p_buffer || NULL == p_slice->p_scratch) {
+            return VCODEC_STATUS_NOMEM;
+        }
+    }
+    p_dct_ctx->num_rows = 0;
+    p_dct_ctx->p_rows = NULL;
+    if (p_ctx->wavefront) {
+        p_dct_ctx->p_rows = p_ctx->alloc(sizeof(vcodec_dct_row_t) * height_mbs);
+        if (NULL == p_dct_ctx->p_rows) {
+            return VCODEC_STATUS_NOMEM;
+        }
+        for (int i = 0; i < p_dct_ctx->num_slices; i++) {
+            const vcodec_dct_slice_t *p_slice = &p_dct_ctx->p_slices[i];
+            for (int mb_y = p_slice->mb_row_start; mb_y < p_slice->mb_row_end; mb_y++) {
+                vcodec_dct_row_t *p_row = &p_dct_ctx->p_rows[mb_y];
+                p_row->slice.mb_row_start = p_slice->mb_row_start;
+                p_row->slice.mb_row_end = p_slice->mb_row_end;
+                p_row->slice.buffer_size = VCODEC_BITSTREAM_WRITER_BUFFER_LEN + VCODEC_BITSTREAM_PADDING;
+                p_row->slice.p_buffer = p_ctx->alloc(p_row->slice.buffer_size);
+                p_row->slice.p_scratch = vcodec_scratch_alloc(p_ctx->alloc);
+                if (NULL == p_row->slice.p_buffer || NULL == p_row->slice.p_scratch) {
+                    return VCODEC_STATUS_NOMEM;
+                }
+                atomic_init(&p_row->progress, 0);
+                p_dct_ctx->num_rows++;
+            }
+        }
+    }
+    if (VCODEC_STATUS_OK != vcodec_thread_pool_init(&p_dct_ctx->threads, p_ctx->num_threads)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    p_ctx->cpu_level = vcodec_dsp_init(&p_dct_ctx->dsp, p_ctx->cpu_level);
+    vcodec_quant_tables_init(&p_dct_ctx->quant);
+    p_dct_ctx->width_mbs = (p_ctx->width + VCODEC_MACROBLOCK_SIZE - 1) / VCODEC_MACROBLOCK_SIZE;
+    p_dct_ctx->p_motion_field = p_ctx->alloc(sizeof(motion_vector_t) * p_dct_ctx->width_mbs * height_mbs);
+    p_dct_ctx->p_prev_motion_field = p_ctx->alloc(sizeof(motion_vector_t) * p_dct_ctx->width_mbs * height_mbs);
+    p_dct_ctx->p_coded_motion_field = p_ctx->alloc(sizeof(motion_vector_t) * p_dct_ctx->width_mbs * height_mbs);
+    p_dct_ctx->p_activity_map = p_ctx->alloc(p_dct_ctx->width_mbs * height_mbs);
+    if (NULL == p_dct_ctx->p_motion_field || NULL == p_dct_ctx->p_prev_motion_field || NULL == p_dct_ctx->p_coded_motion_field
+            || NULL == p_dct_ctx->p_activity_map) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    p_dct_ctx->prev_source_valid = false;
+    p_ctx->p_activity_map = NULL;
+    p_dct_ctx->prev_motion_field_valid = false;
+    if (VCODEC_STATUS_OK != vcodec_pyramid_init(&p_dct_ctx->source_pyramid, p_ctx->width, p_ctx->height, p_ctx->alloc)
+            || VCODEC_STATUS_OK != vcodec_pyramid_init(&p_dct_ctx->ref_pyramid, p_ctx->width, p_ctx->height, p_ctx->alloc)) {
+        return VCODEC_STATUS_NOMEM;
+    }
 
     p_ctx->process_frame = vcodec_dct_process_frame;
     p_ctx->reset = vcodec_dct_reset;
@@ -94,111 +274,308 @@ vcodec_status_t vcodec_dct_init(vcodec_enc_ctx_t *p_ctx) {
 
 static vcodec_status_t vcodec_dct_process_frame(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame) {
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    if (0 == p_dct_ctx->gop_cnt++ % GOP) {
+    if (p_ctx->qp < VCODEC_QP_MIN || p_ctx->qp > VCODEC_QP_MAX || p_ctx->gop_size < 1 || p_ctx->activity_threshold < 0
+            || (VCODEC_SUBPEL_FILTER_6TAP != p_ctx->subpel_filter && VCODEC_SUBPEL_FILTER_BILINEAR != p_ctx->subpel_filter)) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (NULL == p_ctx->write) {
+        const vcodec_status_t ret = vcodec_bitstream_writer_init_mem(p_ctx->bitstream_writer, p_ctx->p_out_buffer, p_ctx->out_buffer_size,
+                p_ctx->out_buffer_grow ? p_ctx->alloc : NULL, p_ctx->free);
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+    }
+    vcodec_frame_copy_from(&p_dct_ctx->source_frame, p_frame);
+    const int height_mbs = (p_ctx->height + VCODEC_MACROBLOCK_SIZE - 1) / VCODEC_MACROBLOCK_SIZE;
+    if (p_dct_ctx->prev_source_valid) {
+        p_dct_ctx->dsp.activity_map(p_dct_ctx->p_activity_map, p_dct_ctx->source_frame.p_data, p_dct_ctx->prev_source_frame.p_data,
+                p_dct_ctx->source_frame.stride, p_ctx->width, p_ctx->height, p_ctx->activity_threshold);
+    } else {
+        memset(p_dct_ctx->p_activity_map, 1, p_dct_ctx->width_mbs * height_mbs);
+    }
+    p_ctx->p_activity_map = p_dct_ctx->p_activity_map;
+    p_dct_ctx->p_recon = vcodec_picture_pool_acquire(&p_dct_ctx->pictures);
+    const bool is_key_frame = 0 == p_dct_ctx->gop_cnt++ % p_ctx->gop_size;
+    p_dct_ctx->key_frame = is_key_frame;
+    p_ctx->out_frame_type = is_key_frame ? VCODEC_FRAME_TYPE_KEY : VCODEC_FRAME_TYPE_P;
+    p_dct_ctx->p_quant = &p_dct_ctx->quant.qp[p_ctx->qp];
+    vcodec_status_t ret;
+    if (is_key_frame) {
         debug_printf("KEYFRAME\n");
-        encode_key_frame(p_ctx, p_frame);
+        ret = encode_key_frame(p_ctx);
     } else {
-        encode_p_frame(p_ctx, p_frame);
+        ret = encode_p_frame(p_ctx);
     }
-    return VCODEC_STATUS_OK;
+    report_psnr(p_ctx);
+    const vcodec_frame_t source_frame = p_dct_ctx->source_frame;
+    p_dct_ctx->source_frame = p_dct_ctx->prev_source_frame;
+    p_dct_ctx->prev_source_frame = source_frame;
+    p_dct_ctx->prev_source_valid = true;
+    // Motion vectors of the next frame can point outside the picture
+    vcodec_frame_extend_border(&p_dct_ctx->p_recon->frame);
+    if (is_key_frame) {
+        // Frames before a key frame are never referenced again
+        vcodec_picture_pool_clear(&p_dct_ctx->pictures);
+        if (p_ctx->long_term_ref) {
+            vcodec_picture_pool_set_long_term(&p_dct_ctx->pictures, p_dct_ctx->p_recon);
+        }
+    }
+    vcodec_picture_pool_push(&p_dct_ctx->pictures, p_dct_ctx->p_recon);
+    vcodec_picture_unref(p_dct_ctx->p_recon);
+    // Frames are byte aligned, so the output is written once per frame (or when writer buffer is full)
+    vcodec_bitstream_writer_flush(p_ctx->bitstream_writer);
+    if (NULL == p_ctx->write) {
+        // Buffer might have been replaced by a larger one
+        p_ctx->p_out_buffer = vcodec_bitstream_writer_data(p_ctx->bitstream_writer, &p_ctx->out_size);
+        p_ctx->out_buffer_size = p_ctx->bitstream_writer->data_len + VCODEC_BITSTREAM_PADDING;
+    }
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    return vcodec_bitstream_writer_status(p_ctx->bitstream_writer);
 }
 
 static vcodec_status_t vcodec_dct_reset(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    // Next frame is a key frame, with no previous frame to compare to
+    p_dct_ctx->gop_cnt = 0;
+    p_dct_ctx->prev_source_valid = false;
     return VCODEC_STATUS_OK;
 }
 
 static vcodec_status_t vcodec_dct_deinit(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_thread_pool_free(&p_dct_ctx->threads);
+    vcodec_packet_pool_close(p_ctx);
+    for (int i = 0; i < p_dct_ctx->num_slices; i++) {
+        p_ctx->free(p_dct_ctx->p_slices[i].p_buffer);
+        vcodec_scratch_free(p_dct_ctx->p_slices[i].p_scratch, p_ctx->free);
+    }
+    p_ctx->free(p_dct_ctx->p_slices);
+    for (int i = 0; i < p_dct_ctx->num_rows; i++) {
+        p_ctx->free(p_dct_ctx->p_rows[i].slice.p_buffer);
+        vcodec_scratch_free(p_dct_ctx->p_rows[i].slice.p_scratch, p_ctx->free);
+    }
+    if (NULL != p_dct_ctx->p_rows) {
+        p_ctx->free(p_dct_ctx->p_rows);
+    }
+    p_ctx->free(p_dct_ctx->p_motion_field);
+    p_ctx->free(p_dct_ctx->p_prev_motion_field);
+    p_ctx->free(p_dct_ctx->p_coded_motion_field);
+    p_ctx->free(p_dct_ctx->p_activity_map);
+    vcodec_pyramid_free(&p_dct_ctx->source_pyramid, p_ctx->free);
+    vcodec_pyramid_free(&p_dct_ctx->ref_pyramid, p_ctx->free);
+    vcodec_picture_pool_free(&p_dct_ctx->pictures, p_ctx->free);
+    vcodec_frame_free(&p_dct_ctx->source_frame, p_ctx->free);
+    vcodec_frame_free(&p_dct_ctx->prev_source_frame, p_ctx->free);
+    p_ctx->free(p_dct_ctx);
+    p_ctx->encoder_ctx = NULL;
     return VCODEC_STATUS_OK;
 }
 
-static vcodec_status_t encode_key_frame(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame) {
-    const uint32_t macroblock_size = 16;
-    int quant[4*4] = {
-        16,	11,	10,	16,
-        12,	12,	14,	19,
-        14,	13,	16,	24,
-        14,	17,	22,	29,
-    };
-
+static vcodec_status_t encode_key_frame(vcodec_enc_ctx_t *p_ctx) {
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    int h = p_ctx->height / macroblock_size * macroblock_size;
-    int y = 0;
+    // Every key frame carries the parameter sets, so that decoding can start from it
+    write_sps(p_ctx);
+    write_pps(p_ctx);
     write_frame_header(p_ctx, true);
-    for (; y < h; y += macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += macroblock_size) {
-            encode_macroblock_i(p_ctx, p_frame, x, y, quant, macroblock_size);
-        }
+    p_dct_ctx->prev_motion_field_valid = false;
+    return encode_slices(p_ctx);
+}
+
+static vcodec_status_t encode_p_frame(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_picture_pool_t *p_pictures = &p_dct_ctx->pictures;
+    // Long-term reference is left out while it is one of the short-term ones, right after its key frame
+    bool long_term = NULL != p_pictures->p_long_term;
+    for (int i = 0; i < p_pictures->num_short_term; i++) {
+        long_term &= p_pictures->p_long_term != p_pictures->p_short_term[i];
     }
-    int reduced_macroblock_size;
-    if ((p_ctx->height - y) % 8 == 0) {
-        reduced_macroblock_size = 8;
-    } else {
-        reduced_macroblock_size = 4;
+    if (p_ctx->qp != p_dct_ctx->pps_qp || p_ctx->gop_size != p_dct_ctx->pps_gop_size) {
+        write_pps(p_ctx);
     }
-    for (; y < p_ctx->height; y += reduced_macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += reduced_macroblock_size) {
-            encode_macroblock_i(p_ctx, p_frame, x, y, quant, reduced_macroblock_size);
-        }
+    write_frame_header(p_ctx, false);
+    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, p_pictures->num_short_term - 1, VCODEC_REF_FRAMES_BITS);
+    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, long_term, 1);
+    p_dct_ctx->num_refs = 0;
+    for (int i = 0; i < p_pictures->num_short_term; i++) {
+        p_dct_ctx->p_refs[p_dct_ctx->num_refs++] = vcodec_picture_subpel(p_pictures->p_short_term[i], p_ctx->subpel_filter, &p_dct_ctx->dsp);
     }
-
-    int mse = 0;
-    for (int i = 0; i < p_ctx->width * p_ctx->height; i++) {
-        const int diff = p_frame[i] - p_dct_ctx->p_ref_frame[i];
-        mse += diff * diff;
+    if (long_term) {
+        p_dct_ctx->p_refs[p_dct_ctx->num_refs++] = vcodec_picture_subpel(p_pictures->p_long_term, p_ctx->subpel_filter, &p_dct_ctx->dsp);
     }
-    double mse_divided = (double)mse / (p_ctx->width * p_ctx->height);
-    double psnr = 20 * log10(255) - 10 * log10(mse_divided);
-    fprintf(stderr, "PSNR %f mse %f\n", psnr, mse_divided);
-    const char *frame_hdr = "FRAME\n";
-    //p_ctx->write(frame_hdr, strlen(frame_hdr), p_ctx->io_ctx);
-    //p_ctx->write(p_dct_ctx->p_ref_frame, p_ctx->width * p_ctx->height, p_ctx->io_ctx);
+    if (VCODEC_MOTION_SEARCH_EPZS == p_ctx->motion_search) {
+        vcodec_pyramid_build(&p_dct_ctx->source_pyramid, &p_dct_ctx->source_frame, &p_dct_ctx->dsp);
+        vcodec_pyramid_build(&p_dct_ctx->ref_pyramid, &p_pictures->p_short_term[0]->frame, &p_dct_ctx->dsp);
+    }
+    const vcodec_status_t ret = encode_slices(p_ctx);
 
-    return vcodec_bitstream_writer_status(p_ctx->bitstream_writer);
+    motion_vector_t *p_motion_field = p_dct_ctx->p_prev_motion_field;
+    p_dct_ctx->p_prev_motion_field = p_dct_ctx->p_motion_field;
+    p_dct_ctx->p_motion_field = p_motion_field;
+    p_dct_ctx->prev_motion_field_valid = true;
+    return ret;
 }
 
-static vcodec_status_t encode_p_frame(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame) {
-    const int macroblock_size = 16;
-    const int quant[4*4] = {
-        16,	11,	10,	16,
-        12,	12,	14,	19,
-        14,	13,	16,	24,
-        14,	17,	22,	29,
-    };
+/**
+ * Code the slices of the frame on the thread pool and write them after the frame header:
+ * number of slices minus one (exp-Golomb), then each slice as its size in bytes (exp-Golomb) followed by its data, all byte aligned.
+ * Slices do not depend on each other, so the output does not depend on the number of threads.
+ */
+static vcodec_status_t encode_slices(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_bitstream_writer_t *p_writer = p_ctx->bitstream_writer;
+    vcodec_bitstream_writer_write_exp_golomb(p_writer, p_dct_ctx->num_slices - 1);
+    vcodec_bitstream_writer_align(p_writer);
+    if (p_dct_ctx->key_frame && NULL != p_dct_ctx->p_rows) {
+        return encode_slices_wavefront(p_ctx);
+    }
+    vcodec_thread_pool_run(&p_dct_ctx->threads, encode_slice, p_ctx, p_dct_ctx->num_slices);
+    for (int i = 0; i < p_dct_ctx->num_slices; i++) {
+        vcodec_dct_slice_t *p_slice = &p_dct_ctx->p_slices[i];
+        const vcodec_status_t ret = vcodec_bitstream_writer_status(&p_slice->writer);
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+        size_t size;
+        const uint8_t *p_data = vcodec_bitstream_writer_data(&p_slice->writer, &size);
+        vcodec_bitstream_writer_write_exp_golomb(p_writer, size);
+        vcodec_bitstream_writer_align(p_writer);
+        vcodec_bitstream_writer_putbytes(p_writer, p_data, size);
+    }
+    return vcodec_bitstream_writer_status(p_writer);
+}
 
+/**
+ * Code the macroblock rows of a key frame on the thread pool, then write each slice from the bits of its rows.
+ * Rows are taken in order, so the row a job waits for is always being coded by another thread.
+ */
+static vcodec_status_t encode_slices_wavefront(vcodec_enc_ctx_t *p_ctx) {
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    int h = p_ctx->height / macroblock_size * macroblock_size;
-    int y = 0;
-    write_frame_header(p_ctx, false);
-    for (; y < h; y += macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += macroblock_size) {
-            encode_macroblock_p(p_ctx, p_frame, x, y, quant, macroblock_size);
+    vcodec_bitstream_writer_t *p_writer = p_ctx->bitstream_writer;
+    for (int i = 0; i < p_dct_ctx->num_rows; i++) {
+        atomic_init(&p_dct_ctx->p_rows[i].progress, 0);
+    }
+    vcodec_thread_pool_run(&p_dct_ctx->threads, encode_row, p_ctx, p_dct_ctx->num_rows);
+    for (int i = 0; i < p_dct_ctx->num_slices; i++) {
+        const vcodec_dct_slice_t *p_slice = &p_dct_ctx->p_slices[i];
+        size_t num_bits = 0;
+        for (int mb_y = p_slice->mb_row_start; mb_y < p_slice->mb_row_end; mb_y++) {
+            const vcodec_status_t ret = vcodec_bitstream_writer_status(&p_dct_ctx->p_rows[mb_y].slice.writer);
+            if (VCODEC_STATUS_OK != ret) {
+                return ret;
+            }
+            num_bits += p_dct_ctx->p_rows[mb_y].num_bits;
+        }
+        vcodec_bitstream_writer_write_exp_golomb(p_writer, (num_bits + 7) / 8);
+        vcodec_bitstream_writer_align(p_writer);
+        for (int mb_y = p_slice->mb_row_start; mb_y < p_slice->mb_row_end; mb_y++) {
+            const vcodec_dct_row_t *p_row = &p_dct_ctx->p_rows[mb_y];
+            vcodec_bitstream_writer_putbits_from(p_writer, p_row->slice.p_buffer, p_row->num_bits);
         }
+        vcodec_bitstream_writer_align(p_writer);
     }
-    int reduced_macroblock_size;
-    if ((p_ctx->height - y) % 8 == 0) {
-        reduced_macroblock_size = 8;
-    } else {
-        reduced_macroblock_size = 4;
+    return vcodec_bitstream_writer_status(p_writer);
+}
+
+/**
+ * Job of the thread pool: code macroblock row @c index of a key frame into its own buffer.
+ * Intra prediction reads the row above up to the top-left neighbour of a macroblock, so each one waits until the macroblock
+ * straight above it is reconstructed, unless the row is the first one of its slice.
+ */
+static void encode_row(void *p_arg, int index) {
+    vcodec_enc_ctx_t *p_ctx = p_arg;
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_dct_row_t *p_row = &p_dct_ctx->p_rows[index];
+    const vcodec_dct_row_t *p_above = index > p_row->slice.mb_row_start ? p_row - 1 : NULL;
+    const uint8_t *p_frame = p_dct_ctx->source_frame.p_data;
+    const int macroblock_size = VCODEC_MACROBLOCK_SIZE;
+    vcodec_bitstream_writer_init_mem(&p_row->slice.writer, p_row->slice.p_buffer, p_row->slice.buffer_size, p_ctx->alloc, p_ctx->free);
+    const int h = p_ctx->height / macroblock_size * macroblock_size;
+    int y = index * macroblock_size;
+    const int size = y < h ? macroblock_size : (0 == (p_ctx->height - y) % 8 ? 8 : 4);
+    const int band_end = MIN(y + macroblock_size, (int)p_ctx->height);
+    for (; y < band_end; y += size) {
+        for (int x = 0; x < p_ctx->width; x += size) {
+            if (NULL != p_above) {
+                vcodec_progress_wait(&p_above->progress, x + size);
+            }
+            encode_macroblock_i(p_ctx, &p_row->slice, p_frame, x, y, p_dct_ctx->p_quant, size);
+            if (size == macroblock_size) {
+                vcodec_progress_set(&p_row->progress, x + size);
+            }
+        }
     }
-    for (; y < p_ctx->height; y += reduced_macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += reduced_macroblock_size) {
-            encode_macroblock_p(p_ctx, p_frame, x, y, quant, reduced_macroblock_size);
+    // Reduced macroblocks of the last band only count once the whole band is done
+    vcodec_progress_set(&p_row->progress, INT_MAX);
+    p_row->num_bits = vcodec_bitstream_writer_tell(&p_row->slice.writer);
+    // Writer might have replaced the buffer with a larger one
+    p_row->slice.p_buffer = p_row->slice.writer.p_data;
+    p_row->slice.buffer_size = p_row->slice.writer.data_len + VCODEC_BITSTREAM_PADDING;
+}
+
+/**
+ * Job of the thread pool: code the macroblocks of slice @c index into its own buffer.
+ */
+static void encode_slice(void *p_arg, int index) {
+    vcodec_enc_ctx_t *p_ctx = p_arg;
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_dct_slice_t *p_slice = &p_dct_ctx->p_slices[index];
+    const uint8_t *p_frame = p_dct_ctx->source_frame.p_data;
+    const vcodec_quant_t *p_quant = p_dct_ctx->p_quant;
+    const int macroblock_size = VCODEC_MACROBLOCK_SIZE;
+    // Buffer is larger than the padding, so attaching it cannot fail
+    vcodec_bitstream_writer_init_mem(&p_slice->writer, p_slice->p_buffer, p_slice->buffer_size, p_ctx->alloc, p_ctx->free);
+    const int h = p_ctx->height / macroblock_size * macroblock_size;
+    for (int mb_y = p_slice->mb_row_start; mb_y < p_slice->mb_row_end; mb_y++) {
+        int y = mb_y * macroblock_size;
+        // Last band of the frame is covered with 8x8 or 4x4 macroblocks
+        const int size = y < h ? macroblock_size : (0 == (p_ctx->height - y) % 8 ? 8 : 4);
+        const int band_end = MIN(y + macroblock_size, (int)p_ctx->height);
+        for (; y < band_end; y += size) {
+            for (int x = 0; x < p_ctx->width; x += size) {
+                if (p_dct_ctx->key_frame) {
+                    encode_macroblock_i(p_ctx, p_slice, p_frame, x, y, p_quant, size);
+                } else {
+                    encode_macroblock_p(p_ctx, p_slice, p_frame, x, y, p_quant, size);
+                }
+            }
         }
     }
+    vcodec_bitstream_writer_flush(&p_slice->writer);
+    // Writer might have replaced the buffer with a larger one
+    p_slice->p_buffer = p_slice->writer.p_data;
+    p_slice->buffer_size = p_slice->writer.data_len + VCODEC_BITSTREAM_PADDING;
+}
 
-    return VCODEC_STATUS_OK;
+/**
+ * Print PSNR of the reconstructed frame, which is the reference of the next one.
+ */
+static void report_psnr(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    const int stride = p_dct_ctx->p_recon->frame.stride;
+    int64_t mse = 0;
+    for (int i = 0; i < p_ctx->height; i++) {
+        const uint8_t *p_source = p_dct_ctx->source_frame.p_data + i * stride;
+        const uint8_t *p_recon = p_dct_ctx->p_recon->frame.p_data + i * stride;
+        for (int j = 0; j < p_ctx->width; j++) {
+            const int diff = p_source[j] - p_recon[j];
+            mse += diff * diff;
+        }
+    }
+    double mse_divided = (double)mse / (p_ctx->width * p_ctx->height);
+    double psnr = 20 * log10(255) - 10 * log10(mse_divided);
+    fprintf(stderr, "PSNR %f mse %f\n", psnr, mse_divided);
 }
 
-static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size) {
-    const int block_size = 4;
+static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size) {
+    const int block_size = VCODEC_BLOCK_SIZE;
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    // Copy block to temp location
-    int macroblock[macroblock_size * macroblock_size];
-    const vcodec_prediction_mode_t pred_mode = vcodec_predict_block(macroblock, p_dct_ctx->p_ref_frame, macroblock_x, macroblock_y, p_frame, p_ctx->width, macroblock_size);
+    int16_t *macroblock = p_slice->p_scratch->macroblock;
+    vcodec_frame_t *p_recon = &p_dct_ctx->p_recon->frame;
+    const vcodec_prediction_mode_t pred_mode = vcodec_predict_block(macroblock, p_recon->p_data, macroblock_x, macroblock_y,
+            p_slice->mb_row_start * VCODEC_MACROBLOCK_SIZE, p_frame, p_recon->stride, macroblock_size, p_slice->p_scratch, &p_dct_ctx->dsp);
     debug_printf("Block predicted with %d:\n", pred_mode);
     for (int i = 0; i < macroblock_size; i++) {
         for (int j = 0; j < macroblock_size; j++) {
@@ -207,31 +584,33 @@ static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame,
         debug_printf("\n");
     }
 
-    write_macroblock_header(p_ctx, pred_mode);
+    write_macroblock_header(&p_slice->writer, pred_mode);
+    encode_residual(p_ctx, p_slice, macroblock, p_quant, macroblock_size, true);
+
+    vcodec_unpredict_block(macroblock, p_recon->p_data, macroblock_x, macroblock_y, macroblock_size, p_recon->stride, pred_mode);
+    p_dct_ctx->dsp.reconstruct(p_recon->p_data + macroblock_y * p_recon->stride + macroblock_x, p_recon->stride, macroblock, macroblock_size);
+}
+
+/**
+ * Transform, quantize and write the residual of a macroblock, then replace it with the residual the decoder reconstructs.
+ */
+static void encode_residual(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size,
+        bool intra) {
+    const int block_size = VCODEC_BLOCK_SIZE;
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    // Rescaled coefficients are kept in the macroblock for the inverse transform
+    int16_t *levels = p_slice->p_scratch->levels;
+    p_dct_ctx->dsp.forward_quant_mb(levels, p_macroblock, macroblock_size, p_quant, vcodec_quant_rounding(p_quant, intra));
 
     for (int y = 0; y < macroblock_size; y += block_size) {
         for (int x = 0; x < macroblock_size; x += block_size) {
-            int block[block_size * block_size];
-            for (int i = 0; i < block_size; i++) {
-                // TODO: rework transform functions to work directly with macroblock buffer to avoid this copy operations
-                memcpy(block + i * block_size, macroblock + (y + i) * macroblock_size + x, sizeof(int) * block_size);
-            }
-            forward4x4(block, block);
-            debug_printf("DCT:\n");
+            int16_t zigzag_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
             for (int i = 0; i < block_size; i++) {
                 for (int j = 0; j < block_size; j++) {
-                    debug_printf("%4d ", block[i * block_size + j]);
-                }
-                debug_printf("\n");
-            }
-            int rescaled_block[block_size * block_size];
-            int zigzag_block[block_size * block_size];
-            for (int i = 0; i < block_size; i++) {
-                for (int j = 0; j < block_size; j++) {
-                    zigzag_block[jpeg_zigzag_order4x4[i][j]] = block[i * block_size + j] / (p_quant[i * block_size + j]);
-                    rescaled_block[i * block_size + j] = zigzag_block[jpeg_zigzag_order4x4[i][j]] * (p_quant[i * block_size + j]);
+                    zigzag_block[jpeg_zigzag_order4x4[i][j]] = levels[i * block_size + j];
                 }
             }
+            levels += block_size * block_size;
             debug_printf("AC CODING:\n");
             for (int i = 1; i < block_size * block_size; i++) {
                 debug_printf("%4d ", zigzag_block[i]);
@@ -239,87 +618,39 @@ static void encode_macroblock_i(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame,
             debug_printf("\n");
 
             // Don't write the DC coefficient yet
-            vcodec_ec_write_coeffs(p_ctx->bitstream_writer, zigzag_block + 1, block_size * block_size - 1);
-
-            for (int i = 0; i < block_size; i++) {
-                // Copy transformed coefficients ditrcly into the macroblock (reference framebuffer)
-                memcpy(macroblock + (y + i) * macroblock_size + x, rescaled_block + i * block_size, sizeof(int) * block_size);
-            }
+            vcodec_ec_write_coeffs(&p_slice->writer, zigzag_block + 1, block_size * block_size - 1);
         }
     }
 
-    encode_dc(p_ctx, macroblock, p_quant, macroblock_size, block_size);
+    encode_dc(p_ctx, p_slice, p_macroblock, p_quant, macroblock_size, block_size, intra);
 
-    for (int y = 0; y < macroblock_size; y += block_size) {
-        for (int x = 0; x < macroblock_size; x += block_size) {
-            int reconstructed_block[block_size * block_size];
-            for (int i = 0; i < block_size; i++) {
-                // TODO: rework transform functions to work directly with macroblock buffer to avoid this copy operations
-                memcpy(reconstructed_block + i * block_size, macroblock + (y + i) * macroblock_size + x, sizeof(int) * block_size);
-            }
-            inverse4x4(reconstructed_block, reconstructed_block);
-            debug_printf("IDCT out:\n");
-            for (int i = 0; i < block_size; i++) {
-                for (int j = 0; j < block_size; j++) {
-                    reconstructed_block[i * block_size + j] /= 16;
-                    debug_printf("%4d ", reconstructed_block[i * block_size + j]);
-                }
-                // Copy reconstructed block back into reference framebuffer
-                memcpy(macroblock + (y + i) * macroblock_size + x, reconstructed_block + i * block_size, sizeof(int) * block_size);
-                debug_printf("\n");
-            }
-        }
-    }
-
-    vcodec_unpredict_block(macroblock, p_dct_ctx->p_ref_frame, macroblock_x, macroblock_y, macroblock_size, p_ctx->width, pred_mode);
-    debug_printf("Reconstructed:\n");
-    int sad = 0;
-    for (int i = 0; i < macroblock_size; i++) {
-        for (int j = 0; j < macroblock_size; j++) {
-            p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j] = MAX(MIN(macroblock[i * macroblock_size + j], 255), 0);
-            debug_printf("%3d ", p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j]);
-            const int diff = p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j] - p_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j];
-            debug_printf("(%3d) ", diff);
-            sad += abs(diff);
-        }
-        debug_printf("\n");
-    }
-    debug_printf("SAD = %d at %4d %4d\n", sad, macroblock_x, macroblock_y);
+    p_dct_ctx->dsp.inverse4x4_descale_mb(p_macroblock, macroblock_size);
 }
 
-static void encode_dc(vcodec_enc_ctx_t *p_ctx, int *p_macroblock, const int *p_quant, int macroblock_size, int block_size) {
+static void encode_dc(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size,
+        int block_size, bool intra) {
     const int dc_block_size = macroblock_size / block_size;
-    int dc_block[dc_block_size * dc_block_size];
-    for (int y = 0; y < dc_block_size; y++) {
-        for (int x = 0; x < dc_block_size; x++) {
-            dc_block[y * dc_block_size + x] = p_macroblock[y * block_size * macroblock_size + x * block_size];
-        }
-    }
-    if (4 == dc_block_size) {
-        hadamard4x4(dc_block, dc_block);
-    } else {
-        hadamard2x2(dc_block, dc_block);
-    }
-    debug_printf("DC hadamard:\n");
-    int zigzag_block[dc_block_size * dc_block_size];
+    int dc_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
+    quant_dc(p_ctx, p_macroblock, p_quant, macroblock_size, block_size, intra, dc_block);
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    int16_t zigzag_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
     for (int y = 0; y < dc_block_size; y++) {
         for (int x = 0; x < dc_block_size; x++) {
-            dc_block[y * dc_block_size + x] /= p_quant[0];
             if (4 == dc_block_size) {
                 zigzag_block[jpeg_zigzag_order4x4[x][y]] = dc_block[y * dc_block_size + x];
             } else {
                 zigzag_block[jpeg_zigzag_order2x2[x][y]] = dc_block[y * dc_block_size + x];
             }
             debug_printf("%3d ", dc_block[y * dc_block_size + x]);
-            dc_block[y * dc_block_size + x] *= p_quant[0];
+            dc_block[y * dc_block_size + x] *= p_quant->dc_step;
         }
         debug_printf("\n");
     }
 
-    vcodec_ec_write_coeffs(p_ctx->bitstream_writer, zigzag_block, dc_block_size * dc_block_size);
+    vcodec_ec_write_coeffs(&p_slice->writer, zigzag_block, dc_block_size * dc_block_size);
 
     if (4 == dc_block_size) {
-        ihadamard4x4(dc_block, dc_block);
+        p_dct_ctx->dsp.ihadamard4x4(dc_block, dc_block);
     } else {
         hadamard2x2(dc_block, dc_block);
     }
@@ -338,120 +669,285 @@ static void encode_dc(vcodec_enc_ctx_t *p_ctx, int *p_macroblock, const int *p_q
     }
 }
 
+/**
+ * Hadamard transform and quantization of the DC coefficients of a macroblock, left by forward_quant_mb.
+ * @param[out] p_dc_block Levels in raster order.
+ * @return true if any level is not zero.
+ */
+static bool quant_dc(vcodec_enc_ctx_t *p_ctx, const int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size, int block_size, bool intra,
+        int *p_dc_block) {
+    const int dc_block_size = macroblock_size / block_size;
+    for (int y = 0; y < dc_block_size; y++) {
+        for (int x = 0; x < dc_block_size; x++) {
+            p_dc_block[y * dc_block_size + x] = p_macroblock[y * block_size * macroblock_size + x * block_size];
+        }
+    }
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    if (4 == dc_block_size) {
+        p_dct_ctx->dsp.hadamard4x4(p_dc_block, p_dc_block);
+    } else {
+        hadamard2x2(p_dc_block, p_dc_block);
+    }
+    debug_printf("DC hadamard:\n");
+    const uint32_t rounding = vcodec_quant_rounding(p_quant, intra);
+    bool coded = false;
+    for (int i = 0; i < dc_block_size * dc_block_size; i++) {
+        p_dc_block[i] = vcodec_quant_dc(p_dc_block[i], p_quant, rounding);
+        coded |= 0 != p_dc_block[i];
+    }
+    return coded;
+}
+
+/**
+ * Write the sequence parameter set: the parameters which are fixed after init, as plain big-endian fields, see doc/bitstream_format.md.
+ */
+static void write_sps(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_bitstream_writer_t *p_writer = p_ctx->bitstream_writer;
+    vcodec_bitstream_writer_putbits(p_writer, VCODEC_UNIT_SPS, VCODEC_UNIT_TYPE_BITS);
+    vcodec_bitstream_writer_align(p_writer);
+    vcodec_bitstream_writer_putbits(p_writer, VCODEC_SPS_MAGIC, 32);
+    vcodec_bitstream_writer_putbits(p_writer, p_ctx->width, 32);
+    vcodec_bitstream_writer_putbits(p_writer, p_ctx->height, 32);
+    vcodec_bitstream_writer_putbits(p_writer, p_ctx->num_ref_frames, 8);
+    vcodec_bitstream_writer_putbits(p_writer, p_ctx->long_term_ref, 8);
+}
+
+/**
+ * Write the picture parameter set: QP of the next frames and the GOP size.
+ */
+static void write_pps(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_bitstream_writer_t *p_writer = p_ctx->bitstream_writer;
+    vcodec_bitstream_writer_putbits(p_writer, VCODEC_UNIT_PPS, VCODEC_UNIT_TYPE_BITS);
+    vcodec_bitstream_writer_putbits(p_writer, p_ctx->qp, VCODEC_QP_BITS);
+    vcodec_bitstream_writer_write_exp_golomb(p_writer, p_ctx->gop_size - 1);
+    vcodec_bitstream_writer_align(p_writer);
+    p_dct_ctx->pps_qp = p_ctx->qp;
+    p_dct_ctx->pps_gop_size = p_ctx->gop_size;
+}
+
 static void write_frame_header(vcodec_enc_ctx_t *p_ctx, bool is_key_frame) {
     //printf("FRM hdr %d\n", is_key_frame);
-    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, is_key_frame, 1);
+    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, is_key_frame ? VCODEC_UNIT_KEY_FRAME : VCODEC_UNIT_P_FRAME, VCODEC_UNIT_TYPE_BITS);
+    if (!is_key_frame) {
+        vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, p_ctx->subpel_filter, 1);
+    }
 }
 
-static void write_macroblock_header(vcodec_enc_ctx_t *p_ctx, vcodec_prediction_mode_t pred_mode) {
+static void write_macroblock_header(vcodec_bitstream_writer_t *p_writer, vcodec_prediction_mode_t pred_mode) {
     uint32_t val = pred_mode;
     //printf("MB hdr %d\n", val);
-    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, val, 2);
+    vcodec_bitstream_writer_putbits(p_writer, val, 2);
 }
 
-static void write_p_macroblock_header(vcodec_enc_ctx_t *p_ctx, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode) {
-    vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, (uint32_t)pred_mode, 2);
+static void write_p_macroblock_header(vcodec_bitstream_writer_t *p_writer, vcodec_motion_prediction_mode_t pred_mode, vcodec_prediction_mode_t intra_pred_mode) {
+    vcodec_bitstream_writer_putbits(p_writer, (uint32_t)pred_mode, 2);
     if (VCODEC_MOTION_PREDICTION_MODE_INTRA == pred_mode) {
-        vcodec_bitstream_writer_putbits(p_ctx->bitstream_writer, (uint32_t)intra_pred_mode, 2);
+        vcodec_bitstream_writer_putbits(p_writer, (uint32_t)intra_pred_mode, 2);
     }
 }
 
-static void encode_macroblock_p(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size) {
-    const int block_size = 4;
+static void encode_macroblock_p(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size) {
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
-    int macroblock[macroblock_size * macroblock_size];
-    int mvx;
-    int mvy;
-    int sad;
-    vcodec_prediction_mode_t intra_pred_mode;
-    const vcodec_motion_prediction_mode_t pred_mode = vcodec_predict_motion_block(macroblock, p_dct_ctx->p_ref_frame, macroblock_x, macroblock_y,
-            p_frame, p_ctx->width, macroblock_size, &mvx, &mvy, &sad, &intra_pred_mode);
-    debug_printf("Block predicted with %d:\n", pred_mode);
-    for (int i = 0; i < macroblock_size; i++) {
-        for (int j = 0; j < macroblock_size; j++) {
-            debug_printf("%4d, ", macroblock[i * block_size + j]);
+    vcodec_scratch_t *p_scratch = p_slice->p_scratch;
+    int16_t *macroblock = p_scratch->macroblock;
+    const int mb_x = macroblock_x / VCODEC_MACROBLOCK_SIZE;
+    const int mb_y = macroblock_y / VCODEC_MACROBLOCK_SIZE;
+    motion_vector_t mv_pred = vcodec_motion_vector_prediction(p_dct_ctx->p_coded_motion_field, mb_x, mb_y, p_slice->mb_row_start, p_dct_ctx->width_mbs);
+    if (encode_macroblock_skip(p_ctx, p_slice, p_frame, macroblock_x, macroblock_y, p_quant, macroblock_size, mv_pred)) {
+        const motion_vector_t mv = {
+            (mv_pred.mvx + VCODEC_SUBPEL_SCALE / 2) >> VCODEC_SUBPEL_SHIFT,
+            (mv_pred.mvy + VCODEC_SUBPEL_SCALE / 2) >> VCODEC_SUBPEL_SHIFT,
+        };
+        p_dct_ctx->p_motion_field[mb_y * p_dct_ctx->width_mbs + mb_x] = mv;
+        p_dct_ctx->p_coded_motion_field[mb_y * p_dct_ctx->width_mbs + mb_x] = mv_pred;
+        return;
+    }
+    block_motion_vector_t *vectors = p_scratch->vectors;
+    memset(vectors, 0, sizeof(p_scratch->vectors));
+    motion_vector_t mv = { 0 };
+    if (p_dct_ctx->p_activity_map[mb_y * p_dct_ctx->width_mbs + mb_x]) {
+        vcodec_motion_search_params_t search = {
+            .method = p_ctx->motion_search,
+            .area_left = -VCODEC_MOTION_RANGE,
+            .area_top = -VCODEC_MOTION_RANGE,
+            .area_right = p_ctx->width + VCODEC_MOTION_RANGE,
+            .area_bottom = p_ctx->height + VCODEC_MOTION_RANGE,
+            .p_cache = p_scratch->cost_cache,
+        };
+        for (int i = 0; i < p_dct_ctx->num_refs; i++) {
+            vcodec_cost_cache_reset(&search.p_cache[i], macroblock_x, macroblock_y);
         }
-        debug_printf("\n");
+        // Search predictors are limited to the slice as well, so that the vectors do not depend on the order slices are coded in
+        search.num_predictors = vcodec_motion_predictors(p_dct_ctx->p_motion_field, p_dct_ctx->prev_motion_field_valid ? p_dct_ctx->p_prev_motion_field : NULL,
+                mb_x, mb_y, p_slice->mb_row_start, p_dct_ctx->width_mbs, search.predictors);
+        // Pyramid search covers motion beyond the reach of the neighbour predictors and the diamond
+        if (VCODEC_MOTION_SEARCH_EPZS == p_ctx->motion_search && VCODEC_MACROBLOCK_SIZE == macroblock_size
+                && vcodec_pyramid_search(&p_dct_ctx->source_pyramid, &p_dct_ctx->ref_pyramid, macroblock_x, macroblock_y, &p_dct_ctx->dsp,
+                        &search.predictors[search.num_predictors])) {
+            search.num_predictors++;
+        }
+        int total_vectors = 0;
+        find_optimal_motion_vectors(p_ctx, p_slice, macroblock, macroblock_size, macroblock_size, p_frame, macroblock_x, macroblock_y,
+                vectors, &total_vectors, &mv, &search, 0);
+        debug_printf("Block predicted with %d vectors:\n", total_vectors);
+    } else {
+        // Static macroblock, the previous frame is the best guess without searching
+        vectors[0].partition_mode = VCODEC_BLOCK_PARTITION_MODE_NONE;
+        vectors[0].motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV;
+        vcodec_subpel_residual(macroblock, macroblock_size, p_frame, p_dct_ctx->p_refs[0], macroblock_x, macroblock_y, 0, 0, macroblock_size);
     }
-    const int min_block_size = 4;
-    const int max_vectors_count = (macroblock_size / min_block_size) * (macroblock_size / min_block_size);
-    block_motion_vector_t vectors[max_vectors_count];
-    memset(vectors, 0, sizeof(vectors));
-    int total_vectors = 0;
-    const int result_sad = find_optimal_motion_vectors(p_ctx, macroblock, macroblock_size, p_frame, macroblock_x, macroblock_y, vectors, &total_vectors);
+    // Reduced macroblocks of the last row share the entry of their macroblock
+    p_dct_ctx->p_motion_field[mb_y * p_dct_ctx->width_mbs + mb_x] = mv;
+
+    write_partition(p_ctx, &p_slice->writer, vectors, macroblock_size, &mv_pred);
+    p_dct_ctx->p_coded_motion_field[mb_y * p_dct_ctx->width_mbs + mb_x] = mv_pred;
+
+    const bool intra = VCODEC_BLOCK_PARTITION_MODE_NONE == vectors[0].partition_mode && VCODEC_MOTION_PREDICTION_MODE_INTRA == vectors[0].motion_pred_mode;
+    encode_residual(p_ctx, p_slice, macroblock, p_quant, macroblock_size, intra);
+
+    const vcodec_frame_t *p_recon = &p_dct_ctx->p_recon->frame;
+    vcodec_unpredict_partition(macroblock, macroblock_size, vectors, p_dct_ctx->p_refs, p_recon->p_data,
+            macroblock_x, macroblock_y, macroblock_size, p_recon->stride);
+    p_dct_ctx->dsp.reconstruct(p_recon->p_data + macroblock_y * p_recon->stride + macroblock_x, p_recon->stride, macroblock, macroblock_size);
+}
+
+/**
+ * Encode a macroblock as skipped if its residual at the predicted motion vector @c mv quantizes to zero:
+ * only the header is written, and the decoder copies the block from the most recent reference.
+ * @return false if the macroblock has to be coded, nothing is written then.
+ */
+static bool encode_macroblock_skip(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, const uint8_t *p_frame, int macroblock_x, int macroblock_y,
+        const vcodec_quant_t *p_quant, int macroblock_size, motion_vector_t mv) {
+    vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    if (!vcodec_motion_vector_in_range(macroblock_x, macroblock_y, macroblock_size, mv.mvx, mv.mvy, p_ctx->width, p_ctx->height)) {
+        return false;
+    }
+    int16_t *macroblock = p_slice->p_scratch->macroblock;
+    vcodec_subpel_residual(macroblock, macroblock_size, p_frame, p_dct_ctx->p_refs[0], macroblock_x, macroblock_y, mv.mvx, mv.mvy, macroblock_size);
+    int16_t *levels = p_slice->p_scratch->levels;
+    p_dct_ctx->dsp.forward_quant_mb(levels, macroblock, macroblock_size, p_quant, vcodec_quant_rounding(p_quant, false));
+    for (int i = 0; i < macroblock_size * macroblock_size; i++) {
+        // DC coefficients are coded separately
+        if (0 != levels[i] && 0 != i % (VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE)) {
+            return false;
+        }
+    }
+    int dc_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
+    if (quant_dc(p_ctx, macroblock, p_quant, macroblock_size, VCODEC_BLOCK_SIZE, false, dc_block)) {
+        return false;
+    }
+
+    if (VCODEC_BLOCK_SIZE != macroblock_size) {
+        vcodec_bitstream_writer_putbits(&p_slice->writer, VCODEC_BLOCK_PARTITION_MODE_NONE, 1);
+    }
+    write_p_macroblock_header(&p_slice->writer, VCODEC_MOTION_PREDICTION_MODE_SKIP, VCODEC_PREDICTION_MODE_NONE);
+    const vcodec_frame_t *p_recon = &p_dct_ctx->p_recon->frame;
+    vcodec_subpel_predict(p_dct_ctx->p_refs[0], macroblock_x, macroblock_y, mv.mvx, mv.mvy, macroblock_size,
+            p_recon->p_data + macroblock_y * p_recon->stride + macroblock_x, &p_dct_ctx->dsp);
+    return true;
 }
 
 /**
- * Recirsively find  motion vectors with optimal block partition and save the result into @c p_vectors.
+ * Write the partition tree of a block in pre-order: partition flag (except for 4x4 blocks), then either the four quadrants
+ * or the prediction mode with the intra mode or the reference index (if the frame has several references) and the motion vector
+ * difference to @c p_mv_pred.
+ * @param[in,out] p_mv_pred Prediction of the next motion vector, updated to each written vector.
+ * @return Number of entries of @c p_vectors written.
+ */
+static int write_partition(vcodec_enc_ctx_t *p_ctx, vcodec_bitstream_writer_t *p_writer, const block_motion_vector_t *p_vectors, int block_size,
+        motion_vector_t *p_mv_pred) {
+    if (VCODEC_BLOCK_SIZE != block_size) {
+        vcodec_bitstream_writer_putbits(p_writer, p_vectors[0].partition_mode, 1);
+    }
+    if (VCODEC_BLOCK_PARTITION_MODE_QUAD == p_vectors[0].partition_mode) {
+        int num_vectors = 1;
+        for (int i = 0; i < 4; i++) {
+            num_vectors += write_partition(p_ctx, p_writer, p_vectors + num_vectors, block_size / 2, p_mv_pred);
+        }
+        return num_vectors;
+    }
+    write_p_macroblock_header(p_writer, p_vectors[0].motion_pred_mode, p_vectors[0].intra_pred_mode);
+    if (VCODEC_MOTION_PREDICTION_MODE_MV == p_vectors[0].motion_pred_mode) {
+        vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+        if (p_dct_ctx->num_refs > 1) {
+            vcodec_bitstream_writer_write_exp_golomb(p_writer, p_vectors[0].ref_idx);
+        }
+        vcodec_ec_write_signed(p_writer, p_vectors[0].mvx - p_mv_pred->mvx);
+        vcodec_ec_write_signed(p_writer, p_vectors[0].mvy - p_mv_pred->mvy);
+        p_mv_pred->mvx = p_vectors[0].mvx;
+        p_mv_pred->mvy = p_vectors[0].mvy;
+    } else {
+        // Intra macroblocks do not carry a vector for their neighbours
+        p_mv_pred->mvx = 0;
+        p_mv_pred->mvy = 0;
+    }
+    return 1;
+}
+
+/**
+ * Find motion vectors of a block with the optimal partition and save the partition tree into @c p_vectors.
+ * Partitions are evaluated bottom-up: the quadrants first, then the whole block with the quadrant vectors as extra predictors,
+ * so that most of its costs are derived from the quadrant costs in the cost cache instead of being computed again.
+ * Residual of the chosen partition is written to @c p_block with row stride @c stride.
+ * @param[out] p_mv Motion vector found for the whole block, regardless of the chosen partition.
  * @return Total SAD.
  */
-static int find_optimal_motion_vectors(vcodec_enc_ctx_t *p_ctx, int *p_block, int block_size, const uint8_t *p_frame, int x, int y, block_motion_vector_t *p_vectors, int *p_total_vectors) {
+static int find_optimal_motion_vectors(vcodec_enc_ctx_t *p_ctx, vcodec_dct_slice_t *p_slice, int16_t *p_block, int stride, int block_size,
+        const uint8_t *p_frame, int x, int y, block_motion_vector_t *p_vectors, int *p_total_vectors, motion_vector_t *p_mv,
+        const vcodec_motion_search_params_t *p_search, int depth) {
     vcodec_dct_ctx_t *p_dct_ctx = p_ctx->encoder_ctx;
+    vcodec_scratch_t *p_scratch = p_slice->p_scratch;
+    block_motion_vector_t *sub_vectors = NULL;
+    int total_vectors = 0;
+    int sub_block_sad = INT_MAX;
+    vcodec_motion_search_params_t whole_search = *p_search;
+
+    if (VCODEC_BLOCK_SIZE != block_size) {
+        const int sub_block_size = block_size / 2;
+        sub_vectors = p_scratch->sub_vectors[depth];
+        sub_block_sad = 0;
+        for (int i = 0; i < 4; i++) {
+            const int sub_x = (i % 2) * sub_block_size;
+            const int sub_y = (i / 2) * sub_block_size;
+            int vectors_written = 0;
+            motion_vector_t sub_mv;
+            // Quadrant residuals go straight to their place in the block, the whole block overwrites them if it wins
+            sub_block_sad += find_optimal_motion_vectors(p_ctx, p_slice, p_block + sub_y * stride + sub_x, stride, sub_block_size, p_frame,
+                    x + sub_x, y + sub_y, sub_vectors + total_vectors, &vectors_written, &sub_mv, p_search, depth + 1);
+            total_vectors += vectors_written;
+            whole_search.predictors[whole_search.num_predictors++] = sub_mv;
+        }
+    }
+
+    int16_t *p_whole_block = p_scratch->partition_blocks[depth];
     int whole_block_sad = 0;
     block_motion_vector_t whole_block_vector = {
         .partition_mode = VCODEC_BLOCK_PARTITION_MODE_NONE,
     };
-    const vcodec_motion_prediction_mode_t whole_pred_mode = vcodec_predict_motion_block(p_block, p_dct_ctx->p_ref_frame, x, y,
-            p_frame, p_ctx->width, block_size, &whole_block_vector.mvx, &whole_block_vector.mvy, &whole_block_sad, &whole_block_vector.intra_pred_mode);
-
-    if (4 == block_size) {
-        memcpy(p_vectors, &whole_block_vector, sizeof(whole_block_vector));
-        *p_total_vectors = 1;
-        return whole_block_sad;
-    }
-
-    const int min_block_size = 4;
-    const int max_vectors_count = (block_size / min_block_size) * (block_size / min_block_size);
-    block_motion_vector_t sub_vectors[max_vectors_count];
-    int vectors_written = 0;
-    int total_vectors = 0;
-    const int sub_block_size = block_size / 2;
-
-    int sub_block_top_left[sub_block_size * sub_block_size];
-    int sub_block_top_right[sub_block_size * sub_block_size];
-    int sub_block_bottom_left[sub_block_size * sub_block_size];
-    int sub_block_bottom_right[sub_block_size * sub_block_size];
-
-    int sub_block_sad = 0;
-    sub_block_sad += find_optimal_motion_vectors(p_ctx, sub_block_top_left, sub_block_size, p_frame, x, y, sub_vectors, &vectors_written);
-    total_vectors += vectors_written;
-    if (sub_block_sad >= whole_block_sad) {
-        goto finish;
-    }
-    sub_block_sad += find_optimal_motion_vectors(p_ctx, sub_block_top_right, sub_block_size, p_frame, x + sub_block_size, y, sub_vectors + total_vectors, &vectors_written);
-    total_vectors += vectors_written;
-    if (sub_block_sad >= whole_block_sad) {
-        goto finish;
-    }
-    sub_block_sad += find_optimal_motion_vectors(p_ctx, sub_block_bottom_left, sub_block_size, p_frame, x, y + sub_block_size, sub_vectors + total_vectors, &vectors_written);
-    total_vectors += vectors_written;
-    if (sub_block_sad >= whole_block_sad) {
-        goto finish;
-    }
-    sub_block_sad += find_optimal_motion_vectors(p_ctx, sub_block_bottom_right, sub_block_size, p_frame, x + sub_block_size, y + sub_block_size, sub_vectors + total_vectors, &vectors_written);
-    total_vectors += vectors_written;
-
- finish:
-    if (whole_block_sad < sub_block_sad) {
+    // Intra prediction needs reconstructed neighbours, which only exist outside of the macroblock
+    const uint8_t *p_recon_frame = 0 == depth ? p_dct_ctx->p_recon->frame.p_data : NULL;
+    whole_block_vector.motion_pred_mode = vcodec_predict_motion_block(p_whole_block, p_dct_ctx->p_refs, p_dct_ctx->num_refs, p_recon_frame,
+            p_slice->mb_row_start * VCODEC_MACROBLOCK_SIZE, x, y,
+            p_frame, p_dct_ctx->p_recon->frame.stride, block_size, &whole_block_vector.ref_idx, &whole_block_vector.mvx, &whole_block_vector.mvy,
+            &whole_block_sad,
+            &whole_block_vector.intra_pred_mode, &whole_search, p_scratch, &p_dct_ctx->dsp);
+    // Search predictors are full-pel
+    p_mv->mvx = (whole_block_vector.mvx + VCODEC_SUBPEL_SCALE / 2) >> VCODEC_SUBPEL_SHIFT;
+    p_mv->mvy = (whole_block_vector.mvy + VCODEC_SUBPEL_SCALE / 2) >> VCODEC_SUBPEL_SHIFT;
+
+    // Whole block wins ties, it needs fewer vectors
+    if (whole_block_sad <= sub_block_sad) {
         memcpy(p_vectors, &whole_block_vector, sizeof(whole_block_vector));
         *p_total_vectors = 1;
-        return whole_block_sad;
-    } else {
-        p_vectors[0].partition_mode = VCODEC_BLOCK_PARTITION_MODE_QUAD;
-        memcpy(p_vectors + 1, sub_vectors, sizeof(block_motion_vector_t) * total_vectors);
-        *p_total_vectors = total_vectors + 1;
-        for (int i = 0; i < sub_block_size; i++) {
-            memcpy(p_block + i * block_size, sub_block_top_left + i * sub_block_size, sub_block_size);
-        }
-        for (int i = 0; i < sub_block_size; i++) {
-            memcpy(p_block + i * block_size + sub_block_size, sub_block_top_right + i * sub_block_size, sub_block_size);
+        for (int i = 0; i < block_size; i++) {
+            memcpy(p_block + i * stride, p_whole_block + i * block_size, sizeof(int16_t) * block_size);
         }
-        for (int i = 0; i < sub_block_size; i++) {
-            memcpy(p_block + (i + sub_block_size) * block_size, sub_block_bottom_left + i * sub_block_size, sub_block_size);
-        }
-        for (int i = 0; i < sub_block_size; i++) {
-            memcpy(p_block + (i + sub_block_size) * block_size + sub_block_size, sub_block_bottom_left + i * sub_block_size, sub_block_size);
-        }
-        return sub_block_sad;
+        return whole_block_sad;
     }
+    p_vectors[0].partition_mode = VCODEC_BLOCK_PARTITION_MODE_QUAD;
+    memcpy(p_vectors + 1, sub_vectors, sizeof(block_motion_vector_t) * total_vectors);
+    *p_total_vectors = total_vectors + 1;
+    return sub_block_sad;
 }
@@ -2,6 +2,11 @@
 #include "vcodec/bitstream.h"
 #include "vcodec_common.h"
 #include "vcodec_transform.h"
+#include "vcodec_dsp.h"
+#include "vcodec_quant.h"
+#include "vcodec_frame.h"
+#include "vcodec_subpel.h"
+#include "vcodec_picture.h"
 #include "vcodec_entropy_coding.h"
 
 #include <string.h>
@@ -13,11 +18,46 @@
 
 //#define debug_printf printf
 #define debug_printf
-#define GOP 1
 
+/**
+ * Sequence parameters, see write_sps() of the encoder.
+ */
 typedef struct {
-    uint8_t *p_ref_frame;
-    int gop_cnt;
+    uint32_t width;
+    uint32_t height;
+    int num_ref_frames;
+    bool long_term_ref;
+} sps_t;
+
+typedef struct {
+    bool is_key_frame;
+    // P frames only
+    vcodec_subpel_filter_t subpel_filter;
+    int num_short_term;
+    bool long_term;
+} frame_header_t;
+
+typedef struct {
+    // Parameters of the stream, from its last SPS and PPS
+    sps_t sps;
+    int qp; //< 0 before the first PPS
+    // Buffers sized for the SPS, allocated by the first key frame after it
+    bool buffers_valid;
+    // Reconstructed frames: as many references as the encoder uses and the frame being decoded
+    vcodec_picture_pool_t pictures;
+    vcodec_picture_t *p_recon;
+    // References of the current P frame, see frame_header_t
+    const vcodec_subpel_ref_t *p_refs[VCODEC_MAX_REFS];
+    int num_refs;
+    // Last coded (quarter-pel) motion vector of each macroblock of the current frame, see vcodec_motion_vector_prediction()
+    motion_vector_t *p_coded_motion_field;
+    int width_mbs;
+    int height_mbs;
+    // First macroblock row of the slice being decoded, nothing above it is used for prediction
+    int slice_mb_row;
+    vcodec_scratch_t *p_scratch;
+    vcodec_dsp_t dsp;
+    vcodec_quant_tables_t quant;
 } dec_ctx_t;
 
 static const int jpeg_zigzag_order4x4[4][4] = {
@@ -35,50 +75,185 @@ static const int jpeg_zigzag_order2x2[2][2] = {
 static vcodec_status_t vcodec_dec_get_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame);
 static vcodec_status_t vcodec_dec_deinit(vcodec_dec_ctx_t *p_ctx);
 
-static vcodec_status_t decode_key_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame);
-static vcodec_status_t decode_p_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame);
+static vcodec_status_t decode_slices(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, bool is_key_frame);
+static vcodec_status_t decode_slice(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, bool is_key_frame, int mb_row_start, int mb_row_end);
+static vcodec_status_t decode_p_frame(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, const frame_header_t *p_header);
 
-static vcodec_status_t decode_macroblock_i(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size);
-static void decode_dc(vcodec_dec_ctx_t *p_ctx, int *p_macroblock, const int *p_quant, int macroblock_size, int block_size);
+static vcodec_status_t decode_macroblock_i(vcodec_dec_ctx_t *p_ctx, int macroblock_x, int macroblock_y, const vcodec_quant_t *p_quant, int macroblock_size);
+static vcodec_status_t decode_macroblock_p(vcodec_dec_ctx_t *p_ctx, int macroblock_x, int macroblock_y, const vcodec_quant_t *p_quant, int macroblock_size);
+static vcodec_status_t decode_residual(vcodec_dec_ctx_t *p_ctx, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size);
+static void decode_dc(vcodec_dec_ctx_t *p_ctx, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size, int block_size);
 
-static vcodec_status_t read_frame_header(vcodec_dec_ctx_t *p_ctx, bool *p_is_key_frame);
+static vcodec_status_t read_sps(vcodec_dec_ctx_t *p_ctx, sps_t *p_sps);
+static vcodec_status_t read_pps(vcodec_dec_ctx_t *p_ctx);
+static vcodec_status_t read_frame_header(vcodec_dec_ctx_t *p_ctx, frame_header_t *p_header);
 static vcodec_status_t read_macroblock_header(vcodec_dec_ctx_t *p_ctx, vcodec_prediction_mode_t *p_pred_mode);
+static vcodec_status_t read_partition(vcodec_dec_ctx_t *p_ctx, block_motion_vector_t *p_vectors, int x, int y, int block_size, int macroblock_size,
+        motion_vector_t *p_mv_pred, int *p_num_vectors);
 
 vcodec_status_t vcodec_dec_dct_init(vcodec_dec_ctx_t *p_ctx) {
-    if (0 == p_ctx->width || 0 == p_ctx->height) {
-        return VCODEC_STATUS_INVAL;
-    }
-
-    p_ctx->decoder_ctx = p_ctx->alloc(sizeof(vcodec_dec_ctx_t));
+    p_ctx->decoder_ctx = p_ctx->alloc(sizeof(dec_ctx_t));
     if (NULL == p_ctx->decoder_ctx) {
         return VCODEC_STATUS_NOMEM;
     }
 
     dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
-    p_dct_ctx->p_ref_frame = p_ctx->alloc(p_ctx->width * p_ctx->height);
-    if (NULL == p_dct_ctx->p_ref_frame) {
+    memset(p_dct_ctx, 0, sizeof(*p_dct_ctx));
+    p_dct_ctx->p_scratch = vcodec_scratch_alloc(p_ctx->alloc);
+    if (NULL == p_dct_ctx->p_scratch) {
         return VCODEC_STATUS_NOMEM;
     }
-    p_dct_ctx->gop_cnt = 0;
-
+    p_ctx->cpu_level = vcodec_dsp_init(&p_dct_ctx->dsp, p_ctx->cpu_level);
+    vcodec_quant_tables_init(&p_dct_ctx->quant);
     p_ctx->get_frame = vcodec_dec_get_frame;
     p_ctx->deinit = vcodec_dec_deinit;
+    p_ctx->gop_size = 0;
+
+    // Stream starts with the parameter sets of its first key frame, the SPS gives the frame size
+    uint32_t type;
+    vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &type, VCODEC_UNIT_TYPE_BITS);
+    vcodec_status_t ret = vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    if (VCODEC_UNIT_SPS != type) {
+        return VCODEC_STATUS_INVAL;
+    }
+    ret = read_sps(p_ctx, &p_dct_ctx->sps);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    p_ctx->width = p_dct_ctx->sps.width;
+    p_ctx->height = p_dct_ctx->sps.height;
+    vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &type, VCODEC_UNIT_TYPE_BITS);
+    ret = vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    if (VCODEC_UNIT_PPS != type) {
+        return VCODEC_STATUS_INVAL;
+    }
+    return read_pps(p_ctx);
+}
+
+/**
+ * Allocate the reference frames and the motion field for the frame size and references of the SPS.
+ */
+static vcodec_status_t buffers_init(vcodec_dec_ctx_t *p_ctx) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    const sps_t *p_sps = &p_dct_ctx->sps;
+    p_dct_ctx->buffers_valid = true;
+    if (VCODEC_STATUS_OK != vcodec_picture_pool_init(&p_dct_ctx->pictures, p_sps->width, p_sps->height, p_sps->num_ref_frames, p_sps->long_term_ref,
+                p_ctx->alloc)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    p_dct_ctx->width_mbs = (p_sps->width + VCODEC_MACROBLOCK_SIZE - 1) / VCODEC_MACROBLOCK_SIZE;
+    p_dct_ctx->height_mbs = (p_sps->height + VCODEC_MACROBLOCK_SIZE - 1) / VCODEC_MACROBLOCK_SIZE;
+    p_dct_ctx->p_coded_motion_field = p_ctx->alloc(p_dct_ctx->width_mbs * p_dct_ctx->height_mbs * sizeof(motion_vector_t));
+    if (NULL == p_dct_ctx->p_coded_motion_field) {
+        return VCODEC_STATUS_NOMEM;
+    }
     return VCODEC_STATUS_OK;
 }
 
+static void buffers_free(vcodec_dec_ctx_t *p_ctx) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    if (!p_dct_ctx->buffers_valid) {
+        return;
+    }
+    vcodec_picture_pool_free(&p_dct_ctx->pictures, p_ctx->free);
+    memset(&p_dct_ctx->pictures, 0, sizeof(p_dct_ctx->pictures));
+    if (NULL != p_dct_ctx->p_coded_motion_field) {
+        p_ctx->free(p_dct_ctx->p_coded_motion_field);
+        p_dct_ctx->p_coded_motion_field = NULL;
+    }
+    p_dct_ctx->buffers_valid = false;
+}
+
+static bool sps_equal(const sps_t *p_a, const sps_t *p_b) {
+    return p_a->width == p_b->width && p_a->height == p_b->height && p_a->num_ref_frames == p_b->num_ref_frames
+        && p_a->long_term_ref == p_b->long_term_ref;
+}
+
+/**
+ * Read the parameter sets up to the header of the next frame.
+ * A new SPS drops the buffers of the previous one, they are allocated again by the key frame which follows it.
+ * @retval VCODEC_STATUS_AGAIN if the frame size changed, see get_frame.
+ */
+static vcodec_status_t read_parameter_sets(vcodec_dec_ctx_t *p_ctx, frame_header_t *p_header) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    for (;;) {
+        uint32_t type;
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &type, VCODEC_UNIT_TYPE_BITS);
+        vcodec_status_t ret = vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+        if (VCODEC_UNIT_KEY_FRAME == type || VCODEC_UNIT_P_FRAME == type) {
+            p_header->is_key_frame = VCODEC_UNIT_KEY_FRAME == type;
+            return read_frame_header(p_ctx, p_header);
+        }
+        if (VCODEC_UNIT_PPS == type) {
+            ret = read_pps(p_ctx);
+        } else {
+            sps_t sps;
+            ret = read_sps(p_ctx, &sps);
+            if (VCODEC_STATUS_OK == ret && !sps_equal(&sps, &p_dct_ctx->sps)) {
+                buffers_free(p_ctx);
+                p_dct_ctx->sps = sps;
+                if (sps.width != p_ctx->width || sps.height != p_ctx->height) {
+                    p_ctx->width = sps.width;
+                    p_ctx->height = sps.height;
+                    return VCODEC_STATUS_AGAIN;
+                }
+            }
+        }
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+    }
+}
+
 static vcodec_status_t vcodec_dec_get_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame) {
     dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
-    bool is_key_frame = false;
-    vcodec_status_t ret = read_frame_header(p_ctx, &is_key_frame);
+    frame_header_t header;
+    vcodec_status_t ret = read_parameter_sets(p_ctx, &header);
     if (VCODEC_STATUS_OK != ret) {
         return ret;
     }
-    if (is_key_frame) {
-        return decode_key_frame(p_ctx, p_frame);
+    // P frames need the key frame before them, and every frame the PPS
+    if ((!header.is_key_frame && !p_dct_ctx->buffers_valid) || 0 == p_dct_ctx->qp) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (!p_dct_ctx->buffers_valid) {
+        ret = buffers_init(p_ctx);
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+    }
+    const vcodec_quant_t *p_quant = &p_dct_ctx->quant.qp[p_dct_ctx->qp];
+    p_dct_ctx->p_recon = vcodec_picture_pool_acquire(&p_dct_ctx->pictures);
+    if (header.is_key_frame) {
+        ret = decode_slices(p_ctx, p_quant, true);
     } else {
-        return decode_p_frame(p_ctx, p_frame);
+        ret = decode_p_frame(p_ctx, p_quant, &header);
     }
-    return VCODEC_STATUS_OK;
+    vcodec_bitstream_reader_align(p_ctx->bitstream_reader);
+    if (VCODEC_STATUS_OK == ret) {
+        vcodec_frame_t *p_recon = &p_dct_ctx->p_recon->frame;
+        vcodec_frame_copy_to(p_recon, p_frame);
+        vcodec_frame_extend_border(p_recon);
+        if (header.is_key_frame) {
+            vcodec_picture_pool_clear(&p_dct_ctx->pictures);
+            if (p_dct_ctx->sps.long_term_ref) {
+                // Every key frame is the long-term reference until the next one, the encoder decides whether to use it
+                vcodec_picture_pool_set_long_term(&p_dct_ctx->pictures, p_dct_ctx->p_recon);
+            }
+        }
+        vcodec_picture_pool_push(&p_dct_ctx->pictures, p_dct_ctx->p_recon);
+    }
+    vcodec_picture_unref(p_dct_ctx->p_recon);
+    return ret;
 }
 
 static vcodec_status_t vcodec_dct_reset(vcodec_dec_ctx_t *p_ctx) {
@@ -86,57 +261,101 @@ static vcodec_status_t vcodec_dct_reset(vcodec_dec_ctx_t *p_ctx) {
 }
 
 static vcodec_status_t vcodec_dec_deinit(vcodec_dec_ctx_t *p_ctx) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    vcodec_scratch_free(p_dct_ctx->p_scratch, p_ctx->free);
+    buffers_free(p_ctx);
+    p_ctx->free(p_dct_ctx);
+    p_ctx->decoder_ctx = NULL;
     return VCODEC_STATUS_OK;
 }
 
-static vcodec_status_t decode_key_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame) {
-    const uint32_t macroblock_size = 16;
-    int quant[4*4] = {
-        16,	11,	10,	16,
-        12,	12,	14,	19,
-        14,	13,	16,	24,
-        14,	17,	22,	29,
-    };
-    //printf("Key frame\n");
-    int h = p_ctx->height / macroblock_size * macroblock_size;
-    int y = 0;
-    for (; y < h; y += macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += macroblock_size) {
-            decode_macroblock_i(p_ctx, p_frame, x, y, quant, macroblock_size);
-        }
-    }
-    int reduced_macroblock_size;
-    if ((p_ctx->height - y) % 8 == 0) {
-        reduced_macroblock_size = 8;
-    } else {
-        reduced_macroblock_size = 4;
+/**
+ * Read the slices of a frame, see encode_slices() of the encoder.
+ * @retval VCODEC_STATUS_INVAL if the frame has more slices than macroblock rows or a slice is not as long as its header says.
+ */
+static vcodec_status_t decode_slices(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, bool is_key_frame) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    vcodec_bitstream_reader_t *p_reader = p_ctx->bitstream_reader;
+    const uint32_t num_slices = vcodec_bitstream_reader_read_exp_golomb(p_reader) + 1;
+    vcodec_bitstream_reader_align(p_reader);
+    vcodec_status_t ret = vcodec_bitstream_reader_status(p_reader);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    if (num_slices > (uint32_t)p_dct_ctx->height_mbs) {
+        return VCODEC_STATUS_INVAL;
     }
-    for (; y < p_ctx->height; y += reduced_macroblock_size) {
-        int x = 0;
-        for (; x < p_ctx->width; x += reduced_macroblock_size) {
-            decode_macroblock_i(p_ctx, p_frame, x, y, quant, reduced_macroblock_size);
+    for (uint32_t i = 0; i < num_slices; i++) {
+        const size_t size = vcodec_bitstream_reader_read_exp_golomb(p_reader);
+        vcodec_bitstream_reader_align(p_reader);
+        const size_t start = vcodec_bitstream_reader_tell(p_reader);
+        ret = decode_slice(p_ctx, p_quant, is_key_frame, p_dct_ctx->height_mbs * i / num_slices, p_dct_ctx->height_mbs * (i + 1) / num_slices);
+        if (VCODEC_STATUS_OK != ret) {
+            return ret;
+        }
+        vcodec_bitstream_reader_align(p_reader);
+        if (vcodec_bitstream_reader_tell(p_reader) - start != size * 8) {
+            return VCODEC_STATUS_INVAL;
         }
     }
+    return vcodec_bitstream_reader_status(p_reader);
+}
+
+static vcodec_status_t decode_slice(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, bool is_key_frame, int mb_row_start, int mb_row_end) {
+    const int macroblock_size = VCODEC_MACROBLOCK_SIZE;
     dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
-    memcpy(p_frame, p_dct_ctx->p_ref_frame, p_ctx->width * p_ctx->height);
+    p_dct_ctx->slice_mb_row = mb_row_start;
+    vcodec_status_t ret = VCODEC_STATUS_OK;
+    const int h = p_ctx->height / macroblock_size * macroblock_size;
+    for (int mb_y = mb_row_start; mb_y < mb_row_end && VCODEC_STATUS_OK == ret; mb_y++) {
+        int y = mb_y * macroblock_size;
+        // Last band of the frame is covered with 8x8 or 4x4 macroblocks
+        const int size = y < h ? macroblock_size : (0 == (p_ctx->height - y) % 8 ? 8 : 4);
+        const int band_end = MIN(y + macroblock_size, (int)p_ctx->height);
+        for (; y < band_end && VCODEC_STATUS_OK == ret; y += size) {
+            for (int x = 0; x < p_ctx->width && VCODEC_STATUS_OK == ret; x += size) {
+                if (is_key_frame) {
+                    ret = decode_macroblock_i(p_ctx, x, y, p_quant, size);
+                } else {
+                    ret = decode_macroblock_p(p_ctx, x, y, p_quant, size);
+                }
+            }
+        }
+    }
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    return vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
 }
 
-static vcodec_status_t decode_macroblock_i(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame, int macroblock_x, int macroblock_y, const int *p_quant, int macroblock_size) {
-    const int block_size = 4;
+static vcodec_status_t decode_macroblock_i(vcodec_dec_ctx_t *p_ctx, int macroblock_x, int macroblock_y, const vcodec_quant_t *p_quant, int macroblock_size) {
     dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
     vcodec_status_t ret = VCODEC_STATUS_OK;
     // Copy block to temp location
-    int macroblock[macroblock_size * macroblock_size];
+    int16_t *macroblock = p_dct_ctx->p_scratch->macroblock;
     vcodec_prediction_mode_t pred_mode;
     if (VCODEC_STATUS_OK != (ret = read_macroblock_header(p_ctx, &pred_mode))) {
         return ret;
     }
     debug_printf("Block predicted with %d:\n", pred_mode);
+    ret = decode_residual(p_ctx, macroblock, p_quant, macroblock_size);
+
+    const vcodec_frame_t *p_recon = &p_dct_ctx->p_recon->frame;
+    vcodec_unpredict_block(macroblock, p_recon->p_data, macroblock_x, macroblock_y, macroblock_size, p_recon->stride, pred_mode);
+    p_dct_ctx->dsp.reconstruct(p_recon->p_data + macroblock_y * p_recon->stride + macroblock_x, p_recon->stride, macroblock, macroblock_size);
+    return ret;
+}
 
+/**
+ * Read and dequantize the residual of a macroblock, then inverse transform it in place.
+ */
+static vcodec_status_t decode_residual(vcodec_dec_ctx_t *p_ctx, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size) {
+    const int block_size = VCODEC_BLOCK_SIZE;
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    vcodec_status_t ret = VCODEC_STATUS_OK;
     for (int y = 0; y < macroblock_size; y += block_size) {
         for (int x = 0; x < macroblock_size; x += block_size) {
-            int zigzag_block[block_size * block_size];
+            int16_t zigzag_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
             zigzag_block[0] = 0; // DC to be filled later
             ret = vcodec_ec_read_coeffs(p_ctx->bitstream_reader, zigzag_block + 1, block_size * block_size - 1);
             debug_printf("AC COEFFS:\n");
@@ -144,63 +363,27 @@ static vcodec_status_t decode_macroblock_i(vcodec_dec_ctx_t *p_ctx, uint8_t *p_f
                 debug_printf("%4d ", zigzag_block[i]);
             }
             debug_printf("\n");
-            int rescaled_block[block_size * block_size];
+            int16_t levels[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
             for (int i = 0; i < block_size; i++) {
                 for (int j = 0; j < block_size; j++) {
-                    rescaled_block[i * block_size + j] = zigzag_block[jpeg_zigzag_order4x4[i][j]] * p_quant[i * block_size + j];
+                    levels[i * block_size + j] = zigzag_block[jpeg_zigzag_order4x4[i][j]];
                 }
             }
-            for (int i = 0; i < block_size; i++) {
-                // Save rescaled coeffs into the framebuffer for future inverse transform when DC coefficients will be available
-                memcpy(macroblock + (y + i) * macroblock_size + x, rescaled_block + i * block_size, sizeof(int) * block_size);
-            }
+            // Save rescaled coeffs into the macroblock for future inverse transform when DC coefficients will be available
+            p_dct_ctx->dsp.dequant4x4(p_macroblock + y * macroblock_size + x, macroblock_size, levels, p_quant);
         }
     }
 
-    decode_dc(p_ctx, macroblock, p_quant, macroblock_size, block_size);
+    decode_dc(p_ctx, p_macroblock, p_quant, macroblock_size, block_size);
 
-    for (int y = 0; y < macroblock_size; y += block_size) {
-        for (int x = 0; x < macroblock_size; x += block_size) {
-            int reconstructed_block[block_size * block_size];
-            for (int i = 0; i < block_size; i++) {
-                // TODO: rework transform functions to work directly with macroblock buffer to avoid this copy operations
-                memcpy(reconstructed_block + i * block_size, macroblock + (y + i) * macroblock_size + x, sizeof(int) * block_size);
-            }
-            inverse4x4(reconstructed_block, reconstructed_block);
-            debug_printf("IDCT out:\n");
-            for (int i = 0; i < block_size; i++) {
-                for (int j = 0; j < block_size; j++) {
-                    reconstructed_block[i * block_size + j] /= 16;
-                    debug_printf("%4d ", reconstructed_block[i * block_size + j]);
-                }
-                memcpy(macroblock + (y + i) * macroblock_size + x, reconstructed_block + i * block_size, sizeof(int) * block_size);
-                debug_printf("\n");
-            }
-        }
-    }
-
-    vcodec_unpredict_block(macroblock, p_dct_ctx->p_ref_frame, macroblock_x, macroblock_y, macroblock_size, p_ctx->width, pred_mode);
-    debug_printf("Reconstructed:\n");
-    int sad = 0;
-    for (int i = 0; i < macroblock_size; i++) {
-        for (int j = 0; j < macroblock_size; j++) {
-            p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j] = MAX(MIN(macroblock[i * macroblock_size + j], 255), 0);
-            debug_printf("%3d ", p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j]);
-            const int diff = p_dct_ctx->p_ref_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j] - p_frame[(macroblock_y + i) * p_ctx->width + macroblock_x + j];
-            debug_printf("(%3d) ", diff);
-            sad += abs(diff);
-        }
-        if (macroblock_size / block_size < 4) {
-            debug_printf("\n");
-        }
-    }
-    debug_printf("SAD = %d at %4d %4d\n", sad, macroblock_x, macroblock_y);
+    p_dct_ctx->dsp.inverse4x4_descale_mb(p_macroblock, macroblock_size);
+    return ret;
 }
 
-static void decode_dc(vcodec_dec_ctx_t *p_ctx, int *p_macroblock, const int *p_quant, int macroblock_size, int block_size) {
+static void decode_dc(vcodec_dec_ctx_t *p_ctx, int16_t *p_macroblock, const vcodec_quant_t *p_quant, int macroblock_size, int block_size) {
     const int dc_block_size = macroblock_size / block_size;
-    int dc_block[dc_block_size * dc_block_size];
-    int zigzag_block[dc_block_size * dc_block_size];
+    int dc_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
+    int16_t zigzag_block[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
     vcodec_ec_read_coeffs(p_ctx->bitstream_reader, zigzag_block, dc_block_size * dc_block_size);
     for (int y = 0; y < dc_block_size; y++) {
         for (int x = 0; x < dc_block_size; x++) {
@@ -209,13 +392,14 @@ static void decode_dc(vcodec_dec_ctx_t *p_ctx, int *p_macroblock, const int *p_q
             } else {
                 dc_block[y * dc_block_size + x] = zigzag_block[jpeg_zigzag_order2x2[x][y]];
             }
-            dc_block[y * dc_block_size + x] *= p_quant[0];
+            dc_block[y * dc_block_size + x] *= p_quant->dc_step;
             debug_printf("%3d ", dc_block[y * dc_block_size + x]);
         }
         debug_printf("\n");
     }
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
     if (4 == dc_block_size) {
-        ihadamard4x4(dc_block, dc_block);
+        p_dct_ctx->dsp.ihadamard4x4(dc_block, dc_block);
     } else {
         hadamard2x2(dc_block, dc_block);
     }
@@ -232,15 +416,118 @@ static void decode_dc(vcodec_dec_ctx_t *p_ctx, int *p_macroblock, const int *p_q
     }
 }
 
-static vcodec_status_t decode_p_frame(vcodec_dec_ctx_t *p_ctx, uint8_t *p_frame) {
+static vcodec_status_t decode_p_frame(vcodec_dec_ctx_t *p_ctx, const vcodec_quant_t *p_quant, const frame_header_t *p_header) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    vcodec_picture_pool_t *p_pictures = &p_dct_ctx->pictures;
+    // Stream does not start with a key frame, or uses more references than the decoded frames
+    if (p_header->num_short_term > p_pictures->num_short_term || (p_header->long_term && NULL == p_pictures->p_long_term)) {
+        return VCODEC_STATUS_INVAL;
+    }
+    p_dct_ctx->num_refs = 0;
+    for (int i = 0; i < p_header->num_short_term; i++) {
+        p_dct_ctx->p_refs[p_dct_ctx->num_refs++] = vcodec_picture_subpel(p_pictures->p_short_term[i], p_header->subpel_filter, &p_dct_ctx->dsp);
+    }
+    if (p_header->long_term) {
+        p_dct_ctx->p_refs[p_dct_ctx->num_refs++] = vcodec_picture_subpel(p_pictures->p_long_term, p_header->subpel_filter, &p_dct_ctx->dsp);
+    }
+    return decode_slices(p_ctx, p_quant, false);
+}
+
+static vcodec_status_t decode_macroblock_p(vcodec_dec_ctx_t *p_ctx, int macroblock_x, int macroblock_y, const vcodec_quant_t *p_quant, int macroblock_size) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    int16_t *macroblock = p_dct_ctx->p_scratch->macroblock;
+    block_motion_vector_t *vectors = p_dct_ctx->p_scratch->vectors;
+    const int mb_x = macroblock_x / VCODEC_MACROBLOCK_SIZE;
+    const int mb_y = macroblock_y / VCODEC_MACROBLOCK_SIZE;
+
+    motion_vector_t mv_pred = vcodec_motion_vector_prediction(p_dct_ctx->p_coded_motion_field, mb_x, mb_y, p_dct_ctx->slice_mb_row, p_dct_ctx->width_mbs);
+    int num_vectors = 0;
+    vcodec_status_t ret = read_partition(p_ctx, vectors, macroblock_x, macroblock_y, macroblock_size, macroblock_size, &mv_pred, &num_vectors);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    p_dct_ctx->p_coded_motion_field[mb_y * p_dct_ctx->width_mbs + mb_x] = mv_pred;
+
+    const vcodec_frame_t *p_recon_frame = &p_dct_ctx->p_recon->frame;
+    const int stride = p_recon_frame->stride;
+    uint8_t *p_recon = p_recon_frame->p_data + macroblock_y * stride + macroblock_x;
+    if (VCODEC_BLOCK_PARTITION_MODE_NONE == vectors[0].partition_mode && VCODEC_MOTION_PREDICTION_MODE_SKIP == vectors[0].motion_pred_mode) {
+        // No residual, the block is copied as is
+        vcodec_subpel_predict(p_dct_ctx->p_refs[0], macroblock_x, macroblock_y, vectors[0].mvx, vectors[0].mvy, macroblock_size,
+                p_recon, &p_dct_ctx->dsp);
+        return VCODEC_STATUS_OK;
+    }
+
+    if (VCODEC_STATUS_OK != (ret = decode_residual(p_ctx, macroblock, p_quant, macroblock_size))) {
+        return ret;
+    }
+
+    vcodec_unpredict_partition(macroblock, macroblock_size, vectors, p_dct_ctx->p_refs, p_recon_frame->p_data,
+            macroblock_x, macroblock_y, macroblock_size, stride);
+    p_dct_ctx->dsp.reconstruct(p_recon, stride, macroblock, macroblock_size);
+    return VCODEC_STATUS_OK;
+}
+
+
+/**
+ * Read an SPS after its type.
+ * @retval VCODEC_STATUS_INVAL if it is not from the encoder or its parameters are out of range.
+ */
+static vcodec_status_t read_sps(vcodec_dec_ctx_t *p_ctx, sps_t *p_sps) {
+    vcodec_bitstream_reader_t *p_reader = p_ctx->bitstream_reader;
+    uint32_t magic;
+    uint32_t val;
+    vcodec_bitstream_reader_align(p_reader);
+    vcodec_bitstream_reader_getbits(p_reader, &magic, 32);
+    vcodec_bitstream_reader_getbits(p_reader, &p_sps->width, 32);
+    vcodec_bitstream_reader_getbits(p_reader, &p_sps->height, 32);
+    vcodec_bitstream_reader_getbits(p_reader, &val, 8);
+    p_sps->num_ref_frames = val;
+    vcodec_bitstream_reader_getbits(p_reader, &val, 8);
+    p_sps->long_term_ref = 0 != val;
+    const vcodec_status_t ret = vcodec_bitstream_reader_status(p_reader);
+    if (VCODEC_STATUS_OK == ret && (VCODEC_SPS_MAGIC != magic || 0 == p_sps->width || 0 == p_sps->height || p_sps->width > VCODEC_MAX_DIMENSION
+                || p_sps->height > VCODEC_MAX_DIMENSION || p_sps->num_ref_frames < 1 || p_sps->num_ref_frames > VCODEC_MAX_REF_FRAMES || val > 1)) {
+        return VCODEC_STATUS_INVAL;
+    }
+    return ret;
+}
+
+/**
+ * Read a PPS after its type.
+ */
+static vcodec_status_t read_pps(vcodec_dec_ctx_t *p_ctx) {
+    dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+    vcodec_bitstream_reader_t *p_reader = p_ctx->bitstream_reader;
+    uint32_t qp;
+    vcodec_bitstream_reader_getbits(p_reader, &qp, VCODEC_QP_BITS);
+    const uint32_t gop_size = vcodec_bitstream_reader_read_exp_golomb(p_reader) + 1;
+    vcodec_bitstream_reader_align(p_reader);
+    const vcodec_status_t ret = vcodec_bitstream_reader_status(p_reader);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    if (qp < VCODEC_QP_MIN || qp > VCODEC_QP_MAX) {
+        return VCODEC_STATUS_INVAL;
+    }
+    p_dct_ctx->qp = qp;
+    p_ctx->gop_size = gop_size;
     return VCODEC_STATUS_OK;
 }
 
-static vcodec_status_t read_frame_header(vcodec_dec_ctx_t *p_ctx, bool *p_is_key_frame) {
+/**
+ * Read the header of a frame after its type.
+ */
+static vcodec_status_t read_frame_header(vcodec_dec_ctx_t *p_ctx, frame_header_t *p_header) {
     uint32_t val = 0;
-    vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 1);
-    *p_is_key_frame = (bool)val;
-    //printf("FRM hdr %d\n", val);
+    if (!p_header->is_key_frame) {
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 1);
+        p_header->subpel_filter = val;
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, VCODEC_REF_FRAMES_BITS);
+        p_header->num_short_term = val + 1;
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 1);
+        p_header->long_term = val;
+    }
     return vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
 }
 
@@ -251,3 +538,74 @@ static vcodec_status_t read_macroblock_header(vcodec_dec_ctx_t *p_ctx, vcodec_pr
     //printf("MB hdr %d\n", val);
     return vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
 }
+
+/**
+ * Read a partition tree written by the encoder into @c p_vectors (pre-order), see write_partition() of the encoder.
+ * @param[in,out] p_mv_pred Prediction of the next motion vector, updated to each read vector.
+ * @param[in,out] p_num_vectors Number of entries of @c p_vectors used so far.
+ * Skipped macroblocks get the predicted vector.
+ * @retval VCODEC_STATUS_INVAL if the tree uses a mode the encoder does not produce or a vector points too far outside the reference.
+ */
+static vcodec_status_t read_partition(vcodec_dec_ctx_t *p_ctx, block_motion_vector_t *p_vectors, int x, int y, int block_size, int macroblock_size,
+        motion_vector_t *p_mv_pred, int *p_num_vectors) {
+    block_motion_vector_t *p_vector = p_vectors + (*p_num_vectors)++;
+    uint32_t val = VCODEC_BLOCK_PARTITION_MODE_NONE;
+    if (VCODEC_BLOCK_SIZE != block_size) {
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 1);
+    }
+    p_vector->partition_mode = val;
+    if (VCODEC_BLOCK_PARTITION_MODE_QUAD == p_vector->partition_mode) {
+        const int sub_block_size = block_size / 2;
+        for (int i = 0; i < 4; i++) {
+            const vcodec_status_t ret = read_partition(p_ctx, p_vectors, x + (i % 2) * sub_block_size, y + (i / 2) * sub_block_size, sub_block_size,
+                    macroblock_size, p_mv_pred, p_num_vectors);
+            if (VCODEC_STATUS_OK != ret) {
+                return ret;
+            }
+        }
+        return VCODEC_STATUS_OK;
+    }
+
+    vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 2);
+    p_vector->motion_pred_mode = val;
+    // Intra prediction and skip are only used for whole macroblocks
+    if (VCODEC_MOTION_PREDICTION_MODE_MV != p_vector->motion_pred_mode && block_size != macroblock_size) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (VCODEC_MOTION_PREDICTION_MODE_INTRA == p_vector->motion_pred_mode) {
+        vcodec_bitstream_reader_getbits(p_ctx->bitstream_reader, &val, 2);
+        p_vector->intra_pred_mode = val;
+        p_mv_pred->mvx = 0;
+        p_mv_pred->mvy = 0;
+        return vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
+    }
+    int mvdx = 0;
+    int mvdy = 0;
+    p_vector->ref_idx = 0;
+    if (VCODEC_MOTION_PREDICTION_MODE_MV == p_vector->motion_pred_mode) {
+        const dec_ctx_t *p_dct_ctx = p_ctx->decoder_ctx;
+        if (p_dct_ctx->num_refs > 1) {
+            const uint32_t ref_idx = vcodec_bitstream_reader_read_exp_golomb(p_ctx->bitstream_reader);
+            if (ref_idx >= (uint32_t)p_dct_ctx->num_refs) {
+                return VCODEC_STATUS_INVAL;
+            }
+            p_vector->ref_idx = ref_idx;
+        }
+        vcodec_status_t ret = vcodec_ec_read_signed(p_ctx->bitstream_reader, &mvdx);
+        if (VCODEC_STATUS_OK != ret || VCODEC_STATUS_OK != (ret = vcodec_ec_read_signed(p_ctx->bitstream_reader, &mvdy))) {
+            return ret;
+        }
+    } else if (VCODEC_MOTION_PREDICTION_MODE_SKIP != p_vector->motion_pred_mode) {
+        return VCODEC_STATUS_INVAL;
+    }
+    // Skipped macroblocks take the predicted vector
+    p_vector->mvx = p_mv_pred->mvx + mvdx;
+    p_vector->mvy = p_mv_pred->mvy + mvdy;
+    // Interpolated planes only cover the motion range around the frame
+    if (!vcodec_motion_vector_in_range(x, y, block_size, p_vector->mvx, p_vector->mvy, p_ctx->width, p_ctx->height)) {
+        return VCODEC_STATUS_INVAL;
+    }
+    p_mv_pred->mvx = p_vector->mvx;
+    p_mv_pred->mvy = p_vector->mvy;
+    return vcodec_bitstream_reader_status(p_ctx->bitstream_reader);
+}
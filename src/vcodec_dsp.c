@@ -0,0 +1,275 @@
+#include "vcodec_dsp.h"
+#include "vcodec_transform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline int16_t quant_coeff(int coeff, int i, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    const int level = ((uint32_t)ABS(coeff) * p_quant->mult[i] + rounding) >> p_quant->shift;
+    return coeff < 0 ? -level : level;
+}
+
+/**
+ * Forward transform of one block with the quantizer fed straight from the vertical pass, see forward4x4().
+ */
+static void forward_quant4x4_c(int16_t *p_levels, int16_t *p_block, int stride, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    int tmp[VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE];
+    for (int i = 0; i < VCODEC_BLOCK_SIZE; i++) {
+        const int16_t *p_row = p_block + i * stride;
+        const int t0 = p_row[0] + p_row[3];
+        const int t1 = p_row[1] + p_row[2];
+        const int t2 = p_row[1] - p_row[2];
+        const int t3 = p_row[0] - p_row[3];
+        tmp[i * VCODEC_BLOCK_SIZE + 0] = t0 + t1;
+        tmp[i * VCODEC_BLOCK_SIZE + 1] = (t3 << 1) + t2;
+        tmp[i * VCODEC_BLOCK_SIZE + 2] = t0 - t1;
+        tmp[i * VCODEC_BLOCK_SIZE + 3] = t3 - (t2 << 1);
+    }
+    for (int j = 0; j < VCODEC_BLOCK_SIZE; j++) {
+        const int t0 = tmp[j] + tmp[12 + j];
+        const int t1 = tmp[4 + j] + tmp[8 + j];
+        const int t2 = tmp[4 + j] - tmp[8 + j];
+        const int t3 = tmp[j] - tmp[12 + j];
+        const int coeffs[VCODEC_BLOCK_SIZE] = { t0 + t1, t2 + (t3 << 1), t0 - t1, t3 - (t2 << 1) };
+        for (int i = 0; i < VCODEC_BLOCK_SIZE; i++) {
+            const int k = i * VCODEC_BLOCK_SIZE + j;
+            const int16_t level = quant_coeff(coeffs[i], k, p_quant, rounding);
+            p_levels[k] = level;
+            p_block[i * stride + j] = level * p_quant->step[k];
+        }
+    }
+}
+
+void vcodec_forward_quant_mb_c(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    for (int y = 0; y < macroblock_size; y += VCODEC_BLOCK_SIZE) {
+        for (int x = 0; x < macroblock_size; x += VCODEC_BLOCK_SIZE) {
+            forward_quant4x4_c(p_levels, p_macroblock + y * macroblock_size + x, macroblock_size, p_quant, rounding);
+            p_levels += VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE;
+        }
+    }
+}
+
+#if defined(VCODEC_X86_SIMD)
+void vcodec_forward_quant_mb_sse2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    forward4x4_mb_sse2(p_macroblock, macroblock_size);
+    vcodec_quant_mb_sse2(p_levels, p_macroblock, macroblock_size, p_quant, rounding);
+}
+
+void vcodec_forward_quant_mb_avx2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    forward4x4_mb_avx2(p_macroblock, macroblock_size);
+    vcodec_quant_mb_sse2(p_levels, p_macroblock, macroblock_size, p_quant, rounding);
+}
+#endif
+
+void vcodec_dequant4x4_c(int16_t *p_block, int stride, const int16_t *p_levels, const vcodec_quant_t *p_quant) {
+    for (int i = 0; i < VCODEC_BLOCK_SIZE; i++) {
+        for (int j = 0; j < VCODEC_BLOCK_SIZE; j++) {
+            p_block[i * stride + j] = p_levels[i * VCODEC_BLOCK_SIZE + j] * p_quant->step[i * VCODEC_BLOCK_SIZE + j];
+        }
+    }
+}
+
+int vcodec_block_cost_c(const int16_t *p_block, int block_size) {
+    int sum = 0;
+    for (int i = 0; i < block_size * block_size; i++) {
+        sum += abs(p_block[i]);
+    }
+    return sum;
+}
+
+int vcodec_motion_block_sad_c(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width) {
+    int diff = 0;
+    for (int i = y; i < y + block_size; i++) {
+        for (int j = x; j < x + block_size; j++) {
+            diff += abs(p_source_frame[i * frame_width + j] - p_ref_frame[(i + mvy) * frame_width + j + mvx]);
+        }
+    }
+    return diff;
+}
+
+void vcodec_motion_block_sad_multi_c(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, const motion_vector_t *p_candidates,
+        int num_candidates, int block_size, int frame_width, int *p_costs) {
+    for (int k = 0; k < num_candidates; k++) {
+        p_costs[k] = vcodec_motion_block_sad_c(p_source_frame, p_ref_frame, x, y, p_candidates[k].mvx, p_candidates[k].mvy, block_size, frame_width);
+    }
+}
+
+void vcodec_sad_window4x4_c(const uint8_t *p_source, const uint8_t *p_ref, int stride, int num_dx, int num_dy, int *p_costs) {
+    for (int dy = 0; dy < num_dy; dy++) {
+        for (int dx = 0; dx < num_dx; dx++) {
+            p_costs[dy * num_dx + dx] = vcodec_motion_block_sad_c(p_source, p_ref + dy * stride + dx, 0, 0, 0, 0, 4, stride);
+        }
+    }
+}
+
+void vcodec_downsample2x_c(uint8_t *p_dst, int dst_width, int dst_height, const uint8_t *p_src, int src_width) {
+    for (int i = 0; i < dst_height; i++) {
+        const uint8_t *p_row0 = p_src + 2 * i * src_width;
+        const uint8_t *p_row1 = p_row0 + src_width;
+        for (int j = 0; j < dst_width; j++) {
+            const int left = (p_row0[2 * j] + p_row1[2 * j] + 1) >> 1;
+            const int right = (p_row0[2 * j + 1] + p_row1[2 * j + 1] + 1) >> 1;
+            p_dst[i * dst_width + j] = (left + right + 1) >> 1;
+        }
+    }
+}
+
+void vcodec_reconstruct_c(uint8_t *p_dst, int frame_width, const int16_t *p_block, int block_size) {
+    for (int i = 0; i < block_size; i++) {
+        for (int j = 0; j < block_size; j++) {
+            p_dst[i * frame_width + j] = MAX(MIN(p_block[i * block_size + j], 255), 0);
+        }
+    }
+}
+
+void vcodec_copy_block_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int block_size) {
+    for (int i = 0; i < block_size; i++) {
+        memcpy(p_dst + i * stride, p_src + i * stride, block_size);
+    }
+}
+
+/**
+ * Half-pel sample between p_src[0] and p_src[step].
+ */
+static inline uint8_t interpolate(const uint8_t *p_src, int step, vcodec_subpel_filter_t filter) {
+    if (VCODEC_SUBPEL_FILTER_BILINEAR == filter) {
+        return (p_src[0] + p_src[step] + 1) >> 1;
+    }
+    const int sum = p_src[-2 * step] - 5 * p_src[-step] + 20 * p_src[0] + 20 * p_src[step] - 5 * p_src[2 * step] + p_src[3 * step];
+    return MIN(255, MAX(0, (sum + 16) >> 5));
+}
+
+void vcodec_interpolate_h_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            p_dst[i * stride + j] = interpolate(p_src + i * stride + j, 1, filter);
+        }
+    }
+}
+
+void vcodec_interpolate_v_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            p_dst[i * stride + j] = interpolate(p_src + i * stride + j, stride, filter);
+        }
+    }
+}
+
+void vcodec_average_block_c(uint8_t *p_dst, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size) {
+    for (int i = 0; i < block_size; i++) {
+        for (int j = 0; j < block_size; j++) {
+            p_dst[i * stride + j] = (p_a[i * stride + j] + p_b[i * stride + j] + 1) >> 1;
+        }
+    }
+}
+
+int vcodec_sad_average_c(const uint8_t *p_source, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size) {
+    int sad = 0;
+    for (int i = 0; i < block_size; i++) {
+        for (int j = 0; j < block_size; j++) {
+            sad += abs(p_source[i * stride + j] - ((p_a[i * stride + j] + p_b[i * stride + j] + 1) >> 1));
+        }
+    }
+    return sad;
+}
+
+void vcodec_activity_map_c(uint8_t *p_map, const uint8_t *p_frame, const uint8_t *p_prev_frame, int stride, int width, int height, int threshold) {
+    for (int y = 0; y < height; y += VCODEC_MACROBLOCK_SIZE) {
+        const int rows = MIN(VCODEC_MACROBLOCK_SIZE, height - y);
+        for (int x = 0; x < width; x += VCODEC_MACROBLOCK_SIZE) {
+            const int cols = MIN(VCODEC_MACROBLOCK_SIZE, width - x);
+            int sad = 0;
+            for (int i = y; i < y + rows; i++) {
+                for (int j = x; j < x + cols; j++) {
+                    sad += abs(p_frame[i * stride + j] - p_prev_frame[i * stride + j]);
+                }
+            }
+            *p_map++ = sad > threshold;
+        }
+    }
+}
+
+vcodec_cpu_level_t vcodec_cpu_detect(void) {
+#if defined(VCODEC_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return VCODEC_CPU_LEVEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return VCODEC_CPU_LEVEL_SSE2;
+    }
+#endif
+    return VCODEC_CPU_LEVEL_C;
+}
+
+static vcodec_cpu_level_t cpu_level_from_env(void) {
+    const char *p_level = getenv(VCODEC_CPU_ENV);
+    if (NULL == p_level) {
+        return VCODEC_CPU_LEVEL_AUTO;
+    } else if (0 == strcmp(p_level, "c")) {
+        return VCODEC_CPU_LEVEL_C;
+    } else if (0 == strcmp(p_level, "sse2")) {
+        return VCODEC_CPU_LEVEL_SSE2;
+    } else if (0 == strcmp(p_level, "avx2")) {
+        return VCODEC_CPU_LEVEL_AVX2;
+    }
+    return VCODEC_CPU_LEVEL_AUTO;
+}
+
+vcodec_cpu_level_t vcodec_dsp_init(vcodec_dsp_t *p_dsp, vcodec_cpu_level_t level) {
+    const vcodec_cpu_level_t supported = vcodec_cpu_detect();
+    if (VCODEC_CPU_LEVEL_AUTO == level) {
+        level = cpu_level_from_env();
+    }
+    if (VCODEC_CPU_LEVEL_AUTO == level || level > supported) {
+        level = supported;
+    }
+
+    p_dsp->level = VCODEC_CPU_LEVEL_C;
+    p_dsp->inverse4x4_descale_mb = inverse4x4_descale_mb_c;
+    p_dsp->hadamard4x4 = hadamard4x4;
+    p_dsp->ihadamard4x4 = ihadamard4x4;
+    p_dsp->forward_quant_mb = vcodec_forward_quant_mb_c;
+    p_dsp->dequant4x4 = vcodec_dequant4x4_c;
+    p_dsp->block_cost = vcodec_block_cost_c;
+    p_dsp->sad = vcodec_motion_block_sad_c;
+    p_dsp->sad_multi = vcodec_motion_block_sad_multi_c;
+    p_dsp->sad_window4x4 = vcodec_sad_window4x4_c;
+    p_dsp->downsample2x = vcodec_downsample2x_c;
+    p_dsp->reconstruct = vcodec_reconstruct_c;
+    p_dsp->copy_block = vcodec_copy_block_c;
+    p_dsp->interpolate_h = vcodec_interpolate_h_c;
+    p_dsp->interpolate_v = vcodec_interpolate_v_c;
+    p_dsp->average_block = vcodec_average_block_c;
+    p_dsp->sad_average = vcodec_sad_average_c;
+    p_dsp->activity_map = vcodec_activity_map_c;
+
+#if defined(VCODEC_X86_SIMD)
+    if (level >= VCODEC_CPU_LEVEL_SSE2) {
+        p_dsp->level = VCODEC_CPU_LEVEL_SSE2;
+        p_dsp->inverse4x4_descale_mb = inverse4x4_descale_mb_sse2;
+        p_dsp->forward_quant_mb = vcodec_forward_quant_mb_sse2;
+        p_dsp->dequant4x4 = vcodec_dequant4x4_sse2;
+        p_dsp->hadamard4x4 = hadamard4x4_sse2;
+        p_dsp->ihadamard4x4 = ihadamard4x4_sse2;
+        p_dsp->block_cost = vcodec_block_cost_sse2;
+        p_dsp->sad = vcodec_motion_block_sad_sse2;
+        p_dsp->sad_multi = vcodec_motion_block_sad_multi_sse2;
+        p_dsp->sad_window4x4 = vcodec_sad_window4x4_sse2;
+        p_dsp->downsample2x = vcodec_downsample2x_sse2;
+        p_dsp->reconstruct = vcodec_reconstruct_sse2;
+        p_dsp->copy_block = vcodec_copy_block_sse2;
+        p_dsp->interpolate_h = vcodec_interpolate_h_sse2;
+        p_dsp->interpolate_v = vcodec_interpolate_v_sse2;
+        p_dsp->average_block = vcodec_average_block_sse2;
+        p_dsp->sad_average = vcodec_sad_average_sse2;
+        p_dsp->activity_map = vcodec_activity_map_sse2;
+    }
+    if (level >= VCODEC_CPU_LEVEL_AVX2) {
+        p_dsp->level = VCODEC_CPU_LEVEL_AVX2;
+        p_dsp->inverse4x4_descale_mb = inverse4x4_descale_mb_avx2;
+        p_dsp->forward_quant_mb = vcodec_forward_quant_mb_avx2;
+    }
+#endif
+    return p_dsp->level;
+}
@@ -0,0 +1,147 @@
+#ifndef _VCODEC_DSP_H_
+#define _VCODEC_DSP_H_
+
+#include "vcodec/vcodec.h"
+#include "vcodec_common.h"
+#include "vcodec_quant.h"
+
+/**
+ * Environment variable to force a kernel level when @c cpu_level of the codec context is VCODEC_CPU_LEVEL_AUTO.
+ * Accepted values: "c", "sse2", "avx2".
+ */
+#define VCODEC_CPU_ENV "VCODEC_CPU"
+
+/**
+ * Hot-path kernels of the codec, picked once at init for the running CPU.
+ * Every kernel gives bit-exact results on all levels.
+ */
+struct vcodec_dsp {
+    vcodec_cpu_level_t level;
+
+    // Transform, see vcodec_transform.h
+    void (*inverse4x4_descale_mb)(int16_t *p_macroblock, int macroblock_size);
+    void (*hadamard4x4)(int *tblock, const int *block);
+    void (*ihadamard4x4)(int *block, const int *tblock);
+
+    // Forward transform, quantization and rescaling of a macroblock in place, see vcodec_quant_t.
+    // Raster-order levels of each 4x4 block are written to @c p_levels, 16 per block, blocks in raster order.
+    // Rescaled coefficients are left in the macroblock for reconstruction.
+    void (*forward_quant_mb)(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding);
+    // Rescale levels of one 4x4 block into a macroblock with row stride @c stride
+    void (*dequant4x4)(int16_t *p_block, int stride, const int16_t *p_levels, const vcodec_quant_t *p_quant);
+
+    // Prediction cost: sum of absolute values of a residual block
+    int (*block_cost)(const int16_t *p_block, int block_size);
+
+    // Motion estimation cost of 16x16, 8x8 or 4x4 blocks, for one or several motion vectors
+    compute_motion_block_cost_t sad;
+    compute_motion_block_cost_multi_t sad_multi;
+    // SAD of a 4x4 block against every position of a @c num_dx by @c num_dy window of the reference, both with row stride @c stride.
+    // @c p_ref points to the top left position, costs are written in raster order of the window.
+    void (*sad_window4x4)(const uint8_t *p_source, const uint8_t *p_ref, int stride, int num_dx, int num_dy, int *p_costs);
+    // Halve a plane in both directions, each output pixel being the rounded average of a 2x2 input block:
+    // rows are averaged first, then columns, with (a + b + 1) >> 1 at each step
+    void (*downsample2x)(uint8_t *p_dst, int dst_width, int dst_height, const uint8_t *p_src, int src_width);
+
+    // Reconstruction: clamp a block to 8 bits and store it into a frame with stride @c frame_width
+    void (*reconstruct)(uint8_t *p_dst, int frame_width, const int16_t *p_block, int block_size);
+    // Motion compensation of a skipped macroblock: copy a block between two frames with row stride @c stride.
+    // @c p_dst is aligned to the block size (16 bytes at most), as every macroblock of a vcodec_frame_t is.
+    void (*copy_block)(uint8_t *p_dst, const uint8_t *p_src, int stride, int block_size);
+
+    // Half-pel interpolation of a @c width by @c height area, horizontally (between p_src[x] and p_src[x + 1]) or vertically
+    // (between rows y and y + 1). The 6-tap filter reads 2 samples before and 3 after, the bilinear one the two neighbours.
+    void (*interpolate_h)(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+    void (*interpolate_v)(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+    // Quarter-pel prediction: rounded average (a + b + 1) >> 1 of two blocks with row stride @c stride
+    void (*average_block)(uint8_t *p_dst, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+    // SAD of a source block against the rounded average of two blocks, all with row stride @c stride
+    int (*sad_average)(const uint8_t *p_source, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+
+    // Change map of a frame against the previous one, both @c width by @c height with row stride @c stride:
+    // one entry per macroblock in raster order, 1 if the SAD of its pixels inside the picture exceeds @c threshold, 0 otherwise.
+    // Rows of both frames are 16-byte aligned, as in a vcodec_frame_t.
+    void (*activity_map)(uint8_t *p_map, const uint8_t *p_frame, const uint8_t *p_prev_frame, int stride, int width, int height, int threshold);
+};
+
+/**
+ * Highest kernel level supported by the running CPU.
+ */
+vcodec_cpu_level_t vcodec_cpu_detect(void);
+
+/**
+ * Fill @c p_dsp with kernels of the given level.
+ * VCODEC_CPU_LEVEL_AUTO picks the level from VCODEC_CPU_ENV, or the highest supported one.
+ * A forced level is lowered to what the running CPU supports.
+ * @return Level actually used.
+ */
+vcodec_cpu_level_t vcodec_dsp_init(vcodec_dsp_t *p_dsp, vcodec_cpu_level_t level);
+
+void vcodec_forward_quant_mb_c(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding);
+
+void vcodec_dequant4x4_c(int16_t *p_block, int stride, const int16_t *p_levels, const vcodec_quant_t *p_quant);
+
+int vcodec_block_cost_c(const int16_t *p_block, int block_size);
+
+int vcodec_motion_block_sad_c(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width);
+
+void vcodec_motion_block_sad_multi_c(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, const motion_vector_t *p_candidates,
+        int num_candidates, int block_size, int frame_width, int *p_costs);
+
+void vcodec_sad_window4x4_c(const uint8_t *p_source, const uint8_t *p_ref, int stride, int num_dx, int num_dy, int *p_costs);
+
+void vcodec_downsample2x_c(uint8_t *p_dst, int dst_width, int dst_height, const uint8_t *p_src, int src_width);
+
+void vcodec_reconstruct_c(uint8_t *p_dst, int frame_width, const int16_t *p_block, int block_size);
+
+void vcodec_copy_block_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int block_size);
+
+void vcodec_interpolate_h_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+
+void vcodec_interpolate_v_c(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+
+void vcodec_average_block_c(uint8_t *p_dst, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+
+int vcodec_sad_average_c(const uint8_t *p_source, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+
+void vcodec_activity_map_c(uint8_t *p_map, const uint8_t *p_frame, const uint8_t *p_prev_frame, int stride, int width, int height, int threshold);
+
+#if defined(VCODEC_X86_SIMD)
+void vcodec_forward_quant_mb_sse2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding);
+
+void vcodec_forward_quant_mb_avx2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding);
+
+/**
+ * Quantization and rescaling part of forward_quant_mb, for coefficients already transformed in place.
+ */
+void vcodec_quant_mb_sse2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding);
+
+void vcodec_dequant4x4_sse2(int16_t *p_block, int stride, const int16_t *p_levels, const vcodec_quant_t *p_quant);
+
+int vcodec_block_cost_sse2(const int16_t *p_block, int block_size);
+
+int vcodec_motion_block_sad_sse2(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width);
+
+void vcodec_motion_block_sad_multi_sse2(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, const motion_vector_t *p_candidates,
+        int num_candidates, int block_size, int frame_width, int *p_costs);
+
+void vcodec_sad_window4x4_sse2(const uint8_t *p_source, const uint8_t *p_ref, int stride, int num_dx, int num_dy, int *p_costs);
+
+void vcodec_downsample2x_sse2(uint8_t *p_dst, int dst_width, int dst_height, const uint8_t *p_src, int src_width);
+
+void vcodec_reconstruct_sse2(uint8_t *p_dst, int frame_width, const int16_t *p_block, int block_size);
+
+void vcodec_copy_block_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int block_size);
+
+void vcodec_interpolate_h_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+
+void vcodec_interpolate_v_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter);
+
+void vcodec_average_block_sse2(uint8_t *p_dst, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+
+int vcodec_sad_average_sse2(const uint8_t *p_source, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size);
+
+void vcodec_activity_map_sse2(uint8_t *p_map, const uint8_t *p_frame, const uint8_t *p_prev_frame, int stride, int width, int height, int threshold);
+#endif
+
+#endif // _VCODEC_DSP_H_
@@ -0,0 +1,321 @@
+/**
+ * SSE2 versions of the quantization, prediction cost, motion estimation, interpolation and reconstruction kernels, see vcodec_dsp.h.
+ */
+
+#include "vcodec_dsp.h"
+
+#include <emmintrin.h>
+#include <string.h>
+
+/**
+ * Load two rows of a 4x4 block into one register.
+ */
+static inline __m128i load_rows4x2_epi16(const int16_t *p_block, int stride) {
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p_block), _mm_loadl_epi64((const __m128i *)(p_block + stride)));
+}
+
+static inline void store_rows4x2_epi16(int16_t *p_block, int stride, __m128i v) {
+    _mm_storel_epi64((__m128i *)p_block, v);
+    _mm_storel_epi64((__m128i *)(p_block + stride), _mm_srli_si128(v, 8));
+}
+
+/**
+ * Dead zone quantization of 8 coefficients, see vcodec_quant_t.
+ * |c| * mult is computed in 32 bits from the low and high halves of the 16-bit unsigned product.
+ */
+static inline __m128i quant_epi16(__m128i v, __m128i mult, __m128i rounding, __m128i shift) {
+    const __m128i sign = _mm_srai_epi16(v, 15);
+    const __m128i magnitude = _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+    const __m128i lo = _mm_mullo_epi16(magnitude, mult);
+    const __m128i hi = _mm_mulhi_epu16(magnitude, mult);
+    const __m128i p0 = _mm_srl_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), rounding), shift);
+    const __m128i p1 = _mm_srl_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), rounding), shift);
+    const __m128i level = _mm_packs_epi32(p0, p1);
+    return _mm_sub_epi16(_mm_xor_si128(level, sign), sign);
+}
+
+void vcodec_quant_mb_sse2(int16_t *p_levels, int16_t *p_macroblock, int macroblock_size, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    const __m128i rounding_v = _mm_set1_epi32(rounding);
+    const __m128i shift_v = _mm_cvtsi32_si128(p_quant->shift);
+    const __m128i mult[2] = {
+        _mm_loadu_si128((const __m128i *)p_quant->mult),
+        _mm_loadu_si128((const __m128i *)(p_quant->mult + 8)),
+    };
+    const __m128i step[2] = {
+        _mm_loadu_si128((const __m128i *)p_quant->step),
+        _mm_loadu_si128((const __m128i *)(p_quant->step + 8)),
+    };
+    for (int y = 0; y < macroblock_size; y += VCODEC_BLOCK_SIZE) {
+        for (int x = 0; x < macroblock_size; x += VCODEC_BLOCK_SIZE) {
+            int16_t *p_block = p_macroblock + y * macroblock_size + x;
+            for (int i = 0; i < 2; i++) {
+                int16_t *p_rows = p_block + 2 * i * macroblock_size;
+                const __m128i level = quant_epi16(load_rows4x2_epi16(p_rows, macroblock_size), mult[i], rounding_v, shift_v);
+                _mm_storeu_si128((__m128i *)(p_levels + 8 * i), level);
+                store_rows4x2_epi16(p_rows, macroblock_size, _mm_mullo_epi16(level, step[i]));
+            }
+            p_levels += VCODEC_BLOCK_SIZE * VCODEC_BLOCK_SIZE;
+        }
+    }
+}
+
+void vcodec_dequant4x4_sse2(int16_t *p_block, int stride, const int16_t *p_levels, const vcodec_quant_t *p_quant) {
+    for (int i = 0; i < 2; i++) {
+        const __m128i level = _mm_loadu_si128((const __m128i *)(p_levels + 8 * i));
+        const __m128i step = _mm_loadu_si128((const __m128i *)(p_quant->step + 8 * i));
+        store_rows4x2_epi16(p_block + 2 * i * stride, stride, _mm_mullo_epi16(level, step));
+    }
+}
+
+int vcodec_block_cost_sse2(const int16_t *p_block, int block_size) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    // Block sizes are multiples of 4, so there are always full registers
+    for (int i = 0; i < block_size * block_size; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(p_block + i));
+        const __m128i magnitude = _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(magnitude, ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+/**
+ * Load the i-th 16 pixels of a block in raster order: one row of a 16x16 block, two rows of 8x8 or four rows of 4x4.
+ */
+static inline __m128i load_block_epu8(const uint8_t *p_block, int stride, int block_size, int i) {
+    if (16 == block_size) {
+        return _mm_loadu_si128((const __m128i *)(p_block + i * stride));
+    } else if (8 == block_size) {
+        const uint8_t *p_row = p_block + 2 * i * stride;
+        return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p_row), _mm_loadl_epi64((const __m128i *)(p_row + stride)));
+    }
+    int rows[4];
+    for (int j = 0; j < 4; j++) {
+        memcpy(&rows[j], p_block + j * stride, sizeof(rows[j]));
+    }
+    const __m128i rows01 = _mm_unpacklo_epi32(_mm_cvtsi32_si128(rows[0]), _mm_cvtsi32_si128(rows[1]));
+    const __m128i rows23 = _mm_unpacklo_epi32(_mm_cvtsi32_si128(rows[2]), _mm_cvtsi32_si128(rows[3]));
+    return _mm_unpacklo_epi64(rows01, rows23);
+}
+
+static inline int sad_block_epu8(const __m128i *p_source, const uint8_t *p_ref, int block_size, int frame_width) {
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < block_size * block_size / 16; i++) {
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(p_source[i], load_block_epu8(p_ref, frame_width, block_size, i)));
+    }
+    return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_srli_si128(sum, 8)));
+}
+
+int vcodec_motion_block_sad_sse2(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width) {
+    motion_vector_t candidate = { .mvx = mvx, .mvy = mvy };
+    int sad;
+    vcodec_motion_block_sad_multi_sse2(p_source_frame, p_ref_frame, x, y, &candidate, 1, block_size, frame_width, &sad);
+    return sad;
+}
+
+void vcodec_motion_block_sad_multi_sse2(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, const motion_vector_t *p_candidates,
+        int num_candidates, int block_size, int frame_width, int *p_costs) {
+    // Source block is loaded once for all candidates
+    __m128i source[VCODEC_MACROBLOCK_SIZE];
+    const uint8_t *p_source = p_source_frame + y * frame_width + x;
+    for (int i = 0; i < block_size * block_size / 16; i++) {
+        source[i] = load_block_epu8(p_source, frame_width, block_size, i);
+    }
+    for (int k = 0; k < num_candidates; k++) {
+        const uint8_t *p_ref = p_ref_frame + (y + p_candidates[k].mvy) * frame_width + x + p_candidates[k].mvx;
+        p_costs[k] = sad_block_epu8(source, p_ref, block_size, frame_width);
+    }
+}
+
+void vcodec_sad_window4x4_sse2(const uint8_t *p_source, const uint8_t *p_ref, int stride, int num_dx, int num_dy, int *p_costs) {
+    // Each source pixel is broadcast and compared against 16 horizontal positions at once
+    __m128i source[4 * 4];
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < 4; k++) {
+            source[i * 4 + k] = _mm_set1_epi8(p_source[i * stride + k]);
+        }
+    }
+    const __m128i zero = _mm_setzero_si128();
+    int dx = 0;
+    for (; dx + 16 <= num_dx; dx += 16) {
+        for (int dy = 0; dy < num_dy; dy++) {
+            // 16 absolute differences of 8 bits add up to 4080 at most, so 16-bit sums do not overflow
+            __m128i sum_lo = zero;
+            __m128i sum_hi = zero;
+            for (int i = 0; i < 4; i++) {
+                const uint8_t *p_row = p_ref + (dy + i) * stride + dx;
+                for (int k = 0; k < 4; k++) {
+                    const __m128i r = _mm_loadu_si128((const __m128i *)(p_row + k));
+                    const __m128i s = source[i * 4 + k];
+                    const __m128i diff = _mm_or_si128(_mm_subs_epu8(r, s), _mm_subs_epu8(s, r));
+                    sum_lo = _mm_add_epi16(sum_lo, _mm_unpacklo_epi8(diff, zero));
+                    sum_hi = _mm_add_epi16(sum_hi, _mm_unpackhi_epi8(diff, zero));
+                }
+            }
+            int *p_row_costs = p_costs + dy * num_dx + dx;
+            _mm_storeu_si128((__m128i *)p_row_costs, _mm_unpacklo_epi16(sum_lo, zero));
+            _mm_storeu_si128((__m128i *)(p_row_costs + 4), _mm_unpackhi_epi16(sum_lo, zero));
+            _mm_storeu_si128((__m128i *)(p_row_costs + 8), _mm_unpacklo_epi16(sum_hi, zero));
+            _mm_storeu_si128((__m128i *)(p_row_costs + 12), _mm_unpackhi_epi16(sum_hi, zero));
+        }
+    }
+    for (; dx < num_dx; dx++) {
+        for (int dy = 0; dy < num_dy; dy++) {
+            p_costs[dy * num_dx + dx] = vcodec_motion_block_sad_sse2(p_source, p_ref + dy * stride + dx, 0, 0, 0, 0, 4, stride);
+        }
+    }
+}
+
+void vcodec_downsample2x_sse2(uint8_t *p_dst, int dst_width, int dst_height, const uint8_t *p_src, int src_width) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    for (int i = 0; i < dst_height; i++) {
+        const uint8_t *p_row0 = p_src + 2 * i * src_width;
+        const uint8_t *p_row1 = p_row0 + src_width;
+        uint8_t *p_dst_row = p_dst + i * dst_width;
+        int j = 0;
+        // 16 input pixels of each row give 8 output pixels
+        for (; j + 8 <= dst_width; j += 8) {
+            const __m128i rows = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(p_row0 + 2 * j)), _mm_loadu_si128((const __m128i *)(p_row1 + 2 * j)));
+            const __m128i even = _mm_and_si128(rows, low_bytes);
+            const __m128i odd = _mm_srli_epi16(rows, 8);
+            const __m128i avg = _mm_avg_epu16(even, odd);
+            _mm_storel_epi64((__m128i *)(p_dst_row + j), _mm_packus_epi16(avg, avg));
+        }
+        if (j < dst_width) {
+            vcodec_downsample2x_c(p_dst_row + j, dst_width - j, 1, p_row0 + 2 * j, src_width);
+        }
+    }
+}
+
+void vcodec_reconstruct_sse2(uint8_t *p_dst, int frame_width, const int16_t *p_block, int block_size) {
+    for (int i = 0; i < block_size; i++) {
+        const int16_t *p_row = p_block + i * block_size;
+        uint8_t *p_dst_row = p_dst + i * frame_width;
+        if (4 == block_size) {
+            const __m128i v = _mm_loadl_epi64((const __m128i *)p_row);
+            const int pixels = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+            memcpy(p_dst_row, &pixels, sizeof(pixels));
+            continue;
+        }
+        for (int j = 0; j < block_size; j += 8) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(p_row + j));
+            _mm_storel_epi64((__m128i *)(p_dst_row + j), _mm_packus_epi16(v, v));
+        }
+    }
+}
+
+void vcodec_copy_block_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int block_size) {
+    if (16 == block_size) {
+        for (int i = 0; i < 16; i++) {
+            _mm_store_si128((__m128i *)(p_dst + i * stride), _mm_loadu_si128((const __m128i *)(p_src + i * stride)));
+        }
+    } else if (8 == block_size) {
+        for (int i = 0; i < 8; i++) {
+            _mm_storel_epi64((__m128i *)(p_dst + i * stride), _mm_loadl_epi64((const __m128i *)(p_src + i * stride)));
+        }
+    } else {
+        vcodec_copy_block_c(p_dst, p_src, stride, block_size);
+    }
+}
+
+/**
+ * 6-tap filter of 8 samples widened to 16 bits, @c p_src pointing to the third tap.
+ * Intermediate sums are within [-2550, 10726], so they fit 16 bits.
+ */
+static inline __m128i filter6_epi16(const uint8_t *p_src, int step) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i taps[6];
+    for (int i = 0; i < 6; i++) {
+        taps[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p_src + (i - 2) * step)), zero);
+    }
+    const __m128i outer = _mm_add_epi16(taps[0], taps[5]);
+    const __m128i middle = _mm_mullo_epi16(_mm_add_epi16(taps[1], taps[4]), _mm_set1_epi16(5));
+    const __m128i inner = _mm_mullo_epi16(_mm_add_epi16(taps[2], taps[3]), _mm_set1_epi16(20));
+    const __m128i sum = _mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(outer, inner), middle), _mm_set1_epi16(16));
+    return _mm_srai_epi16(sum, 5);
+}
+
+/**
+ * Shared by both directions, @c step is the distance between the taps.
+ */
+static inline void interpolate_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int full_width, int height, vcodec_subpel_filter_t filter, int step) {
+    for (int i = 0; i < height; i++) {
+        const uint8_t *p_row = p_src + i * stride;
+        uint8_t *p_dst_row = p_dst + i * stride;
+        for (int j = 0; j < full_width; j += 16) {
+            __m128i v;
+            if (VCODEC_SUBPEL_FILTER_BILINEAR == filter) {
+                v = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(p_row + j)), _mm_loadu_si128((const __m128i *)(p_row + j + step)));
+            } else {
+                v = _mm_packus_epi16(filter6_epi16(p_row + j, step), filter6_epi16(p_row + j + 8, step));
+            }
+            _mm_storeu_si128((__m128i *)(p_dst_row + j), v);
+        }
+    }
+}
+
+void vcodec_interpolate_h_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter) {
+    const int full_width = width & ~15;
+    interpolate_sse2(p_dst, p_src, stride, full_width, height, filter, 1);
+    if (full_width < width) {
+        vcodec_interpolate_h_c(p_dst + full_width, p_src + full_width, stride, width - full_width, height, filter);
+    }
+}
+
+void vcodec_interpolate_v_sse2(uint8_t *p_dst, const uint8_t *p_src, int stride, int width, int height, vcodec_subpel_filter_t filter) {
+    const int full_width = width & ~15;
+    interpolate_sse2(p_dst, p_src, stride, full_width, height, filter, stride);
+    if (full_width < width) {
+        vcodec_interpolate_v_c(p_dst + full_width, p_src + full_width, stride, width - full_width, height, filter);
+    }
+}
+
+void vcodec_average_block_sse2(uint8_t *p_dst, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size) {
+    if (16 == block_size) {
+        for (int i = 0; i < 16; i++) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(p_a + i * stride));
+            const __m128i b = _mm_loadu_si128((const __m128i *)(p_b + i * stride));
+            _mm_storeu_si128((__m128i *)(p_dst + i * stride), _mm_avg_epu8(a, b));
+        }
+    } else if (8 == block_size) {
+        for (int i = 0; i < 8; i++) {
+            const __m128i a = _mm_loadl_epi64((const __m128i *)(p_a + i * stride));
+            const __m128i b = _mm_loadl_epi64((const __m128i *)(p_b + i * stride));
+            _mm_storel_epi64((__m128i *)(p_dst + i * stride), _mm_avg_epu8(a, b));
+        }
+    } else {
+        vcodec_average_block_c(p_dst, p_a, p_b, stride, block_size);
+    }
+}
+
+int vcodec_sad_average_sse2(const uint8_t *p_source, const uint8_t *p_a, const uint8_t *p_b, int stride, int block_size) {
+    __m128i sad = _mm_setzero_si128();
+    for (int i = 0; i < block_size * block_size / 16; i++) {
+        const __m128i average = _mm_avg_epu8(load_block_epu8(p_a, stride, block_size, i), load_block_epu8(p_b, stride, block_size, i));
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(load_block_epu8(p_source, stride, block_size, i), average));
+    }
+    return _mm_cvtsi128_si32(_mm_add_epi64(sad, _mm_srli_si128(sad, 8)));
+}
+
+void vcodec_activity_map_sse2(uint8_t *p_map, const uint8_t *p_frame, const uint8_t *p_prev_frame, int stride, int width, int height, int threshold) {
+    const int full_width = width / VCODEC_MACROBLOCK_SIZE * VCODEC_MACROBLOCK_SIZE;
+    for (int y = 0; y < height; y += VCODEC_MACROBLOCK_SIZE) {
+        const int rows = MIN(VCODEC_MACROBLOCK_SIZE, height - y);
+        for (int x = 0; x < full_width; x += VCODEC_MACROBLOCK_SIZE) {
+            __m128i sad = _mm_setzero_si128();
+            for (int i = y; i < y + rows; i++) {
+                const __m128i a = _mm_load_si128((const __m128i *)(p_frame + i * stride + x));
+                const __m128i b = _mm_load_si128((const __m128i *)(p_prev_frame + i * stride + x));
+                sad = _mm_add_epi64(sad, _mm_sad_epu8(a, b));
+            }
+            *p_map++ = _mm_cvtsi128_si32(_mm_add_epi64(sad, _mm_srli_si128(sad, 8))) > threshold;
+        }
+        // Last macroblock of a row is narrower if the width is not a multiple of the macroblock size
+        if (full_width < width) {
+            vcodec_activity_map_c(p_map++, p_frame + y * stride + full_width, p_prev_frame + y * stride + full_width, stride, width - full_width,
+                    rows, threshold);
+        }
+    }
+}
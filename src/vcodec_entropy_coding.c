@@ -3,7 +3,7 @@
 #include <stdlib.h>
 #include "vcodec/bitstream.h"
 
-void vcodec_ec_write_coeffs(vcodec_bitstream_writer_t *p_bitstream_writer, const int *p_coeffs, int count) {
+void vcodec_ec_write_coeffs(vcodec_bitstream_writer_t *p_bitstream_writer, const int16_t *p_coeffs, int count) {
     int num_zeroes = 0;
     uint32_t sign_buffer = 0;
     int sign_buffer_size = 0;
@@ -26,7 +26,7 @@ void vcodec_ec_write_coeffs(vcodec_bitstream_writer_t *p_bitstream_writer, const
     vcodec_bitstream_writer_putbits(p_bitstream_writer, sign_buffer, sign_buffer_size);
 }
 
-vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_reader, int *p_coeffs, int count) {
+vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_reader, int16_t *p_coeffs, int count) {
     int num_zeroes = 0;
     uint32_t sign_buffer = 0;
     uint32_t sign_buffer_size = 0;
@@ -43,7 +43,11 @@ vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_rea
         if (count == 0) {
             break;
         }
-        p_coeffs[count - 1] = vcodec_bitstream_reader_read_exp_golomb(p_bitstream_reader) + 1;
+        const uint32_t magnitude_minus1 = vcodec_bitstream_reader_read_exp_golomb(p_bitstream_reader);
+        if (magnitude_minus1 >= INT16_MAX) {
+            return VCODEC_STATUS_INVAL;
+        }
+        p_coeffs[count - 1] = magnitude_minus1 + 1;
         sign_buffer_size++;
         count--;
     }
@@ -56,3 +60,16 @@ vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_rea
     }
     return vcodec_bitstream_reader_status(p_bitstream_reader);
 }
+
+void vcodec_ec_write_signed(vcodec_bitstream_writer_t *p_bitstream_writer, int value) {
+    vcodec_bitstream_writer_write_exp_golomb(p_bitstream_writer, value > 0 ? 2 * (uint32_t)value - 1 : 2 * (uint32_t)-value);
+}
+
+vcodec_status_t vcodec_ec_read_signed(vcodec_bitstream_reader_t *p_bitstream_reader, int *p_value) {
+    const uint32_t code = vcodec_bitstream_reader_read_exp_golomb(p_bitstream_reader);
+    if (code > INT16_MAX) {
+        return VCODEC_STATUS_INVAL;
+    }
+    *p_value = code & 1 ? (int)(code + 1) / 2 : -(int)(code / 2);
+    return vcodec_bitstream_reader_status(p_bitstream_reader);
+}
@@ -8,9 +8,21 @@ typedef struct vcodec_bitstream_reader vcodec_bitstream_reader_t;
 /**
  * Write coefficient block of size @c count from @c p_coeffs into bitstream represented by @c p_bitstream_writer.
  */
-void vcodec_ec_write_coeffs(vcodec_bitstream_writer_t *p_bitstream_writer, const int *p_coeffs, int count);
+void vcodec_ec_write_coeffs(vcodec_bitstream_writer_t *p_bitstream_writer, const int16_t *p_coeffs, int count);
 
 /**
  * Read coefficient block of size @c count into @c p_coeffs from bitstream represented by @c p_bitstream_reader.
+ * @retval VCODEC_STATUS_INVAL if the block is malformed or a coefficient does not fit into 16 bits.
  */
-vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_reader, int *p_coeffs, int count);
+vcodec_status_t vcodec_ec_read_coeffs(vcodec_bitstream_reader_t *p_bitstream_reader, int16_t *p_coeffs, int count);
+
+/**
+ * Write a signed value (a motion vector difference) as the exp-Golomb code of 2v - 1 for positive values and -2v for the others.
+ */
+void vcodec_ec_write_signed(vcodec_bitstream_writer_t *p_bitstream_writer, int value);
+
+/**
+ * Read a value written by vcodec_ec_write_signed().
+ * @retval VCODEC_STATUS_INVAL if the value does not fit into 16 bits.
+ */
+vcodec_status_t vcodec_ec_read_signed(vcodec_bitstream_reader_t *p_bitstream_reader, int *p_value);
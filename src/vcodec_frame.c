@@ -0,0 +1,52 @@
+#include "vcodec_frame.h"
+
+#include <string.h>
+
+vcodec_status_t vcodec_frame_init(vcodec_frame_t *p_frame, int width, int height, vcodec_alloc_t alloc) {
+    // Left and right borders of adjacent rows share the gap between the rows, so it has to fit both
+    const int stride = (width + 2 * VCODEC_FRAME_BORDER + VCODEC_FRAME_ALIGNMENT - 1) & ~(VCODEC_FRAME_ALIGNMENT - 1);
+    p_frame->p_allocation = alloc((size_t)stride * (height + 2 * VCODEC_FRAME_BORDER) + VCODEC_FRAME_ALIGNMENT - 1);
+    if (NULL == p_frame->p_allocation) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    const uintptr_t origin = (uintptr_t)p_frame->p_allocation + (uintptr_t)stride * VCODEC_FRAME_BORDER + VCODEC_FRAME_BORDER;
+    p_frame->p_data = (uint8_t *)((origin + VCODEC_FRAME_ALIGNMENT - 1) & ~(uintptr_t)(VCODEC_FRAME_ALIGNMENT - 1));
+    p_frame->stride = stride;
+    p_frame->width = width;
+    p_frame->height = height;
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_frame_free(vcodec_frame_t *p_frame, vcodec_free_t free) {
+    free(p_frame->p_allocation);
+    p_frame->p_allocation = NULL;
+    p_frame->p_data = NULL;
+}
+
+void vcodec_frame_copy_from(vcodec_frame_t *p_frame, const uint8_t *p_src) {
+    for (int i = 0; i < p_frame->height; i++) {
+        memcpy(p_frame->p_data + i * p_frame->stride, p_src + i * p_frame->width, p_frame->width);
+    }
+}
+
+void vcodec_frame_copy_to(const vcodec_frame_t *p_frame, uint8_t *p_dst) {
+    for (int i = 0; i < p_frame->height; i++) {
+        memcpy(p_dst + i * p_frame->width, p_frame->p_data + i * p_frame->stride, p_frame->width);
+    }
+}
+
+void vcodec_frame_extend_border(vcodec_frame_t *p_frame) {
+    const int stride = p_frame->stride;
+    for (int i = 0; i < p_frame->height; i++) {
+        uint8_t *p_row = p_frame->p_data + i * stride;
+        memset(p_row - VCODEC_FRAME_BORDER, p_row[0], VCODEC_FRAME_BORDER);
+        memset(p_row + p_frame->width, p_row[p_frame->width - 1], VCODEC_FRAME_BORDER);
+    }
+    // Top and bottom rows are copied with their left and right borders
+    const uint8_t *p_top = p_frame->p_data - VCODEC_FRAME_BORDER;
+    const uint8_t *p_bottom = p_top + (p_frame->height - 1) * stride;
+    for (int i = 1; i <= VCODEC_FRAME_BORDER; i++) {
+        memcpy((uint8_t *)p_top - i * stride, p_top, p_frame->width + 2 * VCODEC_FRAME_BORDER);
+        memcpy((uint8_t *)p_bottom + i * stride, p_bottom, p_frame->width + 2 * VCODEC_FRAME_BORDER);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+
+#include <stdint.h>
+
+/**
+ * Width of the replicated border around frames, in pixels.
+ * Motion vectors can move a block this far outside the picture.
+ */
+#define VCODEC_FRAME_BORDER 32
+
+/**
+ * Alignment of frame rows, one cache line.
+ */
+#define VCODEC_FRAME_ALIGNMENT 64
+
+/**
+ * Luma plane surrounded by a VCODEC_FRAME_BORDER pixel border.
+ * The stride is a multiple of VCODEC_FRAME_ALIGNMENT and every row of the picture starts on a VCODEC_FRAME_ALIGNMENT boundary.
+ */
+typedef struct {
+    uint8_t *p_data; //< Top left pixel of the picture
+    int stride;
+    int width;
+    int height;
+    void *p_allocation; //< Pointer returned by alloc, before alignment
+} vcodec_frame_t;
+
+vcodec_status_t vcodec_frame_init(vcodec_frame_t *p_frame, int width, int height, vcodec_alloc_t alloc);
+
+void vcodec_frame_free(vcodec_frame_t *p_frame, vcodec_free_t free);
+
+/**
+ * Copy a picture with rows of @c width pixels into the frame. The border is left as is.
+ */
+void vcodec_frame_copy_from(vcodec_frame_t *p_frame, const uint8_t *p_src);
+
+/**
+ * Copy the picture out of the frame into rows of @c width pixels.
+ */
+void vcodec_frame_copy_to(const vcodec_frame_t *p_frame, uint8_t *p_dst);
+
+/**
+ * Fill the border by replicating the edge pixels of the picture.
+ */
+void vcodec_frame_extend_border(vcodec_frame_t *p_frame);
@@ -0,0 +1,162 @@
+#include "vcodec/vcodec.h"
+#include "vcodec_common.h"
+
+#include <pthread.h>
+#include <string.h>
+
+typedef struct vcodec_packet_pool vcodec_packet_pool_t;
+
+/**
+ * Packet of vcodec_enc_encode_packet() with the output buffer it keeps between uses.
+ */
+typedef struct vcodec_pool_packet {
+    vcodec_packet_t packet; //< First, so that the pointer given to the application converts back
+    uint8_t *p_buffer;
+    size_t buffer_size;
+    vcodec_packet_pool_t *p_pool;
+    struct vcodec_pool_packet *p_next; //< Next free packet
+} vcodec_pool_packet_t;
+
+/**
+ * Packets are allocated on demand and kept on a free list once released, so their number settles at the most packets held
+ * at once, and each buffer at the size of the largest frame coded into it.
+ */
+struct vcodec_packet_pool {
+    pthread_mutex_t lock;
+    vcodec_pool_packet_t *p_free;
+    int num_held; //< Packets owned by the application
+    bool closed;  //< Encoder is deinitialized, the last packet to be released frees the pool
+    vcodec_alloc_t alloc;
+    vcodec_free_t free;
+};
+
+/**
+ * Free the pool and its free packets, with the lock held and no packet owned by the application.
+ */
+static void pool_free(vcodec_packet_pool_t *p_pool) {
+    while (NULL != p_pool->p_free) {
+        vcodec_pool_packet_t *p_packet = p_pool->p_free;
+        p_pool->p_free = p_packet->p_next;
+        if (NULL != p_packet->p_buffer) {
+            p_pool->free(p_packet->p_buffer);
+        }
+        p_pool->free(p_packet);
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+    pthread_mutex_destroy(&p_pool->lock);
+    p_pool->free(p_pool);
+}
+
+static vcodec_packet_pool_t *pool_get(vcodec_enc_ctx_t *p_ctx) {
+    if (NULL != p_ctx->packet_pool) {
+        return p_ctx->packet_pool;
+    }
+    vcodec_packet_pool_t *p_pool = p_ctx->alloc(sizeof(vcodec_packet_pool_t));
+    if (NULL == p_pool) {
+        return NULL;
+    }
+    memset(p_pool, 0, sizeof(*p_pool));
+    if (0 != pthread_mutex_init(&p_pool->lock, NULL)) {
+        p_ctx->free(p_pool);
+        return NULL;
+    }
+    p_pool->alloc = p_ctx->alloc;
+    p_pool->free = p_ctx->free;
+    p_ctx->packet_pool = p_pool;
+    return p_pool;
+}
+
+/**
+ * Take a free packet, or allocate one without a buffer.
+ */
+static vcodec_pool_packet_t *pool_acquire(vcodec_packet_pool_t *p_pool) {
+    pthread_mutex_lock(&p_pool->lock);
+    vcodec_pool_packet_t *p_packet = p_pool->p_free;
+    if (NULL != p_packet) {
+        p_pool->p_free = p_packet->p_next;
+    }
+    p_pool->num_held++;
+    pthread_mutex_unlock(&p_pool->lock);
+    if (NULL == p_packet) {
+        p_packet = p_pool->alloc(sizeof(vcodec_pool_packet_t));
+        if (NULL == p_packet) {
+            pthread_mutex_lock(&p_pool->lock);
+            p_pool->num_held--;
+            pthread_mutex_unlock(&p_pool->lock);
+            return NULL;
+        }
+        memset(p_packet, 0, sizeof(*p_packet));
+        p_packet->p_pool = p_pool;
+    }
+    return p_packet;
+}
+
+vcodec_status_t vcodec_enc_encode_packet(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int64_t pts, vcodec_packet_t **pp_packet) {
+    *pp_packet = NULL;
+    if (NULL != p_ctx->write || !p_ctx->out_buffer_grow || NULL != p_ctx->async_ctx) {
+        return VCODEC_STATUS_INVAL;
+    }
+    vcodec_packet_pool_t *p_pool = pool_get(p_ctx);
+    if (NULL == p_pool) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    vcodec_pool_packet_t *p_packet = pool_acquire(p_pool);
+    if (NULL == p_packet) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    uint8_t *p_out_buffer = p_ctx->p_out_buffer;
+    const size_t out_buffer_size = p_ctx->out_buffer_size;
+    p_ctx->p_out_buffer = p_packet->p_buffer;
+    p_ctx->out_buffer_size = p_packet->buffer_size;
+    const vcodec_status_t ret = p_ctx->process_frame(p_ctx, p_frame);
+    // Packet keeps the buffer even on error, it might have been replaced by a larger one
+    p_packet->p_buffer = p_ctx->p_out_buffer;
+    p_packet->buffer_size = p_ctx->out_buffer_size;
+    p_ctx->p_out_buffer = p_out_buffer;
+    p_ctx->out_buffer_size = out_buffer_size;
+    p_packet->packet = (vcodec_packet_t){
+        .p_data = p_packet->p_buffer,
+        .size = p_ctx->out_size,
+        .frame_type = p_ctx->out_frame_type,
+        .pts = pts,
+        .status = ret,
+    };
+    if (VCODEC_STATUS_OK != ret) {
+        vcodec_packet_release(&p_packet->packet);
+        return ret;
+    }
+    *pp_packet = &p_packet->packet;
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_packet_release(vcodec_packet_t *p_packet) {
+    if (NULL == p_packet) {
+        return;
+    }
+    vcodec_pool_packet_t *p_pool_packet = (vcodec_pool_packet_t *)p_packet;
+    vcodec_packet_pool_t *p_pool = p_pool_packet->p_pool;
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool_packet->p_next = p_pool->p_free;
+    p_pool->p_free = p_pool_packet;
+    p_pool->num_held--;
+    if (p_pool->closed && 0 == p_pool->num_held) {
+        pool_free(p_pool);
+        return;
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+}
+
+void vcodec_packet_pool_close(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_packet_pool_t *p_pool = p_ctx->packet_pool;
+    p_ctx->packet_pool = NULL;
+    if (NULL == p_pool) {
+        return;
+    }
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->closed = true;
+    if (0 == p_pool->num_held) {
+        pool_free(p_pool);
+        return;
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+}
@@ -0,0 +1,81 @@
+#include "vcodec_picture.h"
+
+#include <string.h>
+
+vcodec_status_t vcodec_picture_pool_init(vcodec_picture_pool_t *p_pool, int width, int height, int max_short_term, bool long_term, vcodec_alloc_t alloc) {
+    memset(p_pool, 0, sizeof(*p_pool));
+    if (max_short_term < 1 || max_short_term > VCODEC_MAX_REF_FRAMES) {
+        return VCODEC_STATUS_INVAL;
+    }
+    p_pool->max_short_term = max_short_term;
+    // Frame being reconstructed comes on top of the references
+    p_pool->num_pictures = max_short_term + (long_term ? 1 : 0) + 1;
+    for (int i = 0; i < p_pool->num_pictures; i++) {
+        vcodec_picture_t *p_picture = &p_pool->pictures[i];
+        if (VCODEC_STATUS_OK != vcodec_frame_init(&p_picture->frame, width, height, alloc)
+                || VCODEC_STATUS_OK != vcodec_subpel_init(&p_picture->subpel, width, height, alloc)) {
+            return VCODEC_STATUS_NOMEM;
+        }
+    }
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_picture_pool_free(vcodec_picture_pool_t *p_pool, vcodec_free_t free) {
+    for (int i = 0; i < p_pool->num_pictures; i++) {
+        vcodec_picture_t *p_picture = &p_pool->pictures[i];
+        if (NULL != p_picture->frame.p_allocation) {
+            vcodec_frame_free(&p_picture->frame, free);
+        }
+        vcodec_subpel_free(&p_picture->subpel, free);
+    }
+}
+
+vcodec_picture_t *vcodec_picture_pool_acquire(vcodec_picture_pool_t *p_pool) {
+    for (int i = 0; i < p_pool->num_pictures; i++) {
+        vcodec_picture_t *p_picture = &p_pool->pictures[i];
+        if (0 == p_picture->refcount) {
+            p_picture->refcount = 1;
+            p_picture->subpel_valid = false;
+            return p_picture;
+        }
+    }
+    return NULL;
+}
+
+void vcodec_picture_pool_push(vcodec_picture_pool_t *p_pool, vcodec_picture_t *p_picture) {
+    vcodec_picture_ref(p_picture);
+    if (p_pool->num_short_term == p_pool->max_short_term) {
+        vcodec_picture_unref(p_pool->p_short_term[--p_pool->num_short_term]);
+    }
+    memmove(p_pool->p_short_term + 1, p_pool->p_short_term, sizeof(p_pool->p_short_term[0]) * p_pool->num_short_term);
+    p_pool->p_short_term[0] = p_picture;
+    p_pool->num_short_term++;
+}
+
+void vcodec_picture_pool_set_long_term(vcodec_picture_pool_t *p_pool, vcodec_picture_t *p_picture) {
+    vcodec_picture_ref(p_picture);
+    if (NULL != p_pool->p_long_term) {
+        vcodec_picture_unref(p_pool->p_long_term);
+    }
+    p_pool->p_long_term = p_picture;
+}
+
+void vcodec_picture_pool_clear(vcodec_picture_pool_t *p_pool) {
+    for (int i = 0; i < p_pool->num_short_term; i++) {
+        vcodec_picture_unref(p_pool->p_short_term[i]);
+    }
+    p_pool->num_short_term = 0;
+    if (NULL != p_pool->p_long_term) {
+        vcodec_picture_unref(p_pool->p_long_term);
+        p_pool->p_long_term = NULL;
+    }
+}
+
+const vcodec_subpel_ref_t *vcodec_picture_subpel(vcodec_picture_t *p_picture, vcodec_subpel_filter_t filter, const vcodec_dsp_t *p_dsp) {
+    if (!p_picture->subpel_valid || p_picture->subpel_filter != filter) {
+        vcodec_subpel_build(&p_picture->subpel, &p_picture->frame, filter, p_dsp);
+        p_picture->subpel_filter = filter;
+        p_picture->subpel_valid = true;
+    }
+    return &p_picture->subpel;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+#include "vcodec_common.h"
+#include "vcodec_frame.h"
+#include "vcodec_subpel.h"
+
+/**
+ * Bits of the number of short-term references (minus one) in P frame headers.
+ */
+#define VCODEC_REF_FRAMES_BITS 2
+
+/**
+ * Pictures of a pool: the short-term references, the long-term one and the frame being reconstructed.
+ */
+#define VCODEC_PICTURE_POOL_SIZE (VCODEC_MAX_REFS + 1)
+
+/**
+ * Reconstructed frame with its half-pel planes, which are interpolated the first time the frame is used as a reference.
+ * Pictures are shared between the reference lists and the frame being coded, and go back to the pool when unreferenced.
+ */
+typedef struct {
+    vcodec_frame_t frame;
+    vcodec_subpel_ref_t subpel;
+    vcodec_subpel_filter_t subpel_filter; //< Filter of the half-pel planes, if subpel_valid
+    bool subpel_valid;
+    int refcount;
+} vcodec_picture_t;
+
+/**
+ * Pictures allocated once at init and the references of the next frame, which are pointers into them.
+ * Adding a reference rotates the pointers, no picture is ever copied.
+ */
+typedef struct {
+    vcodec_picture_t pictures[VCODEC_PICTURE_POOL_SIZE];
+    int num_pictures;
+    // Short-term references, the most recent frame first
+    vcodec_picture_t *p_short_term[VCODEC_MAX_REF_FRAMES];
+    int num_short_term;
+    int max_short_term;
+    // Long-term reference, or NULL
+    vcodec_picture_t *p_long_term;
+} vcodec_picture_pool_t;
+
+/**
+ * Allocate a pool for up to @c max_short_term short-term references, with the long-term reference if @c long_term is set.
+ */
+vcodec_status_t vcodec_picture_pool_init(vcodec_picture_pool_t *p_pool, int width, int height, int max_short_term, bool long_term, vcodec_alloc_t alloc);
+
+void vcodec_picture_pool_free(vcodec_picture_pool_t *p_pool, vcodec_free_t free);
+
+/**
+ * Take an unreferenced picture for the next frame to reconstruct, with a reference count of 1.
+ * @return NULL if every picture is referenced, which only happens if the pool is used with more references than it was sized for.
+ */
+vcodec_picture_t *vcodec_picture_pool_acquire(vcodec_picture_pool_t *p_pool);
+
+static inline void vcodec_picture_ref(vcodec_picture_t *p_picture) {
+    p_picture->refcount++;
+}
+
+static inline void vcodec_picture_unref(vcodec_picture_t *p_picture) {
+    p_picture->refcount--;
+}
+
+/**
+ * Make @c p_picture the most recent short-term reference, dropping the oldest one if the list is full.
+ */
+void vcodec_picture_pool_push(vcodec_picture_pool_t *p_pool, vcodec_picture_t *p_picture);
+
+/**
+ * Replace the long-term reference with @c p_picture.
+ */
+void vcodec_picture_pool_set_long_term(vcodec_picture_pool_t *p_pool, vcodec_picture_t *p_picture);
+
+/**
+ * Drop all references, the next frame has to be a key frame.
+ */
+void vcodec_picture_pool_clear(vcodec_picture_pool_t *p_pool);
+
+/**
+ * Half-pel planes of a picture with its border extended, interpolated with @c filter unless they already are.
+ */
+const vcodec_subpel_ref_t *vcodec_picture_subpel(vcodec_picture_t *p_picture, vcodec_subpel_filter_t filter, const vcodec_dsp_t *p_dsp);
@@ -0,0 +1,443 @@
+#include "vcodec/pipeline.h"
+#include "vcodec_common.h"
+#include "vcodec_ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+/**
+ * Slot of the input queue. The last slot of a run carries the reason the source stopped instead of a frame.
+ */
+typedef struct {
+    uint8_t *p_frame;
+    int64_t pts;
+    void *user_tag;
+    vcodec_status_t status; //< VCODEC_STATUS_OK for a frame
+} vcodec_pipeline_frame_t;
+
+/**
+ * Slot of the output queue, the coded frame is written by the encoder directly into @c p_data.
+ */
+typedef struct {
+    uint8_t *p_data; //< Memory-backed output of the encoder, replaced by a larger one when it grows
+    size_t buffer_size;
+    size_t size;
+    vcodec_frame_type_t frame_type;
+    int64_t pts;
+    void *user_tag;
+    vcodec_status_t status; //< VCODEC_STATUS_OK for a frame, otherwise the end of the run or the error of the frame
+} vcodec_pipeline_packet_t;
+
+/**
+ * Queues and state of the encoder stages, shared by vcodec_pipeline_t and the asynchronous encoder.
+ */
+typedef struct {
+    vcodec_enc_ctx_t *p_enc;
+    int depth;
+    vcodec_ring_t input;
+    vcodec_ring_t output;
+    // Raised to stop the stages, e.g. by a stage which failed
+    atomic_bool abort;
+    // Output callback of the encoder context, which is switched to memory-backed output
+    vcodec_write_t write;
+    void *io_ctx;
+    vcodec_status_t output_status;
+    // Frame counters of the current run, updated by the producing stage of each queue
+    vcodec_pipeline_queue_stats_t input_stats;
+    vcodec_pipeline_queue_stats_t output_stats;
+    // Asynchronous encoder
+    pthread_t worker;
+    vcodec_enc_deinit_t encoder_deinit; //< Replaced in the encoder context, which has to stop the worker first
+    atomic_size_t submitted; //< Frames queued by vcodec_enc_submit()
+    size_t received; //< Packets taken by vcodec_enc_receive()
+    bool packet_held; //< Front packet was returned by the last vcodec_enc_receive() and is popped by the next one
+    vcodec_status_t error; //< First coding error of the worker
+} vcodec_pipeline_ctx_t;
+
+/**
+ * Allocate the context and the queues, with a frame buffer in each input slot.
+ */
+static vcodec_status_t queues_init(vcodec_pipeline_ctx_t **pp_pipeline_ctx, vcodec_enc_ctx_t *p_enc, int depth) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_enc->alloc(sizeof(vcodec_pipeline_ctx_t));
+    *pp_pipeline_ctx = p_pipeline_ctx;
+    if (NULL == p_pipeline_ctx) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    memset(p_pipeline_ctx, 0, sizeof(*p_pipeline_ctx));
+    p_pipeline_ctx->p_enc = p_enc;
+    p_pipeline_ctx->depth = depth;
+    atomic_init(&p_pipeline_ctx->abort, false);
+    atomic_init(&p_pipeline_ctx->submitted, 0);
+    if (VCODEC_STATUS_OK != vcodec_ring_init(&p_pipeline_ctx->input, depth, sizeof(vcodec_pipeline_frame_t), p_enc->alloc)
+            || VCODEC_STATUS_OK != vcodec_ring_init(&p_pipeline_ctx->output, depth, sizeof(vcodec_pipeline_packet_t), p_enc->alloc)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    for (int i = 0; i < depth; i++) {
+        vcodec_pipeline_frame_t *p_frame = vcodec_ring_slot(&p_pipeline_ctx->input, i);
+        p_frame->p_frame = p_enc->alloc(p_enc->width * p_enc->height);
+        if (NULL == p_frame->p_frame) {
+            return VCODEC_STATUS_NOMEM;
+        }
+    }
+    // Packet memory is allocated by the encoder with the first frames, and then reused
+    return VCODEC_STATUS_OK;
+}
+
+static void queues_free(vcodec_pipeline_ctx_t *p_pipeline_ctx) {
+    vcodec_enc_ctx_t *p_enc = p_pipeline_ctx->p_enc;
+    for (int i = 0; NULL != p_pipeline_ctx->input.p_slots && i < p_pipeline_ctx->depth; i++) {
+        vcodec_pipeline_frame_t *p_frame = vcodec_ring_slot(&p_pipeline_ctx->input, i);
+        if (NULL != p_frame->p_frame) {
+            p_enc->free(p_frame->p_frame);
+        }
+    }
+    for (int i = 0; NULL != p_pipeline_ctx->output.p_slots && i < p_pipeline_ctx->depth; i++) {
+        vcodec_pipeline_packet_t *p_packet = vcodec_ring_slot(&p_pipeline_ctx->output, i);
+        if (NULL != p_packet->p_data) {
+            p_enc->free(p_packet->p_data);
+        }
+    }
+    vcodec_ring_free(&p_pipeline_ctx->input, p_enc->free);
+    vcodec_ring_free(&p_pipeline_ctx->output, p_enc->free);
+    p_enc->free(p_pipeline_ctx);
+}
+
+/**
+ * Publish the frame in the back slot of @c p_ring and count it.
+ */
+static void push_frame(vcodec_ring_t *p_ring, vcodec_pipeline_queue_stats_t *p_stats) {
+    vcodec_ring_push(p_ring);
+    const int occupancy = vcodec_ring_occupancy(p_ring);
+    p_stats->frames++;
+    p_stats->occupancy_sum += occupancy;
+    if (occupancy > p_stats->max_occupancy) {
+        p_stats->max_occupancy = occupancy;
+    }
+}
+
+/**
+ * Code @c p_frame into the buffer of @c p_packet.
+ */
+static vcodec_status_t code_frame(vcodec_enc_ctx_t *p_enc, const vcodec_pipeline_frame_t *p_frame, vcodec_pipeline_packet_t *p_packet) {
+    p_enc->p_out_buffer = p_packet->p_data;
+    p_enc->out_buffer_size = p_packet->buffer_size;
+    p_packet->status = p_enc->process_frame(p_enc, p_frame->p_frame);
+    // Packet keeps the buffer even on error, it might have been replaced by a larger one
+    p_packet->p_data = p_enc->p_out_buffer;
+    p_packet->buffer_size = p_enc->out_buffer_size;
+    p_packet->size = p_enc->out_size;
+    p_packet->frame_type = p_enc->out_frame_type;
+    p_packet->pts = p_frame->pts;
+    p_packet->user_tag = p_frame->user_tag;
+    p_enc->p_out_buffer = NULL;
+    return p_packet->status;
+}
+
+static void fill_packet(vcodec_packet_t *p_packet, const vcodec_pipeline_packet_t *p_slot) {
+    *p_packet = (vcodec_packet_t){
+        .p_data = p_slot->p_data,
+        .size = p_slot->size,
+        .frame_type = p_slot->frame_type,
+        .pts = p_slot->pts,
+        .user_tag = p_slot->user_tag,
+        .status = p_slot->status,
+    };
+}
+
+vcodec_status_t vcodec_pipeline_init(vcodec_pipeline_t *p_pipeline, vcodec_type_t type) {
+    vcodec_enc_ctx_t *p_enc = p_pipeline->p_enc;
+    p_pipeline->pipeline_ctx = NULL;
+    if (NULL == p_enc || NULL == p_enc->write || 0 != p_enc->async_depth || NULL == p_pipeline->read_frame) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (0 == p_pipeline->depth) {
+        p_pipeline->depth = VCODEC_PIPELINE_DEPTH_DEFAULT;
+    }
+    if (p_pipeline->depth < 1) {
+        return VCODEC_STATUS_INVAL;
+    }
+    memset(&p_pipeline->stats, 0, sizeof(p_pipeline->stats));
+    const vcodec_write_t write = p_enc->write;
+    p_enc->write = NULL;
+    p_enc->p_out_buffer = NULL;
+    p_enc->out_buffer_size = 0;
+    p_enc->out_buffer_grow = true;
+    const vcodec_status_t ret = vcodec_enc_init(p_enc, type);
+    if (VCODEC_STATUS_OK != ret) {
+        return ret;
+    }
+    vcodec_pipeline_ctx_t *p_pipeline_ctx;
+    const vcodec_status_t queues_ret = queues_init(&p_pipeline_ctx, p_enc, p_pipeline->depth);
+    p_pipeline->pipeline_ctx = p_pipeline_ctx;
+    if (NULL != p_pipeline_ctx) {
+        p_pipeline_ctx->write = write;
+        p_pipeline_ctx->io_ctx = p_enc->io_ctx;
+    }
+    return queues_ret;
+}
+
+/**
+ * Pop the input queue up to the slot which ends the run, so that the source stage can stop.
+ */
+static void drain_source(vcodec_pipeline_ctx_t *p_pipeline_ctx) {
+    atomic_store(&p_pipeline_ctx->abort, true);
+    bool source_done = false;
+    while (!source_done) {
+        const vcodec_pipeline_frame_t *p_frame = vcodec_ring_front(&p_pipeline_ctx->input);
+        source_done = VCODEC_STATUS_OK != p_frame->status;
+        vcodec_ring_pop(&p_pipeline_ctx->input);
+    }
+}
+
+/**
+ * Source stage: fill the input queue until the source ends, fails, or another stage failed.
+ */
+static void *source_main(void *p_arg) {
+    vcodec_pipeline_t *p_pipeline = p_arg;
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_pipeline->pipeline_ctx;
+    vcodec_status_t status = VCODEC_STATUS_OK;
+    while (VCODEC_STATUS_OK == status) {
+        vcodec_pipeline_frame_t *p_frame = vcodec_ring_back(&p_pipeline_ctx->input);
+        status = atomic_load(&p_pipeline_ctx->abort) ? VCODEC_STATUS_EOF : p_pipeline->read_frame(p_frame->p_frame, p_pipeline->read_ctx);
+        p_frame->status = status;
+        if (VCODEC_STATUS_OK == status) {
+            push_frame(&p_pipeline_ctx->input, &p_pipeline_ctx->input_stats);
+        } else {
+            vcodec_ring_push(&p_pipeline_ctx->input);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Output stage: write the coded frames until the end of the run. After a write error the rest is only drained.
+ */
+static void *output_main(void *p_arg) {
+    vcodec_pipeline_t *p_pipeline = p_arg;
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_pipeline->pipeline_ctx;
+    for (;;) {
+        const vcodec_pipeline_packet_t *p_packet = vcodec_ring_front(&p_pipeline_ctx->output);
+        const vcodec_status_t status = p_packet->status;
+        if (VCODEC_STATUS_OK == status && VCODEC_STATUS_OK == p_pipeline_ctx->output_status) {
+            p_pipeline_ctx->output_status = p_pipeline_ctx->write(p_packet->p_data, p_packet->size, p_pipeline_ctx->io_ctx);
+            if (VCODEC_STATUS_OK != p_pipeline_ctx->output_status) {
+                atomic_store(&p_pipeline_ctx->abort, true);
+            }
+        }
+        vcodec_ring_pop(&p_pipeline_ctx->output);
+        if (VCODEC_STATUS_OK != status) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Coding stage, on the calling thread: code each source frame into the next packet of the output queue.
+ * @return Reason the run ended: VCODEC_STATUS_EOF from the source, or an error of the source or the encoder.
+ */
+static vcodec_status_t code_frames(vcodec_pipeline_t *p_pipeline) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_pipeline->pipeline_ctx;
+    vcodec_status_t ret = VCODEC_STATUS_OK;
+    bool source_done = false;
+    while (VCODEC_STATUS_OK == ret && !atomic_load(&p_pipeline_ctx->abort)) {
+        const vcodec_pipeline_frame_t *p_frame = vcodec_ring_front(&p_pipeline_ctx->input);
+        if (VCODEC_STATUS_OK != p_frame->status) {
+            // End of the source, which has already stopped
+            ret = p_frame->status;
+            source_done = true;
+            vcodec_ring_pop(&p_pipeline_ctx->input);
+            break;
+        }
+        vcodec_pipeline_packet_t *p_packet = vcodec_ring_back(&p_pipeline_ctx->output);
+        ret = code_frame(p_pipeline->p_enc, p_frame, p_packet);
+        vcodec_ring_pop(&p_pipeline_ctx->input);
+        if (VCODEC_STATUS_OK == ret) {
+            push_frame(&p_pipeline_ctx->output, &p_pipeline_ctx->output_stats);
+        }
+    }
+    // Output stage stops at this packet, it keeps its buffer for the next run
+    vcodec_pipeline_packet_t *p_packet = vcodec_ring_back(&p_pipeline_ctx->output);
+    p_packet->status = VCODEC_STATUS_OK == ret ? VCODEC_STATUS_EOF : ret;
+    vcodec_ring_push(&p_pipeline_ctx->output);
+    if (!source_done) {
+        // Coding failed, the source might be waiting for a free slot
+        drain_source(p_pipeline_ctx);
+    }
+    return ret;
+}
+
+/**
+ * Add the counters of the last run of a queue to @c p_stats.
+ */
+static void add_queue_stats(vcodec_pipeline_queue_stats_t *p_stats, const vcodec_pipeline_queue_stats_t *p_run_stats, const vcodec_ring_t *p_ring) {
+    p_stats->frames += p_run_stats->frames;
+    p_stats->occupancy_sum += p_run_stats->occupancy_sum;
+    if (p_run_stats->max_occupancy > p_stats->max_occupancy) {
+        p_stats->max_occupancy = p_run_stats->max_occupancy;
+    }
+    p_stats->full_stalls += p_ring->full_stalls;
+    p_stats->empty_stalls += p_ring->empty_stalls;
+}
+
+vcodec_status_t vcodec_pipeline_run(vcodec_pipeline_t *p_pipeline) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_pipeline->pipeline_ctx;
+    atomic_store(&p_pipeline_ctx->abort, false);
+    p_pipeline_ctx->output_status = VCODEC_STATUS_OK;
+    memset(&p_pipeline_ctx->input_stats, 0, sizeof(p_pipeline_ctx->input_stats));
+    memset(&p_pipeline_ctx->output_stats, 0, sizeof(p_pipeline_ctx->output_stats));
+    p_pipeline_ctx->input.full_stalls = p_pipeline_ctx->input.empty_stalls = 0;
+    p_pipeline_ctx->output.full_stalls = p_pipeline_ctx->output.empty_stalls = 0;
+    pthread_t source_thread;
+    pthread_t output_thread;
+    if (0 != pthread_create(&source_thread, NULL, source_main, p_pipeline)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    if (0 != pthread_create(&output_thread, NULL, output_main, p_pipeline)) {
+        drain_source(p_pipeline_ctx);
+        pthread_join(source_thread, NULL);
+        return VCODEC_STATUS_NOMEM;
+    }
+    const vcodec_status_t ret = code_frames(p_pipeline);
+    pthread_join(source_thread, NULL);
+    pthread_join(output_thread, NULL);
+    add_queue_stats(&p_pipeline->stats.input, &p_pipeline_ctx->input_stats, &p_pipeline_ctx->input);
+    add_queue_stats(&p_pipeline->stats.output, &p_pipeline_ctx->output_stats, &p_pipeline_ctx->output);
+    if (VCODEC_STATUS_OK != p_pipeline_ctx->output_status) {
+        return p_pipeline_ctx->output_status;
+    }
+    return VCODEC_STATUS_EOF == ret ? VCODEC_STATUS_OK : ret;
+}
+
+void vcodec_pipeline_deinit(vcodec_pipeline_t *p_pipeline) {
+    vcodec_enc_ctx_t *p_enc = p_pipeline->p_enc;
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_pipeline->pipeline_ctx;
+    if (NULL != p_pipeline_ctx) {
+        p_enc->write = p_pipeline_ctx->write;
+        queues_free(p_pipeline_ctx);
+        p_pipeline->pipeline_ctx = NULL;
+    }
+    p_enc->deinit(p_enc);
+}
+
+/**
+ * Worker of the asynchronous encoder: code the submitted frames in order until deinit.
+ * Packets are either queued for vcodec_enc_receive() or passed to on_packet, in which case the back slot of the output queue
+ * is only used for its buffer.
+ */
+static void *async_worker_main(void *p_arg) {
+    vcodec_enc_ctx_t *p_enc = p_arg;
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_enc->async_ctx;
+    for (;;) {
+        const vcodec_pipeline_frame_t *p_frame = vcodec_ring_front(&p_pipeline_ctx->input);
+        if (VCODEC_STATUS_OK != p_frame->status) {
+            // Pushed by deinit
+            vcodec_ring_pop(&p_pipeline_ctx->input);
+            return NULL;
+        }
+        if (atomic_load(&p_pipeline_ctx->abort)) {
+            vcodec_ring_pop(&p_pipeline_ctx->input);
+            continue;
+        }
+        vcodec_pipeline_packet_t *p_packet = vcodec_ring_back(&p_pipeline_ctx->output);
+        if (VCODEC_STATUS_OK == p_pipeline_ctx->error) {
+            p_pipeline_ctx->error = code_frame(p_enc, p_frame, p_packet);
+        } else {
+            // References are unusable after an error, the remaining frames only report it
+            p_packet->status = p_pipeline_ctx->error;
+            p_packet->size = 0;
+            p_packet->pts = p_frame->pts;
+            p_packet->user_tag = p_frame->user_tag;
+        }
+        vcodec_ring_pop(&p_pipeline_ctx->input);
+        if (NULL != p_enc->on_packet) {
+            vcodec_packet_t packet;
+            fill_packet(&packet, p_packet);
+            p_enc->on_packet(&packet, p_enc->io_ctx);
+        } else {
+            push_frame(&p_pipeline_ctx->output, &p_pipeline_ctx->output_stats);
+        }
+    }
+}
+
+/**
+ * Stop the worker, dropping the frames it has not coded yet, then deinit the encoder.
+ */
+static vcodec_status_t async_deinit(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_ctx->async_ctx;
+    atomic_store(&p_pipeline_ctx->abort, true);
+    // Worker might be waiting for a free packet, after which it pushes at most the one it is coding
+    if (NULL == p_ctx->on_packet) {
+        while (vcodec_ring_occupancy(&p_pipeline_ctx->output) > 0) {
+            vcodec_ring_front(&p_pipeline_ctx->output);
+            vcodec_ring_pop(&p_pipeline_ctx->output);
+        }
+    }
+    vcodec_pipeline_frame_t *p_frame = vcodec_ring_back(&p_pipeline_ctx->input);
+    p_frame->status = VCODEC_STATUS_EOF;
+    vcodec_ring_push(&p_pipeline_ctx->input);
+    pthread_join(p_pipeline_ctx->worker, NULL);
+    const vcodec_enc_deinit_t encoder_deinit = p_pipeline_ctx->encoder_deinit;
+    queues_free(p_pipeline_ctx);
+    p_ctx->async_ctx = NULL;
+    p_ctx->deinit = encoder_deinit;
+    return encoder_deinit(p_ctx);
+}
+
+vcodec_status_t vcodec_enc_async_init(vcodec_enc_ctx_t *p_ctx) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx;
+    vcodec_status_t ret = queues_init(&p_pipeline_ctx, p_ctx, p_ctx->async_depth);
+    if (VCODEC_STATUS_OK == ret) {
+        p_pipeline_ctx->encoder_deinit = p_ctx->deinit;
+        p_ctx->async_ctx = p_pipeline_ctx;
+        if (0 != pthread_create(&p_pipeline_ctx->worker, NULL, async_worker_main, p_ctx)) {
+            ret = VCODEC_STATUS_NOMEM;
+        }
+    }
+    if (VCODEC_STATUS_OK != ret) {
+        if (NULL != p_pipeline_ctx) {
+            queues_free(p_pipeline_ctx);
+        }
+        p_ctx->async_ctx = NULL;
+        return ret;
+    }
+    p_ctx->deinit = async_deinit;
+    return VCODEC_STATUS_OK;
+}
+
+vcodec_status_t vcodec_enc_submit(vcodec_enc_ctx_t *p_ctx, const uint8_t *p_frame, int64_t pts, void *user_tag) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_ctx->async_ctx;
+    if (NULL == p_pipeline_ctx) {
+        return VCODEC_STATUS_INVAL;
+    }
+    vcodec_pipeline_frame_t *p_slot = vcodec_ring_try_back(&p_pipeline_ctx->input);
+    if (NULL == p_slot) {
+        return VCODEC_STATUS_AGAIN;
+    }
+    memcpy(p_slot->p_frame, p_frame, p_ctx->width * p_ctx->height);
+    p_slot->pts = pts;
+    p_slot->user_tag = user_tag;
+    p_slot->status = VCODEC_STATUS_OK;
+    push_frame(&p_pipeline_ctx->input, &p_pipeline_ctx->input_stats);
+    atomic_fetch_add(&p_pipeline_ctx->submitted, 1);
+    return VCODEC_STATUS_OK;
+}
+
+vcodec_status_t vcodec_enc_receive(vcodec_enc_ctx_t *p_ctx, vcodec_packet_t *p_packet) {
+    vcodec_pipeline_ctx_t *p_pipeline_ctx = p_ctx->async_ctx;
+    if (NULL == p_pipeline_ctx || NULL != p_ctx->on_packet) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (p_pipeline_ctx->packet_held) {
+        vcodec_ring_pop(&p_pipeline_ctx->output);
+        p_pipeline_ctx->packet_held = false;
+    }
+    if (p_pipeline_ctx->received == atomic_load(&p_pipeline_ctx->submitted)) {
+        return VCODEC_STATUS_AGAIN;
+    }
+    const vcodec_pipeline_packet_t *p_slot = vcodec_ring_front(&p_pipeline_ctx->output);
+    p_pipeline_ctx->received++;
+    p_pipeline_ctx->packet_held = true;
+    fill_packet(p_packet, p_slot);
+    return p_slot->status;
+}
@@ -0,0 +1,128 @@
+#include "vcodec_pyramid.h"
+#include "vcodec_dsp.h"
+
+#include <limits.h>
+
+vcodec_status_t vcodec_pyramid_init(vcodec_pyramid_t *p_pyramid, int width, int height, vcodec_alloc_t alloc) {
+    size_t size = 0;
+    p_pyramid->width[0] = width;
+    p_pyramid->stride[0] = width;
+    p_pyramid->height[0] = height;
+    for (int i = 1; i < VCODEC_PYRAMID_LEVELS; i++) {
+        p_pyramid->width[i] = p_pyramid->width[i - 1] / 2;
+        p_pyramid->height[i] = p_pyramid->height[i - 1] / 2;
+        p_pyramid->stride[i] = p_pyramid->width[i];
+        size += p_pyramid->width[i] * p_pyramid->height[i];
+    }
+    p_pyramid->p_allocation = alloc(size);
+    if (NULL == p_pyramid->p_allocation) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    p_pyramid->p_planes[0] = NULL;
+    uint8_t *p_plane = p_pyramid->p_allocation;
+    for (int i = 1; i < VCODEC_PYRAMID_LEVELS; i++) {
+        p_pyramid->p_planes[i] = p_plane;
+        p_plane += p_pyramid->width[i] * p_pyramid->height[i];
+    }
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_pyramid_free(vcodec_pyramid_t *p_pyramid, vcodec_free_t free) {
+    free(p_pyramid->p_allocation);
+    p_pyramid->p_allocation = NULL;
+}
+
+void vcodec_pyramid_build(vcodec_pyramid_t *p_pyramid, const vcodec_frame_t *p_frame, const vcodec_dsp_t *p_dsp) {
+    p_pyramid->p_planes[0] = p_frame->p_data;
+    p_pyramid->stride[0] = p_frame->stride;
+    for (int i = 1; i < VCODEC_PYRAMID_LEVELS; i++) {
+        p_dsp->downsample2x((uint8_t *)p_pyramid->p_planes[i], p_pyramid->width[i], p_pyramid->height[i], p_pyramid->p_planes[i - 1], p_pyramid->stride[i - 1]);
+    }
+}
+
+static bool block_in_plane(const vcodec_pyramid_t *p_pyramid, int level, int x, int y, int block_size) {
+    return x >= 0 && y >= 0 && x + block_size <= p_pyramid->width[level] && y + block_size <= p_pyramid->height[level];
+}
+
+/**
+ * Evaluate up to 9 refinement candidates, skipping the ones which move the block outside the plane, and update the best one.
+ */
+static void evaluate(const vcodec_pyramid_t *p_source, const vcodec_pyramid_t *p_ref, int level, int x, int y, int block_size, const vcodec_dsp_t *p_dsp,
+        const motion_vector_t *p_candidates, int num_candidates, motion_vector_t *p_best, int *p_best_cost) {
+    motion_vector_t candidates[9];
+    int costs[9];
+    int n = 0;
+    for (int i = 0; i < num_candidates; i++) {
+        if (block_in_plane(p_ref, level, x + p_candidates[i].mvx, y + p_candidates[i].mvy, block_size)) {
+            candidates[n++] = p_candidates[i];
+        }
+    }
+    p_dsp->sad_multi(p_source->p_planes[level], p_ref->p_planes[level], x, y, candidates, n, block_size, p_source->stride[level], costs);
+    for (int i = 0; i < n; i++) {
+        if (costs[i] < *p_best_cost) {
+            *p_best_cost = costs[i];
+            *p_best = candidates[i];
+        }
+    }
+}
+
+bool vcodec_pyramid_search(const vcodec_pyramid_t *p_source, const vcodec_pyramid_t *p_ref, int x, int y, const vcodec_dsp_t *p_dsp, motion_vector_t *p_mv) {
+    // Macroblocks are 4x4 blocks at the coarsest level
+    int level = VCODEC_PYRAMID_LEVELS - 1;
+    int block_size = VCODEC_MACROBLOCK_SIZE >> level;
+    int level_x = x >> level;
+    int level_y = y >> level;
+    if (!block_in_plane(p_source, level, level_x, level_y, block_size)) {
+        return false;
+    }
+
+    // Exhaustive search over the part of the window inside the plane
+    const int width = p_ref->width[level];
+    const int stride = p_ref->stride[level];
+    const int left = MAX(-VCODEC_PYRAMID_SEARCH_RANGE, -level_x);
+    const int top = MAX(-VCODEC_PYRAMID_SEARCH_RANGE, -level_y);
+    const int right = MIN(VCODEC_PYRAMID_SEARCH_RANGE, width - block_size - level_x);
+    const int bottom = MIN(VCODEC_PYRAMID_SEARCH_RANGE, p_ref->height[level] - block_size - level_y);
+    const int num_dx = right - left + 1;
+    const int num_dy = bottom - top + 1;
+    int costs[(2 * VCODEC_PYRAMID_SEARCH_RANGE + 1) * (2 * VCODEC_PYRAMID_SEARCH_RANGE + 1)];
+    p_dsp->sad_window4x4(p_source->p_planes[level] + level_y * stride + level_x, p_ref->p_planes[level] + (level_y + top) * stride + level_x + left,
+            stride, num_dx, num_dy, costs);
+    // Zero vector wins ties
+    motion_vector_t best = { 0, 0 };
+    int best_cost = costs[-top * num_dx - left];
+    for (int i = 0; i < num_dy; i++) {
+        for (int j = 0; j < num_dx; j++) {
+            if (costs[i * num_dx + j] < best_cost) {
+                best_cost = costs[i * num_dx + j];
+                best.mvx = left + j;
+                best.mvy = top + i;
+            }
+        }
+    }
+
+    for (level--; level > 0; level--) {
+        block_size *= 2;
+        level_x = x >> level;
+        level_y = y >> level;
+        const motion_vector_t center = { best.mvx * 2, best.mvy * 2 };
+        motion_vector_t candidates[9];
+        int n = 0;
+        candidates[n++] = center;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (0 != dx || 0 != dy) {
+                    candidates[n].mvx = center.mvx + dx;
+                    candidates[n].mvy = center.mvy + dy;
+                    n++;
+                }
+            }
+        }
+        best = center;
+        best_cost = INT_MAX;
+        evaluate(p_source, p_ref, level, level_x, level_y, block_size, p_dsp, candidates, n, &best, &best_cost);
+    }
+    p_mv->mvx = best.mvx * 2;
+    p_mv->mvy = best.mvy * 2;
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+#include "vcodec_common.h"
+#include "vcodec_frame.h"
+
+/**
+ * Pyramid levels: full, 1/2 and 1/4 resolution.
+ */
+#define VCODEC_PYRAMID_LEVELS 3
+
+/**
+ * Range of the exhaustive search at the coarsest level, in its pixels (4 full resolution pixels each).
+ */
+#define VCODEC_PYRAMID_SEARCH_RANGE 8
+
+/**
+ * Downsampled copies of a frame, rebuilt once per frame. Level 0 points to the frame itself,
+ * other levels are unpadded planes with the stride equal to their width.
+ */
+typedef struct {
+    const uint8_t *p_planes[VCODEC_PYRAMID_LEVELS];
+    int stride[VCODEC_PYRAMID_LEVELS];
+    int width[VCODEC_PYRAMID_LEVELS];
+    int height[VCODEC_PYRAMID_LEVELS];
+    uint8_t *p_allocation;
+} vcodec_pyramid_t;
+
+vcodec_status_t vcodec_pyramid_init(vcodec_pyramid_t *p_pyramid, int width, int height, vcodec_alloc_t alloc);
+
+void vcodec_pyramid_free(vcodec_pyramid_t *p_pyramid, vcodec_free_t free);
+
+/**
+ * Fill levels 1 and up of @c p_pyramid from a frame of the size given to vcodec_pyramid_init().
+ */
+void vcodec_pyramid_build(vcodec_pyramid_t *p_pyramid, const vcodec_frame_t *p_frame, const vcodec_dsp_t *p_dsp);
+
+/**
+ * Coarse-to-fine search of a macroblock: exhaustive search at the coarsest level, then a 3x3 refinement at each finer level
+ * except the full resolution one, which is left to vcodec_predict_motion_block().
+ * @param[out] p_mv Full resolution motion vector candidate.
+ * @retval false if the macroblock does not fit the coarse levels, @c p_mv is not set.
+ */
+bool vcodec_pyramid_search(const vcodec_pyramid_t *p_source, const vcodec_pyramid_t *p_ref, int x, int y, const vcodec_dsp_t *p_dsp, motion_vector_t *p_mv);
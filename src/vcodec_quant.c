@@ -0,0 +1,55 @@
+#include "vcodec_quant.h"
+#include "vcodec_common.h"
+
+/**
+ * Quantizer steps at VCODEC_QP_DEFAULT.
+ */
+static const int base_step[4 * 4] = {
+    16, 11, 10, 16,
+    12, 12, 14, 19,
+    14, 13, 16, 24,
+    14, 17, 22, 29,
+};
+
+/**
+ * Step multipliers within one octave of QP, 2^(i/6) with 6 fractional bits.
+ * The step doubles every 6 QP.
+ */
+static const int octave_scale[6] = { 64, 72, 81, 91, 102, 114 };
+
+static int step_for_qp(int base, int qp) {
+    // VCODEC_QP_DEFAULT is 4 octaves up, and octave_scale has 6 fractional bits
+    const int step = ((base * octave_scale[qp % 6] << (qp / 6)) + (1 << 9)) >> 10;
+    return MAX(step, 1);
+}
+
+static void quant_init(vcodec_quant_t *p_quant, int qp) {
+    int min_step = INT16_MAX;
+    for (int i = 0; i < 4 * 4; i++) {
+        p_quant->step[i] = step_for_qp(base_step[i], qp);
+        min_step = MIN(min_step, p_quant->step[i]);
+    }
+    p_quant->dc_step = MAX(p_quant->step[0], VCODEC_QUANT_DC_MIN_STEP);
+
+    // Largest shift for which 2^shift / min_step still fits 16 bits
+    p_quant->shift = 0;
+    while ((1u << (p_quant->shift + 1)) <= (uint32_t)UINT16_MAX * min_step) {
+        p_quant->shift++;
+    }
+    const uint32_t one = 1u << p_quant->shift;
+    for (int i = 0; i < 4 * 4; i++) {
+        p_quant->mult[i] = (one + p_quant->step[i] / 2) / p_quant->step[i];
+    }
+    p_quant->dc_mult = (one + p_quant->dc_step / 2) / p_quant->dc_step;
+}
+
+void vcodec_quant_tables_init(vcodec_quant_tables_t *p_tables) {
+    for (int qp = 0; qp <= VCODEC_QP_MAX; qp++) {
+        quant_init(&p_tables->qp[qp], qp);
+    }
+}
+
+int vcodec_quant_dc(int coeff, const vcodec_quant_t *p_quant, uint32_t rounding) {
+    const int level = ((uint64_t)ABS(coeff) * p_quant->dc_mult + rounding) >> p_quant->shift;
+    return coeff < 0 ? -level : level;
+}
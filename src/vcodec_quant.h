@@ -0,0 +1,51 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Width of the QP field of the frame header.
+ */
+#define VCODEC_QP_BITS 6
+
+/**
+ * Smallest quantizer step of the DC coefficients.
+ * Hadamard-transformed DC coefficients reach 16 * 9180 / 2, so with smaller steps the levels would not fit 16 bits.
+ */
+#define VCODEC_QUANT_DC_MIN_STEP 4
+
+/**
+ * Quantizer of one QP.
+ * A coefficient c is quantized as sign(c) * ((|c| * mult + rounding) >> shift), mult being 2^shift / step,
+ * and rescaled as level * step. @c shift is picked per QP so that all multipliers fit 16 bits.
+ */
+typedef struct {
+    uint16_t mult[4 * 4];
+    int16_t step[4 * 4];
+    int shift;
+    uint32_t dc_mult;
+    int dc_step;
+} vcodec_quant_t;
+
+/**
+ * Quantizers of all QPs, built once at init.
+ */
+typedef struct {
+    vcodec_quant_t qp[VCODEC_QP_MAX + 1];
+} vcodec_quant_tables_t;
+
+void vcodec_quant_tables_init(vcodec_quant_tables_t *p_tables);
+
+/**
+ * Dead zone rounding offset of a quantizer: 1/3 of the step for intra blocks, 1/6 for inter blocks.
+ */
+static inline uint32_t vcodec_quant_rounding(const vcodec_quant_t *p_quant, bool intra) {
+    return (1u << p_quant->shift) / (intra ? 3 : 6);
+}
+
+/**
+ * Quantize a single (DC) coefficient, which might not fit 16 bits.
+ */
+int vcodec_quant_dc(int coeff, const vcodec_quant_t *p_quant, uint32_t rounding);
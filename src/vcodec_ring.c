@@ -0,0 +1,101 @@
+#include "vcodec_ring.h"
+
+#include <string.h>
+
+vcodec_status_t vcodec_ring_init(vcodec_ring_t *p_ring, int num_slots, size_t slot_size, vcodec_alloc_t alloc) {
+    memset(p_ring, 0, sizeof(*p_ring));
+    if (num_slots < 1) {
+        return VCODEC_STATUS_INVAL;
+    }
+    p_ring->p_slots = alloc(slot_size * num_slots);
+    if (NULL == p_ring->p_slots) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    memset(p_ring->p_slots, 0, slot_size * num_slots);
+    p_ring->slot_size = slot_size;
+    p_ring->num_slots = num_slots;
+    atomic_init(&p_ring->head, 0);
+    atomic_init(&p_ring->tail, 0);
+    atomic_init(&p_ring->sleeping, false);
+    if (0 != pthread_mutex_init(&p_ring->lock, NULL)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    pthread_cond_init(&p_ring->cond, NULL);
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_ring_free(vcodec_ring_t *p_ring, vcodec_free_t free) {
+    if (NULL == p_ring->p_slots) {
+        return;
+    }
+    pthread_cond_destroy(&p_ring->cond);
+    pthread_mutex_destroy(&p_ring->lock);
+    free(p_ring->p_slots);
+    p_ring->p_slots = NULL;
+}
+
+static bool ring_full(vcodec_ring_t *p_ring) {
+    return atomic_load(&p_ring->head) - atomic_load(&p_ring->tail) == p_ring->num_slots;
+}
+
+static bool ring_empty(vcodec_ring_t *p_ring) {
+    return atomic_load(&p_ring->head) == atomic_load(&p_ring->tail);
+}
+
+/**
+ * Sleep while @c blocked holds. The flag is raised before checking again under the lock, and the other side checks it after
+ * moving its counter (all sequentially consistent), so either this side sees the new position or the other one wakes it up.
+ */
+static void ring_wait(vcodec_ring_t *p_ring, bool (*blocked)(vcodec_ring_t *)) {
+    pthread_mutex_lock(&p_ring->lock);
+    for (;;) {
+        atomic_store(&p_ring->sleeping, true);
+        if (!blocked(p_ring)) {
+            break;
+        }
+        pthread_cond_wait(&p_ring->cond, &p_ring->lock);
+    }
+    pthread_mutex_unlock(&p_ring->lock);
+}
+
+static void ring_wake(vcodec_ring_t *p_ring) {
+    if (atomic_exchange(&p_ring->sleeping, false)) {
+        pthread_mutex_lock(&p_ring->lock);
+        pthread_cond_broadcast(&p_ring->cond);
+        pthread_mutex_unlock(&p_ring->lock);
+    }
+}
+
+void *vcodec_ring_back(vcodec_ring_t *p_ring) {
+    if (ring_full(p_ring)) {
+        p_ring->full_stalls++;
+        ring_wait(p_ring, ring_full);
+    }
+    return vcodec_ring_slot(p_ring, atomic_load(&p_ring->head));
+}
+
+void *vcodec_ring_try_back(vcodec_ring_t *p_ring) {
+    if (ring_full(p_ring)) {
+        p_ring->full_stalls++;
+        return NULL;
+    }
+    return vcodec_ring_slot(p_ring, atomic_load(&p_ring->head));
+}
+
+void vcodec_ring_push(vcodec_ring_t *p_ring) {
+    atomic_fetch_add(&p_ring->head, 1);
+    ring_wake(p_ring);
+}
+
+void *vcodec_ring_front(vcodec_ring_t *p_ring) {
+    if (ring_empty(p_ring)) {
+        p_ring->empty_stalls++;
+        ring_wait(p_ring, ring_empty);
+    }
+    return vcodec_ring_slot(p_ring, atomic_load(&p_ring->tail));
+}
+
+void vcodec_ring_pop(vcodec_ring_t *p_ring) {
+    atomic_fetch_add(&p_ring->tail, 1);
+    ring_wake(p_ring);
+}
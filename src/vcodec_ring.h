@@ -0,0 +1,65 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Bounded single-producer single-consumer queue of preallocated slots, which are filled and consumed in place.
+ * Positions are lock-free counters, the mutex is only taken to sleep while the queue is full (producer) or empty (consumer).
+ */
+typedef struct {
+    uint8_t *p_slots;
+    size_t slot_size;
+    size_t num_slots;
+    atomic_size_t head; //< Slots pushed by the producer
+    atomic_size_t tail; //< Slots popped by the consumer
+    // Set by a side about to sleep, so that the other one takes the lock to wake it up
+    atomic_bool sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // Times each side had to wait, read once both sides are done
+    uint64_t full_stalls;
+    uint64_t empty_stalls;
+} vcodec_ring_t;
+
+/**
+ * Allocate @c num_slots zeroed slots of @c slot_size bytes.
+ */
+vcodec_status_t vcodec_ring_init(vcodec_ring_t *p_ring, int num_slots, size_t slot_size, vcodec_alloc_t alloc);
+
+void vcodec_ring_free(vcodec_ring_t *p_ring, vcodec_free_t free);
+
+/**
+ * Slot @c index of the ring, regardless of its state, e.g. to allocate or free what it points to.
+ */
+static inline void *vcodec_ring_slot(vcodec_ring_t *p_ring, size_t index) {
+    return p_ring->p_slots + index % p_ring->num_slots * p_ring->slot_size;
+}
+
+/**
+ * Producer: wait for a free slot and return it, to be filled and then published with vcodec_ring_push().
+ */
+void *vcodec_ring_back(vcodec_ring_t *p_ring);
+
+/**
+ * Producer: free slot like vcodec_ring_back(), or NULL without waiting if the ring is full.
+ */
+void *vcodec_ring_try_back(vcodec_ring_t *p_ring);
+
+void vcodec_ring_push(vcodec_ring_t *p_ring);
+
+/**
+ * Consumer: wait for the oldest published slot and return it, to be released with vcodec_ring_pop() once consumed.
+ */
+void *vcodec_ring_front(vcodec_ring_t *p_ring);
+
+void vcodec_ring_pop(vcodec_ring_t *p_ring);
+
+/**
+ * Number of published slots which are not popped yet.
+ */
+static inline int vcodec_ring_occupancy(vcodec_ring_t *p_ring) {
+    return (int)(atomic_load(&p_ring->head) - atomic_load(&p_ring->tail));
+}
@@ -0,0 +1,164 @@
+#include "vcodec_subpel.h"
+#include "vcodec_dsp.h"
+
+/**
+ * Full-pel samples, in addition to the half-pel planes.
+ */
+#define FULLPEL VCODEC_HALFPEL_PLANES
+
+typedef struct {
+    int8_t plane;
+    int8_t dx;
+    int8_t dy;
+} subpel_source_t;
+
+/**
+ * The two samples averaged at each quarter-pel position, indexed by the fractional part of the vector (y * VCODEC_SUBPEL_SCALE + x).
+ * Quarter-pel positions take the two nearest full or half-pel samples, the center ones the nearest diagonal pair, as in H.264.
+ */
+static const subpel_source_t subpel_sources[VCODEC_SUBPEL_SCALE * VCODEC_SUBPEL_SCALE][2] = {
+    { { FULLPEL, 0, 0 },           { FULLPEL, 0, 0 } },
+    { { FULLPEL, 0, 0 },           { VCODEC_HALFPEL_H, 0, 0 } },
+    { { VCODEC_HALFPEL_H, 0, 0 },  { VCODEC_HALFPEL_H, 0, 0 } },
+    { { VCODEC_HALFPEL_H, 0, 0 },  { FULLPEL, 1, 0 } },
+
+    { { FULLPEL, 0, 0 },           { VCODEC_HALFPEL_V, 0, 0 } },
+    { { VCODEC_HALFPEL_H, 0, 0 },  { VCODEC_HALFPEL_V, 0, 0 } },
+    { { VCODEC_HALFPEL_H, 0, 0 },  { VCODEC_HALFPEL_HV, 0, 0 } },
+    { { VCODEC_HALFPEL_H, 0, 0 },  { VCODEC_HALFPEL_V, 1, 0 } },
+
+    { { VCODEC_HALFPEL_V, 0, 0 },  { VCODEC_HALFPEL_V, 0, 0 } },
+    { { VCODEC_HALFPEL_V, 0, 0 },  { VCODEC_HALFPEL_HV, 0, 0 } },
+    { { VCODEC_HALFPEL_HV, 0, 0 }, { VCODEC_HALFPEL_HV, 0, 0 } },
+    { { VCODEC_HALFPEL_HV, 0, 0 }, { VCODEC_HALFPEL_V, 1, 0 } },
+
+    { { VCODEC_HALFPEL_V, 0, 0 },  { FULLPEL, 0, 1 } },
+    { { VCODEC_HALFPEL_V, 0, 0 },  { VCODEC_HALFPEL_H, 0, 1 } },
+    { { VCODEC_HALFPEL_HV, 0, 0 }, { VCODEC_HALFPEL_H, 0, 1 } },
+    { { VCODEC_HALFPEL_H, 0, 1 },  { VCODEC_HALFPEL_V, 1, 0 } },
+};
+
+static const motion_vector_t refine_square[] = {
+    { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 },
+};
+
+vcodec_status_t vcodec_subpel_init(vcodec_subpel_ref_t *p_ref, int width, int height, vcodec_alloc_t alloc) {
+    p_ref->p_full = NULL;
+    p_ref->width = width;
+    p_ref->height = height;
+    for (int i = 0; i < VCODEC_HALFPEL_PLANES; i++) {
+        p_ref->halfpel[i].p_allocation = NULL;
+    }
+    for (int i = 0; i < VCODEC_HALFPEL_PLANES; i++) {
+        if (VCODEC_STATUS_OK != vcodec_frame_init(&p_ref->halfpel[i], width, height, alloc)) {
+            return VCODEC_STATUS_NOMEM;
+        }
+    }
+    p_ref->stride = p_ref->halfpel[0].stride;
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_subpel_free(vcodec_subpel_ref_t *p_ref, vcodec_free_t free) {
+    for (int i = 0; i < VCODEC_HALFPEL_PLANES; i++) {
+        if (NULL != p_ref->halfpel[i].p_allocation) {
+            vcodec_frame_free(&p_ref->halfpel[i], free);
+        }
+    }
+}
+
+void vcodec_subpel_build(vcodec_subpel_ref_t *p_ref, const vcodec_frame_t *p_frame, vcodec_subpel_filter_t filter, const vcodec_dsp_t *p_dsp) {
+    const int stride = p_ref->stride;
+    const int width = p_ref->width + 2 * VCODEC_MOTION_RANGE;
+    const int height = p_ref->height + 2 * VCODEC_MOTION_RANGE;
+    const int origin = VCODEC_MOTION_RANGE * stride + VCODEC_MOTION_RANGE;
+    p_ref->p_full = p_frame->p_data;
+    // Rows of the horizontal plane cover the whole border: the vertical filter of the diagonal plane reads 3 rows past the range
+    const int border_origin = VCODEC_FRAME_BORDER * stride + VCODEC_MOTION_RANGE;
+    p_dsp->interpolate_h(p_ref->halfpel[VCODEC_HALFPEL_H].p_data - border_origin, p_frame->p_data - border_origin, stride, width,
+            p_ref->height + 2 * VCODEC_FRAME_BORDER, filter);
+    p_dsp->interpolate_v(p_ref->halfpel[VCODEC_HALFPEL_V].p_data - origin, p_frame->p_data - origin, stride, width, height, filter);
+    p_dsp->interpolate_v(p_ref->halfpel[VCODEC_HALFPEL_HV].p_data - origin, p_ref->halfpel[VCODEC_HALFPEL_H].p_data - origin, stride, width, height, filter);
+}
+
+bool vcodec_motion_vector_in_range(int x, int y, int block_size, int mvx, int mvy, int width, int height) {
+    // Fractional vectors read one more column or row than the full-pel part of the vector does
+    const int left = x + (mvx >> VCODEC_SUBPEL_SHIFT);
+    const int right = x + ((mvx + VCODEC_SUBPEL_SCALE - 1) >> VCODEC_SUBPEL_SHIFT) + block_size;
+    const int top = y + (mvy >> VCODEC_SUBPEL_SHIFT);
+    const int bottom = y + ((mvy + VCODEC_SUBPEL_SCALE - 1) >> VCODEC_SUBPEL_SHIFT) + block_size;
+    return left >= -VCODEC_MOTION_RANGE && right <= width + VCODEC_MOTION_RANGE && top >= -VCODEC_MOTION_RANGE && bottom <= height + VCODEC_MOTION_RANGE;
+}
+
+static const uint8_t *subpel_sample(const vcodec_subpel_ref_t *p_ref, const subpel_source_t *p_source, int x, int y) {
+    const uint8_t *p_plane = FULLPEL == p_source->plane ? p_ref->p_full : p_ref->halfpel[p_source->plane].p_data;
+    return p_plane + (y + p_source->dy) * p_ref->stride + x + p_source->dx;
+}
+
+void vcodec_subpel_sources(const vcodec_subpel_ref_t *p_ref, int x, int y, int mvx, int mvy, const uint8_t **pp_a, const uint8_t **pp_b) {
+    const int full_x = x + (mvx >> VCODEC_SUBPEL_SHIFT);
+    const int full_y = y + (mvy >> VCODEC_SUBPEL_SHIFT);
+    const subpel_source_t *p_sources = subpel_sources[(mvy & (VCODEC_SUBPEL_SCALE - 1)) * VCODEC_SUBPEL_SCALE + (mvx & (VCODEC_SUBPEL_SCALE - 1))];
+    *pp_a = subpel_sample(p_ref, &p_sources[0], full_x, full_y);
+    *pp_b = subpel_sample(p_ref, &p_sources[1], full_x, full_y);
+}
+
+void vcodec_subpel_predict(const vcodec_subpel_ref_t *p_ref, int x, int y, int mvx, int mvy, int block_size, uint8_t *p_dst, const vcodec_dsp_t *p_dsp) {
+    const uint8_t *p_a;
+    const uint8_t *p_b;
+    vcodec_subpel_sources(p_ref, x, y, mvx, mvy, &p_a, &p_b);
+    if (p_a == p_b) {
+        p_dsp->copy_block(p_dst, p_a, p_ref->stride, block_size);
+    } else {
+        p_dsp->average_block(p_dst, p_a, p_b, p_ref->stride, block_size);
+    }
+}
+
+void vcodec_subpel_residual(int16_t *p_residual, int residual_stride, const uint8_t *p_source_frame, const vcodec_subpel_ref_t *p_ref,
+        int x, int y, int mvx, int mvy, int block_size) {
+    const int stride = p_ref->stride;
+    const uint8_t *p_a;
+    const uint8_t *p_b;
+    vcodec_subpel_sources(p_ref, x, y, mvx, mvy, &p_a, &p_b);
+    const uint8_t *p_source = p_source_frame + y * stride + x;
+    if (p_a == p_b) {
+        for (int i = 0; i < block_size; i++) {
+            for (int j = 0; j < block_size; j++) {
+                p_residual[i * residual_stride + j] = p_source[i * stride + j] - p_a[i * stride + j];
+            }
+        }
+        return;
+    }
+    for (int i = 0; i < block_size; i++) {
+        for (int j = 0; j < block_size; j++) {
+            p_residual[i * residual_stride + j] = p_source[i * stride + j] - ((p_a[i * stride + j] + p_b[i * stride + j] + 1) >> 1);
+        }
+    }
+}
+
+int vcodec_subpel_refine(const vcodec_subpel_ref_t *p_ref, const uint8_t *p_source_frame, int x, int y, int block_size, int *p_mvx, int *p_mvy, int cost,
+        const vcodec_dsp_t *p_dsp) {
+    const uint8_t *p_source = p_source_frame + y * p_ref->stride + x;
+    // Candidates stay within a pixel of the initial vector, so they only need checking near the edges of the motion range
+    const bool check_range = !vcodec_motion_vector_in_range(x - 1, y - 1, block_size + 2, *p_mvx, *p_mvy, p_ref->width, p_ref->height);
+    for (int step = VCODEC_SUBPEL_SCALE / 2; step > 0 && cost > 0; step /= 2) {
+        const int center_x = *p_mvx;
+        const int center_y = *p_mvy;
+        for (size_t i = 0; i < sizeof(refine_square) / sizeof(refine_square[0]); i++) {
+            const int mvx = center_x + refine_square[i].mvx * step;
+            const int mvy = center_y + refine_square[i].mvy * step;
+            if (check_range && !vcodec_motion_vector_in_range(x, y, block_size, mvx, mvy, p_ref->width, p_ref->height)) {
+                continue;
+            }
+            const uint8_t *p_a;
+            const uint8_t *p_b;
+            vcodec_subpel_sources(p_ref, x, y, mvx, mvy, &p_a, &p_b);
+            const int candidate_cost = p_dsp->sad_average(p_source, p_a, p_b, p_ref->stride, block_size);
+            if (candidate_cost < cost) {
+                cost = candidate_cost;
+                *p_mvx = mvx;
+                *p_mvy = mvy;
+            }
+        }
+    }
+    return cost;
+}
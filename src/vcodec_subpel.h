@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+#include "vcodec_common.h"
+#include "vcodec_frame.h"
+
+/**
+ * Motion vectors are in 1/VCODEC_SUBPEL_SCALE pixels (quarter pixels).
+ */
+#define VCODEC_SUBPEL_SHIFT 2
+#define VCODEC_SUBPEL_SCALE (1 << VCODEC_SUBPEL_SHIFT)
+
+/**
+ * Part of the frame border left out of the half-pel planes: the 6-tap filter reads 2 pixels before and 3 after the interpolated position.
+ */
+#define VCODEC_SUBPEL_MARGIN 4
+
+/**
+ * How far outside the picture a motion compensated block can read, in pixels.
+ */
+#define VCODEC_MOTION_RANGE (VCODEC_FRAME_BORDER - VCODEC_SUBPEL_MARGIN)
+
+typedef enum {
+    VCODEC_HALFPEL_H = 0, //< Half a pixel right of the full-pel sample
+    VCODEC_HALFPEL_V,     //< Half a pixel below
+    VCODEC_HALFPEL_HV,    //< Both, vertical interpolation of VCODEC_HALFPEL_H
+    VCODEC_HALFPEL_PLANES,
+} vcodec_halfpel_plane_t;
+
+/**
+ * Reference frame of motion compensation with its half-pel planes, interpolated once per frame.
+ * Half-pel planes are frames of the reference size, sharing its stride, filled up to VCODEC_MOTION_RANGE pixels outside the picture.
+ */
+struct vcodec_subpel_ref {
+    const uint8_t *p_full; //< Full-pel samples, the reference frame itself
+    vcodec_frame_t halfpel[VCODEC_HALFPEL_PLANES];
+    int stride;
+    int width;
+    int height;
+};
+
+vcodec_status_t vcodec_subpel_init(vcodec_subpel_ref_t *p_ref, int width, int height, vcodec_alloc_t alloc);
+
+void vcodec_subpel_free(vcodec_subpel_ref_t *p_ref, vcodec_free_t free);
+
+/**
+ * Interpolate the half-pel planes of @c p_frame, which has its border extended, and make it the reference.
+ */
+void vcodec_subpel_build(vcodec_subpel_ref_t *p_ref, const vcodec_frame_t *p_frame, vcodec_subpel_filter_t filter, const vcodec_dsp_t *p_dsp);
+
+/**
+ * Check that a block at (@c x, @c y) displaced by the quarter-pel vector (@c mvx, @c mvy) stays within VCODEC_MOTION_RANGE of the picture,
+ * including the extra full-pel column and row read by fractional vectors.
+ */
+bool vcodec_motion_vector_in_range(int x, int y, int block_size, int mvx, int mvy, int width, int height);
+
+/**
+ * Top left samples of the two planes averaged into the prediction of a block: the prediction is (a + b + 1) >> 1.
+ * Both are the same for full and half-pel vectors.
+ */
+void vcodec_subpel_sources(const vcodec_subpel_ref_t *p_ref, int x, int y, int mvx, int mvy, const uint8_t **pp_a, const uint8_t **pp_b);
+
+/**
+ * Motion compensated prediction of a block into @c p_dst, which has the reference stride and is aligned as a block of a frame.
+ */
+void vcodec_subpel_predict(const vcodec_subpel_ref_t *p_ref, int x, int y, int mvx, int mvy, int block_size, uint8_t *p_dst, const vcodec_dsp_t *p_dsp);
+
+/**
+ * Difference between a block of @c p_source_frame (reference stride) and its prediction, written with row stride @c residual_stride.
+ */
+void vcodec_subpel_residual(int16_t *p_residual, int residual_stride, const uint8_t *p_source_frame, const vcodec_subpel_ref_t *p_ref,
+        int x, int y, int mvx, int mvy, int block_size);
+
+/**
+ * Refine a motion vector with the 8 half-pel positions around it, then the 8 quarter-pel positions around the best one.
+ * Candidates read from the cached planes, nothing is interpolated per candidate.
+ * @param[in,out] p_mvx, p_mvy Quarter-pel vector.
+ * @param cost                 SAD of the initial vector, kept on ties.
+ * @return SAD of the refined vector.
+ */
+int vcodec_subpel_refine(const vcodec_subpel_ref_t *p_ref, const uint8_t *p_source_frame, int x, int y, int block_size, int *p_mvx, int *p_mvy, int cost,
+        const vcodec_dsp_t *p_dsp);
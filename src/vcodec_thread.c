@@ -0,0 +1,105 @@
+#include "vcodec_thread.h"
+
+#include <sched.h>
+#include <string.h>
+
+/**
+ * Take the next job of the current batch and run it with @c lock released.
+ * @return false if the batch has no jobs left.
+ */
+static bool run_next_job(vcodec_thread_pool_t *p_pool) {
+    if (p_pool->next_job >= p_pool->num_jobs) {
+        return false;
+    }
+    const int index = p_pool->next_job++;
+    pthread_mutex_unlock(&p_pool->lock);
+    p_pool->job(p_pool->p_arg, index);
+    pthread_mutex_lock(&p_pool->lock);
+    if (++p_pool->jobs_done == p_pool->num_jobs) {
+        pthread_cond_signal(&p_pool->done_cond);
+    }
+    return true;
+}
+
+static void *worker_main(void *p_arg) {
+    vcodec_thread_pool_t *p_pool = p_arg;
+    pthread_mutex_lock(&p_pool->lock);
+    while (!p_pool->exit) {
+        if (!run_next_job(p_pool)) {
+            pthread_cond_wait(&p_pool->job_cond, &p_pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+    return NULL;
+}
+
+vcodec_status_t vcodec_thread_pool_init(vcodec_thread_pool_t *p_pool, int num_threads) {
+    memset(p_pool, 0, sizeof(*p_pool));
+    if (num_threads < 1 || num_threads > VCODEC_MAX_THREADS) {
+        return VCODEC_STATUS_INVAL;
+    }
+    if (1 == num_threads) {
+        return VCODEC_STATUS_OK;
+    }
+    if (0 != pthread_mutex_init(&p_pool->lock, NULL)) {
+        return VCODEC_STATUS_NOMEM;
+    }
+    pthread_cond_init(&p_pool->job_cond, NULL);
+    pthread_cond_init(&p_pool->done_cond, NULL);
+    for (int i = 0; i < num_threads - 1; i++) {
+        if (0 != pthread_create(&p_pool->threads[i], NULL, worker_main, p_pool)) {
+            return VCODEC_STATUS_NOMEM;
+        }
+        p_pool->num_workers++;
+    }
+    return VCODEC_STATUS_OK;
+}
+
+void vcodec_thread_pool_free(vcodec_thread_pool_t *p_pool) {
+    if (0 == p_pool->num_workers) {
+        return;
+    }
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->exit = true;
+    pthread_cond_broadcast(&p_pool->job_cond);
+    pthread_mutex_unlock(&p_pool->lock);
+    for (int i = 0; i < p_pool->num_workers; i++) {
+        pthread_join(p_pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&p_pool->job_cond);
+    pthread_cond_destroy(&p_pool->done_cond);
+    pthread_mutex_destroy(&p_pool->lock);
+    p_pool->num_workers = 0;
+}
+
+void vcodec_thread_pool_run(vcodec_thread_pool_t *p_pool, vcodec_job_t job, void *p_arg, int num_jobs) {
+    if (0 == p_pool->num_workers || num_jobs <= 1) {
+        for (int i = 0; i < num_jobs; i++) {
+            job(p_arg, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->job = job;
+    p_pool->p_arg = p_arg;
+    p_pool->num_jobs = num_jobs;
+    p_pool->next_job = 0;
+    p_pool->jobs_done = 0;
+    pthread_cond_broadcast(&p_pool->job_cond);
+    // Caller works on the batch too, then waits for the jobs still running on the workers
+    while (run_next_job(p_pool)) {
+    }
+    while (p_pool->jobs_done < p_pool->num_jobs) {
+        pthread_cond_wait(&p_pool->done_cond, &p_pool->lock);
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+}
+
+void vcodec_progress_wait(const atomic_int *p_progress, int value) {
+    // Dependencies are usually a macroblock or two away, so only give up the CPU once the other job is clearly behind
+    for (int i = 0; atomic_load_explicit(p_progress, memory_order_acquire) < value; i++) {
+        if (i >= 64) {
+            sched_yield();
+        }
+    }
+}
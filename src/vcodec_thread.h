@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vcodec/vcodec.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Job of vcodec_thread_pool_run(), called once for each index in [0, num_jobs).
+ */
+typedef void (*vcodec_job_t)(void *p_arg, int index);
+
+/**
+ * Fixed set of worker threads which run the jobs of one batch at a time, together with the calling thread.
+ * Jobs are taken in index order, so a job can wait for the progress of a job with a lower index without a deadlock.
+ */
+typedef struct {
+    pthread_t threads[VCODEC_MAX_THREADS - 1];
+    int num_workers; //< Not counting the thread which calls vcodec_thread_pool_run()
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;
+    pthread_cond_t done_cond;
+    // Current batch, protected by @c lock
+    vcodec_job_t job;
+    void *p_arg;
+    int num_jobs;
+    int next_job;
+    int jobs_done;
+    bool exit;
+} vcodec_thread_pool_t;
+
+/**
+ * Start @c num_threads - 1 workers, so that batches run on @c num_threads threads with the caller.
+ * A single thread runs the jobs inline, without any synchronization.
+ */
+vcodec_status_t vcodec_thread_pool_init(vcodec_thread_pool_t *p_pool, int num_threads);
+
+/**
+ * Stop and join the workers.
+ */
+void vcodec_thread_pool_free(vcodec_thread_pool_t *p_pool);
+
+/**
+ * Run @c job for every index in [0, @c num_jobs) and return when all of them are done.
+ */
+void vcodec_thread_pool_run(vcodec_thread_pool_t *p_pool, vcodec_job_t job, void *p_arg, int num_jobs);
+
+/**
+ * Publish the progress of a job, e.g. the number of samples of a macroblock row which are reconstructed.
+ * Everything the job wrote before is visible to the jobs which see @c value in vcodec_progress_wait().
+ */
+static inline void vcodec_progress_set(atomic_int *p_progress, int value) {
+    atomic_store_explicit(p_progress, value, memory_order_release);
+}
+
+/**
+ * Wait until the progress of another job of the batch reaches @c value, spinning without taking any lock.
+ * The other job must have a lower index, see vcodec_thread_pool_t.
+ */
+void vcodec_progress_wait(const atomic_int *p_progress, int value);
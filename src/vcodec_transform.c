@@ -4,19 +4,21 @@
  * Modified by RostakaGmfun to fit into the vcodec code.
  */
 
-void forward4x4(int *tblock, const int *block)
+#include "vcodec_transform.h"
+
+void forward4x4(int16_t *p_block, int stride)
 {
   int i;
   int tmp[16];
   int *pTmp = tmp;
-  const int*pblock;
+  int16_t *pblock;
   int p0,p1,p2,p3;
   int t0,t1,t2,t3;
 
   // Horizontal
   for (i=0; i < 4; i++)
   {
-    pblock = &block[i * 4];
+    pblock = &p_block[i * stride];
     p0 = *(pblock++);
     p1 = *(pblock++);
     p2 = *(pblock++);
@@ -47,26 +49,26 @@ void forward4x4(int *tblock, const int *block)
     t2 = p1 - p2;
     t3 = p0 - p3;
 
-    tblock[i] = t0 +  t1;
-    tblock[4  + i] = t2 + (t3 << 1);
-    tblock[8  + i] = t0 -  t1;
-    tblock[12 + i] = t3 - (t2 << 1);
+    p_block[i] = t0 +  t1;
+    p_block[stride + i] = t2 + (t3 << 1);
+    p_block[2 * stride + i] = t0 -  t1;
+    p_block[3 * stride + i] = t3 - (t2 << 1);
   }
 }
 
-void inverse4x4(int *block, const int *tblock)
+void inverse4x4(int16_t *p_block, int stride)
 {
   int i;
   int tmp[16];
   int *pTmp = tmp;
-  const int *pblock;
+  int16_t *pblock;
   int p0,p1,p2,p3;
   int t0,t1,t2,t3;
 
   // Horizontal
   for (i = 0; i < 4; i++)
   {
-    pblock = &tblock[i * 4];
+    pblock = &p_block[i * stride];
     t0 = *(pblock++);
     t1 = *(pblock++);
     t2 = *(pblock++);
@@ -97,10 +99,10 @@ void inverse4x4(int *block, const int *tblock)
     p2 =(t1 >> 1) - t3;
     p3 = t1 + (t3 >> 1);
 
-    block[i] = p0 + p3;
-    block[4 + i] = p1 + p2;
-    block[8 + i] = p1 - p2;
-    block[12 + i] = p0 - p3;
+    p_block[i] = p0 + p3;
+    p_block[stride + i] = p1 + p2;
+    p_block[2 * stride + i] = p1 - p2;
+    p_block[3 * stride + i] = p0 - p3;
   }
 }
 
@@ -219,3 +221,25 @@ void hadamard2x2(int *tblock, const int *block)
   tblock[2] = (p0 - p2);
   tblock[3] = (p1 - p3);
 }
+
+void forward4x4_mb_c(int16_t *p_macroblock, int macroblock_size)
+{
+  for (int y = 0; y < macroblock_size; y += 4)
+    for (int x = 0; x < macroblock_size; x += 4)
+      forward4x4(p_macroblock + y * macroblock_size + x, macroblock_size);
+}
+
+void inverse4x4_descale_mb_c(int16_t *p_macroblock, int macroblock_size)
+{
+  for (int y = 0; y < macroblock_size; y += 4)
+  {
+    for (int x = 0; x < macroblock_size; x += 4)
+    {
+      int16_t *pblock = p_macroblock + y * macroblock_size + x;
+      inverse4x4(pblock, macroblock_size);
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+          pblock[i * macroblock_size + j] /= 16;
+    }
+  }
+}
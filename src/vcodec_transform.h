@@ -1,11 +1,48 @@
 #pragma once
 
-void forward4x4(int *tblock, const int *block);
+#include <stdint.h>
 
-void inverse4x4(int *block, const int *tblock);
+/**
+ * In-place 4x4 transforms of a block located at @c p_block inside a larger buffer with row stride @c stride.
+ * For residuals in [-255, 255] all forward4x4() outputs are within [-9180, 9180], and so are the
+ * intermediate values of inverse4x4() for rescaled coefficients, so both fit 16-bit storage.
+ */
+void forward4x4(int16_t *p_block, int stride);
+
+void inverse4x4(int16_t *p_block, int stride);
 
 void hadamard4x4(int *tblock, const int *block);
 
 void ihadamard4x4(int *block, const int *tblock);
 
 void hadamard2x2(int *tblock, const int *block);
+
+/**
+ * Apply forward4x4() in place to every 4x4 block of a macroblock stored row by row with a stride of @c macroblock_size.
+ * Input has to be a residual in the [-255, 255] range.
+ */
+void forward4x4_mb_c(int16_t *p_macroblock, int macroblock_size);
+
+/**
+ * Apply inverse4x4() in place to every 4x4 block of a macroblock stored row by row with a stride of @c macroblock_size,
+ * then descale the result (divide by 16, rounding towards zero) to get the residual back.
+ * Input has to be rescaled coefficients of a forward4x4_mb_c() output.
+ */
+void inverse4x4_descale_mb_c(int16_t *p_macroblock, int macroblock_size);
+
+#if defined(VCODEC_X86_SIMD)
+void forward4x4_mb_sse2(int16_t *p_macroblock, int macroblock_size);
+
+void inverse4x4_descale_mb_sse2(int16_t *p_macroblock, int macroblock_size);
+
+/**
+ * SSE2 versions of the DC transforms. DC sums do not fit 16 bits, so these use 32-bit lanes.
+ */
+void hadamard4x4_sse2(int *tblock, const int *block);
+
+void ihadamard4x4_sse2(int *block, const int *tblock);
+
+void forward4x4_mb_avx2(int16_t *p_macroblock, int macroblock_size);
+
+void inverse4x4_descale_mb_avx2(int16_t *p_macroblock, int macroblock_size);
+#endif
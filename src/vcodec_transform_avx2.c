@@ -0,0 +1,94 @@
+/**
+ * AVX2 versions of the macroblock integer transforms.
+ * One register holds a full 16-pixel macroblock row, so a single pass transforms four 4x4 blocks.
+ * Results are bit-exact with the scalar functions in vcodec_transform.c.
+ */
+
+#include "vcodec_transform.h"
+
+#include <immintrin.h>
+
+/**
+ * Transpose four 4x4 blocks of 16-bit values stored side by side, one 64-bit block row per block in each register.
+ */
+static inline void transpose4x4x4_epi16(__m256i *r) {
+    const __m256i t0 = _mm256_unpacklo_epi16(r[0], r[1]);
+    const __m256i t1 = _mm256_unpackhi_epi16(r[0], r[1]);
+    const __m256i t2 = _mm256_unpacklo_epi16(r[2], r[3]);
+    const __m256i t3 = _mm256_unpackhi_epi16(r[2], r[3]);
+    const __m256i u0 = _mm256_unpacklo_epi32(t0, t2);
+    const __m256i u1 = _mm256_unpackhi_epi32(t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi32(t1, t3);
+    const __m256i u3 = _mm256_unpackhi_epi32(t1, t3);
+    r[0] = _mm256_unpacklo_epi64(u0, u2);
+    r[1] = _mm256_unpackhi_epi64(u0, u2);
+    r[2] = _mm256_unpacklo_epi64(u1, u3);
+    r[3] = _mm256_unpackhi_epi64(u1, u3);
+}
+
+static inline void forward_butterfly_epi16(__m256i *r) {
+    const __m256i t0 = _mm256_add_epi16(r[0], r[3]);
+    const __m256i t1 = _mm256_add_epi16(r[1], r[2]);
+    const __m256i t2 = _mm256_sub_epi16(r[1], r[2]);
+    const __m256i t3 = _mm256_sub_epi16(r[0], r[3]);
+    r[0] = _mm256_add_epi16(t0, t1);
+    r[1] = _mm256_add_epi16(_mm256_slli_epi16(t3, 1), t2);
+    r[2] = _mm256_sub_epi16(t0, t1);
+    r[3] = _mm256_sub_epi16(t3, _mm256_slli_epi16(t2, 1));
+}
+
+static inline void inverse_butterfly_epi16(__m256i *r) {
+    const __m256i p0 = _mm256_add_epi16(r[0], r[2]);
+    const __m256i p1 = _mm256_sub_epi16(r[0], r[2]);
+    const __m256i p2 = _mm256_sub_epi16(_mm256_srai_epi16(r[1], 1), r[3]);
+    const __m256i p3 = _mm256_add_epi16(r[1], _mm256_srai_epi16(r[3], 1));
+    r[0] = _mm256_add_epi16(p0, p3);
+    r[1] = _mm256_add_epi16(p1, p2);
+    r[2] = _mm256_sub_epi16(p1, p2);
+    r[3] = _mm256_sub_epi16(p0, p3);
+}
+
+/**
+ * Division by 16 with rounding towards zero, like the scalar code.
+ */
+static inline void inverse_butterfly_descale_epi16(__m256i *r) {
+    inverse_butterfly_epi16(r);
+    for (int i = 0; i < 4; i++) {
+        const __m256i bias = _mm256_srli_epi16(_mm256_srai_epi16(r[i], 15), 12);
+        r[i] = _mm256_srai_epi16(_mm256_add_epi16(r[i], bias), 4);
+    }
+}
+
+#define TRANSFORM_MB_AVX2(p_macroblock, butterfly, last_butterfly) \
+    do { \
+        for (int y = 0; y < 16; y += 4) { \
+            int16_t *p = (p_macroblock) + y * 16; \
+            __m256i r[4]; \
+            for (int i = 0; i < 4; i++) { \
+                r[i] = _mm256_loadu_si256((const __m256i *)(p + i * 16)); \
+            } \
+            transpose4x4x4_epi16(r); \
+            butterfly(r); \
+            transpose4x4x4_epi16(r); \
+            last_butterfly(r); \
+            for (int i = 0; i < 4; i++) { \
+                _mm256_storeu_si256((__m256i *)(p + i * 16), r[i]); \
+            } \
+        } \
+    } while (0)
+
+void forward4x4_mb_avx2(int16_t *p_macroblock, int macroblock_size) {
+    if (16 != macroblock_size) {
+        forward4x4_mb_sse2(p_macroblock, macroblock_size);
+        return;
+    }
+    TRANSFORM_MB_AVX2(p_macroblock, forward_butterfly_epi16, forward_butterfly_epi16);
+}
+
+void inverse4x4_descale_mb_avx2(int16_t *p_macroblock, int macroblock_size) {
+    if (16 != macroblock_size) {
+        inverse4x4_descale_mb_sse2(p_macroblock, macroblock_size);
+        return;
+    }
+    TRANSFORM_MB_AVX2(p_macroblock, inverse_butterfly_epi16, inverse_butterfly_descale_epi16);
+}
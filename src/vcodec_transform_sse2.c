@@ -0,0 +1,161 @@
+/**
+ * SSE2 versions of the integer and hadamard transforms.
+ * Results are bit-exact with the scalar functions in vcodec_transform.c.
+ */
+
+#include "vcodec_transform.h"
+
+#include <emmintrin.h>
+
+/**
+ * Transpose two 4x4 blocks of 16-bit values stored side by side:
+ * row i of the left block is in the low 64 bits of r[i], row i of the right block is in the high 64 bits.
+ */
+static inline void transpose4x4x2_epi16(__m128i *r) {
+    const __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]);
+    const __m128i t1 = _mm_unpackhi_epi16(r[0], r[1]);
+    const __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]);
+    const __m128i t3 = _mm_unpackhi_epi16(r[2], r[3]);
+    const __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+    const __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+    const __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+    const __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+    r[0] = _mm_unpacklo_epi64(u0, u2);
+    r[1] = _mm_unpackhi_epi64(u0, u2);
+    r[2] = _mm_unpacklo_epi64(u1, u3);
+    r[3] = _mm_unpackhi_epi64(u1, u3);
+}
+
+static inline void forward_butterfly_epi16(__m128i *r) {
+    const __m128i t0 = _mm_add_epi16(r[0], r[3]);
+    const __m128i t1 = _mm_add_epi16(r[1], r[2]);
+    const __m128i t2 = _mm_sub_epi16(r[1], r[2]);
+    const __m128i t3 = _mm_sub_epi16(r[0], r[3]);
+    r[0] = _mm_add_epi16(t0, t1);
+    r[1] = _mm_add_epi16(_mm_slli_epi16(t3, 1), t2);
+    r[2] = _mm_sub_epi16(t0, t1);
+    r[3] = _mm_sub_epi16(t3, _mm_slli_epi16(t2, 1));
+}
+
+static inline void inverse_butterfly_epi16(__m128i *r) {
+    const __m128i p0 = _mm_add_epi16(r[0], r[2]);
+    const __m128i p1 = _mm_sub_epi16(r[0], r[2]);
+    const __m128i p2 = _mm_sub_epi16(_mm_srai_epi16(r[1], 1), r[3]);
+    const __m128i p3 = _mm_add_epi16(r[1], _mm_srai_epi16(r[3], 1));
+    r[0] = _mm_add_epi16(p0, p3);
+    r[1] = _mm_add_epi16(p1, p2);
+    r[2] = _mm_sub_epi16(p1, p2);
+    r[3] = _mm_sub_epi16(p0, p3);
+}
+
+/**
+ * Division by 16 with rounding towards zero, like the scalar code.
+ */
+static inline void inverse_butterfly_descale_epi16(__m128i *r) {
+    inverse_butterfly_epi16(r);
+    for (int i = 0; i < 4; i++) {
+        const __m128i bias = _mm_srli_epi16(_mm_srai_epi16(r[i], 15), 12);
+        r[i] = _mm_srai_epi16(_mm_add_epi16(r[i], bias), 4);
+    }
+}
+
+/**
+ * Run the row pass (across registers after the transpose) first and the column pass second, like the scalar code.
+ * The order matters for the inverse transform, which drops bits in the shifts.
+ */
+#define TRANSFORM_MB_SSE2(p_macroblock, macroblock_size, butterfly, last_butterfly) \
+    do { \
+        for (int y = 0; y < (macroblock_size); y += 4) { \
+            for (int x = 0; x < (macroblock_size); x += 8) { \
+                int16_t *p = (p_macroblock) + y * (macroblock_size) + x; \
+                __m128i r[4]; \
+                for (int i = 0; i < 4; i++) { \
+                    r[i] = _mm_loadu_si128((const __m128i *)(p + i * (macroblock_size))); \
+                } \
+                transpose4x4x2_epi16(r); \
+                butterfly(r); \
+                transpose4x4x2_epi16(r); \
+                last_butterfly(r); \
+                for (int i = 0; i < 4; i++) { \
+                    _mm_storeu_si128((__m128i *)(p + i * (macroblock_size)), r[i]); \
+                } \
+            } \
+        } \
+    } while (0)
+
+void forward4x4_mb_sse2(int16_t *p_macroblock, int macroblock_size) {
+    if (macroblock_size < 8) {
+        forward4x4_mb_c(p_macroblock, macroblock_size);
+        return;
+    }
+    TRANSFORM_MB_SSE2(p_macroblock, macroblock_size, forward_butterfly_epi16, forward_butterfly_epi16);
+}
+
+void inverse4x4_descale_mb_sse2(int16_t *p_macroblock, int macroblock_size) {
+    if (macroblock_size < 8) {
+        inverse4x4_descale_mb_c(p_macroblock, macroblock_size);
+        return;
+    }
+    TRANSFORM_MB_SSE2(p_macroblock, macroblock_size, inverse_butterfly_epi16, inverse_butterfly_descale_epi16);
+}
+
+static inline void transpose4x4_epi32(__m128i *r) {
+    const __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    const __m128i t1 = _mm_unpackhi_epi32(r[0], r[1]);
+    const __m128i t2 = _mm_unpacklo_epi32(r[2], r[3]);
+    const __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+    r[0] = _mm_unpacklo_epi64(t0, t2);
+    r[1] = _mm_unpackhi_epi64(t0, t2);
+    r[2] = _mm_unpacklo_epi64(t1, t3);
+    r[3] = _mm_unpackhi_epi64(t1, t3);
+}
+
+static inline void hadamard_butterfly_epi32(__m128i *r) {
+    const __m128i t0 = _mm_add_epi32(r[0], r[3]);
+    const __m128i t1 = _mm_add_epi32(r[1], r[2]);
+    const __m128i t2 = _mm_sub_epi32(r[1], r[2]);
+    const __m128i t3 = _mm_sub_epi32(r[0], r[3]);
+    r[0] = _mm_add_epi32(t0, t1);
+    r[1] = _mm_add_epi32(t3, t2);
+    r[2] = _mm_sub_epi32(t0, t1);
+    r[3] = _mm_sub_epi32(t3, t2);
+}
+
+static inline void ihadamard_butterfly_epi32(__m128i *r) {
+    const __m128i p0 = _mm_add_epi32(r[0], r[2]);
+    const __m128i p1 = _mm_sub_epi32(r[0], r[2]);
+    const __m128i p2 = _mm_sub_epi32(r[1], r[3]);
+    const __m128i p3 = _mm_add_epi32(r[1], r[3]);
+    r[0] = _mm_add_epi32(p0, p3);
+    r[1] = _mm_add_epi32(p1, p2);
+    r[2] = _mm_sub_epi32(p1, p2);
+    r[3] = _mm_sub_epi32(p0, p3);
+}
+
+void hadamard4x4_sse2(int *tblock, const int *block) {
+    __m128i r[4];
+    for (int i = 0; i < 4; i++) {
+        r[i] = _mm_loadu_si128((const __m128i *)(block + i * 4));
+    }
+    transpose4x4_epi32(r);
+    hadamard_butterfly_epi32(r);
+    transpose4x4_epi32(r);
+    hadamard_butterfly_epi32(r);
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(tblock + i * 4), _mm_srai_epi32(r[i], 1));
+    }
+}
+
+void ihadamard4x4_sse2(int *block, const int *tblock) {
+    __m128i r[4];
+    for (int i = 0; i < 4; i++) {
+        r[i] = _mm_loadu_si128((const __m128i *)(tblock + i * 4));
+    }
+    transpose4x4_epi32(r);
+    ihadamard_butterfly_epi32(r);
+    transpose4x4_epi32(r);
+    ihadamard_butterfly_epi32(r);
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(block + i * 4), r[i]);
+    }
+}
@@ -1,6 +1,7 @@
 #include <unity.h>
 #include <unity_fixture.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "vcodec/bitstream.h"
 
@@ -38,9 +39,8 @@ TEST_TEAR_DOWN(bitstream_tests) {
 }
 
 TEST(bitstream_tests, test_bitstream_writer_putbits) {
-    vcodec_bitstream_writer_t writer = {
-        .write = write_mock,
-    };
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
 
     vcodec_bitstream_writer_putbits(&writer, 0xabcd, 16);
     TEST_ASSERT_EQUAL_HEX(0xab, writer.buffer[0]);
@@ -104,9 +104,8 @@ TEST(bitstream_tests, test_bitstream_writer_putbits) {
 }
 
 TEST(bitstream_tests, test_bitstream_writer_zeroes_ones_flush) {
-    vcodec_bitstream_writer_t writer = {
-        .write = write_mock,
-    };
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
     vcodec_bitstream_writer_putones(&writer, 10);
     TEST_ASSERT_EQUAL(0, io_ctx.cursor);
     TEST_ASSERT_EQUAL_HEX(0, io_ctx.buffer[0]);
@@ -132,9 +131,8 @@ TEST(bitstream_tests, test_bitstream_writer_zeroes_ones_flush) {
 }
 
 TEST(bitstream_tests, test_bitstream_writer_write_exp_golomb) {
-    vcodec_bitstream_writer_t writer = {
-        .write = write_mock,
-    };
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
     vcodec_bitstream_writer_write_exp_golomb(&writer, 0);
     TEST_ASSERT_EQUAL(0, io_ctx.cursor);
     TEST_ASSERT_EQUAL_HEX(0, io_ctx.buffer[0]);
@@ -167,9 +165,8 @@ TEST(bitstream_tests, test_bitstream_writer_write_exp_golomb) {
 }
 
 TEST(bitstream_tests, test_bitstream_reader_getbits) {
-    vcodec_bitstream_reader_t reader = {
-        .read = read_mock,
-    };
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
     io_ctx.buffer[0] = 0x81;
     io_ctx.buffer[1] = 0xff;
     io_ctx.buffer[2] = 0xab;
@@ -191,9 +188,8 @@ TEST(bitstream_tests, test_bitstream_reader_getbits) {
 }
 
 TEST(bitstream_tests, test_bitstream_reader_getzeroes) {
-    vcodec_bitstream_reader_t reader = {
-        .read = read_mock,
-    };
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
     io_ctx.buffer[0] = 0x81;
     io_ctx.buffer[1] = 0x00;
     io_ctx.buffer[2] = 0x00;
@@ -229,9 +225,8 @@ TEST(bitstream_tests, test_bitstream_reader_getzeroes) {
 }
 
 TEST(bitstream_tests, test_bitstream_reader_read_exp_golomb) {
-    vcodec_bitstream_reader_t reader = {
-        .read = read_mock,
-    };
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
     // 0 as 0b1, 1 as 0b010, 256 as 0b00000000100000001, and 0 as 0b1
     io_ctx.buffer[0] = 0xa0;
     io_ctx.buffer[1] = 0x08;
@@ -255,13 +250,11 @@ TEST(bitstream_tests, test_bitstream_reader_read_exp_golomb) {
 }
 
 TEST(bitstream_tests, test_bitstream_exp_golomb_write_read) {
-    vcodec_bitstream_reader_t reader = {
-        .read = read_mock,
-    };
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
 
-    vcodec_bitstream_writer_t writer = {
-        .write = write_mock,
-    };
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
 
     for (int i = 0; i < 16; i++) {
         vcodec_bitstream_writer_write_exp_golomb(&writer, i);
@@ -273,6 +266,161 @@ TEST(bitstream_tests, test_bitstream_exp_golomb_write_read) {
     }
 }
 
+TEST(bitstream_tests, test_bitstream_reader_peek_skip) {
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
+    io_ctx.buffer[0] = 0xab;
+    io_ctx.buffer[1] = 0xcd;
+    io_ctx.buffer[2] = 0xef;
+    TEST_ASSERT_EQUAL_HEX(0xa, vcodec_bitstream_reader_peekbits(&reader, 4));
+    TEST_ASSERT_EQUAL_HEX(0xabcd, vcodec_bitstream_reader_peekbits(&reader, 16));
+    TEST_ASSERT_EQUAL(0, reader.bit_pos);
+    vcodec_bitstream_reader_skipbits(&reader, 4);
+    TEST_ASSERT_EQUAL_HEX(0xbcdef, vcodec_bitstream_reader_peekbits(&reader, 20));
+    vcodec_bitstream_reader_skipbits(&reader, 12);
+    TEST_ASSERT_EQUAL(16, reader.bit_pos);
+    TEST_ASSERT_EQUAL_HEX(0xef, vcodec_bitstream_reader_peekbits(&reader, 8));
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_reader_status(&reader));
+}
+
+TEST(bitstream_tests, test_bitstream_exp_golomb_long_codes) {
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
+
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
+
+    // Cover table lookup, single window and bit by bit decoding paths
+    static const uint32_t values[] = { 14, 15, 254, 255, 65535, (1u << 28) - 2, (1u << 28) - 1, (1u << 31) - 1, 0 };
+    const int num_values = sizeof(values) / sizeof(values[0]);
+    for (int i = 0; i < num_values; i++) {
+        vcodec_bitstream_writer_write_exp_golomb(&writer, values[i]);
+    }
+    vcodec_bitstream_writer_flush(&writer);
+    io_ctx.cursor = 0;
+    for (int i = 0; i < num_values; i++) {
+        TEST_ASSERT_EQUAL(values[i], vcodec_bitstream_reader_read_exp_golomb(&reader));
+    }
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_reader_status(&reader));
+}
+
+static void *alloc_mock(size_t size) {
+    return malloc(size);
+}
+
+static void free_mock(void *ptr) {
+    free(ptr);
+}
+
+TEST(bitstream_tests, test_bitstream_writer_mem_overflow) {
+    uint8_t mem[4 + VCODEC_BITSTREAM_PADDING];
+    memset(mem, 0xff, sizeof(mem));
+    vcodec_bitstream_writer_t writer;
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_init_mem(&writer, mem, sizeof(mem), NULL, NULL));
+
+    vcodec_bitstream_writer_putbits(&writer, 0xabcd, 16);
+    vcodec_bitstream_writer_putbits(&writer, 0x1, 2);
+    vcodec_bitstream_writer_flush(&writer);
+    TEST_ASSERT_EQUAL(24, writer.bit_pos);
+    vcodec_bitstream_writer_putbits(&writer, 0x55, 8);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_status(&writer));
+    TEST_ASSERT_EQUAL_HEX(0xab, mem[0]);
+    TEST_ASSERT_EQUAL_HEX(0xcd, mem[1]);
+    TEST_ASSERT_EQUAL_HEX(0x40, mem[2]);
+    TEST_ASSERT_EQUAL_HEX(0x55, mem[3]);
+
+    vcodec_bitstream_writer_putbits(&writer, 0x1, 1);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_NOMEM, vcodec_bitstream_writer_status(&writer));
+    size_t size;
+    TEST_ASSERT_EQUAL_PTR(mem, vcodec_bitstream_writer_data(&writer, &size));
+    TEST_ASSERT_EQUAL(4, size);
+}
+
+TEST(bitstream_tests, test_bitstream_writer_mem_init_ownership) {
+    vcodec_bitstream_writer_t writer;
+    uint8_t mem[VCODEC_BITSTREAM_PADDING];
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_INVAL, vcodec_bitstream_writer_init_mem(&writer, mem, sizeof(mem), NULL, NULL));
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_INVAL, vcodec_bitstream_writer_init_mem(&writer, mem, sizeof(mem), alloc_mock, NULL));
+
+    // Too small buffer is released and replaced
+    uint8_t *p_small = alloc_mock(VCODEC_BITSTREAM_PADDING);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_init_mem(&writer, p_small, VCODEC_BITSTREAM_PADDING, alloc_mock, free_mock));
+    TEST_ASSERT_EQUAL(VCODEC_BITSTREAM_WRITER_BUFFER_LEN, writer.data_len);
+    vcodec_bitstream_writer_putbits(&writer, 0xab, 8);
+    size_t size;
+    uint8_t *p_data = vcodec_bitstream_writer_data(&writer, &size);
+    TEST_ASSERT_EQUAL(1, size);
+    TEST_ASSERT_EQUAL_HEX(0xab, p_data[0]);
+    free_mock(p_data);
+}
+
+TEST(bitstream_tests, test_bitstream_mem_grow_write_read) {
+    const size_t initial_size = 16 + VCODEC_BITSTREAM_PADDING;
+    uint8_t *p_initial = alloc_mock(initial_size);
+    vcodec_bitstream_writer_t writer;
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_init_mem(&writer, p_initial, initial_size, alloc_mock, free_mock));
+    for (uint32_t i = 0; i < 1000; i++) {
+        vcodec_bitstream_writer_write_exp_golomb(&writer, i * 37);
+    }
+    vcodec_bitstream_writer_flush(&writer);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_status(&writer));
+    size_t size;
+    uint8_t *p_data = vcodec_bitstream_writer_data(&writer, &size);
+    TEST_ASSERT_TRUE(size > initial_size);
+
+    // Exact-size copy: reader must not touch memory past the end
+    uint8_t *p_exact = alloc_mock(size);
+    memcpy(p_exact, p_data, size);
+    free_mock(p_data);
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init_mem(&reader, p_exact, size);
+    for (uint32_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL(i * 37, vcodec_bitstream_reader_read_exp_golomb(&reader));
+    }
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_reader_status(&reader));
+    vcodec_bitstream_reader_align(&reader);
+    uint32_t bits;
+    vcodec_bitstream_reader_getbits(&reader, &bits, 1);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_EOF, vcodec_bitstream_reader_status(&reader));
+    free_mock(p_exact);
+}
+
+/**
+ * Byte payloads written after alignment come back unchanged, and the reader position counts bits across buffer refills.
+ */
+TEST(bitstream_tests, test_bitstream_putbytes_tell) {
+    uint8_t payload[VCODEC_BITSTREAM_WRITER_BUFFER_LEN + 7];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)(i * 13 + 1);
+    }
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
+    vcodec_bitstream_writer_putbits(&writer, 0x5, 3);
+    vcodec_bitstream_writer_align(&writer);
+    vcodec_bitstream_writer_putbytes(&writer, payload, sizeof(payload));
+    vcodec_bitstream_writer_putbits(&writer, 0x1, 1);
+    vcodec_bitstream_writer_flush(&writer);
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_bitstream_writer_status(&writer));
+    TEST_ASSERT_EQUAL(sizeof(payload) + 2, io_ctx.cursor);
+    TEST_ASSERT_EQUAL_HEX(0xa0, io_ctx.buffer[0]);
+    TEST_ASSERT_EQUAL_MEMORY(payload, io_ctx.buffer + 1, sizeof(payload));
+
+    io_ctx.cursor = 0;
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
+    uint32_t bits;
+    vcodec_bitstream_reader_getbits(&reader, &bits, 3);
+    TEST_ASSERT_EQUAL(3, vcodec_bitstream_reader_tell(&reader));
+    vcodec_bitstream_reader_align(&reader);
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        vcodec_bitstream_reader_getbits(&reader, &bits, 8);
+        TEST_ASSERT_EQUAL_HEX(payload[i], bits);
+    }
+    TEST_ASSERT_EQUAL((sizeof(payload) + 1) * 8, vcodec_bitstream_reader_tell(&reader));
+    vcodec_bitstream_reader_getbits(&reader, &bits, 1);
+    TEST_ASSERT_EQUAL(1, bits);
+}
+
 TEST_GROUP_RUNNER(bitstream_tests)
 {
     RUN_TEST_CASE(bitstream_tests, test_bitstream_writer_putbits);
@@ -282,6 +430,13 @@ TEST_GROUP_RUNNER(bitstream_tests)
     RUN_TEST_CASE(bitstream_tests, test_bitstream_reader_getbits);
     RUN_TEST_CASE(bitstream_tests, test_bitstream_reader_getzeroes);
     RUN_TEST_CASE(bitstream_tests, test_bitstream_reader_read_exp_golomb);
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_reader_peek_skip);
 
     RUN_TEST_CASE(bitstream_tests, test_bitstream_exp_golomb_write_read);
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_exp_golomb_long_codes);
+
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_writer_mem_overflow);
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_writer_mem_init_ownership);
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_mem_grow_write_read);
+    RUN_TEST_CASE(bitstream_tests, test_bitstream_putbytes_tell);
 }
@@ -0,0 +1,503 @@
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vcodec/vcodec.h"
+#include "vcodec/pipeline.h"
+
+#define WIDTH 64
+#define HEIGHT 56
+#define NUM_FRAMES 4
+#define MAX_STREAM_SIZE (NUM_FRAMES * WIDTH * HEIGHT * 2)
+
+TEST_GROUP(codec_tests);
+
+TEST_SETUP(codec_tests) {
+}
+
+TEST_TEAR_DOWN(codec_tests) {
+}
+
+static void *test_alloc(size_t size) {
+    return malloc(size);
+}
+
+static void test_free(void *ptr) {
+    free(ptr);
+}
+
+/**
+ * Textured pattern moving right by 3 pixels per frame.
+ */
+static void make_frame(uint8_t *p_frame, int index) {
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            const int u = x - 3 * index;
+            p_frame[y * WIDTH + x] = (uint8_t)(40 + 2 * u + y + ((u * y) & 7) * 4);
+        }
+    }
+}
+
+/**
+ * Encode NUM_FRAMES frames into @c p_stream.
+ * @return Size of the stream.
+ */
+static size_t encode(uint8_t *p_stream, int num_slices, int num_threads, bool wavefront) {
+    vcodec_enc_ctx_t ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .out_buffer_grow = true,
+        .gop_size = 3,
+        .num_slices = num_slices,
+        .num_threads = num_threads,
+        .wavefront = wavefront,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    uint8_t frame[WIDTH * HEIGHT];
+    size_t size = 0;
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, ctx.process_frame(&ctx, frame));
+        TEST_ASSERT_TRUE(size + ctx.out_size <= MAX_STREAM_SIZE);
+        memcpy(p_stream + size, ctx.p_out_buffer, ctx.out_size);
+        size += ctx.out_size;
+    }
+    ctx.deinit(&ctx);
+    free(ctx.p_out_buffer);
+    free(ctx.bitstream_writer);
+    return size;
+}
+
+/**
+ * Slices are coded in parallel, but the stream must not depend on the number of threads, and must decode.
+ */
+TEST(codec_tests, test_slices_thread_independent) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    static uint8_t threaded_stream[MAX_STREAM_SIZE];
+    const size_t size = encode(stream, 3, 1, false);
+    TEST_ASSERT_EQUAL_INT(size, encode(threaded_stream, 3, 3, false));
+    TEST_ASSERT_EQUAL_MEMORY(stream, threaded_stream, size);
+    // More slices than macroblock rows
+    vcodec_enc_ctx_t ctx = { .width = WIDTH, .height = HEIGHT, .alloc = test_alloc, .free = test_free, .out_buffer_grow = true, .num_slices = 5 };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    free(ctx.bitstream_writer);
+
+    vcodec_dec_ctx_t dec_ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .p_in_buffer = stream,
+        .in_buffer_size = size,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_dec_init(&dec_ctx, VCODEC_TYPE_DCT));
+    uint8_t decoded[WIDTH * HEIGHT];
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        uint8_t source[WIDTH * HEIGHT];
+        make_frame(source, i);
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, dec_ctx.get_frame(&dec_ctx, decoded));
+        for (int j = 0; j < WIDTH * HEIGHT; j++) {
+            TEST_ASSERT_INT_WITHIN(32, source[j], decoded[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_EOF, dec_ctx.get_frame(&dec_ctx, decoded));
+    dec_ctx.deinit(&dec_ctx);
+    free(dec_ctx.bitstream_reader);
+}
+
+/**
+ * Three step search reaches 31 pixels, but the vectors must stay within the range the decoder accepts, also next to the frame edges.
+ */
+TEST(codec_tests, test_tss_fast_motion_decodes) {
+    enum { TSS_WIDTH = 64, TSS_HEIGHT = 128, TSS_FRAMES = 4 };
+    static uint8_t frames[TSS_FRAMES][TSS_WIDTH * TSS_HEIGHT];
+    for (int i = 0; i < TSS_FRAMES; i++) {
+        // Moves up by 29 to 31 pixels per frame
+        const int shift = 29 * i + i * (i - 1) / 2;
+        for (int y = 0; y < TSS_HEIGHT; y++) {
+            for (int x = 0; x < TSS_WIDTH; x++) {
+                frames[i][y * TSS_WIDTH + x] = (uint8_t)(128 + (int)(60 * sin((y + shift) * 0.1)) + x);
+            }
+        }
+    }
+    static uint8_t stream[TSS_FRAMES * TSS_WIDTH * TSS_HEIGHT * 2];
+    size_t size = 0;
+    vcodec_enc_ctx_t ctx = {
+        .width = TSS_WIDTH,
+        .height = TSS_HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .out_buffer_grow = true,
+        .motion_search = VCODEC_MOTION_SEARCH_TSS,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    for (int i = 0; i < TSS_FRAMES; i++) {
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, ctx.process_frame(&ctx, frames[i]));
+        TEST_ASSERT_TRUE(size + ctx.out_size <= sizeof(stream));
+        memcpy(stream + size, ctx.p_out_buffer, ctx.out_size);
+        size += ctx.out_size;
+    }
+    ctx.deinit(&ctx);
+    free(ctx.p_out_buffer);
+    free(ctx.bitstream_writer);
+
+    vcodec_dec_ctx_t dec_ctx = { .alloc = test_alloc, .free = test_free, .p_in_buffer = stream, .in_buffer_size = size };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_dec_init(&dec_ctx, VCODEC_TYPE_DCT));
+    static uint8_t decoded[TSS_WIDTH * TSS_HEIGHT];
+    for (int i = 0; i < TSS_FRAMES; i++) {
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, dec_ctx.get_frame(&dec_ctx, decoded));
+        for (int j = 0; j < TSS_WIDTH * TSS_HEIGHT; j++) {
+            TEST_ASSERT_INT_WITHIN(32, frames[i][j], decoded[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_EOF, dec_ctx.get_frame(&dec_ctx, decoded));
+    dec_ctx.deinit(&dec_ctx);
+    free(dec_ctx.bitstream_reader);
+}
+
+/**
+ * Wavefront codes the rows of key frames in parallel, but the stream must be the same as when they are coded one after another.
+ */
+TEST(codec_tests, test_wavefront_matches_serial) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    static uint8_t wavefront_stream[MAX_STREAM_SIZE];
+    for (int num_slices = 1; num_slices <= 2; num_slices++) {
+        const size_t size = encode(stream, num_slices, 1, false);
+        TEST_ASSERT_EQUAL_INT(size, encode(wavefront_stream, num_slices, 1, true));
+        TEST_ASSERT_EQUAL_MEMORY(stream, wavefront_stream, size);
+        TEST_ASSERT_EQUAL_INT(size, encode(wavefront_stream, num_slices, 4, true));
+        TEST_ASSERT_EQUAL_MEMORY(stream, wavefront_stream, size);
+    }
+}
+
+typedef struct {
+    int frames_read;
+    uint8_t *p_stream;
+    size_t size;
+    int writes_left; //< Writes before the output fails
+} test_io_t;
+
+static vcodec_status_t test_read_frame(uint8_t *p_frame, void *ctx) {
+    test_io_t *p_io = ctx;
+    if (NUM_FRAMES == p_io->frames_read) {
+        return VCODEC_STATUS_EOF;
+    }
+    make_frame(p_frame, p_io->frames_read++);
+    return VCODEC_STATUS_OK;
+}
+
+static vcodec_status_t test_write(const uint8_t *p_data, uint32_t size, void *ctx) {
+    test_io_t *p_io = ctx;
+    if (0 == p_io->writes_left--) {
+        return VCODEC_STATUS_IO_FAILED;
+    }
+    TEST_ASSERT_TRUE(p_io->size + size <= MAX_STREAM_SIZE);
+    memcpy(p_io->p_stream + p_io->size, p_data, size);
+    p_io->size += size;
+    return VCODEC_STATUS_OK;
+}
+
+/**
+ * Pipeline runs the source, coding and output on separate threads, with queues shorter than the clip,
+ * and must produce the same stream as process_frame. A failing output must stop it.
+ */
+TEST(codec_tests, test_pipeline_matches_process_frame) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    static uint8_t pipeline_stream[MAX_STREAM_SIZE];
+    const size_t size = encode(stream, 1, 1, false);
+
+    test_io_t io = { .p_stream = pipeline_stream, .writes_left = NUM_FRAMES };
+    vcodec_enc_ctx_t ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .write = test_write,
+        .io_ctx = &io,
+        .gop_size = 3,
+    };
+    vcodec_pipeline_t pipeline = {
+        .p_enc = &ctx,
+        .read_frame = test_read_frame,
+        .read_ctx = &io,
+        .depth = 2,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_pipeline_init(&pipeline, VCODEC_TYPE_DCT));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_pipeline_run(&pipeline));
+    TEST_ASSERT_EQUAL_INT(size, io.size);
+    TEST_ASSERT_EQUAL_MEMORY(stream, pipeline_stream, size);
+    TEST_ASSERT_EQUAL_INT(NUM_FRAMES, pipeline.stats.input.frames);
+    TEST_ASSERT_EQUAL_INT(NUM_FRAMES, pipeline.stats.output.frames);
+    TEST_ASSERT_TRUE(pipeline.stats.input.max_occupancy <= 2);
+    TEST_ASSERT_TRUE(pipeline.stats.output.max_occupancy <= 2);
+
+    // Output fails after the first frame
+    io = (test_io_t){ .p_stream = pipeline_stream, .writes_left = 1 };
+    ctx.reset(&ctx);
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_IO_FAILED, vcodec_pipeline_run(&pipeline));
+    vcodec_pipeline_deinit(&pipeline);
+    free(ctx.bitstream_writer);
+}
+
+typedef struct {
+    uint8_t *p_stream;
+    size_t size;
+    atomic_int packets;
+} test_packets_t;
+
+/**
+ * Append @c p_packet to the stream, checking that packets come in submission order, tagged with their frame index.
+ */
+static void append_packet(test_packets_t *p_packets, const vcodec_packet_t *p_packet) {
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, p_packet->status);
+    const int index = atomic_load(&p_packets->packets);
+    TEST_ASSERT_EQUAL_PTR((void *)(intptr_t)index, p_packet->user_tag);
+    TEST_ASSERT_EQUAL_INT(index, p_packet->pts);
+    TEST_ASSERT_EQUAL_INT(0 == index % 3 ? VCODEC_FRAME_TYPE_KEY : VCODEC_FRAME_TYPE_P, p_packet->frame_type);
+    TEST_ASSERT_TRUE(p_packets->size + p_packet->size <= MAX_STREAM_SIZE);
+    memcpy(p_packets->p_stream + p_packets->size, p_packet->p_data, p_packet->size);
+    p_packets->size += p_packet->size;
+    atomic_fetch_add(&p_packets->packets, 1);
+}
+
+static void test_on_packet(const vcodec_packet_t *p_packet, void *ctx) {
+    append_packet(ctx, p_packet);
+}
+
+/**
+ * Frames submitted to the worker thread, with receive or with the completion callback, must give the same stream as process_frame.
+ */
+TEST(codec_tests, test_async_submit_receive) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    static uint8_t async_stream[MAX_STREAM_SIZE];
+    const size_t size = encode(stream, 1, 1, false);
+
+    test_packets_t packets = { .p_stream = async_stream };
+    vcodec_enc_ctx_t ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .gop_size = 3,
+        .async_depth = 2,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    vcodec_packet_t packet;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_AGAIN, vcodec_enc_receive(&ctx, &packet));
+    uint8_t frame[WIDTH * HEIGHT];
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        vcodec_status_t ret;
+        while (VCODEC_STATUS_AGAIN == (ret = vcodec_enc_submit(&ctx, frame, i, (void *)(intptr_t)i))) {
+            // Queue is full, make room by taking the oldest packet
+            TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_receive(&ctx, &packet));
+            append_packet(&packets, &packet);
+        }
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, ret);
+        // Frame is copied, so the buffer can be overwritten right away
+        memset(frame, 0, sizeof(frame));
+    }
+    vcodec_status_t ret;
+    while (VCODEC_STATUS_OK == (ret = vcodec_enc_receive(&ctx, &packet))) {
+        append_packet(&packets, &packet);
+    }
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_AGAIN, ret);
+    TEST_ASSERT_EQUAL_INT(NUM_FRAMES, atomic_load(&packets.packets));
+    TEST_ASSERT_EQUAL_INT(size, packets.size);
+    TEST_ASSERT_EQUAL_MEMORY(stream, async_stream, size);
+    ctx.deinit(&ctx);
+    free(ctx.bitstream_writer);
+
+    // Completion callback variant
+    packets = (test_packets_t){ .p_stream = async_stream };
+    ctx = (vcodec_enc_ctx_t){
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .gop_size = 3,
+        .async_depth = 1,
+        .on_packet = test_on_packet,
+        .io_ctx = &packets,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_enc_receive(&ctx, &packet));
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        while (VCODEC_STATUS_AGAIN == vcodec_enc_submit(&ctx, frame, i, (void *)(intptr_t)i)) {
+            sched_yield();
+        }
+    }
+    // Deinit drops the frames which are not coded yet
+    while (atomic_load(&packets.packets) < NUM_FRAMES) {
+        sched_yield();
+    }
+    TEST_ASSERT_EQUAL_INT(size, packets.size);
+    TEST_ASSERT_EQUAL_MEMORY(stream, async_stream, size);
+    ctx.deinit(&ctx);
+    free(ctx.bitstream_writer);
+
+    // Output is returned in packets, not written
+    ctx = (vcodec_enc_ctx_t){ .width = WIDTH, .height = HEIGHT, .alloc = test_alloc, .free = test_free, .write = test_write, .async_depth = 1 };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+}
+
+/**
+ * Each frame gets a packet of its own which stays valid until released, released buffers are reused for later frames,
+ * and packets can outlive the encoder.
+ */
+TEST(codec_tests, test_encode_packet) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    const size_t size = encode(stream, 1, 1, false);
+
+    vcodec_enc_ctx_t ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .out_buffer_grow = true,
+        .gop_size = 3,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    uint8_t frame[WIDTH * HEIGHT];
+    vcodec_packet_t *packets[NUM_FRAMES];
+    size_t offset = 0;
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_encode_packet(&ctx, frame, 1000 * i, &packets[i]));
+        TEST_ASSERT_EQUAL_INT(0 == i % 3 ? VCODEC_FRAME_TYPE_KEY : VCODEC_FRAME_TYPE_P, packets[i]->frame_type);
+        TEST_ASSERT_EQUAL_INT(1000 * i, packets[i]->pts);
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT_TRUE(packets[i]->p_data != packets[j]->p_data);
+        }
+        offset += packets[i]->size;
+    }
+    // Packets held together make up the stream, without copies
+    TEST_ASSERT_EQUAL_INT(size, offset);
+    offset = 0;
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        TEST_ASSERT_EQUAL_MEMORY(stream + offset, packets[i]->p_data, packets[i]->size);
+        offset += packets[i]->size;
+    }
+    TEST_ASSERT_NULL(ctx.p_out_buffer);
+
+    const uint8_t *p_data = packets[1]->p_data;
+    vcodec_packet_release(packets[1]);
+    make_frame(frame, NUM_FRAMES);
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_encode_packet(&ctx, frame, 0, &packets[1]));
+    TEST_ASSERT_EQUAL_PTR(p_data, packets[1]->p_data);
+
+    ctx.qp = VCODEC_QP_MAX + 1;
+    vcodec_packet_t *p_packet;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_enc_encode_packet(&ctx, frame, 0, &p_packet));
+    TEST_ASSERT_NULL(p_packet);
+    ctx.deinit(&ctx);
+    free(ctx.bitstream_writer);
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        vcodec_packet_release(packets[i]);
+    }
+
+    // Output goes to the write callback
+    ctx = (vcodec_enc_ctx_t){ .width = WIDTH, .height = HEIGHT, .alloc = test_alloc, .free = test_free, .write = test_write };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_enc_encode_packet(&ctx, frame, 0, &p_packet));
+    ctx.deinit(&ctx);
+    free(ctx.bitstream_writer);
+}
+
+/**
+ * Decoder takes the frame size from the stream, follows QP changes, and carries on into an appended stream of another size.
+ */
+TEST(codec_tests, test_stream_parameter_sets) {
+    static uint8_t stream[MAX_STREAM_SIZE];
+    size_t size = 0;
+    vcodec_enc_ctx_t ctx = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .alloc = test_alloc,
+        .free = test_free,
+        .out_buffer_grow = true,
+        .gop_size = 3,
+        .num_ref_frames = 2,
+        .long_term_ref = true,
+    };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    uint8_t frame[WIDTH * HEIGHT];
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        // Next PPS is in the middle of the GOP
+        ctx.qp = i < 2 ? 20 : 30;
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, ctx.process_frame(&ctx, frame));
+        memcpy(stream + size, ctx.p_out_buffer, ctx.out_size);
+        size += ctx.out_size;
+    }
+    ctx.deinit(&ctx);
+    free(ctx.p_out_buffer);
+    free(ctx.bitstream_writer);
+
+    // Second stream with a smaller flat frame
+    const int small_width = 32;
+    const int small_height = 24;
+    ctx = (vcodec_enc_ctx_t){ .width = small_width, .height = small_height, .alloc = test_alloc, .free = test_free, .out_buffer_grow = true };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_enc_init(&ctx, VCODEC_TYPE_DCT));
+    memset(frame, 100, small_width * small_height);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, ctx.process_frame(&ctx, frame));
+        memcpy(stream + size, ctx.p_out_buffer, ctx.out_size);
+        size += ctx.out_size;
+    }
+    ctx.deinit(&ctx);
+    free(ctx.p_out_buffer);
+    free(ctx.bitstream_writer);
+
+    vcodec_dec_ctx_t dec_ctx = { .alloc = test_alloc, .free = test_free, .p_in_buffer = stream, .in_buffer_size = size };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_dec_init(&dec_ctx, VCODEC_TYPE_DCT));
+    TEST_ASSERT_EQUAL_INT(WIDTH, dec_ctx.width);
+    TEST_ASSERT_EQUAL_INT(HEIGHT, dec_ctx.height);
+    TEST_ASSERT_EQUAL_INT(3, dec_ctx.gop_size);
+    uint8_t decoded[WIDTH * HEIGHT];
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        make_frame(frame, i);
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, dec_ctx.get_frame(&dec_ctx, decoded));
+        for (int j = 0; j < WIDTH * HEIGHT; j++) {
+            TEST_ASSERT_INT_WITHIN(32, frame[j], decoded[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_AGAIN, dec_ctx.get_frame(&dec_ctx, decoded));
+    TEST_ASSERT_EQUAL_INT(small_width, dec_ctx.width);
+    TEST_ASSERT_EQUAL_INT(small_height, dec_ctx.height);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, dec_ctx.get_frame(&dec_ctx, decoded));
+        for (int j = 0; j < small_width * small_height; j++) {
+            TEST_ASSERT_INT_WITHIN(4, 100, decoded[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_EOF, dec_ctx.get_frame(&dec_ctx, decoded));
+    dec_ctx.deinit(&dec_ctx);
+    free(dec_ctx.bitstream_reader);
+
+    // Stream which does not start with an SPS
+    static const uint8_t p_frame_only[16] = { 0x00 };
+    dec_ctx = (vcodec_dec_ctx_t){ .alloc = test_alloc, .free = test_free, .p_in_buffer = p_frame_only, .in_buffer_size = sizeof(p_frame_only) };
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_dec_init(&dec_ctx, VCODEC_TYPE_DCT));
+    dec_ctx.deinit(&dec_ctx);
+    free(dec_ctx.bitstream_reader);
+}
+
+TEST_GROUP_RUNNER(codec_tests)
+{
+    RUN_TEST_CASE(codec_tests, test_slices_thread_independent);
+    RUN_TEST_CASE(codec_tests, test_tss_fast_motion_decodes);
+    RUN_TEST_CASE(codec_tests, test_wavefront_matches_serial);
+    RUN_TEST_CASE(codec_tests, test_pipeline_matches_process_frame);
+    RUN_TEST_CASE(codec_tests, test_async_submit_receive);
+    RUN_TEST_CASE(codec_tests, test_encode_packet);
+    RUN_TEST_CASE(codec_tests, test_stream_parameter_sets);
+}
@@ -0,0 +1,321 @@
+#include <unity.h>
+#include <unity_fixture.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "vcodec_dsp.h"
+
+TEST_GROUP(dsp_tests);
+
+#define TEST_ITERATIONS 1000
+
+static const vcodec_cpu_level_t levels[] = {
+    VCODEC_CPU_LEVEL_C,
+    VCODEC_CPU_LEVEL_SSE2,
+    VCODEC_CPU_LEVEL_AVX2,
+};
+
+TEST_SETUP(dsp_tests) {
+    unsetenv(VCODEC_CPU_ENV);
+}
+
+TEST_TEAR_DOWN(dsp_tests) {
+    unsetenv(VCODEC_CPU_ENV);
+}
+
+TEST(dsp_tests, test_dsp_init_level) {
+    vcodec_dsp_t dsp;
+    const vcodec_cpu_level_t supported = vcodec_cpu_detect();
+    TEST_ASSERT_EQUAL(supported, vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO));
+    TEST_ASSERT_EQUAL(VCODEC_CPU_LEVEL_C, vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_C));
+    TEST_ASSERT_EQUAL(VCODEC_CPU_LEVEL_C, dsp.level);
+    TEST_ASSERT_EQUAL_PTR(vcodec_block_cost_c, dsp.block_cost);
+    // Levels above the CPU capabilities fall back to the supported one
+    TEST_ASSERT_EQUAL(supported, vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AVX2));
+
+    setenv(VCODEC_CPU_ENV, "c", 1);
+    TEST_ASSERT_EQUAL(VCODEC_CPU_LEVEL_C, vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO));
+    // API field has priority over the environment
+    TEST_ASSERT_EQUAL(MIN(supported, VCODEC_CPU_LEVEL_SSE2), vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_SSE2));
+    setenv(VCODEC_CPU_ENV, "bogus", 1);
+    TEST_ASSERT_EQUAL(supported, vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO));
+}
+
+TEST(dsp_tests, test_dsp_kernels_bit_exact) {
+    static const int sizes[] = { 16, 8, 4 };
+    static vcodec_quant_tables_t quant;
+    vcodec_quant_tables_init(&quant);
+    vcodec_dsp_t ref;
+    vcodec_dsp_init(&ref, VCODEC_CPU_LEVEL_C);
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        srand(1);
+        for (int i = 0; i < TEST_ITERATIONS; i++) {
+            const int size = sizes[i % 3];
+            int16_t block[16 * 16];
+            uint8_t expected[16 * 20];
+            uint8_t actual[16 * 20];
+            for (int j = 0; j < size * size; j++) {
+                block[j] = rand() % 1024 - 384;
+            }
+            TEST_ASSERT_EQUAL_INT(ref.block_cost(block, size), dsp.block_cost(block, size));
+
+            memset(expected, 0xAA, sizeof(expected));
+            memset(actual, 0xAA, sizeof(actual));
+            ref.reconstruct(expected, 20, block, size);
+            dsp.reconstruct(actual, 20, block, size);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+
+            const vcodec_quant_t *p_quant = &quant.qp[VCODEC_QP_MIN + i % (VCODEC_QP_MAX - VCODEC_QP_MIN + 1)];
+            const uint32_t rounding = vcodec_quant_rounding(p_quant, i % 2);
+            int16_t mb_ref[16 * 16];
+            int16_t mb[16 * 16];
+            int16_t levels_ref[16 * 16];
+            int16_t levels[16 * 16];
+            for (int j = 0; j < size * size; j++) {
+                mb_ref[j] = rand() % 511 - 255;
+            }
+            memcpy(mb, mb_ref, sizeof(int16_t) * size * size);
+            ref.forward_quant_mb(levels_ref, mb_ref, size, p_quant, rounding);
+            dsp.forward_quant_mb(levels, mb, size, p_quant, rounding);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(levels_ref, levels, size * size);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(mb_ref, mb, size * size);
+
+            // Rescaling the levels of the last block gives the coefficients left by forward_quant_mb
+            int16_t *p_last_levels = levels + size * size - 16;
+            int16_t *p_last_block = mb + (size - 4) * size + size - 4;
+            int16_t dequant_ref[16 * 16];
+            memcpy(dequant_ref, mb, sizeof(int16_t) * size * size);
+            memset(p_last_block, 0, sizeof(int16_t) * 4);
+            ref.dequant4x4(dequant_ref + (size - 4) * size + size - 4, size, p_last_levels, p_quant);
+            dsp.dequant4x4(p_last_block, size, p_last_levels, p_quant);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(mb_ref, dequant_ref, size * size);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(mb_ref, mb, size * size);
+
+            ref.inverse4x4_descale_mb(mb_ref, size);
+            dsp.inverse4x4_descale_mb(mb, size);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(mb_ref, mb, size * size);
+        }
+    }
+}
+
+TEST(dsp_tests, test_dsp_sad_bit_exact) {
+    enum { WIDTH = 48, HEIGHT = 48 };
+    static const int sizes[] = { 16, 8, 4 };
+    static uint8_t source[WIDTH * HEIGHT];
+    static uint8_t ref[WIDTH * HEIGHT];
+    srand(1);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        source[i] = rand() % 256;
+        ref[i] = rand() % 256;
+    }
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        for (int i = 0; i < TEST_ITERATIONS; i++) {
+            const int size = sizes[i % 3];
+            // Keep the candidates inside the frame
+            const int x = 8 + rand() % (WIDTH - 16 - size + 1);
+            const int y = 8 + rand() % (HEIGHT - 16 - size + 1);
+            motion_vector_t candidates[9];
+            int costs[9];
+            for (int k = 0; k < 9; k++) {
+                candidates[k].mvx = rand() % 17 - 8;
+                candidates[k].mvy = rand() % 17 - 8;
+            }
+            const int num_candidates = 1 + i % 9;
+            dsp.sad_multi(source, ref, x, y, candidates, num_candidates, size, WIDTH, costs);
+            for (int k = 0; k < num_candidates; k++) {
+                const int expected = vcodec_motion_block_sad_c(source, ref, x, y, candidates[k].mvx, candidates[k].mvy, size, WIDTH);
+                TEST_ASSERT_EQUAL_INT(expected, costs[k]);
+                TEST_ASSERT_EQUAL_INT(expected, dsp.sad(source, ref, x, y, candidates[k].mvx, candidates[k].mvy, size, WIDTH));
+            }
+        }
+    }
+}
+
+TEST(dsp_tests, test_dsp_sad_window_bit_exact) {
+    enum { WIDTH = 40, HEIGHT = 24, NUM_DX = WIDTH - 3 - 2, NUM_DY = HEIGHT - 3 - 1 };
+    static uint8_t source[WIDTH * HEIGHT];
+    static uint8_t ref[WIDTH * HEIGHT];
+    static int expected[NUM_DX * NUM_DY];
+    static int actual[NUM_DX * NUM_DY];
+    srand(1);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        source[i] = rand() % 256;
+        ref[i] = rand() % 256;
+    }
+    // Window reaches the right and bottom edges of the plane, its width is not a multiple of 16
+    for (int i = 0; i < NUM_DY; i++) {
+        for (int j = 0; j < NUM_DX; j++) {
+            expected[i * NUM_DX + j] = vcodec_motion_block_sad_c(source, ref, 5, 3, j + 2 - 5, i + 1 - 3, 4, WIDTH);
+        }
+    }
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        dsp.sad_window4x4(source + 3 * WIDTH + 5, ref + WIDTH + 2, WIDTH, NUM_DX, NUM_DY, actual);
+        TEST_ASSERT_EQUAL_INT_ARRAY(expected, actual, NUM_DX * NUM_DY);
+    }
+}
+
+TEST(dsp_tests, test_dsp_downsample_bit_exact) {
+    // Odd output width exercises the tail of the SIMD kernels
+    enum { WIDTH = 78, HEIGHT = 12 };
+    static uint8_t source[WIDTH * HEIGHT];
+    static uint8_t expected[WIDTH / 2 * HEIGHT / 2];
+    static uint8_t actual[WIDTH / 2 * HEIGHT / 2];
+    srand(1);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        source[i] = rand() % 256;
+    }
+    vcodec_downsample2x_c(expected, WIDTH / 2, HEIGHT / 2, source, WIDTH);
+    TEST_ASSERT_EQUAL_INT((((source[0] + source[WIDTH] + 1) >> 1) + ((source[1] + source[WIDTH + 1] + 1) >> 1) + 1) >> 1, expected[0]);
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        memset(actual, 0, sizeof(actual));
+        dsp.downsample2x(actual, WIDTH / 2, HEIGHT / 2, source, WIDTH);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+    }
+}
+
+TEST(dsp_tests, test_dsp_copy_block_bit_exact) {
+    static const int sizes[] = { 16, 8, 4 };
+    enum { STRIDE = 32 };
+    // Source is read at an odd offset, destination is block aligned like in a frame
+    static uint8_t source[STRIDE * 17];
+    static uint8_t expected[STRIDE * 16] __attribute__((aligned(16)));
+    static uint8_t actual[STRIDE * 16] __attribute__((aligned(16)));
+    srand(1);
+    for (size_t i = 0; i < sizeof(source); i++) {
+        source[i] = rand() % 256;
+    }
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            memset(expected, 0xAA, sizeof(expected));
+            memset(actual, 0xAA, sizeof(actual));
+            for (int y = 0; y < sizes[i]; y++) {
+                memcpy(expected + y * STRIDE + sizes[i], source + y * STRIDE + 3, sizes[i]);
+            }
+            dsp.copy_block(actual + sizes[i], source + 3, STRIDE, sizes[i]);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+        }
+    }
+}
+
+TEST(dsp_tests, test_dsp_activity_map_bit_exact) {
+    // Narrower last column and shorter last row of macroblocks
+    enum { WIDTH = 72, HEIGHT = 40, STRIDE = 128, WIDTH_MBS = 5, HEIGHT_MBS = 3 };
+    static uint8_t frame[STRIDE * HEIGHT] __attribute__((aligned(16)));
+    static uint8_t prev_frame[STRIDE * HEIGHT] __attribute__((aligned(16)));
+    uint8_t expected[WIDTH_MBS * HEIGHT_MBS];
+    uint8_t actual[WIDTH_MBS * HEIGHT_MBS];
+    srand(1);
+    for (int i = 0; i < TEST_ITERATIONS; i++) {
+        const int threshold = rand() % 512;
+        for (int j = 0; j < STRIDE * HEIGHT; j++) {
+            frame[j] = rand() % 256;
+            prev_frame[j] = MIN(255, MAX(0, frame[j] + rand() % 5 - 2));
+        }
+        vcodec_activity_map_c(expected, frame, prev_frame, STRIDE, WIDTH, HEIGHT, threshold);
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+            vcodec_dsp_t dsp;
+            vcodec_dsp_init(&dsp, levels[l]);
+            memset(actual, 0xAA, sizeof(actual));
+            dsp.activity_map(actual, frame, prev_frame, STRIDE, WIDTH, HEIGHT, threshold);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+        }
+    }
+    // Pixels outside of the picture are not compared
+    memcpy(prev_frame, frame, sizeof(frame));
+    for (int y = 0; y < HEIGHT; y++) {
+        prev_frame[y * STRIDE + WIDTH] ^= 0xFF;
+    }
+    prev_frame[0] ^= 0xFF;
+    vcodec_activity_map_c(expected, frame, prev_frame, STRIDE, WIDTH, HEIGHT, 0);
+    TEST_ASSERT_EQUAL_UINT8(1, expected[0]);
+    for (int i = 1; i < WIDTH_MBS * HEIGHT_MBS; i++) {
+        TEST_ASSERT_EQUAL_UINT8(0, expected[i]);
+    }
+}
+
+TEST(dsp_tests, test_dsp_interpolate_bit_exact) {
+    // Plane width is not a multiple of the vector width, rows of the 6-tap filter read 2 samples before and 3 after
+    enum { WIDTH = 45, HEIGHT = 12, STRIDE = 64, ORIGIN = 3 * STRIDE + 8 };
+    static uint8_t source[STRIDE * (HEIGHT + 6)];
+    static uint8_t expected[STRIDE * (HEIGHT + 6)];
+    static uint8_t actual[STRIDE * (HEIGHT + 6)];
+    static const vcodec_subpel_filter_t filters[] = { VCODEC_SUBPEL_FILTER_6TAP, VCODEC_SUBPEL_FILTER_BILINEAR };
+    srand(1);
+    for (int i = 0; i < TEST_ITERATIONS; i++) {
+        for (size_t j = 0; j < sizeof(source); j++) {
+            // Extreme values check the clamping of the 6-tap filter
+            source[j] = rand() % 3 ? rand() % 256 : (rand() % 2) * 255;
+        }
+        for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+                vcodec_dsp_t dsp;
+                vcodec_dsp_init(&dsp, levels[l]);
+                memset(expected, 0xAA, sizeof(expected));
+                memset(actual, 0xAA, sizeof(actual));
+                vcodec_interpolate_h_c(expected + ORIGIN, source + ORIGIN, STRIDE, WIDTH, HEIGHT, filters[f]);
+                dsp.interpolate_h(actual + ORIGIN, source + ORIGIN, STRIDE, WIDTH, HEIGHT, filters[f]);
+                TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+                vcodec_interpolate_v_c(expected + ORIGIN, source + ORIGIN, STRIDE, WIDTH, HEIGHT, filters[f]);
+                dsp.interpolate_v(actual + ORIGIN, source + ORIGIN, STRIDE, WIDTH, HEIGHT, filters[f]);
+                TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+            }
+        }
+    }
+    // Bilinear half-pel samples are the rounded average of the two neighbours
+    vcodec_interpolate_h_c(expected + ORIGIN, source + ORIGIN, STRIDE, WIDTH, HEIGHT, VCODEC_SUBPEL_FILTER_BILINEAR);
+    TEST_ASSERT_EQUAL_UINT8((source[ORIGIN] + source[ORIGIN + 1] + 1) >> 1, expected[ORIGIN]);
+}
+
+TEST(dsp_tests, test_dsp_average_block_bit_exact) {
+    static const int sizes[] = { 16, 8, 4 };
+    enum { STRIDE = 32 };
+    static uint8_t a[STRIDE * 17];
+    static uint8_t b[STRIDE * 17];
+    static uint8_t expected[STRIDE * 16] __attribute__((aligned(16)));
+    static uint8_t actual[STRIDE * 16] __attribute__((aligned(16)));
+    srand(1);
+    for (size_t i = 0; i < sizeof(a); i++) {
+        a[i] = rand() % 256;
+        b[i] = rand() % 256;
+    }
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        vcodec_dsp_t dsp;
+        vcodec_dsp_init(&dsp, levels[l]);
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            memset(expected, 0xAA, sizeof(expected));
+            memset(actual, 0xAA, sizeof(actual));
+            // Sources are read at unaligned offsets, as planes of a sub-pel vector are
+            vcodec_average_block_c(expected + sizes[i], a + 3, b + STRIDE + 1, STRIDE, sizes[i]);
+            dsp.average_block(actual + sizes[i], a + 3, b + STRIDE + 1, STRIDE, sizes[i]);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+            TEST_ASSERT_EQUAL_INT(vcodec_sad_average_c(b + 5, a + 3, b + STRIDE + 1, STRIDE, sizes[i]),
+                    dsp.sad_average(b + 5, a + 3, b + STRIDE + 1, STRIDE, sizes[i]));
+        }
+        // SAD against the average itself
+        vcodec_average_block_c(expected, a + 3, b + STRIDE + 1, STRIDE, 16);
+        TEST_ASSERT_EQUAL_INT(0, dsp.sad_average(expected, a + 3, b + STRIDE + 1, STRIDE, 16));
+    }
+}
+
+TEST_GROUP_RUNNER(dsp_tests)
+{
+    RUN_TEST_CASE(dsp_tests, test_dsp_init_level);
+    RUN_TEST_CASE(dsp_tests, test_dsp_kernels_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_sad_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_sad_window_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_downsample_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_copy_block_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_activity_map_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_interpolate_bit_exact);
+    RUN_TEST_CASE(dsp_tests, test_dsp_average_block_bit_exact);
+}
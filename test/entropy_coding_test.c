@@ -37,15 +37,13 @@ TEST_TEAR_DOWN(entropy_coding_tests) {
 }
 
 TEST(entropy_coding_tests, test_vcodec_ec_read_write_coeffs) {
-    vcodec_bitstream_reader_t reader = {
-        .read = read_mock,
-    };
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
 
-    vcodec_bitstream_writer_t writer = {
-        .write = write_mock,
-    };
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
 
-    static const int test_vectors16[][16] = {
+    static const int16_t test_vectors16[][16] = {
         {
             0, 0, 0, 0,
             0, 0, 0, 0,
@@ -74,16 +72,61 @@ TEST(entropy_coding_tests, test_vcodec_ec_read_write_coeffs) {
     vcodec_bitstream_writer_flush(&writer);
     io_ctx.cursor = 0;
 
-    int result_vectors16[num_test_vectors16][16];
+    int16_t result_vectors16[num_test_vectors16][16];
 
     for (uint32_t i = 0; i < num_test_vectors16; i++) {
         const vcodec_status_t ret = vcodec_ec_read_coeffs(&reader, result_vectors16[i], 16);
         TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, ret);
-        TEST_ASSERT_EQUAL_INT_ARRAY(test_vectors16[i], result_vectors16[i], 16);
+        TEST_ASSERT_EQUAL_INT16_ARRAY(test_vectors16[i], result_vectors16[i], 16);
+    }
+}
+
+TEST(entropy_coding_tests, test_vcodec_ec_read_coeffs_overflow) {
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
+
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
+
+    // No zeroes, then a magnitude that does not fit 16 bits
+    vcodec_bitstream_writer_write_exp_golomb(&writer, 0);
+    vcodec_bitstream_writer_write_exp_golomb(&writer, INT16_MAX);
+    vcodec_bitstream_writer_flush(&writer);
+    io_ctx.cursor = 0;
+
+    int16_t result[16];
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_INVAL, vcodec_ec_read_coeffs(&reader, result, 16));
+}
+
+TEST(entropy_coding_tests, test_vcodec_ec_read_write_signed) {
+    vcodec_bitstream_reader_t reader;
+    vcodec_bitstream_reader_init(&reader, read_mock, NULL);
+
+    vcodec_bitstream_writer_t writer;
+    vcodec_bitstream_writer_init(&writer, write_mock, NULL);
+
+    static const int test_values[] = { 0, 1, -1, 2, -2, 63, -64, INT16_MAX / 2, -INT16_MAX / 2 };
+    const uint32_t num_test_values = sizeof(test_values) / sizeof(test_values[0]);
+    for (uint32_t i = 0; i < num_test_values; i++) {
+        vcodec_ec_write_signed(&writer, test_values[i]);
+    }
+    // Code of a value that does not fit 16 bits
+    vcodec_bitstream_writer_write_exp_golomb(&writer, INT16_MAX + 1);
+    vcodec_bitstream_writer_flush(&writer);
+    io_ctx.cursor = 0;
+
+    for (uint32_t i = 0; i < num_test_values; i++) {
+        int value = 0;
+        TEST_ASSERT_EQUAL(VCODEC_STATUS_OK, vcodec_ec_read_signed(&reader, &value));
+        TEST_ASSERT_EQUAL_INT(test_values[i], value);
     }
+    int value = 0;
+    TEST_ASSERT_EQUAL(VCODEC_STATUS_INVAL, vcodec_ec_read_signed(&reader, &value));
 }
 
 TEST_GROUP_RUNNER(entropy_coding_tests)
 {
     RUN_TEST_CASE(entropy_coding_tests, test_vcodec_ec_read_write_coeffs);
+    RUN_TEST_CASE(entropy_coding_tests, test_vcodec_ec_read_coeffs_overflow);
+    RUN_TEST_CASE(entropy_coding_tests, test_vcodec_ec_read_write_signed);
 }
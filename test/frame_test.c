@@ -0,0 +1,103 @@
+#include <unity.h>
+#include <unity_fixture.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vcodec_frame.h"
+#include "vcodec_picture.h"
+
+TEST_GROUP(frame_tests);
+
+TEST_SETUP(frame_tests) {
+}
+
+TEST_TEAR_DOWN(frame_tests) {
+}
+
+TEST(frame_tests, test_frame_layout) {
+    // Width is not a multiple of the alignment
+    vcodec_frame_t frame;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&frame, 100, 20, malloc));
+    TEST_ASSERT_EQUAL_INT(0, frame.stride % VCODEC_FRAME_ALIGNMENT);
+    TEST_ASSERT_GREATER_OR_EQUAL_INT(100 + 2 * VCODEC_FRAME_BORDER, frame.stride);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)frame.p_data % VCODEC_FRAME_ALIGNMENT);
+    // Whole border is inside the allocation
+    TEST_ASSERT_TRUE(frame.p_data - VCODEC_FRAME_BORDER * frame.stride - VCODEC_FRAME_BORDER >= (uint8_t *)frame.p_allocation);
+    vcodec_frame_free(&frame, free);
+    TEST_ASSERT_NULL(frame.p_allocation);
+}
+
+TEST(frame_tests, test_frame_extend_border) {
+    enum { WIDTH = 20, HEIGHT = 10 };
+    uint8_t picture[WIDTH * HEIGHT];
+    uint8_t copy[WIDTH * HEIGHT];
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        picture[i] = i;
+    }
+    vcodec_frame_t frame;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&frame, WIDTH, HEIGHT, malloc));
+    vcodec_frame_copy_from(&frame, picture);
+    vcodec_frame_extend_border(&frame);
+    for (int y = -VCODEC_FRAME_BORDER; y < HEIGHT + VCODEC_FRAME_BORDER; y++) {
+        for (int x = -VCODEC_FRAME_BORDER; x < WIDTH + VCODEC_FRAME_BORDER; x++) {
+            const int clamped_x = x < 0 ? 0 : (x >= WIDTH ? WIDTH - 1 : x);
+            const int clamped_y = y < 0 ? 0 : (y >= HEIGHT ? HEIGHT - 1 : y);
+            TEST_ASSERT_EQUAL_UINT8(picture[clamped_y * WIDTH + clamped_x], frame.p_data[y * frame.stride + x]);
+        }
+    }
+    vcodec_frame_copy_to(&frame, copy);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(picture, copy, WIDTH * HEIGHT);
+    vcodec_frame_free(&frame, free);
+}
+
+/**
+ * Short-term references rotate through the pool without copies, pictures are reused once nothing references them.
+ */
+TEST(frame_tests, test_picture_pool) {
+    vcodec_picture_pool_t pool;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_INVAL, vcodec_picture_pool_init(&pool, 32, 16, VCODEC_MAX_REF_FRAMES + 1, false, malloc));
+    vcodec_picture_pool_free(&pool, free);
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_picture_pool_init(&pool, 32, 16, 2, true, malloc));
+    TEST_ASSERT_EQUAL_INT(4, pool.num_pictures);
+
+    // Key frame, also kept as the long-term reference
+    vcodec_picture_t *p_key = vcodec_picture_pool_acquire(&pool);
+    vcodec_picture_pool_set_long_term(&pool, p_key);
+    vcodec_picture_pool_push(&pool, p_key);
+    vcodec_picture_unref(p_key);
+    TEST_ASSERT_EQUAL_INT(2, p_key->refcount);
+
+    vcodec_picture_t *p_frames[3];
+    for (int i = 0; i < 3; i++) {
+        p_frames[i] = vcodec_picture_pool_acquire(&pool);
+        TEST_ASSERT_NOT_NULL(p_frames[i]);
+        vcodec_picture_pool_push(&pool, p_frames[i]);
+        vcodec_picture_unref(p_frames[i]);
+    }
+    // Two most recent frames are the short-term references, the first one went back to the pool
+    TEST_ASSERT_EQUAL_INT(2, pool.num_short_term);
+    TEST_ASSERT_EQUAL_PTR(p_frames[2], pool.p_short_term[0]);
+    TEST_ASSERT_EQUAL_PTR(p_frames[1], pool.p_short_term[1]);
+    TEST_ASSERT_EQUAL_PTR(p_key, pool.p_long_term);
+    TEST_ASSERT_EQUAL_INT(1, p_key->refcount);
+    TEST_ASSERT_EQUAL_INT(0, p_frames[0]->refcount);
+    TEST_ASSERT_EQUAL_PTR(p_frames[0], vcodec_picture_pool_acquire(&pool));
+    // Every picture is in use
+    TEST_ASSERT_NULL(vcodec_picture_pool_acquire(&pool));
+
+    vcodec_picture_unref(p_frames[0]);
+    vcodec_picture_pool_clear(&pool);
+    TEST_ASSERT_EQUAL_INT(0, pool.num_short_term);
+    TEST_ASSERT_NULL(pool.p_long_term);
+    for (int i = 0; i < pool.num_pictures; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pool.pictures[i].refcount);
+    }
+    vcodec_picture_pool_free(&pool, free);
+}
+
+TEST_GROUP_RUNNER(frame_tests)
+{
+    RUN_TEST_CASE(frame_tests, test_frame_layout);
+    RUN_TEST_CASE(frame_tests, test_frame_extend_border);
+    RUN_TEST_CASE(frame_tests, test_picture_pool);
+}
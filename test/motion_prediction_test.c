@@ -1,8 +1,13 @@
 #include <unity.h>
 #include <unity_fixture.h>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include "vcodec_common.h"
+#include "vcodec_dsp.h"
+#include "vcodec_pyramid.h"
+#include "vcodec_subpel.h"
 
 TEST_GROUP(motion_prediction_tests);
 
@@ -15,8 +20,13 @@ typedef struct {
 
 cost_t *p_current_cost_table;
 int cost_table_size;
+// Cost of vectors missing from the table grows with the distance to this vector
+static int target_mvx;
+static int target_mvy;
+static int num_cost_calls;
 
 static int mock_cost_function(const uint8_t *p_source_frame, const uint8_t *p_ref_frame, int x, int y, int mvx, int mvy, int block_size, int frame_width) {
+    num_cost_calls++;
     for (int i = 0; i < cost_table_size; i++) {
         cost_t *c = p_current_cost_table + i;
         if (mvx == c->mvx && mvy == c->mvy) {
@@ -24,19 +34,25 @@ static int mock_cost_function(const uint8_t *p_source_frame, const uint8_t *p_re
             return c->cost;
         }
     }
-    TEST_ASSERT_FAIL_MESSAGE("Unexpected cost function arguments");
+    return 100 + 10 * (abs(mvx - target_mvx) + abs(mvy - target_mvy));
 }
 
-TEST_SETUP(motion_prediciton_tests) {
-
+static void set_cost_table(cost_t *p_table, int size, int mvx, int mvy) {
+    p_current_cost_table = p_table;
+    cost_table_size = size;
+    target_mvx = mvx;
+    target_mvy = mvy;
+    num_cost_calls = 0;
 }
 
-TEST_TEAR_DOWN(motion_prediciton_tests) {
+TEST_SETUP(motion_prediction_tests) {
+}
 
+TEST_TEAR_DOWN(motion_prediction_tests) {
 }
 
 /**
- * Block size: 4 -> 3*3*3 - 2 = 25 block comparisons
+ * Block size: 4 -> 3 steps of 9 block comparisons
  *
  * 0  0  0  0  0  0  0  0
  * 0  0  0  0  0  0  0  0
@@ -53,15 +69,436 @@ static cost_t tss_test_vector_1[] = {
     },
 };
 
-TEST(motion_prediciton_tests, test_match_block_tss) {
-    p_current_cost_table = tss_test_vector_1;
-    cost_table_size = sizeof(tss_test_vector_1) / sizeof(tss_test_vector_1[0]);
-    for (int i = 0; i < cost_table_size; i++) {
+/**
+ * Search area of TSS tests, large enough for every step.
+ */
+static const vcodec_motion_search_params_t tss_params = {
+    .method = VCODEC_MOTION_SEARCH_TSS,
+    .area_left = -64,
+    .area_top = -64,
+    .area_right = 64,
+    .area_bottom = 64,
+};
+
+TEST(motion_prediction_tests, test_match_block_tss) {
+    set_cost_table(tss_test_vector_1, sizeof(tss_test_vector_1) / sizeof(tss_test_vector_1[0]), 0, 0);
+    int mvx = -1;
+    int mvy = -1;
+    TEST_ASSERT_EQUAL_INT(1, vcodec_match_block_tss(NULL, NULL, 0, 0, 8, 4, &tss_params, &mvx, &mvy, mock_cost_function, NULL));
+    TEST_ASSERT_EQUAL_INT(0, mvx);
+    TEST_ASSERT_EQUAL_INT(0, mvy);
+    TEST_ASSERT_TRUE(tss_test_vector_1[0].visited);
+    TEST_ASSERT_EQUAL_INT(3 * 9, num_cost_calls);
+}
+
+/**
+ * Costs descend towards (-5, 6), the search has to follow them through all steps.
+ */
+static cost_t tss_test_vector_2[] = {
+    {
+        -5, 6, 7
+    },
+};
+
+TEST(motion_prediction_tests, test_match_block_tss_descends) {
+    set_cost_table(tss_test_vector_2, sizeof(tss_test_vector_2) / sizeof(tss_test_vector_2[0]), -5, 6);
+    int mvx = 0;
+    int mvy = 0;
+    TEST_ASSERT_EQUAL_INT(7, vcodec_match_block_tss(NULL, NULL, 0, 0, 16, 8, &tss_params, &mvx, &mvy, mock_cost_function, NULL));
+    TEST_ASSERT_EQUAL_INT(-5, mvx);
+    TEST_ASSERT_EQUAL_INT(6, mvy);
+    TEST_ASSERT_TRUE(tss_test_vector_2[0].visited);
+    TEST_ASSERT_EQUAL_INT(4 * 9, num_cost_calls);
+}
+
+/**
+ * Costs descend towards (-20, 25), but the area ends 9 pixels below the block, which TSS must not read past.
+ */
+TEST(motion_prediction_tests, test_match_block_tss_area) {
+    set_cost_table(NULL, 0, -20, 25);
+    vcodec_motion_search_params_t params = tss_params;
+    params.area_bottom = 16 + 9;
+    int mvx = 0;
+    int mvy = 0;
+    vcodec_match_block_tss(NULL, NULL, 0, 0, 32, 16, &params, &mvx, &mvy, mock_cost_function, NULL);
+    TEST_ASSERT_EQUAL_INT(-20, mvx);
+    TEST_ASSERT_EQUAL_INT(9, mvy);
+}
+
+/**
+ * Batched SAD has to pick the same vectors as SAD of one candidate at a time.
+ */
+TEST(motion_prediction_tests, test_match_block_tss_multi) {
+    enum { WIDTH = 96, HEIGHT = 96 };
+    static uint8_t source[WIDTH * HEIGHT];
+    static uint8_t ref[WIDTH * HEIGHT];
+    srand(1);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        ref[i] = rand() % 256;
+    }
+    // Source is the reference shifted by (3, -2) with some noise
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            const int ref_x = MIN(MAX(x + 3, 0), WIDTH - 1);
+            const int ref_y = MIN(MAX(y - 2, 0), HEIGHT - 1);
+            source[y * WIDTH + x] = MIN(ref[ref_y * WIDTH + ref_x] + rand() % 4, 255);
+        }
+    }
+    vcodec_dsp_t dsp;
+    vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO);
+    static const int sizes[] = { 16, 8, 4 };
+    const vcodec_motion_search_params_t params = { .method = VCODEC_MOTION_SEARCH_TSS, .area_right = WIDTH, .area_bottom = HEIGHT };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int mvx;
+        int mvy;
+        int mvx_multi;
+        int mvy_multi;
+        // Search range of the biggest block is 31 pixels, so the block is kept far enough from the frame edges
+        const int sad = vcodec_match_block_tss(ref, source, 40, 40, WIDTH, sizes[i], &params, &mvx, &mvy, dsp.sad, NULL);
+        const int sad_multi = vcodec_match_block_tss(ref, source, 40, 40, WIDTH, sizes[i], &params, &mvx_multi, &mvy_multi, dsp.sad, dsp.sad_multi);
+        TEST_ASSERT_EQUAL_INT(sad, sad_multi);
+        TEST_ASSERT_EQUAL_INT(mvx, mvx_multi);
+        TEST_ASSERT_EQUAL_INT(mvy, mvy_multi);
+        TEST_ASSERT_EQUAL_INT(sad, dsp.sad(source, ref, 40, 40, mvx, mvy, sizes[i], WIDTH));
+    }
+}
+
+static vcodec_motion_search_params_t epzs_params(int left, int top, int right, int bottom) {
+    vcodec_motion_search_params_t params = {
+        .method = VCODEC_MOTION_SEARCH_EPZS,
+        .area_left = left,
+        .area_top = top,
+        .area_right = right,
+        .area_bottom = bottom,
+    };
+    return params;
+}
+
+/**
+ * A predictor below the stop threshold ends the search right away.
+ */
+static cost_t epzs_test_vector_1[] = {
+    {
+        7, -3, 10
+    },
+};
+
+TEST(motion_prediction_tests, test_match_block_epzs_early_stop) {
+    set_cost_table(epzs_test_vector_1, sizeof(epzs_test_vector_1) / sizeof(epzs_test_vector_1[0]), 0, 0);
+    vcodec_motion_search_params_t params = epzs_params(-64, -64, 64, 64);
+    params.predictors[params.num_predictors++] = (motion_vector_t){ 1, 1 };
+    params.predictors[params.num_predictors++] = (motion_vector_t){ 7, -3 };
+    // Duplicates are evaluated once
+    params.predictors[params.num_predictors++] = (motion_vector_t){ 1, 1 };
+    int mvx;
+    int mvy;
+    TEST_ASSERT_EQUAL_INT(10, vcodec_match_block_epzs(NULL, NULL, 0, 0, 64, 16, &params, &mvx, &mvy, mock_cost_function, NULL));
+    TEST_ASSERT_EQUAL_INT(7, mvx);
+    TEST_ASSERT_EQUAL_INT(-3, mvy);
+    TEST_ASSERT_EQUAL_INT(3, num_cost_calls);
+}
+
+/**
+ * Without predictors the diamonds have to walk to the minimum at (-5, 6).
+ */
+TEST(motion_prediction_tests, test_match_block_epzs_diamond) {
+    set_cost_table(tss_test_vector_2, sizeof(tss_test_vector_2) / sizeof(tss_test_vector_2[0]), -5, 6);
+    tss_test_vector_2[0].visited = false;
+    vcodec_motion_search_params_t params = epzs_params(-64, -64, 64, 64);
+    int mvx;
+    int mvy;
+    TEST_ASSERT_EQUAL_INT(7, vcodec_match_block_epzs(NULL, NULL, 0, 0, 64, 4, &params, &mvx, &mvy, mock_cost_function, NULL));
+    TEST_ASSERT_EQUAL_INT(-5, mvx);
+    TEST_ASSERT_EQUAL_INT(6, mvy);
+    TEST_ASSERT_TRUE(tss_test_vector_2[0].visited);
+    // Still far less than an exhaustive search of the area
+    TEST_ASSERT_LESS_THAN(64, num_cost_calls);
+}
+
+TEST(motion_prediction_tests, test_match_block_epzs_area) {
+    set_cost_table(NULL, 0, -20, 0);
+    vcodec_motion_search_params_t params = epzs_params(0, 0, 64, 64);
+    params.predictors[params.num_predictors++] = (motion_vector_t){ -20, 0 };
+    int mvx;
+    int mvy;
+    // Block at x = 8 can not move more than 8 pixels left
+    vcodec_match_block_epzs(NULL, NULL, 8, 8, 64, 4, &params, &mvx, &mvy, mock_cost_function, NULL);
+    TEST_ASSERT_EQUAL_INT(-8, mvx);
+    TEST_ASSERT_EQUAL_INT(0, mvy);
+}
+
+TEST(motion_prediction_tests, test_motion_predictors) {
+    const motion_vector_t field[2 * 3] = {
+        { 1, 2 }, { 3, -4 }, { -5, 6 },
+        { 7, 8 }, { 0, 0 }, { 0, 0 },
+    };
+    const motion_vector_t prev_field[2 * 3] = {
+        { 0, 0 }, { 0, 0 }, { 0, 0 },
+        { 0, 0 }, { 9, 9 }, { 0, 0 },
+    };
+    motion_vector_t predictors[VCODEC_MAX_MOTION_PREDICTORS];
+    TEST_ASSERT_EQUAL_INT(0, vcodec_motion_predictors(field, NULL, 0, 0, 0, 3, predictors));
+    TEST_ASSERT_EQUAL_INT(1, vcodec_motion_predictors(field, NULL, 1, 0, 0, 3, predictors));
+    TEST_ASSERT_EQUAL_INT(1, predictors[0].mvx);
+
+    TEST_ASSERT_EQUAL_INT(5, vcodec_motion_predictors(field, prev_field, 1, 1, 0, 3, predictors));
+    // Left, top, top-right, median, co-located
+    TEST_ASSERT_EQUAL_INT(7, predictors[0].mvx);
+    TEST_ASSERT_EQUAL_INT(3, predictors[1].mvx);
+    TEST_ASSERT_EQUAL_INT(-5, predictors[2].mvx);
+    TEST_ASSERT_EQUAL_INT(3, predictors[3].mvx);
+    TEST_ASSERT_EQUAL_INT(6, predictors[3].mvy);
+    TEST_ASSERT_EQUAL_INT(9, predictors[4].mvx);
+
+    // No top-right neighbour in the last column, so no median either
+    TEST_ASSERT_EQUAL_INT(2, vcodec_motion_predictors(field, NULL, 2, 1, 0, 3, predictors));
+
+    // First row of a slice has no neighbours above
+    TEST_ASSERT_EQUAL_INT(2, vcodec_motion_predictors(field, prev_field, 1, 1, 1, 3, predictors));
+    TEST_ASSERT_EQUAL_INT(7, predictors[0].mvx);
+    TEST_ASSERT_EQUAL_INT(9, predictors[1].mvx);
+}
+
+/**
+ * Pyramid search has to find a shift far beyond the reach of the diamond search.
+ */
+TEST(motion_prediction_tests, test_motion_vector_prediction) {
+    const motion_vector_t field[2 * 3] = {
+        { 1, 2 }, { 3, -4 }, { -5, 6 },
+        { 7, 8 }, { 0, 0 }, { 0, 0 },
+    };
+    motion_vector_t mv = vcodec_motion_vector_prediction(field, 0, 0, 0, 3);
+    TEST_ASSERT_EQUAL_INT(0, mv.mvx);
+    TEST_ASSERT_EQUAL_INT(0, mv.mvy);
+    // Top only
+    mv = vcodec_motion_vector_prediction(field, 0, 1, 0, 3);
+    TEST_ASSERT_EQUAL_INT(1, mv.mvx);
+    // Median of left, top and top-right
+    mv = vcodec_motion_vector_prediction(field, 1, 1, 0, 3);
+    TEST_ASSERT_EQUAL_INT(3, mv.mvx);
+    TEST_ASSERT_EQUAL_INT(6, mv.mvy);
+    // No top-right neighbour, left is preferred
+    mv = vcodec_motion_vector_prediction(field, 2, 1, 0, 3);
+    TEST_ASSERT_EQUAL_INT(0, mv.mvx);
+    TEST_ASSERT_EQUAL_INT(0, mv.mvy);
+    mv = vcodec_motion_vector_prediction(field, 2, 0, 0, 3);
+    TEST_ASSERT_EQUAL_INT(3, mv.mvx);
+    // Left only at the top of a slice
+    mv = vcodec_motion_vector_prediction(field, 1, 1, 1, 3);
+    TEST_ASSERT_EQUAL_INT(7, mv.mvx);
+    TEST_ASSERT_EQUAL_INT(8, mv.mvy);
+}
 
+TEST(motion_prediction_tests, test_unpredict_partition) {
+    enum { WIDTH = 32, SIZE = 16 };
+    vcodec_frame_t ref;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&ref, WIDTH, WIDTH, malloc));
+    const int stride = ref.stride;
+    for (int i = 0; i < WIDTH; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+            ref.p_data[i * stride + j] = ((i * WIDTH + j) * 7) & 0xff;
+        }
+    }
+    vcodec_frame_extend_border(&ref);
+    vcodec_dsp_t dsp;
+    vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO);
+    vcodec_subpel_ref_t ref_subpel;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_subpel_init(&ref_subpel, WIDTH, WIDTH, malloc));
+    vcodec_subpel_build(&ref_subpel, &ref, VCODEC_SUBPEL_FILTER_6TAP, &dsp);
+    // Whole top-left quadrant, the others split into 4x4 blocks with the same vector, all full-pel
+    const block_motion_vector_t vectors[] = {
+        { .partition_mode = VCODEC_BLOCK_PARTITION_MODE_QUAD },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 4, .mvy = 8 },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = -12, .mvy = 0 },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 0, .mvy = -16 },
+        { .partition_mode = VCODEC_BLOCK_PARTITION_MODE_QUAD },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 8, .mvy = 8 },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 8, .mvy = 8 },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 8, .mvy = 8 },
+        { .motion_pred_mode = VCODEC_MOTION_PREDICTION_MODE_MV, .mvx = 8, .mvy = 8 },
+    };
+    int16_t residual[SIZE * SIZE] = { 0 };
+    const int x = 8;
+    const int y = 8;
+    const vcodec_subpel_ref_t *refs[] = { &ref_subpel };
+    TEST_ASSERT_EQUAL_INT(9, vcodec_unpredict_partition(residual, SIZE, vectors, refs, NULL, x, y, SIZE, stride));
+    static const int quadrant_vectors[4] = { 1, 2, 3, 5 };
+    for (int i = 0; i < SIZE; i++) {
+        for (int j = 0; j < SIZE; j++) {
+            const block_motion_vector_t *p_mv = &vectors[quadrant_vectors[(i / 8) * 2 + j / 8]];
+            TEST_ASSERT_EQUAL_INT(ref.p_data[(y + i + p_mv->mvy / 4) * stride + x + j + p_mv->mvx / 4], residual[i * SIZE + j]);
+        }
+    }
+    vcodec_subpel_free(&ref_subpel, free);
+    vcodec_frame_free(&ref, free);
+}
+
+/**
+ * Rows of the reference are linear ramps, so both filters interpolate the half-pel sample right of a pixel exactly.
+ * Rows differ in a non-linear way, so the horizontal half-pel shift is the only vector predicting the source without error.
+ */
+TEST(motion_prediction_tests, test_subpel_refine) {
+    enum { WIDTH = 48, HEIGHT = 48, SIZE = 16 };
+    static const vcodec_subpel_filter_t filters[] = { VCODEC_SUBPEL_FILTER_6TAP, VCODEC_SUBPEL_FILTER_BILINEAR };
+    vcodec_frame_t source;
+    vcodec_frame_t ref;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&source, WIDTH, HEIGHT, malloc));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&ref, WIDTH, HEIGHT, malloc));
+    const int stride = ref.stride;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            ref.p_data[y * stride + x] = 2 * x + 40 * (y % 3);
+            source.p_data[y * stride + x] = ref.p_data[y * stride + x] + 1;
+        }
     }
+    vcodec_frame_extend_border(&ref);
+    vcodec_dsp_t dsp;
+    vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO);
+    vcodec_subpel_ref_t ref_subpel;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_subpel_init(&ref_subpel, WIDTH, HEIGHT, malloc));
+    for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+        vcodec_subpel_build(&ref_subpel, &ref, filters[f], &dsp);
+        int mvx = 0;
+        int mvy = 0;
+        TEST_ASSERT_EQUAL_INT(0, vcodec_subpel_refine(&ref_subpel, source.p_data, SIZE, SIZE, SIZE, &mvx, &mvy, SIZE * SIZE, &dsp));
+        TEST_ASSERT_EQUAL_INT(VCODEC_SUBPEL_SCALE / 2, mvx);
+        TEST_ASSERT_EQUAL_INT(0, mvy);
+        int16_t residual[SIZE * SIZE];
+        vcodec_subpel_residual(residual, SIZE, source.p_data, &ref_subpel, SIZE, SIZE, mvx, mvy, SIZE);
+        for (int i = 0; i < SIZE * SIZE; i++) {
+            TEST_ASSERT_EQUAL_INT(0, residual[i]);
+        }
+    }
+    // Vectors reading past the interpolated part of the border are rejected
+    TEST_ASSERT_TRUE(vcodec_motion_vector_in_range(0, 0, SIZE, -VCODEC_MOTION_RANGE * VCODEC_SUBPEL_SCALE, 0, WIDTH, HEIGHT));
+    TEST_ASSERT_FALSE(vcodec_motion_vector_in_range(0, 0, SIZE, -VCODEC_MOTION_RANGE * VCODEC_SUBPEL_SCALE - 1, 0, WIDTH, HEIGHT));
+    TEST_ASSERT_FALSE(vcodec_motion_vector_in_range(WIDTH - SIZE, 0, SIZE, VCODEC_MOTION_RANGE * VCODEC_SUBPEL_SCALE + 1, 0, WIDTH, HEIGHT));
+    vcodec_subpel_free(&ref_subpel, free);
+    vcodec_frame_free(&ref, free);
+    vcodec_frame_free(&source, free);
+}
+
+TEST(motion_prediction_tests, test_pyramid_search) {
+    enum { WIDTH = 128, HEIGHT = 128, SHIFT_X = -22, SHIFT_Y = 13 };
+    vcodec_frame_t source;
+    vcodec_frame_t ref;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&source, WIDTH, HEIGHT, malloc));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_frame_init(&ref, WIDTH, HEIGHT, malloc));
+    const int stride = ref.stride;
+    // Smooth content, so that the downsampled planes keep the structure
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            ref.p_data[y * stride + x] = 128 + 60 * sin(x * 0.21) * cos(y * 0.17) + 40 * sin((x + 2 * y) * 0.05);
+        }
+    }
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            const int ref_x = MIN(MAX(x + SHIFT_X, 0), WIDTH - 1);
+            const int ref_y = MIN(MAX(y + SHIFT_Y, 0), HEIGHT - 1);
+            source.p_data[y * stride + x] = ref.p_data[ref_y * stride + ref_x];
+        }
+    }
+    vcodec_dsp_t dsp;
+    vcodec_dsp_init(&dsp, VCODEC_CPU_LEVEL_AUTO);
+    vcodec_pyramid_t source_pyramid;
+    vcodec_pyramid_t ref_pyramid;
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_pyramid_init(&source_pyramid, WIDTH, HEIGHT, malloc));
+    TEST_ASSERT_EQUAL_INT(VCODEC_STATUS_OK, vcodec_pyramid_init(&ref_pyramid, WIDTH, HEIGHT, malloc));
+    vcodec_pyramid_build(&source_pyramid, &source, &dsp);
+    vcodec_pyramid_build(&ref_pyramid, &ref, &dsp);
+    TEST_ASSERT_EQUAL_INT(WIDTH / 4, source_pyramid.width[2]);
+
+    motion_vector_t mv;
+    TEST_ASSERT_TRUE(vcodec_pyramid_search(&source_pyramid, &ref_pyramid, 48, 48, &dsp, &mv));
+    // Coarse levels are only accurate to a pixel of the 1/2 plane
+    TEST_ASSERT_INT_WITHIN(1, SHIFT_X, mv.mvx);
+    TEST_ASSERT_INT_WITHIN(1, SHIFT_Y, mv.mvy);
+
+    // Final full resolution refinement around the candidate
+    vcodec_motion_search_params_t params = epzs_params(0, 0, WIDTH, HEIGHT);
+    params.predictors[params.num_predictors++] = mv;
+    int mvx;
+    int mvy;
+    TEST_ASSERT_EQUAL_INT(0, vcodec_match_block_epzs(ref.p_data, source.p_data, 48, 48, stride, 16, &params, &mvx, &mvy, dsp.sad, dsp.sad_multi));
+    TEST_ASSERT_EQUAL_INT(SHIFT_X, mvx);
+    TEST_ASSERT_EQUAL_INT(SHIFT_Y, mvy);
+
+    vcodec_pyramid_free(&source_pyramid, free);
+    vcodec_pyramid_free(&ref_pyramid, free);
+    vcodec_frame_free(&source, free);
+    vcodec_frame_free(&ref, free);
+}
+
+/**
+ * Costs of bigger blocks are derived from the costs of their quadrants, for the same vector only.
+ */
+TEST(motion_prediction_tests, test_cost_cache) {
+    static vcodec_cost_cache_t cache;
+    vcodec_cost_cache_reset(&cache, 32, 16);
+    int cost;
+    for (int i = 0; i < 4; i++) {
+        vcodec_cost_cache_insert(&cache, 32 + (i % 2) * 4, 16 + (i / 2) * 4, 4, 2, -1, i + 1);
+    }
+    TEST_ASSERT_TRUE(vcodec_cost_cache_lookup(&cache, 36, 20, 4, 2, -1, &cost));
+    TEST_ASSERT_EQUAL_INT(4, cost);
+    TEST_ASSERT_TRUE(vcodec_cost_cache_lookup(&cache, 32, 16, 8, 2, -1, &cost));
+    TEST_ASSERT_EQUAL_INT(1 + 2 + 3 + 4, cost);
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 32, 16, 8, 2, 0, &cost));
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 40, 16, 8, 2, -1, &cost));
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 32, 16, 16, 2, -1, &cost));
+
+    // The other quadrants of the macroblock are cached as 8x8 blocks
+    vcodec_cost_cache_insert(&cache, 40, 16, 8, 2, -1, 20);
+    vcodec_cost_cache_insert(&cache, 32, 24, 8, 2, -1, 30);
+    vcodec_cost_cache_insert(&cache, 40, 24, 8, 2, -1, 40);
+    TEST_ASSERT_TRUE(vcodec_cost_cache_lookup(&cache, 32, 16, 16, 2, -1, &cost));
+    TEST_ASSERT_EQUAL_INT(10 + 20 + 30 + 40, cost);
+
+    // Blocks outside of the macroblock are not cached
+    vcodec_cost_cache_insert(&cache, 48, 16, 8, 2, -1, 50);
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 48, 16, 8, 2, -1, &cost));
+
+    vcodec_cost_cache_reset(&cache, 32, 16);
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 32, 16, 8, 2, -1, &cost));
+    TEST_ASSERT_FALSE(vcodec_cost_cache_lookup(&cache, 36, 20, 4, 2, -1, &cost));
+}
+
+/**
+ * Repeating a search of the same block takes its costs from the cache.
+ */
+TEST(motion_prediction_tests, test_match_block_tss_cached) {
+    static vcodec_cost_cache_t cache;
+    vcodec_cost_cache_reset(&cache, 0, 0);
+    set_cost_table(tss_test_vector_2, sizeof(tss_test_vector_2) / sizeof(tss_test_vector_2[0]), -5, 6);
+    vcodec_motion_search_params_t params = tss_params;
+    params.p_cache = &cache;
+    int mvx = 0;
+    int mvy = 0;
+    TEST_ASSERT_EQUAL_INT(7, vcodec_match_block_tss(NULL, NULL, 0, 0, 16, 8, &params, &mvx, &mvy, mock_cost_function, NULL));
+    // Center of each step but the first one was evaluated by the previous step
+    TEST_ASSERT_EQUAL_INT(4 * 9 - 3, num_cost_calls);
+    num_cost_calls = 0;
+    TEST_ASSERT_EQUAL_INT(7, vcodec_match_block_tss(NULL, NULL, 0, 0, 16, 8, &params, &mvx, &mvy, mock_cost_function, NULL));
+    TEST_ASSERT_EQUAL_INT(-5, mvx);
+    TEST_ASSERT_EQUAL_INT(6, mvy);
+    // The table is direct mapped, costs of colliding vectors are computed again
+    TEST_ASSERT_LESS_THAN_INT(4, num_cost_calls);
 }
 
-TEST_GROUP_RUNNER(motion_prediciton_tests)
+TEST_GROUP_RUNNER(motion_prediction_tests)
 {
-    RUN_TEST_CASE(motion_prediciton_tests, test_vcodec_ec_read_write_coeffs);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_tss);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_tss_descends);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_tss_area);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_tss_multi);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_epzs_early_stop);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_epzs_diamond);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_epzs_area);
+    RUN_TEST_CASE(motion_prediction_tests, test_motion_predictors);
+    RUN_TEST_CASE(motion_prediction_tests, test_motion_vector_prediction);
+    RUN_TEST_CASE(motion_prediction_tests, test_unpredict_partition);
+    RUN_TEST_CASE(motion_prediction_tests, test_subpel_refine);
+    RUN_TEST_CASE(motion_prediction_tests, test_pyramid_search);
+    RUN_TEST_CASE(motion_prediction_tests, test_cost_cache);
+    RUN_TEST_CASE(motion_prediction_tests, test_match_block_tss_cached);
 }
@@ -0,0 +1,68 @@
+#include <unity.h>
+#include <unity_fixture.h>
+#include <stdlib.h>
+
+#include "vcodec_quant.h"
+
+TEST_GROUP(quant_tests);
+
+static vcodec_quant_tables_t tables;
+
+TEST_SETUP(quant_tests) {
+    vcodec_quant_tables_init(&tables);
+}
+
+TEST_TEAR_DOWN(quant_tests) {
+}
+
+TEST(quant_tests, test_quant_default_qp_steps) {
+    static const int16_t expected[16] = {
+        16, 11, 10, 16,
+        12, 12, 14, 19,
+        14, 13, 16, 24,
+        14, 17, 22, 29,
+    };
+    TEST_ASSERT_EQUAL_INT16_ARRAY(expected, tables.qp[VCODEC_QP_DEFAULT].step, 16);
+    // The step doubles every 6 QP
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL_INT(2 * expected[i], tables.qp[VCODEC_QP_DEFAULT + 6].step[i]);
+    }
+}
+
+TEST(quant_tests, test_quant_tables_monotonic) {
+    for (int qp = VCODEC_QP_MIN; qp <= VCODEC_QP_MAX; qp++) {
+        const vcodec_quant_t *p_quant = &tables.qp[qp];
+        TEST_ASSERT_GREATER_OR_EQUAL_INT(VCODEC_QUANT_DC_MIN_STEP, p_quant->dc_step);
+        for (int i = 0; i < 16; i++) {
+            TEST_ASSERT_GREATER_OR_EQUAL_INT(1, p_quant->step[i]);
+            TEST_ASSERT_GREATER_OR_EQUAL_INT(tables.qp[qp - 1].step[i], p_quant->step[i]);
+            TEST_ASSERT_NOT_EQUAL(0, p_quant->mult[i]);
+        }
+    }
+}
+
+/**
+ * Dead zone quantization with the multiplier has to stay within one level of the division it replaces.
+ */
+TEST(quant_tests, test_quant_dc_matches_division) {
+    for (int qp = VCODEC_QP_MIN; qp <= VCODEC_QP_MAX; qp++) {
+        const vcodec_quant_t *p_quant = &tables.qp[qp];
+        for (int coeff = -16 * 9180 / 2; coeff <= 16 * 9180 / 2; coeff += 7) {
+            const int level = vcodec_quant_dc(coeff, p_quant, 0);
+            const int expected = coeff / p_quant->dc_step;
+            TEST_ASSERT_INT_WITHIN(1, expected, level);
+            TEST_ASSERT_INT_WITHIN(INT16_MAX, 0, level);
+            // Intra rounding moves the level up by a third of a step at most
+            const int rounded = vcodec_quant_dc(coeff, p_quant, vcodec_quant_rounding(p_quant, true));
+            TEST_ASSERT_INT_WITHIN(1, abs(level), abs(rounded));
+            TEST_ASSERT_LESS_OR_EQUAL_INT(p_quant->dc_step * 2 / 3 + 1, abs(coeff - rounded * p_quant->dc_step));
+        }
+    }
+}
+
+TEST_GROUP_RUNNER(quant_tests)
+{
+    RUN_TEST_CASE(quant_tests, test_quant_default_qp_steps);
+    RUN_TEST_CASE(quant_tests, test_quant_tables_monotonic);
+    RUN_TEST_CASE(quant_tests, test_quant_dc_matches_division);
+}
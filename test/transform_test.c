@@ -0,0 +1,144 @@
+#include <unity.h>
+#include <unity_fixture.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "vcodec_transform.h"
+
+TEST_GROUP(transform_tests);
+
+#define TEST_ITERATIONS 1000
+#define TEST_MACROBLOCK_SIZE 16
+
+typedef void (*transform_mb_t)(int16_t *p_macroblock, int macroblock_size);
+
+static const int test_quant[16] = {
+    16, 11, 10, 16,
+    12, 12, 14, 19,
+    14, 13, 16, 24,
+    14, 17, 22, 29,
+};
+
+static int random_in_range(int min, int max) {
+    return min + rand() % (max - min + 1);
+}
+
+/**
+ * Random residuals: the range of forward4x4_mb_c() input.
+ */
+static void fill_residual(int16_t *p_macroblock, int macroblock_size) {
+    for (int i = 0; i < macroblock_size * macroblock_size; i++) {
+        p_macroblock[i] = random_in_range(-255, 255);
+    }
+}
+
+/**
+ * Random quantized and rescaled coefficients: the range of inverse4x4_descale_mb_c() input.
+ */
+static void fill_coeffs(int16_t *p_macroblock, int macroblock_size) {
+    fill_residual(p_macroblock, macroblock_size);
+    forward4x4_mb_c(p_macroblock, macroblock_size);
+    for (int y = 0; y < macroblock_size; y++) {
+        for (int x = 0; x < macroblock_size; x++) {
+            const int q = test_quant[(y % 4) * 4 + x % 4];
+            p_macroblock[y * macroblock_size + x] = p_macroblock[y * macroblock_size + x] / q * q;
+        }
+    }
+}
+
+static void check_transform_mb(transform_mb_t transform, transform_mb_t reference, void (*fill)(int16_t *, int)) {
+    static const int sizes[] = { 16, 8, 4 };
+    int16_t expected[TEST_MACROBLOCK_SIZE * TEST_MACROBLOCK_SIZE];
+    int16_t actual[TEST_MACROBLOCK_SIZE * TEST_MACROBLOCK_SIZE];
+    srand(1);
+    for (int i = 0; i < TEST_ITERATIONS; i++) {
+        const int size = sizes[i % 3];
+        fill(expected, size);
+        memcpy(actual, expected, sizeof(int16_t) * size * size);
+        reference(expected, size);
+        transform(actual, size);
+        TEST_ASSERT_EQUAL_INT16_ARRAY(expected, actual, size * size);
+    }
+}
+
+TEST_SETUP(transform_tests) {
+
+}
+
+TEST_TEAR_DOWN(transform_tests) {
+
+}
+
+TEST(transform_tests, test_transform_mb_c_matches_per_block) {
+    int16_t macroblock[TEST_MACROBLOCK_SIZE * TEST_MACROBLOCK_SIZE];
+    int16_t block[16];
+    srand(2);
+    fill_residual(macroblock, TEST_MACROBLOCK_SIZE);
+    for (int i = 0; i < 4; i++) {
+        memcpy(block + i * 4, macroblock + (4 + i) * TEST_MACROBLOCK_SIZE + 8, sizeof(int16_t) * 4);
+    }
+    forward4x4(block, 4);
+    forward4x4_mb_c(macroblock, TEST_MACROBLOCK_SIZE);
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT16_ARRAY(block + i * 4, macroblock + (4 + i) * TEST_MACROBLOCK_SIZE + 8, 4);
+    }
+
+    // Inverse is done in place with the same stride and then descaled
+    inverse4x4(block, 4);
+    inverse4x4_descale_mb_c(macroblock, TEST_MACROBLOCK_SIZE);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            TEST_ASSERT_EQUAL_INT(block[i * 4 + j] / 16, macroblock[(4 + i) * TEST_MACROBLOCK_SIZE + 8 + j]);
+        }
+    }
+}
+
+TEST(transform_tests, test_forward4x4_mb_simd) {
+#if defined(VCODEC_X86_SIMD)
+    check_transform_mb(forward4x4_mb_sse2, forward4x4_mb_c, fill_residual);
+    if (__builtin_cpu_supports("avx2")) {
+        check_transform_mb(forward4x4_mb_avx2, forward4x4_mb_c, fill_residual);
+    }
+#endif
+}
+
+TEST(transform_tests, test_inverse4x4_descale_mb_simd) {
+#if defined(VCODEC_X86_SIMD)
+    check_transform_mb(inverse4x4_descale_mb_sse2, inverse4x4_descale_mb_c, fill_coeffs);
+    if (__builtin_cpu_supports("avx2")) {
+        check_transform_mb(inverse4x4_descale_mb_avx2, inverse4x4_descale_mb_c, fill_coeffs);
+    }
+#endif
+}
+
+TEST(transform_tests, test_hadamard4x4_simd) {
+#if defined(VCODEC_X86_SIMD)
+    srand(3);
+    for (int i = 0; i < TEST_ITERATIONS; i++) {
+        int block[16];
+        int expected[16];
+        int actual[16];
+        // DC coefficients of forward4x4() output for 8-bit residuals
+        for (int j = 0; j < 16; j++) {
+            block[j] = random_in_range(-16 * 255, 16 * 255);
+        }
+        hadamard4x4(expected, block);
+        hadamard4x4_sse2(actual, block);
+        TEST_ASSERT_EQUAL_INT_ARRAY(expected, actual, 16);
+
+        ihadamard4x4(expected, block);
+        ihadamard4x4_sse2(actual, block);
+        TEST_ASSERT_EQUAL_INT_ARRAY(expected, actual, 16);
+    }
+#else
+    TEST_IGNORE();
+#endif
+}
+
+TEST_GROUP_RUNNER(transform_tests)
+{
+    RUN_TEST_CASE(transform_tests, test_transform_mb_c_matches_per_block);
+    RUN_TEST_CASE(transform_tests, test_forward4x4_mb_simd);
+    RUN_TEST_CASE(transform_tests, test_inverse4x4_descale_mb_simd);
+    RUN_TEST_CASE(transform_tests, test_hadamard4x4_simd);
+}
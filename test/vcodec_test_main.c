@@ -4,6 +4,12 @@ static void run_tests(void)
 {
     RUN_TEST_GROUP(bitstream_tests);
     RUN_TEST_GROUP(entropy_coding_tests);
+    RUN_TEST_GROUP(transform_tests);
+    RUN_TEST_GROUP(dsp_tests);
+    RUN_TEST_GROUP(quant_tests);
+    RUN_TEST_GROUP(motion_prediction_tests);
+    RUN_TEST_GROUP(frame_tests);
+    RUN_TEST_GROUP(codec_tests);
 }
 
 int main(int argc, const char **argv)